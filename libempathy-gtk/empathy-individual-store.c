@@ -31,6 +31,7 @@
 #include <tp-account-widgets/tpaw-utils.h>
 
 #include "empathy-gtk-enum-types.h"
+#include "empathy-timer-wheel.h"
 #include "empathy-ui-utils.h"
 #include "empathy-utils.h"
 
@@ -64,14 +65,17 @@ struct _EmpathyIndividualStorePriv
   /* Hash: char *groupname -> GtkTreeIter * */
   GHashTable                  *empathy_group_cache;
   gboolean show_active;
+  /* Hash: FolksIndividual* -> guint (timer wheel ID of its active timeout) */
+  GHashTable *active_timeouts;
 };
 
 typedef struct
 {
+  /* borrowed, the timeouts are removed when disposing the store */
   EmpathyIndividualStore *self;
+  /* owned */
   FolksIndividual *individual;
   gboolean remove;
-  guint timeout;
 } ShowActiveData;
 
 enum
@@ -408,26 +412,6 @@ individual_store_contact_set_active (EmpathyIndividualStore *self,
   empathy_individual_store_free_iters (iters);
 }
 
-static void individual_store_contact_active_free (ShowActiveData *data);
-
-static void
-individual_store_contact_active_invalidated (ShowActiveData *data,
-    GObject *old_object)
-{
-  /* Remove the timeout and free the struct, since the individual or individual
-   * store has disappeared. */
-  g_source_remove (data->timeout);
-
-  if (old_object == (GObject *) data->self)
-    data->self = NULL;
-  else if (old_object == (GObject *) data->individual)
-    data->individual = NULL;
-  else
-    g_assert_not_reached ();
-
-  individual_store_contact_active_free (data);
-}
-
 static ShowActiveData *
 individual_store_contact_active_new (EmpathyIndividualStore *self,
     FolksIndividual *individual,
@@ -437,18 +421,9 @@ individual_store_contact_active_new (EmpathyIndividualStore *self,
 
   data = g_slice_new0 (ShowActiveData);
 
-  /* We don't actually want to force either the IndividualStore or the
-   * Individual to stay alive, since the user could quit Empathy or disable
-   * the account before the contact_active timeout is fired. */
-  g_object_weak_ref (G_OBJECT (self),
-      (GWeakNotify) individual_store_contact_active_invalidated, data);
-  g_object_weak_ref (G_OBJECT (individual),
-      (GWeakNotify) individual_store_contact_active_invalidated, data);
-
   data->self = self;
-  data->individual = individual;
+  data->individual = g_object_ref (individual);
   data->remove = remove_;
-  data->timeout = 0;
 
   return data;
 }
@@ -456,17 +431,7 @@ individual_store_contact_active_new (EmpathyIndividualStore *self,
 static void
 individual_store_contact_active_free (ShowActiveData *data)
 {
-  if (data->self != NULL)
-    {
-      g_object_weak_unref (G_OBJECT (data->self),
-          (GWeakNotify) individual_store_contact_active_invalidated, data);
-    }
-
-  if (data->individual != NULL)
-    {
-      g_object_weak_unref (G_OBJECT (data->individual),
-          (GWeakNotify) individual_store_contact_active_invalidated, data);
-    }
+  g_object_unref (data->individual);
 
   g_slice_free (ShowActiveData, data);
 }
@@ -474,6 +439,8 @@ individual_store_contact_active_free (ShowActiveData *data)
 static gboolean
 individual_store_contact_active_cb (ShowActiveData *data)
 {
+  g_hash_table_remove (data->self->priv->active_timeouts, data->individual);
+
   if (data->remove)
     {
       DEBUG ("Individual'%s' active timeout, removing item",
@@ -485,11 +452,35 @@ individual_store_contact_active_cb (ShowActiveData *data)
   individual_store_contact_set_active (data->self,
       data->individual, FALSE, TRUE);
 
-  individual_store_contact_active_free (data);
-
   return FALSE;
 }
 
+static void
+individual_store_contact_active_start (EmpathyIndividualStore *self,
+    FolksIndividual *individual,
+    gboolean remove_)
+{
+  EmpathyTimerWheel *wheel = empathy_timer_wheel_get_default ();
+  gpointer id;
+  ShowActiveData *data;
+
+  /* If the individual was already active, restart its timeout rather than
+   * having the previous one setting it as inactive too soon. */
+  id = g_hash_table_lookup (self->priv->active_timeouts, individual);
+  if (id != NULL)
+    empathy_timer_wheel_remove (wheel, GPOINTER_TO_UINT (id));
+
+  /* All the active timeouts share the same main loop source so we don't
+   * create one source per individual when an account reconnects. */
+  data = individual_store_contact_active_new (self, individual, remove_);
+  id = GUINT_TO_POINTER (empathy_timer_wheel_add_full (wheel,
+      ACTIVE_USER_SHOW_TIME * 1000,
+      (GSourceFunc) individual_store_contact_active_cb, data,
+      (GDestroyNotify) individual_store_contact_active_free));
+
+  g_hash_table_insert (self->priv->active_timeouts, individual, id);
+}
+
 typedef struct {
   EmpathyIndividualStore *store; /* weak */
   GCancellable *cancellable; /* owned */
@@ -552,7 +543,6 @@ static void
 individual_store_contact_update (EmpathyIndividualStore *self,
     FolksIndividual *individual)
 {
-  ShowActiveData *data;
   GtkTreeModel *model;
   GList *iters, *l;
   gboolean in_list;
@@ -682,20 +672,9 @@ individual_store_contact_update (EmpathyIndividualStore *self,
           do_set_refresh);
 
       if (do_set_active)
-        {
-          data =
-              individual_store_contact_active_new (self, individual,
-              do_remove);
-          data->timeout = g_timeout_add_seconds (ACTIVE_USER_SHOW_TIME,
-              (GSourceFunc) individual_store_contact_active_cb, data);
-        }
+        individual_store_contact_active_start (self, individual, do_remove);
     }
 
-  /* FIXME: when someone goes online then offline quickly, the
-   * first timeout sets the user to be inactive and the second
-   * timeout removes the user from the contact list, really we
-   * should remove the first timeout.
-   */
   empathy_individual_store_free_iters (iters);
 }
 
@@ -862,6 +841,8 @@ individual_store_dispose (GObject *object)
 {
   EmpathyIndividualStore *self = EMPATHY_INDIVIDUAL_STORE (object);
   GList *l;
+  GHashTableIter iter;
+  gpointer id;
 
   if (self->priv->dispose_has_run)
     return;
@@ -880,6 +861,14 @@ individual_store_dispose (GObject *object)
       g_source_remove (self->priv->inhibit_active);
     }
 
+  g_hash_table_iter_init (&iter, self->priv->active_timeouts);
+  while (g_hash_table_iter_next (&iter, NULL, &id))
+    {
+      empathy_timer_wheel_remove (empathy_timer_wheel_get_default (),
+          GPOINTER_TO_UINT (id));
+    }
+  g_hash_table_unref (self->priv->active_timeouts);
+
   g_hash_table_unref (self->priv->status_icons);
   g_hash_table_unref (self->priv->folks_individual_cache);
   g_hash_table_unref (self->priv->empathy_group_cache);
@@ -1324,6 +1313,7 @@ empathy_individual_store_init (EmpathyIndividualStore *self)
       g_queue_free_full_iter);
   self->priv->empathy_group_cache = g_hash_table_new_full (g_str_hash,
       g_str_equal, g_free, (GDestroyNotify) gtk_tree_iter_free);
+  self->priv->active_timeouts = g_hash_table_new (NULL, NULL);
   individual_store_setup (self);
 }
 
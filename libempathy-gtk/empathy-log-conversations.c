@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-log-conversations.h"
+
+typedef struct
+{
+  GtkTreeIter iter;
+  /* Timestamp of the latest event of the conversation */
+  gint64 last_timestamp;
+  GSequenceIter *seq_iter;
+} Conversation;
+
+struct _EmpathyLogConversations
+{
+  gint64 max_gap;
+
+  /* gchar * key -> owned GSequence of Conversation, sorted by
+   * last_timestamp */
+  GHashTable *conversations;
+
+  /* The conversation the last event was added to, as consecutive events
+   * usually belong to the same one. Borrowed from conversations. */
+  Conversation *open;
+  gchar *open_key;
+};
+
+static void
+conversation_free (Conversation *conversation)
+{
+  g_slice_free (Conversation, conversation);
+}
+
+static gint
+compare_conversations (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  const Conversation *conversation_a = a;
+  const Conversation *conversation_b = b;
+
+  if (conversation_a->last_timestamp < conversation_b->last_timestamp)
+    return -1;
+
+  return conversation_a->last_timestamp > conversation_b->last_timestamp;
+}
+
+EmpathyLogConversations *
+empathy_log_conversations_new (gint64 max_gap)
+{
+  EmpathyLogConversations *self = g_slice_new0 (EmpathyLogConversations);
+
+  self->max_gap = max_gap;
+  self->conversations = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) g_sequence_free);
+
+  return self;
+}
+
+void
+empathy_log_conversations_free (EmpathyLogConversations *self)
+{
+  g_hash_table_unref (self->conversations);
+  g_free (self->open_key);
+
+  g_slice_free (EmpathyLogConversations, self);
+}
+
+static gboolean
+conversation_includes (EmpathyLogConversations *self,
+    Conversation *conversation,
+    gint64 timestamp)
+{
+  return ABS (timestamp - conversation->last_timestamp) < self->max_gap;
+}
+
+static void
+set_open_conversation (EmpathyLogConversations *self,
+    const gchar *key,
+    Conversation *conversation)
+{
+  self->open = conversation;
+
+  if (g_strcmp0 (self->open_key, key) != 0)
+    {
+      g_free (self->open_key);
+      self->open_key = g_strdup (key);
+    }
+}
+
+static void
+extend_conversation (EmpathyLogConversations *self,
+    Conversation *conversation,
+    gint64 timestamp,
+    GtkTreeIter *iter)
+{
+  if (timestamp > conversation->last_timestamp)
+    {
+      conversation->last_timestamp = timestamp;
+      g_sequence_sort_changed (conversation->seq_iter,
+          compare_conversations, NULL);
+    }
+
+  *iter = conversation->iter;
+}
+
+/* Looks for the conversation @key an event sent at @timestamp belongs to.
+ * If there is one, sets @iter to its row and returns TRUE; the caller is
+ * expected to add the event to it. */
+gboolean
+empathy_log_conversations_extend (EmpathyLogConversations *self,
+    const gchar *key,
+    gint64 timestamp,
+    GtkTreeIter *iter)
+{
+  GSequence *sequence;
+  GSequenceIter *next, *prev;
+  Conversation probe = { { 0, }, timestamp, NULL };
+  Conversation *best = NULL;
+
+  if (self->open != NULL && conversation_includes (self, self->open,
+        timestamp) && !g_strcmp0 (self->open_key, key))
+    {
+      extend_conversation (self, self->open, timestamp, iter);
+      return TRUE;
+    }
+
+  sequence = g_hash_table_lookup (self->conversations, key);
+  if (sequence == NULL)
+    return FALSE;
+
+  /* Only the conversations ending right before and right after the event
+   * can be close enough */
+  next = g_sequence_search (sequence, &probe, compare_conversations, NULL);
+
+  if (!g_sequence_iter_is_end (next))
+    {
+      Conversation *conversation = g_sequence_get (next);
+
+      if (conversation_includes (self, conversation, timestamp))
+        best = conversation;
+    }
+
+  if (!g_sequence_iter_is_begin (next))
+    {
+      Conversation *conversation;
+
+      prev = g_sequence_iter_prev (next);
+      conversation = g_sequence_get (prev);
+
+      if (conversation_includes (self, conversation, timestamp) &&
+          (best == NULL || timestamp - conversation->last_timestamp <
+              best->last_timestamp - timestamp))
+        best = conversation;
+    }
+
+  if (best == NULL)
+    return FALSE;
+
+  set_open_conversation (self, key, best);
+  extend_conversation (self, best, timestamp, iter);
+
+  return TRUE;
+}
+
+/* Adds the row @iter, starting a new conversation @key at @timestamp */
+void
+empathy_log_conversations_add (EmpathyLogConversations *self,
+    const gchar *key,
+    gint64 timestamp,
+    GtkTreeIter *iter)
+{
+  GSequence *sequence;
+  Conversation *conversation;
+
+  sequence = g_hash_table_lookup (self->conversations, key);
+  if (sequence == NULL)
+    {
+      sequence = g_sequence_new ((GDestroyNotify) conversation_free);
+      g_hash_table_insert (self->conversations, g_strdup (key), sequence);
+    }
+
+  conversation = g_slice_new0 (Conversation);
+  conversation->iter = *iter;
+  conversation->last_timestamp = timestamp;
+  conversation->seq_iter = g_sequence_insert_sorted (sequence, conversation,
+      compare_conversations, NULL);
+
+  set_open_conversation (self, key, conversation);
+}
+
+/* To be called when rows are removed, as their iters aren't valid anymore */
+void
+empathy_log_conversations_clear (EmpathyLogConversations *self)
+{
+  g_hash_table_remove_all (self->conversations);
+  self->open = NULL;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_LOG_CONVERSATIONS_H__
+#define __EMPATHY_LOG_CONVERSATIONS_H__
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/* Finds the row of the conversation a log event belongs to, without
+ * walking the whole store. Conversations are identified by a key, such as
+ * the account and the contact, and gather the events separated by less
+ * than max_gap seconds. The rows must be top-level rows of a model whose
+ * iters persist, such as a GtkTreeStore. */
+typedef struct _EmpathyLogConversations EmpathyLogConversations;
+
+EmpathyLogConversations * empathy_log_conversations_new (gint64 max_gap);
+void empathy_log_conversations_free (EmpathyLogConversations *self);
+
+gboolean empathy_log_conversations_extend (EmpathyLogConversations *self,
+    const gchar *key,
+    gint64 timestamp,
+    GtkTreeIter *iter);
+void empathy_log_conversations_add (EmpathyLogConversations *self,
+    const gchar *key,
+    gint64 timestamp,
+    GtkTreeIter *iter);
+
+void empathy_log_conversations_clear (EmpathyLogConversations *self);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_LOG_CONVERSATIONS_H__ */
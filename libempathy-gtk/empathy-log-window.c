@@ -40,6 +40,9 @@
 #include "empathy-gsettings.h"
 #include "empathy-images.h"
 #include "empathy-individual-information-dialog.h"
+#include "empathy-log-catalog.h"
+#include "empathy-log-conversations.h"
+#include "empathy-log-index.h"
 #include "empathy-request-util.h"
 #include "empathy-theme-manager.h"
 #include "empathy-ui-utils.h"
@@ -74,6 +77,24 @@ struct _EmpathyLogWindowPriv
   GtkWidget *webview;
 
   GtkTreeStore *store_events;
+  /* Row operations on store_events not sent to the webview yet, as
+   * comma-separated JSON arrays */
+  GString *pending_rows;
+  /* Flush of pending_rows scheduled for the next frame, or for when the
+   * main loop is idle if the webview isn't mapped and won't draw any */
+  guint rows_tick_id;
+  guint rows_idle_id;
+  /* Last insert or change operation queued, and where it starts in
+   * pending_rows */
+  gchar *last_row_path;
+  gsize last_row_offset;
+  const gchar *last_row_op;
+  /* icon name -> owned filename, NULL if there's no such icon */
+  GHashTable *icon_paths;
+
+  /* Conversations of store_events, to find where to append events */
+  EmpathyLogConversations *conversations;
+  gboolean conversations_valid;
 
   GtkWidget *account_chooser;
 
@@ -84,6 +105,7 @@ struct _EmpathyLogWindowPriv
 
   TplActionChain *chain;
   TplLogManager *log_manager;
+  EmpathyLogIndex *log_index;
 
   /* Hash of TpChannel<->TpAccount for use by the observer until we can
    * get a TpAccount from a TpConnection or wherever */
@@ -103,6 +125,27 @@ struct _EmpathyLogWindowPriv
   GList *hits;
   guint source;
 
+  /* Casefolded text of the current search, NULL if not searching */
+  gchar *search_text;
+  GCancellable *search_cancellable;
+  /* TRUE once all the hits of search_text have been found */
+  gboolean search_complete;
+  /* Hits not added to the who pane yet, borrowed from hits */
+  GQueue pending_hits;
+  guint pending_hits_id;
+  /* "account-path identifier" of the entities in the who pane */
+  GHashTable *hit_entities;
+  gboolean search_dates_added;
+  gboolean when_blocked;
+
+  /* Ctx of the dates whose events are being fetched, oldest first */
+  GPtrArray *fetches;
+  /* Index of the next Ctx to fetch, and of the next one to show */
+  guint fetch_next;
+  guint fetch_shown;
+  guint fetches_in_flight;
+  gboolean first_screen_shown;
+
   /* Only used while waiting for the account chooser to be ready */
   TpAccount *selected_account;
   gchar *selected_chat_id;
@@ -140,6 +183,8 @@ static void log_window_create_observer           (EmpathyLogWindow *window);
 static gboolean log_window_events_button_press_event (GtkWidget *webview,
     GdkEventButton *event, EmpathyLogWindow *self);
 static void log_window_update_buttons_sensitivity (EmpathyLogWindow *self);
+static void log_window_search_reset (EmpathyLogWindow *self);
+static void log_window_fetch_reset (EmpathyLogWindow *self);
 
 static void
 empathy_account_chooser_filter_has_logs (TpAccount *account,
@@ -211,6 +256,23 @@ enum
 
 #define WHAT_TYPE_SEPARATOR -1
 
+/* Search hits added to the who pane per main loop iteration */
+#define SEARCH_HITS_PER_IDLE 50
+
+/* Above this, searching all the logs again is faster than checking the
+ * conversations of the previous hits one by one */
+#define MAX_REFINED_HITS 100
+
+/* Dates whose events are requested from the logger at the same time */
+#define MAX_DATE_FETCHES 4
+
+/* Rows shown before hiding the spinner, about a screenful */
+#define FIRST_SCREEN_EVENTS 20
+
+/* Row operations are sent to the webview before the next frame once that
+ * many bytes are queued */
+#define MAX_PENDING_ROWS (256 * 1024)
+
 typedef enum
 {
   EVENT_CALL_INCOMING = 1 << 0,
@@ -245,6 +307,10 @@ typedef struct
   TplEventTypeMask event_mask;
   EventSubtype subtype;
   guint count;
+
+  /* Only used by the date fetcher */
+  gboolean fetched;
+  GList *events;
 } Ctx;
 
 static Ctx *
@@ -278,6 +344,7 @@ ctx_free (Ctx *ctx)
   tp_clear_object (&ctx->account);
   tp_clear_object (&ctx->entity);
   tp_clear_pointer (&ctx->date, g_date_free);
+  g_list_free_full (ctx->events, g_object_unref);
 
   g_slice_free (Ctx, ctx);
 }
@@ -349,72 +416,245 @@ toolbutton_av_clicked (GtkToolButton *toolbutton,
       video, gtk_get_current_event_time ());
 }
 
-static void
-insert_or_change_row (EmpathyLogWindow *self,
-    const char *method,
-    GtkTreeModel *model,
-    GtkTreePath *path,
-    GtkTreeIter *iter)
+static const gchar *
+log_window_lookup_icon (EmpathyLogWindow *self,
+    const gchar *icon_name)
 {
-  char *str = gtk_tree_path_to_string (path);
-  char *script, *text, *date, *stock_icon;
-  GString *escaped_text;
-  char *icon = NULL;
-  gint i;
-
-  gtk_tree_model_get (model, iter,
-      COL_EVENTS_TEXT, &text,
-      COL_EVENTS_PRETTY_DATE, &date,
-      COL_EVENTS_ICON, &stock_icon,
-      -1);
+  gchar *filename;
 
-  if (!tp_str_empty (stock_icon))
+  if (!g_hash_table_lookup_extended (self->priv->icon_paths, icon_name,
+        NULL, (gpointer *) &filename))
     {
       GtkIconInfo *icon_info = gtk_icon_theme_lookup_icon (
           gtk_icon_theme_get_default (),
-          stock_icon,
+          icon_name,
           GTK_ICON_SIZE_MENU, 0);
 
+      filename = NULL;
+
       if (icon_info != NULL)
-        icon = g_strdup (gtk_icon_info_get_filename (icon_info));
+        {
+          filename = g_strdup (gtk_icon_info_get_filename (icon_info));
+          g_object_unref (icon_info);
+        }
 
-      g_object_unref (icon_info);
+      /* Also remember the icons which don't exist */
+      g_hash_table_insert (self->priv->icon_paths, g_strdup (icon_name),
+          filename);
     }
 
-  escaped_text = g_string_new (NULL);
+  return filename;
+}
 
-  /* Only need to deal with «'» and «\».
-   *
-   * Note that these never appear in non-ascii utf8 characters, so just
-   * pretend like we have an ascii string...
-   */
-  for (i = 0; text && text[i]; i++)
+static void
+log_window_icon_theme_changed_cb (GtkIconTheme *icon_theme,
+    EmpathyLogWindow *self)
+{
+  g_hash_table_remove_all (self->priv->icon_paths);
+}
+
+static void
+append_json_string (GString *json,
+    const gchar *str)
+{
+  const gchar *p;
+
+  g_string_append_c (json, '"');
+
+  for (p = str; p != NULL && *p != '\0'; p++)
     {
-      gchar c = text[i];
+      guchar c = *p;
 
-      if (c == '\'' || c == '\\')
-        g_string_append_c (escaped_text, '\\');
+      if (c == '"' || c == '\\')
+        {
+          g_string_append_c (json, '\\');
+          g_string_append_c (json, c);
+        }
+      else if (c < 0x20)
+        {
+          g_string_append_printf (json, "\\u%04x", c);
+        }
+      /* U+2028 and U+2029 are valid in JSON strings, but not in
+       * JavaScript ones */
+      else if (c == 0xe2 && (guchar) p[1] == 0x80 &&
+          ((guchar) p[2] == 0xa8 || (guchar) p[2] == 0xa9))
+        {
+          g_string_append_printf (json, "\\u%04x",
+              (guchar) p[2] == 0xa8 ? 0x2028 : 0x2029);
+          p += 2;
+        }
+      else
+        {
+          g_string_append_c (json, c);
+        }
+    }
 
-      g_string_append_c (escaped_text, c);
+  g_string_append_c (json, '"');
+}
+
+static void
+log_window_cancel_rows_flush (EmpathyLogWindow *self)
+{
+  if (self->priv->rows_tick_id != 0)
+    {
+      gtk_widget_remove_tick_callback (self->priv->webview,
+          self->priv->rows_tick_id);
+      self->priv->rows_tick_id = 0;
     }
 
-  script = g_strdup_printf ("javascript:%s([%s], '%s', '%s', '%s');",
-      method,
-      g_strdelimit (str, ":", ','),
-      escaped_text->str,
-      icon != NULL ? icon : "",
-      date);
+  if (self->priv->rows_idle_id != 0)
+    {
+      g_source_remove (self->priv->rows_idle_id);
+      self->priv->rows_idle_id = 0;
+    }
+}
+
+static void
+log_window_flush_rows (EmpathyLogWindow *self)
+{
+  gchar *script;
+
+  log_window_cancel_rows_flush (self);
+
+  if (self->priv->pending_rows->len == 0)
+    return;
+
+  script = g_strdup_printf ("javascript:applyRowOps([%s]);",
+      self->priv->pending_rows->str);
 
   webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
       script);
 
-  g_string_free (escaped_text, TRUE);
-  g_free (str);
+  g_free (script);
+  g_string_truncate (self->priv->pending_rows, 0);
+  tp_clear_pointer (&self->priv->last_row_path, g_free);
+}
+
+static gboolean
+log_window_flush_rows_tick_cb (GtkWidget *widget,
+    GdkFrameClock *frame_clock,
+    gpointer user_data)
+{
+  EmpathyLogWindow *self = user_data;
+
+  self->priv->rows_tick_id = 0;
+  log_window_flush_rows (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+log_window_flush_rows_idle_cb (gpointer user_data)
+{
+  EmpathyLogWindow *self = user_data;
+
+  self->priv->rows_idle_id = 0;
+  log_window_flush_rows (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* The tick callback doesn't run anymore */
+static void
+log_window_webview_unmap_cb (GtkWidget *webview,
+    EmpathyLogWindow *self)
+{
+  log_window_flush_rows (self);
+}
+
+/* Starts a new operation for the row at @path. Operations are sent to the
+ * webview all at once, in order, when the next frame is drawn.
+ * Returns where the operation starts in pending_rows. */
+static gsize
+log_window_queue_row_op (EmpathyLogWindow *self,
+    const gchar *op,
+    GtkTreePath *path)
+{
+  GString *rows = self->priv->pending_rows;
+  gint *indices, depth, i;
+  gsize offset;
+
+  /* Don't build a huge script, all the previous operations are complete */
+  if (rows->len >= MAX_PENDING_ROWS)
+    log_window_flush_rows (self);
+
+  offset = rows->len;
+
+  if (rows->len > 0)
+    g_string_append_c (rows, ',');
+
+  g_string_append_printf (rows, "[\"%s\",[", op);
+
+  indices = path != NULL ? gtk_tree_path_get_indices_with_depth (path, &depth)
+                         : NULL;
+
+  for (i = 0; indices != NULL && i < depth; i++)
+    g_string_append_printf (rows, i == 0 ? "%d" : ",%d", indices[i]);
+
+  g_string_append_c (rows, ']');
+
+  if (self->priv->rows_tick_id != 0 || self->priv->rows_idle_id != 0)
+    return offset;
+
+  if (gtk_widget_get_mapped (self->priv->webview))
+    self->priv->rows_tick_id = gtk_widget_add_tick_callback (
+        self->priv->webview, log_window_flush_rows_tick_cb, self, NULL);
+  else
+    self->priv->rows_idle_id = g_idle_add (log_window_flush_rows_idle_cb,
+        self);
+
+  return offset;
+}
+
+static void
+insert_or_change_row (EmpathyLogWindow *self,
+    const char *op,
+    GtkTreeModel *model,
+    GtkTreePath *path,
+    GtkTreeIter *iter)
+{
+  GString *rows = self->priv->pending_rows;
+  char *text, *date, *stock_icon, *str;
+  const gchar *icon = NULL;
+  gsize offset;
+
+  gtk_tree_model_get (model, iter,
+      COL_EVENTS_TEXT, &text,
+      COL_EVENTS_PRETTY_DATE, &date,
+      COL_EVENTS_ICON, &stock_icon,
+      -1);
+
+  if (!tp_str_empty (stock_icon))
+    icon = log_window_lookup_icon (self, stock_icon);
+
+  str = gtk_tree_path_to_string (path);
+
+  /* Rows are usually inserted empty and then set: only send the last
+   * contents of a row if nothing happened in between */
+  if (!tp_strdiff (op, "c") && !tp_strdiff (str, self->priv->last_row_path))
+    {
+      g_string_truncate (rows, self->priv->last_row_offset);
+      op = self->priv->last_row_op;
+    }
+
+  offset = log_window_queue_row_op (self, op, path);
+
+  g_free (self->priv->last_row_path);
+  self->priv->last_row_path = str;
+  self->priv->last_row_offset = offset;
+  self->priv->last_row_op = op;
+
+  g_string_append_c (rows, ',');
+  append_json_string (rows, text);
+  g_string_append_c (rows, ',');
+  append_json_string (rows, icon);
+  g_string_append_c (rows, ',');
+  append_json_string (rows, date);
+  g_string_append_c (rows, ']');
+
   g_free (text);
   g_free (date);
   g_free (stock_icon);
-  g_free (icon);
-  g_free (script);
 }
 
 static void
@@ -423,7 +663,7 @@ store_events_row_inserted (GtkTreeModel *model,
     GtkTreeIter *iter,
     EmpathyLogWindow *self)
 {
-  insert_or_change_row (self, "insertRow", model, path, iter);
+  insert_or_change_row (self, "i", model, path, iter);
 }
 
 static void
@@ -432,7 +672,7 @@ store_events_row_changed (GtkTreeModel *model,
     GtkTreeIter *iter,
     EmpathyLogWindow *self)
 {
-  insert_or_change_row (self, "changeRow", model, path, iter);
+  insert_or_change_row (self, "c", model, path, iter);
 }
 
 static void
@@ -440,17 +680,13 @@ store_events_row_deleted (GtkTreeModel *model,
     GtkTreePath *path,
     EmpathyLogWindow *self)
 {
-  char *str = gtk_tree_path_to_string (path);
-  char *script;
-
-  script = g_strdup_printf ("javascript:deleteRow([%s]);",
-      g_strdelimit (str, ":", ','));
+  /* The iters of the conversations may not be valid anymore */
+  self->priv->conversations_valid = FALSE;
 
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
-      script);
+  log_window_queue_row_op (self, "d", path);
+  g_string_append_c (self->priv->pending_rows, ']');
 
-  g_free (str);
-  g_free (script);
+  tp_clear_pointer (&self->priv->last_row_path, g_free);
 }
 
 static void
@@ -459,18 +695,11 @@ store_events_has_child_rows (GtkTreeModel *model,
     GtkTreeIter *iter,
     EmpathyLogWindow *self)
 {
-  char *str = gtk_tree_path_to_string (path);
-  char *script;
-
-  script = g_strdup_printf ("javascript:hasChildRows([%s], %u);",
-      g_strdelimit (str, ":", ','),
-      gtk_tree_model_iter_has_child (model, iter));
+  log_window_queue_row_op (self, "h", path);
+  g_string_append_printf (self->priv->pending_rows, ",%s]",
+      gtk_tree_model_iter_has_child (model, iter) ? "true" : "false");
 
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
-      script);
-
-  g_free (str);
-  g_free (script);
+  tp_clear_pointer (&self->priv->last_row_path, g_free);
 }
 
 static void
@@ -480,29 +709,19 @@ store_events_rows_reordered (GtkTreeModel *model,
     int *new_order,
     EmpathyLogWindow *self)
 {
-  char *str = gtk_tree_path_to_string (path);
+  GString *rows = self->priv->pending_rows;
   int i, children = gtk_tree_model_iter_n_children (model, iter);
-  char **new_order_strv, *new_order_s;
-  char *script;
 
-  new_order_strv = g_new0 (char *, children + 1);
+  log_window_queue_row_op (self, "r", path);
 
-  for (i = 0; i < children; i++)
-    new_order_strv[i] = g_strdup_printf ("%i", new_order[i]);
+  g_string_append (rows, ",[");
 
-  new_order_s = g_strjoinv (",", new_order_strv);
+  for (i = 0; i < children; i++)
+    g_string_append_printf (rows, i == 0 ? "%d" : ",%d", new_order[i]);
 
-  script = g_strdup_printf ("javascript:reorderRows([%s], [%s]);",
-      str == NULL ? "" : g_strdelimit (str, ":", ','),
-      new_order_s);
+  g_string_append (rows, "]]");
 
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
-      script);
-
-  g_free (str);
-  g_free (script);
-  g_free (new_order_s);
-  g_strfreev (new_order_strv);
+  tp_clear_pointer (&self->priv->last_row_path, g_free);
 }
 
 static gboolean
@@ -554,6 +773,15 @@ empathy_log_window_dispose (GObject *object)
       self->priv->source = 0;
     }
 
+  log_window_search_reset (self);
+  tp_clear_pointer (&self->priv->hit_entities, g_hash_table_unref);
+
+  if (self->priv->fetches != NULL)
+    {
+      log_window_fetch_reset (self);
+      tp_clear_pointer (&self->priv->fetches, g_ptr_array_unref);
+    }
+
   if (self->priv->current_dates != NULL)
     {
       g_list_free_full (self->priv->current_dates,
@@ -566,6 +794,7 @@ empathy_log_window_dispose (GObject *object)
 
   tp_clear_object (&self->priv->observer);
   tp_clear_object (&self->priv->log_manager);
+  tp_clear_object (&self->priv->log_index);
   tp_clear_object (&self->priv->selected_account);
   tp_clear_object (&self->priv->selected_contact);
   tp_clear_object (&self->priv->events_contact);
@@ -575,6 +804,11 @@ empathy_log_window_dispose (GObject *object)
   tp_clear_object (&self->priv->gsettings_desktop);
 
   tp_clear_object (&self->priv->store_events);
+  tp_clear_pointer (&self->priv->conversations,
+      empathy_log_conversations_free);
+  tp_clear_pointer (&self->priv->icon_paths, g_hash_table_unref);
+
+  log_window_cancel_rows_flush (self);
 
   G_OBJECT_CLASS (empathy_log_window_parent_class)->dispose (object);
 }
@@ -586,6 +820,8 @@ empathy_log_window_finalize (GObject *object)
 
   g_free (self->priv->last_find);
   g_free (self->priv->selected_chat_id);
+  g_free (self->priv->last_row_path);
+  g_string_free (self->priv->pending_rows, TRUE);
 
   G_OBJECT_CLASS (empathy_log_window_parent_class)->finalize (object);
 }
@@ -604,6 +840,21 @@ empathy_log_window_class_init (
   object_class->finalize = empathy_log_window_finalize;
 }
 
+static void
+log_index_updated_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GError *error = NULL;
+
+  if (!empathy_log_index_update_finish (EMPATHY_LOG_INDEX (source), result,
+        &error))
+    {
+      DEBUG ("Failed to update the log index: %s", error->message);
+      g_error_free (error);
+    }
+}
+
 static void
 empathy_log_window_init (EmpathyLogWindow *self)
 {
@@ -620,10 +871,23 @@ empathy_log_window_init (EmpathyLogWindow *self)
 
   self->priv->chain = _tpl_action_chain_new_async (NULL, NULL, NULL);
 
+  self->priv->hit_entities = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  self->priv->fetches = g_ptr_array_new ();
+  self->priv->conversations = empathy_log_conversations_new (MAX_GAP);
+  self->priv->pending_rows = g_string_new (NULL);
+  self->priv->icon_paths = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_free);
+
   self->priv->camera_monitor = tpaw_camera_monitor_dup_singleton ();
 
   self->priv->log_manager = tpl_log_manager_dup_singleton ();
 
+  /* Index the logs written since the window was last opened */
+  self->priv->log_index = empathy_log_index_dup_singleton ();
+  empathy_log_index_update_async (self->priv->log_index, FALSE, NULL,
+      log_index_updated_cb, NULL);
+
   self->priv->gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
   self->priv->gsettings_desktop = g_settings_new (
       EMPATHY_PREFS_DESKTOP_INTERFACE_SCHEMA);
@@ -777,10 +1041,16 @@ empathy_log_window_init (EmpathyLogWindow *self)
   g_signal_connect (self->priv->store_events, "row-has-child-toggled",
       G_CALLBACK (store_events_has_child_rows), self);
 
+  g_signal_connect_object (gtk_icon_theme_get_default (), "changed",
+      G_CALLBACK (log_window_icon_theme_changed_cb), self, 0);
+
   /* track clicked row */
   g_signal_connect (self->priv->webview, "button-press-event",
       G_CALLBACK (log_window_events_button_press_event), self);
 
+  g_signal_connect (self->priv->webview, "unmap",
+      G_CALLBACK (log_window_webview_unmap_cb), self);
+
   log_window_update_buttons_sensitivity (self);
   gtk_widget_show (GTK_WIDGET (self));
 
@@ -823,37 +1093,6 @@ entity_equal (TplEntity *a,
       tpl_entity_get_identifier (b));
 }
 
-static gboolean
-is_same_confroom (TplEvent *e1,
-    TplEvent *e2)
-{
-  TplEntity *sender1 = tpl_event_get_sender (e1);
-  TplEntity *receiver1 = tpl_event_get_receiver (e1);
-  TplEntity *sender2 = tpl_event_get_sender (e2);
-  TplEntity *receiver2 = tpl_event_get_receiver (e2);
-  TplEntity *room1, *room2;
-
-  if (receiver1 == NULL || receiver2 == NULL)
-    return FALSE;
-
-  if (tpl_entity_get_entity_type (sender1) == TPL_ENTITY_ROOM)
-    room1 = sender1;
-  else if (tpl_entity_get_entity_type (receiver1) == TPL_ENTITY_ROOM)
-    room1 = receiver1;
-  else
-    return FALSE;
-
-  if (tpl_entity_get_entity_type (sender2) == TPL_ENTITY_ROOM)
-    room2 = sender2;
-  else if (tpl_entity_get_entity_type (receiver2) == TPL_ENTITY_ROOM)
-    room2 = receiver2;
-  else
-    return FALSE;
-
-  return g_str_equal (tpl_entity_get_identifier (room1),
-      tpl_entity_get_identifier (room2));
-}
-
 static void
 maybe_refresh_logs (TpChannel *channel,
     TpAccount *account)
@@ -1082,53 +1321,73 @@ event_get_target (TplEvent *event)
   return sender;
 }
 
-static gboolean
-model_is_parent (GtkTreeModel *model,
-    GtkTreeIter *iter,
-    TplEvent *event)
+/* Events of a chat room belong to the same conversation, whoever sent
+ * them. Free with g_free. */
+static gchar *
+conversation_key_for_event (TplEvent *event)
 {
-  TplEvent *stored_event;
-  TplEntity *target;
-  TpAccount *account;
-  gboolean found = FALSE;
-  GtkTreeIter parent;
+  TplEntity *sender = tpl_event_get_sender (event);
+  TplEntity *receiver = tpl_event_get_receiver (event);
 
-  if (gtk_tree_model_iter_parent (model, &parent, iter))
-    return FALSE;
+  if (receiver != NULL &&
+      tpl_entity_get_entity_type (sender) == TPL_ENTITY_ROOM)
+    return g_strdup_printf ("%s %s #%s", G_OBJECT_TYPE_NAME (event),
+        tp_proxy_get_object_path (tpl_event_get_account (event)),
+        tpl_entity_get_identifier (sender));
+
+  if (receiver != NULL &&
+      tpl_entity_get_entity_type (receiver) == TPL_ENTITY_ROOM)
+    return g_strdup_printf ("%s %s #%s", G_OBJECT_TYPE_NAME (event),
+        tp_proxy_get_object_path (tpl_event_get_account (event)),
+        tpl_entity_get_identifier (receiver));
+
+  return g_strdup_printf ("%s %s %s", G_OBJECT_TYPE_NAME (event),
+      tp_proxy_get_object_path (tpl_event_get_account (event)),
+      tpl_entity_get_identifier (event_get_target (event)));
+}
 
-  gtk_tree_model_get (model, iter,
-      COL_EVENTS_ACCOUNT, &account,
-      COL_EVENTS_TARGET, &target,
-      COL_EVENTS_EVENT, &stored_event,
-      -1);
+/* Indexes the conversations already in the store, after some rows have
+ * been removed */
+static void
+log_window_index_conversations (EmpathyLogWindow *self)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->store_events);
+  GtkTreeIter iter, child;
+  gboolean next;
+
+  empathy_log_conversations_clear (self->priv->conversations);
 
-  if (G_OBJECT_TYPE (event) == G_OBJECT_TYPE (stored_event) &&
-      account_equal (account, tpl_event_get_account (event)) &&
-      (entity_equal (target, event_get_target (event)) ||
-      is_same_confroom (event, stored_event)))
+  for (next = gtk_tree_model_get_iter_first (model, &iter);
+       next;
+       next = gtk_tree_model_iter_next (model, &iter))
     {
-      GtkTreeIter child;
+      TplEvent *event;
       gint64 timestamp;
+      gchar *key;
+      gint n;
 
-      gtk_tree_model_iter_nth_child (model, &child, iter,
-          gtk_tree_model_iter_n_children (model, iter) - 1);
+      /* Calls don't have children */
+      n = gtk_tree_model_iter_n_children (model, &iter);
+      if (n == 0 || !gtk_tree_model_iter_nth_child (model, &child, &iter,
+            n - 1))
+        continue;
 
+      gtk_tree_model_get (model, &iter,
+          COL_EVENTS_EVENT, &event,
+          -1);
       gtk_tree_model_get (model, &child,
           COL_EVENTS_TS, &timestamp,
           -1);
 
-      if (ABS (tpl_event_get_timestamp (event) - timestamp) < MAX_GAP)
-        {
-          /* The gap is smaller than 30 min */
-          found = TRUE;
-        }
-    }
+      key = conversation_key_for_event (event);
+      empathy_log_conversations_add (self->priv->conversations, key,
+          timestamp, &iter);
 
-  g_object_unref (stored_event);
-  g_object_unref (account);
-  g_object_unref (target);
+      g_free (key);
+      g_object_unref (event);
+    }
 
-  return found;
+  self->priv->conversations_valid = TRUE;
 }
 
 static gchar *
@@ -1172,42 +1431,33 @@ get_parent_iter_for_message (TplEvent *event,
     GtkTreeIter *parent)
 {
   GtkTreeStore *store;
-  GtkTreeModel *model;
   GtkTreeIter iter;
-  gboolean parent_found = FALSE;
-  gboolean next;
+  gint64 timestamp;
+  gchar *key;
 
   store = log_window->priv->store_events;
-  model = GTK_TREE_MODEL (store);
+  timestamp = tpl_event_get_timestamp (event);
 
-  for (next = gtk_tree_model_get_iter_first (model, &iter);
-       next;
-       next = gtk_tree_model_iter_next (model, &iter))
-    {
-      if ((parent_found = model_is_parent (model, &iter, event)))
-        break;
-    }
+  if (!log_window->priv->conversations_valid)
+    log_window_index_conversations (log_window);
 
-  if (parent_found)
-    {
-      *parent = iter;
-    }
-  else
+  key = conversation_key_for_event (event);
+
+  if (!empathy_log_conversations_extend (log_window->priv->conversations,
+        key, timestamp, parent))
     {
       GDateTime *date;
       gchar *body, *pretty_date;
 
-      date = g_date_time_new_from_unix_local (
-          tpl_event_get_timestamp (event));
+      date = g_date_time_new_from_unix_local (timestamp);
 
       pretty_date = g_date_time_format (date,
           C_("A date with the time", "%A, %e %B %Y %X"));
 
       body = get_display_string_for_chat_message (message, event);
 
-      gtk_tree_store_append (store, &iter, NULL);
-      gtk_tree_store_set (store, &iter,
-          COL_EVENTS_TS, tpl_event_get_timestamp (event),
+      gtk_tree_store_insert_with_values (store, &iter, NULL, -1,
+          COL_EVENTS_TS, timestamp,
           COL_EVENTS_PRETTY_DATE, pretty_date,
           COL_EVENTS_TEXT, body,
           COL_EVENTS_ICON, "format-justify-fill",
@@ -1218,10 +1468,15 @@ get_parent_iter_for_message (TplEvent *event,
 
       *parent = iter;
 
+      empathy_log_conversations_add (log_window->priv->conversations, key,
+          timestamp, &iter);
+
       g_free (body);
       g_free (pretty_date);
       g_date_time_unref (date);
     }
+
+  g_free (key);
 }
 
 static const gchar *
@@ -1297,8 +1552,7 @@ log_window_append_chat_message (TplEvent *event,
       body = g_strdup_printf (_("<b>%s:</b> %s"), alias, msg->str);
     }
 
-  gtk_tree_store_append (store, &iter, &parent);
-  gtk_tree_store_set (store, &iter,
+  gtk_tree_store_insert_with_values (store, &iter, &parent, -1,
       COL_EVENTS_TS, tpl_event_get_timestamp (event),
       COL_EVENTS_PRETTY_DATE, pretty_date,
       COL_EVENTS_TEXT, body,
@@ -1347,8 +1601,7 @@ log_window_append_call (TplEvent *event,
   pretty_date = g_date_time_format (started_date,
       C_("A date with the time", "%A, %e %B %Y %X"));
 
-  gtk_tree_store_append (store, &iter, NULL);
-  gtk_tree_store_set (store, &iter,
+  gtk_tree_store_insert_with_values (store, &iter, NULL, -1,
       COL_EVENTS_TS, tpl_event_get_timestamp (event),
       COL_EVENTS_PRETTY_DATE, pretty_date,
       COL_EVENTS_TEXT, empathy_message_get_body (message),
@@ -1390,8 +1643,7 @@ log_window_append_call (TplEvent *event,
       g_free (duration);
       g_free (finished);
 
-      gtk_tree_store_append (store, &child, &iter);
-      gtk_tree_store_set (store, &child,
+      gtk_tree_store_insert_with_values (store, &child, &iter, -1,
           COL_EVENTS_TS, tpl_event_get_timestamp (event),
           COL_EVENTS_TEXT, body,
           COL_EVENTS_ACCOUNT, tpl_event_get_account (event),
@@ -1577,34 +1829,6 @@ log_window_get_selected (EmpathyLogWindow *self,
   return TRUE;
 }
 
-static gboolean
-model_has_entity (GtkTreeModel *model,
-    GtkTreePath *path,
-    GtkTreeIter *iter,
-    gpointer data)
-{
-  TplLogSearchHit *hit = data;
-  TplEntity *e;
-  TpAccount *a;
-  gboolean ret = FALSE;
-
-  gtk_tree_model_get (model, iter,
-      COL_WHO_TARGET, &e,
-      COL_WHO_ACCOUNT, &a,
-      -1);
-
-  if (e != NULL && entity_equal (hit->target, e) &&
-      a != NULL && account_equal (hit->account, a))
-    {
-      ret = has_element = TRUE;
-    }
-
-  tp_clear_object (&e);
-  tp_clear_object (&a);
-
-  return ret;
-}
-
 static gboolean
 model_has_date (GtkTreeModel *model,
     GtkTreePath *path,
@@ -1629,8 +1853,9 @@ model_has_date (GtkTreeModel *model,
   return FALSE;
 }
 
-static void
-get_events_for_date (TplActionChain *chain, gpointer user_data);
+static void log_window_queue_date (EmpathyLogWindow *self,
+    Ctx *ctx);
+static void log_window_start_fetching_dates (EmpathyLogWindow *self);
 
 static void
 populate_events_from_search_hits (GList *accounts,
@@ -1651,6 +1876,8 @@ populate_events_from_search_hits (GList *accounts,
   if (g_list_find_custom (dates, anytime, (GCompareFunc) g_date_compare))
     is_anytime = TRUE;
 
+  log_window_fetch_reset (log_window);
+
   for (l = log_window->priv->hits; l != NULL; l = l->next)
     {
       TplLogSearchHit *hit = l->data;
@@ -1684,13 +1911,11 @@ populate_events_from_search_hits (GList *accounts,
 
           ctx = ctx_new (log_window, hit->account, hit->target, hit->date,
               event_mask, subtype, log_window->priv->count);
-          _tpl_action_chain_append (log_window->priv->chain,
-              get_events_for_date, ctx);
+          log_window_queue_date (log_window, ctx);
         }
     }
 
-  start_spinner ();
-  _tpl_action_chain_start (log_window->priv->chain);
+  log_window_start_fetching_dates (log_window);
 
   g_date_free (anytime);
 }
@@ -1744,7 +1969,7 @@ format_date_for_display (GDate *date)
   return text;
 }
 
-static void
+static gboolean
 add_date_if_needed (EmpathyLogWindow *self,
     GDate *date)
 {
@@ -1760,7 +1985,7 @@ add_date_if_needed (EmpathyLogWindow *self,
   has_element = FALSE;
   gtk_tree_model_foreach (model, model_has_date, date);
   if (has_element)
-    return;
+    return FALSE;
 
   text = format_date_for_display (date);
 
@@ -1771,6 +1996,8 @@ add_date_if_needed (EmpathyLogWindow *self,
       -1);
 
   g_free (text);
+
+  return TRUE;
 }
 
 static void
@@ -1883,9 +2110,53 @@ add_event_to_store (EmpathyLogWindow *self,
   g_object_unref (contact);
 }
 
+static gchar *
+make_entity_key (TpAccount *account,
+    TplEntity *entity)
+{
+  return g_strdup_printf ("%s %s", tp_proxy_get_object_path (account),
+      tpl_entity_get_identifier (entity));
+}
+
 static void
-populate_entities_from_search_hits (void)
+log_window_unblock_when (EmpathyLogWindow *self)
 {
+  GtkTreeSelection *selection;
+
+  if (!self->priv->when_blocked)
+    return;
+
+  selection = gtk_tree_view_get_selection (
+      GTK_TREE_VIEW (self->priv->treeview_when));
+
+  g_signal_handlers_unblock_by_func (selection,
+      log_window_when_changed_cb,
+      self);
+
+  self->priv->when_blocked = FALSE;
+}
+
+static void
+log_window_search_shown (EmpathyLogWindow *self)
+{
+  log_window_unblock_when (self);
+
+  /* Dates showed up after the events of the selection were fetched, fetch
+   * them again so they include the late hits */
+  if (self->priv->search_dates_added)
+    {
+      self->priv->search_dates_added = FALSE;
+      log_window_chats_get_messages (self, FALSE);
+    }
+}
+
+/* Moves a few pending hits to the who pane, and their dates to the when
+ * pane if they are part of the selection, so the first results show up
+ * while the search is still going on. */
+static gboolean
+log_window_show_search_hits_cb (gpointer user_data)
+{
+  EmpathyLogWindow *self = user_data;
   EmpathyAccountChooser *account_chooser;
   TpAccount *account;
   GtkTreeView *view;
@@ -1893,91 +2164,350 @@ populate_entities_from_search_hits (void)
   GtkTreeSelection *selection;
   GtkTreeIter iter;
   GtkListStore *store;
-  GList *l;
+  GList *accounts = NULL, *targets = NULL, *acc, *targ;
+  GHashTable *selected_keys = NULL;
+  gboolean first, anyone = FALSE, selected = FALSE;
+  guint i;
 
-  view = GTK_TREE_VIEW (log_window->priv->treeview_who);
+  view = GTK_TREE_VIEW (self->priv->treeview_who);
   model = gtk_tree_view_get_model (view);
   store = GTK_LIST_STORE (model);
   selection = gtk_tree_view_get_selection (view);
 
+  account_chooser = EMPATHY_ACCOUNT_CHOOSER (self->priv->account_chooser);
+  account = empathy_account_chooser_get_account (account_chooser);
+
+  /* 'Anyone' is added with the first entity */
+  first = !gtk_tree_model_get_iter_first (model, &iter);
+
+  if (!first)
+    selected = log_window_get_selected (self, &accounts, &targets, &anyone,
+        NULL, NULL, NULL);
+
+  /* 'Anyone' is every entity of the who pane, including the ones about to
+   * be added; otherwise look the hits up in the selected entities */
+  if (selected && !anyone)
+    {
+      selected_keys = g_hash_table_new_full (g_str_hash, g_str_equal,
+          g_free, NULL);
+
+      for (acc = accounts, targ = targets;
+           acc != NULL && targ != NULL;
+           acc = acc->next, targ = targ->next)
+        g_hash_table_add (selected_keys,
+            make_entity_key (acc->data, targ->data));
+    }
+
+  g_list_free_full (accounts, g_object_unref);
+  g_list_free_full (targets, g_object_unref);
+
+  for (i = 0; i < SEARCH_HITS_PER_IDLE; i++)
+    {
+      TplLogSearchHit *hit;
+      gboolean matches;
+      gchar *key;
+
+      hit = g_queue_pop_head (&self->priv->pending_hits);
+      if (hit == NULL)
+        break;
+
+      /* Protect against invalid data (corrupt or old log files). */
+      if (hit->account == NULL || hit->target == NULL)
+        continue;
+
+      /* Filter based on the selected account */
+      if (account != NULL && !account_equal (account, hit->account))
+        continue;
+
+      key = make_entity_key (hit->account, hit->target);
+
+      matches = selected &&
+        (anyone || g_hash_table_contains (selected_keys, key));
+
+      /* Add the entity if it's not already there */
+      if (!g_hash_table_contains (self->priv->hit_entities, key))
+        {
+          add_event_to_store (self, hit->account, hit->target);
+          g_hash_table_add (self->priv->hit_entities, key);
+        }
+      else
+        {
+          g_free (key);
+        }
+
+      if (matches && add_date_if_needed (self, hit->date))
+        self->priv->search_dates_added = TRUE;
+    }
+
+  tp_clear_pointer (&selected_keys, g_hash_table_unref);
+
+  if (first && gtk_tree_model_get_iter_first (model, &iter))
+    {
+      gtk_list_store_prepend (store, &iter);
+      gtk_list_store_set (store, &iter,
+          COL_WHO_TYPE, COL_TYPE_SEPARATOR,
+          COL_WHO_NAME, "separator",
+          -1);
+
+      gtk_list_store_prepend (store, &iter);
+      gtk_list_store_set (store, &iter,
+          COL_WHO_TYPE, COL_TYPE_ANY,
+          COL_WHO_NAME, _("Anyone"),
+          -1);
+
+      log_window_unblock_when (self);
+
+      /* Select 'Anyone' */
+      gtk_tree_selection_select_iter (selection, &iter);
+    }
+
+  if (!g_queue_is_empty (&self->priv->pending_hits))
+    return TRUE;
+
+  self->priv->pending_hits_id = 0;
+
+  if (self->priv->search_complete)
+    log_window_search_shown (self);
+
+  return FALSE;
+}
+
+/* Takes ownership of @hits */
+static void
+log_window_add_search_hits (EmpathyLogWindow *self,
+    GList *hits)
+{
+  GList *l;
+
+  for (l = hits; l != NULL; l = l->next)
+    g_queue_push_tail (&self->priv->pending_hits, l->data);
+
+  /* Only walks the new hits */
+  self->priv->hits = g_list_concat (hits, self->priv->hits);
+
+  if (self->priv->pending_hits_id == 0)
+    self->priv->pending_hits_id = g_idle_add (
+        log_window_show_search_hits_cb, self);
+}
+
+static void
+log_window_search_done (EmpathyLogWindow *self)
+{
+  self->priv->search_complete = TRUE;
+
+  if (self->priv->pending_hits_id == 0)
+    log_window_search_shown (self);
+}
+
+/* Shows all the hits again, for instance after the account changed */
+static void
+log_window_search_show_all (EmpathyLogWindow *self)
+{
+  GtkListStore *store;
+  GList *l;
+
+  store = GTK_LIST_STORE (gtk_tree_view_get_model (
+        GTK_TREE_VIEW (self->priv->treeview_who)));
+
   gtk_list_store_clear (store);
+  g_hash_table_remove_all (self->priv->hit_entities);
+  g_queue_clear (&self->priv->pending_hits);
 
-  account_chooser = EMPATHY_ACCOUNT_CHOOSER (log_window->priv->account_chooser);
-  account = empathy_account_chooser_get_account (account_chooser);
+  for (l = self->priv->hits; l != NULL; l = l->next)
+    g_queue_push_tail (&self->priv->pending_hits, l->data);
 
-  for (l = log_window->priv->hits; l; l = l->next)
+  if (self->priv->pending_hits_id == 0)
+    self->priv->pending_hits_id = g_idle_add (
+        log_window_show_search_hits_cb, self);
+}
+
+static void
+log_window_search_reset (EmpathyLogWindow *self)
+{
+  if (self->priv->search_cancellable != NULL)
     {
-      TplLogSearchHit *hit = l->data;
+      g_cancellable_cancel (self->priv->search_cancellable);
+      tp_clear_object (&self->priv->search_cancellable);
+    }
+
+  if (self->priv->pending_hits_id != 0)
+    {
+      g_source_remove (self->priv->pending_hits_id);
+      self->priv->pending_hits_id = 0;
+    }
+
+  g_queue_clear (&self->priv->pending_hits);
+
+  if (self->priv->hit_entities != NULL)
+    g_hash_table_remove_all (self->priv->hit_entities);
+
+  tp_clear_pointer (&self->priv->hits, tpl_log_manager_search_free);
+  tp_clear_pointer (&self->priv->search_text, g_free);
+
+  self->priv->search_complete = FALSE;
+  self->priv->search_dates_added = FALSE;
+}
+
+static void
+log_manager_searched_new_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GCancellable *cancellable = user_data;
+  GList *hits;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_search_finish (TPL_LOG_MANAGER (manager),
+      result, &hits, &error))
+    {
+      DEBUG ("%s. Aborting", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  /* The query changed in the meantime */
+  if (g_cancellable_is_cancelled (cancellable) || log_window == NULL)
+    {
+      tpl_log_manager_search_free (hits);
+      goto out;
+    }
+
+  log_window_add_search_hits (log_window, hits);
+  log_window_search_done (log_window);
+
+out:
+  g_object_unref (cancellable);
+}
+
+/* Narrows the hits of a previous search down to the ones whose
+ * conversations also contain the new, longer text. */
+typedef struct
+{
+  EmpathyLogWindow *self;
+  GCancellable *cancellable;
+  gchar *text;
+  /* owned TplLogSearchHit */
+  GQueue candidates;
+} RefineCtx;
 
-      /* Protect against invalid data (corrupt or old log files). */
-      if (hit->account == NULL || hit->target == NULL)
-        continue;
+static void
+refine_ctx_free (RefineCtx *ctx)
+{
+  g_queue_foreach (&ctx->candidates,
+      (GFunc) tpl_log_manager_search_hit_free, NULL);
+  g_queue_clear (&ctx->candidates);
+  g_object_unref (ctx->cancellable);
+  g_free (ctx->text);
+  g_slice_free (RefineCtx, ctx);
+}
 
-      /* Filter based on the selected account */
-      if (account != NULL && !account_equal (account, hit->account))
-        continue;
+static void refine_got_events_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data);
 
-      /* Add the entity if it's not already there */
-      has_element = FALSE;
-      gtk_tree_model_foreach (model, model_has_entity, hit);
-      if (!has_element)
-        {
-          add_event_to_store (log_window, hit->account, hit->target);
-        }
-    }
+static void
+refine_next_hit (RefineCtx *ctx)
+{
+  TplLogSearchHit *hit;
 
-  if (gtk_tree_model_get_iter_first (model, &iter))
+  if (g_cancellable_is_cancelled (ctx->cancellable))
     {
-      gtk_list_store_prepend (store, &iter);
-      gtk_list_store_set (store, &iter,
-          COL_WHO_TYPE, COL_TYPE_SEPARATOR,
-          COL_WHO_NAME, "separator",
-          -1);
+      refine_ctx_free (ctx);
+      return;
+    }
 
-      gtk_list_store_prepend (store, &iter);
-      gtk_list_store_set (store, &iter,
-          COL_WHO_TYPE, COL_TYPE_ANY,
-          COL_WHO_NAME, _("Anyone"),
-          -1);
+  /* Protect against invalid data (corrupt or old log files). */
+  while ((hit = g_queue_peek_head (&ctx->candidates)) != NULL &&
+      (hit->account == NULL || hit->target == NULL))
+    tpl_log_manager_search_hit_free (g_queue_pop_head (&ctx->candidates));
+
+  if (hit == NULL)
+    {
+      log_window_search_done (ctx->self);
+      refine_ctx_free (ctx);
+      return;
     }
 
-  /* Select 'Anyone' */
-  if (gtk_tree_model_get_iter_first (model, &iter))
-    gtk_tree_selection_select_iter (selection, &iter);
+  tpl_log_manager_get_events_for_date_async (ctx->self->priv->log_manager,
+      hit->account, hit->target, TPL_EVENT_MASK_TEXT, hit->date,
+      refine_got_events_cb, ctx);
 }
 
 static void
-log_manager_searched_new_cb (GObject *manager,
+refine_got_events_cb (GObject *manager,
     GAsyncResult *result,
     gpointer user_data)
 {
-  GList *hits;
-  GtkTreeView *view;
-  GtkTreeSelection *selection;
+  RefineCtx *ctx = user_data;
+  TplLogSearchHit *hit;
+  GList *events = NULL, *l;
+  gboolean found = FALSE;
   GError *error = NULL;
 
-  if (log_window == NULL)
-    return;
+  hit = g_queue_pop_head (&ctx->candidates);
 
-  if (!tpl_log_manager_search_finish (TPL_LOG_MANAGER (manager),
-      result, &hits, &error))
+  if (!tpl_log_manager_get_events_for_date_finish (TPL_LOG_MANAGER (manager),
+      result, &events, &error))
     {
-      DEBUG ("%s. Aborting", error->message);
+      DEBUG ("Unable to refine search hit: %s", error->message);
       g_error_free (error);
-      return;
     }
 
-  tp_clear_pointer (&log_window->priv->hits, tpl_log_manager_search_free);
-  log_window->priv->hits = hits;
+  for (l = events; l != NULL && !found; l = l->next)
+    {
+      gchar *folded;
 
-  view = GTK_TREE_VIEW (log_window->priv->treeview_when);
-  selection = gtk_tree_view_get_selection (view);
+      if (!TPL_IS_TEXT_EVENT (l->data))
+        continue;
 
-  g_signal_handlers_unblock_by_func (selection,
-      log_window_when_changed_cb,
-      log_window);
+      folded = g_utf8_casefold (tpl_text_event_get_message (l->data), -1);
+      found = strstr (folded, ctx->text) != NULL;
+      g_free (folded);
+    }
+
+  g_list_free_full (events, g_object_unref);
+
+  if (found && !g_cancellable_is_cancelled (ctx->cancellable))
+    log_window_add_search_hits (ctx->self, g_list_prepend (NULL, hit));
+  else
+    tpl_log_manager_search_hit_free (hit);
+
+  refine_next_hit (ctx);
+}
+
+/* Takes @candidates */
+static void
+refine_hits (EmpathyLogWindow *self,
+    const gchar *text,
+    GList *candidates)
+{
+  RefineCtx *ctx = g_slice_new0 (RefineCtx);
+  GList *l;
+
+  ctx->self = self;
+  ctx->cancellable = g_object_ref (self->priv->search_cancellable);
+  ctx->text = g_strdup (text);
+
+  for (l = candidates; l != NULL; l = l->next)
+    g_queue_push_tail (&ctx->candidates, l->data);
+  g_list_free (candidates);
+
+  refine_next_hit (ctx);
+}
+
+/* The index only matches words, wherever they are in a conversation */
+static gboolean
+is_single_word (const gchar *text)
+{
+  const gchar *p;
+
+  for (p = text; *p != '\0'; p = g_utf8_next_char (p))
+    {
+      if (!g_unichar_isalnum (g_utf8_get_char (p)))
+        return FALSE;
+    }
 
-  populate_entities_from_search_hits ();
+  return TRUE;
 }
 
 static void
@@ -1988,6 +2518,9 @@ log_window_find_populate (EmpathyLogWindow *self,
   GtkTreeModel *model;
   GtkTreeSelection *selection;
   GtkListStore *store;
+  GList *hits, *previous = NULL;
+  gchar *text = NULL;
+  gboolean refine = FALSE;
 
   gtk_tree_store_clear (self->priv->store_events);
 
@@ -2004,26 +2537,83 @@ log_window_find_populate (EmpathyLogWindow *self,
 
   gtk_list_store_clear (store);
 
+  if (!TPAW_STR_EMPTY (search_criteria))
+    {
+      text = g_utf8_casefold (search_criteria, -1);
+
+      /* Everything matching the new text also matched the previous one */
+      if (self->priv->search_complete &&
+          strstr (text, self->priv->search_text) != NULL)
+        {
+          previous = self->priv->hits;
+          self->priv->hits = NULL;
+          refine = TRUE;
+        }
+    }
+
+  /* Forget about the previous search, and its outstanding calls */
+  log_window_search_reset (self);
+
   if (TPAW_STR_EMPTY (search_criteria))
     {
-      tp_clear_pointer (&self->priv->hits, tpl_log_manager_search_free);
+      log_window_unblock_when (self);
+
       webkit_web_view_set_highlight_text_matches (
           WEBKIT_WEB_VIEW (self->priv->webview), FALSE);
       log_window_who_populate (self);
       return;
     }
 
-  g_signal_handlers_block_by_func (selection,
-      log_window_when_changed_cb,
-      self);
+  self->priv->search_text = text;
+  self->priv->search_cancellable = g_cancellable_new ();
+
+  if (!self->priv->when_blocked)
+    {
+      g_signal_handlers_block_by_func (selection,
+          log_window_when_changed_cb,
+          self);
+
+      self->priv->when_blocked = TRUE;
+    }
 
   /* highlight the search text */
   webkit_web_view_mark_text_matches (WEBKIT_WEB_VIEW (self->priv->webview),
       search_criteria, FALSE, 0);
 
+  if (empathy_log_index_search (self->priv->log_index, search_criteria,
+        &hits))
+    {
+      tpl_log_manager_search_free (previous);
+
+      /* Look for the whole text in the conversations having all its
+       * words, as the logger would */
+      if (is_single_word (text))
+        {
+          log_window_add_search_hits (self, hits);
+          log_window_search_done (self);
+        }
+      else
+        {
+          refine_hits (self, text, hits);
+        }
+
+      return;
+    }
+
+  /* Checking a few conversations is cheaper than scanning all the logs */
+  if (refine && g_list_length (previous) <= MAX_REFINED_HITS)
+    {
+      refine_hits (self, text, previous);
+      return;
+    }
+
+  tpl_log_manager_search_free (previous);
+
+  /* The logs haven't been indexed yet, scan them */
   tpl_log_manager_search_async (self->priv->log_manager,
       search_criteria, TPL_EVENT_MASK_ANY,
-      log_manager_searched_new_cb, NULL);
+      log_manager_searched_new_cb,
+      g_object_ref (self->priv->search_cancellable));
 }
 
 static gboolean
@@ -2456,9 +3046,9 @@ log_window_who_populate (EmpathyLogWindow *self)
   GtkListStore *store;
   Ctx *ctx;
 
-  if (self->priv->hits != NULL)
+  if (self->priv->search_text != NULL)
     {
-      populate_entities_from_search_hits ();
+      log_window_search_show_all (self);
       return;
     }
 
@@ -3001,7 +3591,7 @@ log_window_what_changed_cb (GtkTreeSelection *selection,
     }
 
   /* The dates need to be updated if we're not searching */
-  log_window_chats_get_messages (self, self->priv->hits == NULL);
+  log_window_chats_get_messages (self, self->priv->search_text == NULL);
 }
 
 static gboolean
@@ -3139,6 +3729,9 @@ log_window_maybe_expand_events (void)
 {
   GtkTreeModel      *model = GTK_TREE_MODEL (log_window->priv->store_events);
 
+  /* The rows need to be there first */
+  log_window_flush_rows (log_window);
+
   /* If there's only one result, expand it */
   if (gtk_tree_model_iter_n_children (model, NULL) == 1)
     webkit_web_view_execute_script (
@@ -3164,15 +3757,12 @@ show_spinner (gpointer data)
 }
 
 static void
-show_events (TplActionChain *chain,
-    gpointer user_data)
+show_events (void)
 {
   log_window_maybe_expand_events ();
   gtk_spinner_stop (GTK_SPINNER (log_window->priv->spinner));
   gtk_notebook_set_current_page (GTK_NOTEBOOK (log_window->priv->notebook),
       PAGE_EVENTS);
-
-  _tpl_action_chain_continue (chain);
 }
 
 static void
@@ -3183,41 +3773,14 @@ start_spinner (void)
       PAGE_EMPTY);
 
   g_timeout_add (1000, show_spinner, NULL);
-  _tpl_action_chain_append (log_window->priv->chain, show_events, NULL);
 }
 
 static void
-log_window_got_messages_for_date_cb (GObject *manager,
-    GAsyncResult *result,
-    gpointer user_data)
+log_window_append_events (Ctx *ctx)
 {
-  Ctx *ctx = user_data;
-  GtkTreeModel *model;
-  GtkTreeIter iter;
-  GList *events;
   GList *l;
-  GError *error = NULL;
-  gint n;
-
-  if (log_window == NULL)
-    {
-      ctx_free (ctx);
-      return;
-    }
-
-  if (log_window->priv->count != ctx->count)
-    goto out;
-
-  if (!tpl_log_manager_get_events_for_date_finish (TPL_LOG_MANAGER (manager),
-      result, &events, &error))
-    {
-      DEBUG ("Unable to retrieve messages for the selected date: %s. Aborting",
-          error->message);
-      g_error_free (error);
-      goto out;
-    }
 
-  for (l = events; l; l = l->next)
+  for (l = ctx->events; l; l = l->next)
     {
       TplEvent *event = l->data;
       gboolean append = TRUE;
@@ -3265,10 +3828,15 @@ log_window_got_messages_for_date_cb (GObject *manager,
           log_window_append_message (event, msg);
           tp_clear_object (&msg);
         }
-
-      g_object_unref (event);
     }
-  g_list_free (events);
+}
+
+static void
+log_window_scroll_to_last_event (void)
+{
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  gint n;
 
   model = GTK_TREE_MODEL (log_window->priv->store_events);
   n = gtk_tree_model_iter_n_children (model, NULL) - 1;
@@ -3284,6 +3852,8 @@ log_window_got_messages_for_date_cb (GObject *manager,
       script = g_strdup_printf ("javascript:scrollToRow([%s]);",
           g_strdelimit (str, ":", ','));
 
+      log_window_flush_rows (log_window);
+
       webkit_web_view_execute_script (
           WEBKIT_WEB_VIEW (log_window->priv->webview),
           script);
@@ -3292,23 +3862,180 @@ log_window_got_messages_for_date_cb (GObject *manager,
       g_free (str);
       g_free (script);
     }
+}
 
- out:
-  ctx_free (ctx);
+/* Appends the events of the fetched dates, as long as all the dates before
+ * them have been fetched as well so conversations are built in order. */
+static void
+log_window_show_fetched_dates (EmpathyLogWindow *self)
+{
+  GPtrArray *fetches = self->priv->fetches;
+  gboolean appended = FALSE;
 
-  _tpl_action_chain_continue (log_window->priv->chain);
+  while (self->priv->fetch_shown < fetches->len)
+    {
+      Ctx *ctx = g_ptr_array_index (fetches, self->priv->fetch_shown);
+
+      if (!ctx->fetched)
+        break;
+
+      log_window_append_events (ctx);
+      appended = TRUE;
+
+      ctx_free (ctx);
+      g_ptr_array_index (fetches, self->priv->fetch_shown) = NULL;
+      self->priv->fetch_shown++;
+    }
+
+  if (appended)
+    log_window_scroll_to_last_event ();
+
+  if (self->priv->fetch_shown == fetches->len)
+    {
+      show_events ();
+    }
+  else if (!self->priv->first_screen_shown &&
+      gtk_tree_model_iter_n_children (
+        GTK_TREE_MODEL (self->priv->store_events), NULL) >=
+          FIRST_SCREEN_EVENTS)
+    {
+      /* Don't keep the spinner until the last date is there */
+      self->priv->first_screen_shown = TRUE;
+      gtk_spinner_stop (GTK_SPINNER (self->priv->spinner));
+      gtk_notebook_set_current_page (GTK_NOTEBOOK (self->priv->notebook),
+          PAGE_EVENTS);
+    }
+}
+
+static void log_window_fetch_dates (EmpathyLogWindow *self);
+
+/* Whether @ctx is one of the dates @self is waiting for. Stale callbacks
+ * can't be told apart by a counter, as the window may have been closed
+ * and opened again since their fetch started. */
+static gboolean
+log_window_is_fetching (EmpathyLogWindow *self,
+    Ctx *ctx)
+{
+  guint i;
+
+  for (i = self->priv->fetch_shown; i < self->priv->fetch_next; i++)
+    {
+      if (g_ptr_array_index (self->priv->fetches, i) == ctx)
+        return !ctx->fetched;
+    }
+
+  return FALSE;
 }
 
 static void
-get_events_for_date (TplActionChain *chain, gpointer user_data)
+log_window_got_messages_for_date_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
 {
   Ctx *ctx = user_data;
+  GError *error = NULL;
 
-  tpl_log_manager_get_events_for_date_async (ctx->self->priv->log_manager,
-      ctx->account, ctx->entity, ctx->event_mask,
-      ctx->date,
-      log_window_got_messages_for_date_cb,
-      ctx);
+  /* The fetch has been reset, the Ctx isn't tracked anymore */
+  if (log_window == NULL || !log_window_is_fetching (log_window, ctx))
+    {
+      ctx_free (ctx);
+      return;
+    }
+
+  ctx->fetched = TRUE;
+  log_window->priv->fetches_in_flight--;
+
+  /* The events are not wanted anymore, the Ctx is freed by the next reset */
+  if (log_window->priv->count != ctx->count)
+    return;
+
+  if (!tpl_log_manager_get_events_for_date_finish (TPL_LOG_MANAGER (manager),
+      result, &ctx->events, &error))
+    {
+      DEBUG ("Unable to retrieve messages for the selected date: %s. Aborting",
+          error->message);
+      g_error_free (error);
+      ctx->events = NULL;
+    }
+
+  log_window_show_fetched_dates (log_window);
+  log_window_fetch_dates (log_window);
+}
+
+static void
+log_window_fetch_dates (EmpathyLogWindow *self)
+{
+  GPtrArray *fetches = self->priv->fetches;
+
+  while (self->priv->fetches_in_flight < MAX_DATE_FETCHES &&
+      self->priv->fetch_next < fetches->len)
+    {
+      Ctx *ctx = g_ptr_array_index (fetches, self->priv->fetch_next);
+
+      self->priv->fetch_next++;
+      self->priv->fetches_in_flight++;
+
+      tpl_log_manager_get_events_for_date_async (self->priv->log_manager,
+          ctx->account, ctx->entity, ctx->event_mask,
+          ctx->date,
+          log_window_got_messages_for_date_cb,
+          ctx);
+    }
+}
+
+/* Forgets about the dates being fetched. The Ctx of the ones in flight
+ * are freed by their callback, as they aren't in the fetches anymore. */
+static void
+log_window_fetch_reset (EmpathyLogWindow *self)
+{
+  GPtrArray *fetches = self->priv->fetches;
+  guint i;
+
+  for (i = self->priv->fetch_shown; i < fetches->len; i++)
+    {
+      Ctx *ctx = g_ptr_array_index (fetches, i);
+
+      if (i >= self->priv->fetch_next || ctx->fetched)
+        ctx_free (ctx);
+    }
+
+  g_ptr_array_set_size (fetches, 0);
+  self->priv->fetch_next = 0;
+  self->priv->fetch_shown = 0;
+  self->priv->fetches_in_flight = 0;
+  self->priv->first_screen_shown = FALSE;
+}
+
+static gint
+compare_ctx_dates (gconstpointer a,
+    gconstpointer b)
+{
+  const Ctx *ctx_a = *(Ctx **) a;
+  const Ctx *ctx_b = *(Ctx **) b;
+
+  return g_date_compare (ctx_a->date, ctx_b->date);
+}
+
+/* Takes ownership of @ctx */
+static void
+log_window_queue_date (EmpathyLogWindow *self,
+    Ctx *ctx)
+{
+  g_ptr_array_add (self->priv->fetches, ctx);
+}
+
+static void
+log_window_start_fetching_dates (EmpathyLogWindow *self)
+{
+  /* Oldest first, so the events can be appended as soon as they arrive */
+  g_ptr_array_sort (self->priv->fetches, compare_ctx_dates);
+
+  start_spinner ();
+
+  if (self->priv->fetches->len == 0)
+    show_events ();
+  else
+    log_window_fetch_dates (self);
 }
 
 static void
@@ -3329,6 +4056,7 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
 
   _tpl_action_chain_clear (self->priv->chain);
   self->priv->count++;
+  log_window_fetch_reset (self);
 
   for (acc = accounts, targ = targets;
        acc != NULL && targ != NULL;
@@ -3348,7 +4076,7 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
 
               ctx = ctx_new (self, account, target, date, event_mask, subtype,
                   self->priv->count);
-              _tpl_action_chain_append (self->priv->chain, get_events_for_date, ctx);
+              log_window_queue_date (self, ctx);
             }
           else
             {
@@ -3373,7 +4101,7 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
                     {
                       ctx = ctx_new (self, account, target, d,
                           event_mask, subtype, self->priv->count);
-                      _tpl_action_chain_append (self->priv->chain, get_events_for_date, ctx);
+                      log_window_queue_date (self, ctx);
                     }
 
                   g_date_free (d);
@@ -3382,8 +4110,7 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
         }
     }
 
-  start_spinner ();
-  _tpl_action_chain_start (self->priv->chain);
+  log_window_start_fetching_dates (self);
 
   g_list_free_full (accounts, g_object_unref);
   g_list_free_full (targets, g_object_unref);
@@ -3566,7 +4293,7 @@ log_window_chats_get_messages (EmpathyLogWindow *self,
   self->priv->count++;
 
   /* If there's a search use the returned hits */
-  if (self->priv->hits != NULL)
+  if (self->priv->search_text != NULL)
     {
       if (force_get_dates)
         {
@@ -3663,31 +4390,23 @@ log_window_chats_get_messages (EmpathyLogWindow *self,
 typedef struct {
   EmpathyAccountChooserFilterResultCallback callback;
   gpointer user_data;
+  TpAccount *account;
 } FilterCallbackData;
 
 static void
-got_entities (GObject *manager,
+account_logs_prepared_cb (GObject *source,
     GAsyncResult *result,
     gpointer user_data)
 {
+  EmpathyLogCatalog *catalog = EMPATHY_LOG_CATALOG (source);
   FilterCallbackData *data = user_data;
-  GList *entities;
-  GError *error = NULL;
 
-  if (!tpl_log_manager_get_entities_finish (TPL_LOG_MANAGER (manager),
-      result, &entities, &error))
-    {
-      DEBUG ("Could not get entities: %s", error->message);
-      g_error_free (error);
-      data->callback (FALSE, data->user_data);
-    }
-  else
-    {
-      data->callback (entities != NULL, data->user_data);
+  empathy_log_catalog_prepare_account_finish (catalog, result, NULL);
 
-      g_list_free_full (entities, g_object_unref);
-    }
+  data->callback (empathy_log_catalog_account_has_logs (catalog,
+        data->account), data->user_data);
 
+  g_object_unref (data->account);
   g_slice_free (FilterCallbackData, data);
 }
 
@@ -3697,15 +4416,18 @@ empathy_account_chooser_filter_has_logs (TpAccount *account,
     gpointer callback_data,
     gpointer user_data)
 {
-  TplLogManager *manager = tpl_log_manager_dup_singleton ();
+  EmpathyLogCatalog *catalog = empathy_log_catalog_dup_singleton ();
   FilterCallbackData *cb_data = g_slice_new0 (FilterCallbackData);
 
   cb_data->callback = callback;
   cb_data->user_data = callback_data;
+  cb_data->account = g_object_ref (account);
 
-  tpl_log_manager_get_entities_async (manager, account, got_entities, cb_data);
+  /* Only waits for the logs to be listed the first time */
+  empathy_log_catalog_prepare_account_async (catalog, account,
+      account_logs_prepared_cb, cb_data);
 
-  g_object_unref (manager);
+  g_object_unref (catalog);
 }
 
 static void
@@ -3714,10 +4436,20 @@ log_window_logger_clear_account_cb (TpProxy *proxy,
     gpointer user_data,
     GObject *weak_object)
 {
-  EmpathyLogWindow *self = EMPATHY_LOG_WINDOW (user_data);
+  EmpathyLogWindow *self = EMPATHY_LOG_WINDOW (weak_object);
+  TpAccount *account = user_data;
 
   if (error != NULL)
     g_warning ("Error when clearing logs: %s", error->message);
+  else
+    {
+      EmpathyLogCatalog *catalog = empathy_log_catalog_dup_singleton ();
+
+      empathy_log_index_clear (self->priv->log_index, account);
+      empathy_log_catalog_clear (catalog, account);
+
+      g_object_unref (catalog);
+    }
 
   /* Refresh the log viewer so the logs are cleared if the account
    * has been deleted */
@@ -3803,7 +4535,7 @@ log_window_delete_menu_clicked_cb (GtkMenuItem *menuitem,
 
       emp_cli_logger_call_clear (logger, -1,
           log_window_logger_clear_account_cb,
-          self, NULL, G_OBJECT (self));
+          NULL, NULL, G_OBJECT (self));
     }
   else
     {
@@ -3816,7 +4548,7 @@ log_window_delete_menu_clicked_cb (GtkMenuItem *menuitem,
       emp_cli_logger_call_clear_account (logger, -1,
           tp_proxy_get_object_path (account),
           log_window_logger_clear_account_cb,
-          self, NULL, G_OBJECT (self));
+          g_object_ref (account), g_object_unref, G_OBJECT (self));
     }
 
   g_object_unref (logger);
@@ -12,6 +12,10 @@ G_DEFINE_TYPE (EmpathyRosterContact, empathy_roster_contact, GTK_TYPE_LIST_BOX_R
 
 #define AVATAR_SIZE 48
 
+/* Maximum number of unused row contents kept around to be reused by the next
+ * row being populated. */
+#define MAX_RECYCLED_CONTENTS 64
+
 enum
 {
   PROP_INDIVIDIUAL = 1,
@@ -30,17 +34,30 @@ enum
 static guint signals[LAST_SIGNAL];
 */
 
-struct _EmpathyRosterContactPriv
+/* The widgets displayed inside the row. They are only created when the row
+ * has to be displayed and are given back to a pool when it's hidden again, so
+ * rows of collapsed groups and hidden contacts are cheap. */
+typedef struct
 {
-  FolksIndividual *individual;
-  gchar *group;
+  /* owned */
+  GtkWidget *alig;
 
+  /* borrowed, children of alig */
   GtkWidget *avatar;
   GtkWidget *first_line_alig;
   GtkWidget *alias;
   GtkWidget *presence_msg;
   GtkWidget *presence_icon;
   GtkWidget *phone_icon;
+} RowContent;
+
+struct _EmpathyRosterContactPriv
+{
+  FolksIndividual *individual;
+  gchar *group;
+
+  /* NULL if the row is not populated */
+  RowContent *content;
 
   /* If not NULL, used instead of the individual's presence icon */
   gchar *event_icon;
@@ -48,6 +65,9 @@ struct _EmpathyRosterContactPriv
   gboolean online;
 };
 
+/* queue of (RowContent *) not currently used by any row */
+static GQueue recycled_contents = G_QUEUE_INIT;
+
 static const gchar *
 get_alias (EmpathyRosterContact *self)
 {
@@ -55,6 +75,119 @@ get_alias (EmpathyRosterContact *self)
         self->priv->individual));
 }
 
+static RowContent *
+row_content_new (void)
+{
+  RowContent *content = g_slice_new0 (RowContent);
+  GtkWidget *main_box, *box, *first_line_box;
+  GtkStyleContext *context;
+
+  content->alig = gtk_alignment_new (0.5, 0.5, 1, 1);
+  g_object_ref_sink (content->alig);
+  gtk_widget_show (content->alig);
+  gtk_alignment_set_padding (GTK_ALIGNMENT (content->alig), 4, 4, 4, 12);
+
+  main_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
+
+  /* Avatar */
+  content->avatar = gtk_image_new ();
+
+  gtk_widget_set_size_request (content->avatar, AVATAR_SIZE, AVATAR_SIZE);
+
+  gtk_box_pack_start (GTK_BOX (main_box), content->avatar, FALSE, FALSE, 0);
+  gtk_widget_show (content->avatar);
+
+  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+
+  /* Alias and phone icon */
+  content->first_line_alig = gtk_alignment_new (0, 0.5, 1, 1);
+  first_line_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+
+  content->alias = gtk_label_new (NULL);
+  gtk_label_set_ellipsize (GTK_LABEL (content->alias), PANGO_ELLIPSIZE_END);
+  gtk_box_pack_start (GTK_BOX (first_line_box), content->alias,
+      FALSE, FALSE, 0);
+  gtk_misc_set_alignment (GTK_MISC (content->alias), 0, 0.5);
+  gtk_widget_show (content->alias);
+
+  content->phone_icon = gtk_image_new_from_icon_name ("phone-symbolic",
+      GTK_ICON_SIZE_MENU);
+  gtk_misc_set_alignment (GTK_MISC (content->phone_icon), 0, 0.5);
+  gtk_box_pack_start (GTK_BOX (first_line_box), content->phone_icon,
+      TRUE, TRUE, 0);
+
+  gtk_container_add (GTK_CONTAINER (content->first_line_alig),
+      first_line_box);
+  gtk_widget_show (content->first_line_alig);
+
+  gtk_box_pack_start (GTK_BOX (box), content->first_line_alig,
+      TRUE, TRUE, 0);
+  gtk_widget_show (first_line_box);
+
+  gtk_box_pack_start (GTK_BOX (main_box), box, TRUE, TRUE, 0);
+  gtk_widget_show (box);
+
+  /* Presence */
+  content->presence_msg = gtk_label_new (NULL);
+  gtk_label_set_ellipsize (GTK_LABEL (content->presence_msg),
+      PANGO_ELLIPSIZE_END);
+  gtk_box_pack_start (GTK_BOX (box), content->presence_msg, TRUE, TRUE, 0);
+  gtk_widget_show (content->presence_msg);
+
+  context = gtk_widget_get_style_context (content->presence_msg);
+  gtk_style_context_add_class (context, GTK_STYLE_CLASS_DIM_LABEL);
+
+  /* Presence icon */
+  content->presence_icon = gtk_image_new ();
+
+  gtk_box_pack_start (GTK_BOX (main_box), content->presence_icon,
+      FALSE, FALSE, 0);
+  gtk_widget_show (content->presence_icon);
+
+  gtk_container_add (GTK_CONTAINER (content->alig), main_box);
+  gtk_widget_show (main_box);
+
+  return content;
+}
+
+static void
+row_content_free (RowContent *content)
+{
+  gtk_widget_destroy (content->alig);
+  g_object_unref (content->alig);
+
+  g_slice_free (RowContent, content);
+}
+
+static RowContent *
+row_content_take_recycled (void)
+{
+  RowContent *content;
+
+  content = g_queue_pop_head (&recycled_contents);
+  if (content != NULL)
+    return content;
+
+  return row_content_new ();
+}
+
+static void
+row_content_recycle (RowContent *content)
+{
+  if (g_queue_get_length (&recycled_contents) >= MAX_RECYCLED_CONTENTS)
+    {
+      row_content_free (content);
+      return;
+    }
+
+  /* Don't keep the previous individual's data alive */
+  gtk_image_clear (GTK_IMAGE (content->avatar));
+  gtk_label_set_text (GTK_LABEL (content->alias), NULL);
+  gtk_label_set_text (GTK_LABEL (content->presence_msg), NULL);
+
+  g_queue_push_head (&recycled_contents, content);
+}
+
 static void
 empathy_roster_contact_get_property (GObject *object,
     guint property_id,
@@ -123,13 +256,21 @@ avatar_loaded_cb (GObject *source,
   pixbuf = empathy_pixbuf_avatar_from_individual_scaled_finish (
       FOLKS_INDIVIDUAL (source), result, NULL);
 
+  /* The row may have been depopulated while we were loading the avatar */
+  if (self->priv->content == NULL)
+    {
+      g_clear_object (&pixbuf);
+      g_object_unref (self);
+      goto out;
+    }
+
   if (pixbuf == NULL)
     {
       pixbuf = tpaw_pixbuf_from_icon_name_sized (
           TPAW_IMAGE_AVATAR_DEFAULT, AVATAR_SIZE);
     }
 
-  gtk_image_set_from_pixbuf (GTK_IMAGE (self->priv->avatar), pixbuf);
+  gtk_image_set_from_pixbuf (GTK_IMAGE (self->priv->content->avatar), pixbuf);
   g_object_unref (pixbuf);
 
   g_object_unref (self);
@@ -151,13 +292,18 @@ avatar_changed_cb (FolksIndividual *individual,
     GParamSpec *spec,
     EmpathyRosterContact *self)
 {
+  if (self->priv->content == NULL)
+    return;
+
   update_avatar (self);
 }
 
 static void
 update_alias (EmpathyRosterContact *self)
 {
-  gtk_label_set_text (GTK_LABEL (self->priv->alias), get_alias (self));
+  if (self->priv->content != NULL)
+    gtk_label_set_text (GTK_LABEL (self->priv->content->alias),
+        get_alias (self));
 
   g_object_notify (G_OBJECT (self), "alias");
 }
@@ -173,19 +319,23 @@ alias_changed_cb (FolksIndividual *individual,
 static void
 update_presence_msg (EmpathyRosterContact *self)
 {
+  RowContent *content = self->priv->content;
   const gchar *msg;
   GStrv types;
 
+  if (content == NULL)
+    return;
+
   msg = folks_presence_details_get_presence_message (
       FOLKS_PRESENCE_DETAILS (self->priv->individual));
 
   if (tp_str_empty (msg))
     {
       /* Just display the alias in the center of the row */
-      gtk_alignment_set (GTK_ALIGNMENT (self->priv->first_line_alig),
+      gtk_alignment_set (GTK_ALIGNMENT (content->first_line_alig),
           0, 0.5, 1, 1);
 
-      gtk_widget_hide (self->priv->presence_msg);
+      gtk_widget_hide (content->presence_msg);
     }
   else
     {
@@ -200,25 +350,25 @@ update_presence_msg (EmpathyRosterContact *self)
           /* Add a prefix explaining that something goes wrong when trying to
            * fetch contact's presence. */
           tmp = g_strdup_printf (_("Server cannot find contact: %s"), msg);
-          gtk_label_set_text (GTK_LABEL (self->priv->presence_msg), tmp);
+          gtk_label_set_text (GTK_LABEL (content->presence_msg), tmp);
 
           g_free (tmp);
         }
       else
         {
-          gtk_label_set_text (GTK_LABEL (self->priv->presence_msg), msg);
+          gtk_label_set_text (GTK_LABEL (content->presence_msg), msg);
         }
 
-      gtk_alignment_set (GTK_ALIGNMENT (self->priv->first_line_alig),
+      gtk_alignment_set (GTK_ALIGNMENT (content->first_line_alig),
           0, 0.75, 1, 1);
-      gtk_misc_set_alignment (GTK_MISC (self->priv->presence_msg), 0, 0.25);
+      gtk_misc_set_alignment (GTK_MISC (content->presence_msg), 0, 0.25);
 
-      gtk_widget_show (self->priv->presence_msg);
+      gtk_widget_show (content->presence_msg);
     }
 
   types = (GStrv) empathy_individual_get_client_types (self->priv->individual);
 
-  gtk_widget_set_visible (self->priv->phone_icon,
+  gtk_widget_set_visible (content->phone_icon,
       empathy_client_types_contains_mobile_device (types));
 }
 
@@ -235,13 +385,16 @@ update_presence_icon (EmpathyRosterContact *self)
 {
   const gchar *icon;
 
+  if (self->priv->content == NULL)
+    return;
+
   if (self->priv->event_icon == NULL)
     icon = empathy_icon_name_for_individual (self->priv->individual);
   else
     icon = self->priv->event_icon;
 
-  gtk_image_set_from_icon_name (GTK_IMAGE (self->priv->presence_icon), icon,
-      GTK_ICON_SIZE_MENU);
+  gtk_image_set_from_icon_name (GTK_IMAGE (self->priv->content->presence_icon),
+      icon, GTK_ICON_SIZE_MENU);
 }
 
 static void
@@ -313,11 +466,7 @@ empathy_roster_contact_constructed (GObject *object)
   tp_g_signal_connect_object (self->priv->individual, "notify::presence-status",
       G_CALLBACK (presence_status_changed_cb), self, 0);
 
-  update_avatar (self);
-  update_alias (self);
-  update_presence_msg (self);
-  update_presence_icon (self);
-
+  /* Widgets are only created once the row is populated */
   update_online (self);
 }
 
@@ -328,6 +477,7 @@ empathy_roster_contact_dispose (GObject *object)
   void (*chain_up) (GObject *) =
       ((GObjectClass *) empathy_roster_contact_parent_class)->dispose;
 
+  empathy_roster_contact_depopulate (self);
   g_clear_object (&self->priv->individual);
 
   if (chain_up != NULL)
@@ -391,76 +541,8 @@ empathy_roster_contact_class_init (
 static void
 empathy_roster_contact_init (EmpathyRosterContact *self)
 {
-  GtkWidget *alig, *main_box, *box, *first_line_box;
-  GtkStyleContext *context;
-
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
       EMPATHY_TYPE_ROSTER_CONTACT, EmpathyRosterContactPriv);
-
-  alig = gtk_alignment_new (0.5, 0.5, 1, 1);
-  gtk_widget_show (alig);
-  gtk_alignment_set_padding (GTK_ALIGNMENT (alig), 4, 4, 4, 12);
-
-  main_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
-
-  /* Avatar */
-  self->priv->avatar = gtk_image_new ();
-
-  gtk_widget_set_size_request (self->priv->avatar, AVATAR_SIZE, AVATAR_SIZE);
-
-  gtk_box_pack_start (GTK_BOX (main_box), self->priv->avatar, FALSE, FALSE, 0);
-  gtk_widget_show (self->priv->avatar);
-
-  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
-
-  /* Alias and phone icon */
-  self->priv->first_line_alig = gtk_alignment_new (0, 0.5, 1, 1);
-  first_line_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
-
-  self->priv->alias = gtk_label_new (NULL);
-  gtk_label_set_ellipsize (GTK_LABEL (self->priv->alias), PANGO_ELLIPSIZE_END);
-  gtk_box_pack_start (GTK_BOX (first_line_box), self->priv->alias,
-      FALSE, FALSE, 0);
-  gtk_misc_set_alignment (GTK_MISC (self->priv->alias), 0, 0.5);
-  gtk_widget_show (self->priv->alias);
-
-  self->priv->phone_icon = gtk_image_new_from_icon_name ("phone-symbolic",
-      GTK_ICON_SIZE_MENU);
-  gtk_misc_set_alignment (GTK_MISC (self->priv->phone_icon), 0, 0.5);
-  gtk_box_pack_start (GTK_BOX (first_line_box), self->priv->phone_icon,
-      TRUE, TRUE, 0);
-
-  gtk_container_add (GTK_CONTAINER (self->priv->first_line_alig),
-      first_line_box);
-  gtk_widget_show (self->priv->first_line_alig);
-
-  gtk_box_pack_start (GTK_BOX (box), self->priv->first_line_alig,
-      TRUE, TRUE, 0);
-  gtk_widget_show (first_line_box);
-
-  gtk_box_pack_start (GTK_BOX (main_box), box, TRUE, TRUE, 0);
-  gtk_widget_show (box);
-
-  /* Presence */
-  self->priv->presence_msg = gtk_label_new (NULL);
-  gtk_label_set_ellipsize (GTK_LABEL (self->priv->presence_msg),
-      PANGO_ELLIPSIZE_END);
-  gtk_box_pack_start (GTK_BOX (box), self->priv->presence_msg, TRUE, TRUE, 0);
-  gtk_widget_show (self->priv->presence_msg);
-
-  context = gtk_widget_get_style_context (self->priv->presence_msg);
-  gtk_style_context_add_class (context, GTK_STYLE_CLASS_DIM_LABEL);
-
-  /* Presence icon */
-  self->priv->presence_icon = gtk_image_new ();
-
-  gtk_box_pack_start (GTK_BOX (main_box), self->priv->presence_icon,
-      FALSE, FALSE, 0);
-  gtk_widget_show (self->priv->presence_icon);
-
-  gtk_container_add (GTK_CONTAINER (self), alig);
-  gtk_container_add (GTK_CONTAINER (alig), main_box);
-  gtk_widget_show (main_box);
 }
 
 GtkWidget *
@@ -506,8 +588,55 @@ empathy_roster_contact_set_event_icon (EmpathyRosterContact *self,
   update_presence_icon (self);
 }
 
+/* Returns NULL if @self is not populated */
 GdkPixbuf *
 empathy_roster_contact_get_avatar_pixbuf (EmpathyRosterContact *self)
 {
-  return gtk_image_get_pixbuf (GTK_IMAGE (self->priv->avatar));
+  if (self->priv->content == NULL)
+    return NULL;
+
+  return gtk_image_get_pixbuf (GTK_IMAGE (self->priv->content->avatar));
+}
+
+gboolean
+empathy_roster_contact_is_populated (EmpathyRosterContact *self)
+{
+  return self->priv->content != NULL;
+}
+
+/* Create (or reuse) the widgets displaying the individual. Rows are created
+ * empty and have to be populated before being displayed. */
+void
+empathy_roster_contact_populate (EmpathyRosterContact *self)
+{
+  if (self->priv->content != NULL)
+    return;
+
+  self->priv->content = row_content_take_recycled ();
+  gtk_container_add (GTK_CONTAINER (self), self->priv->content->alig);
+
+  /* Don't use update_alias() as the alias didn't change, we just have to
+   * display it. */
+  gtk_label_set_text (GTK_LABEL (self->priv->content->alias),
+      get_alias (self));
+
+  update_avatar (self);
+  update_presence_msg (self);
+  update_presence_icon (self);
+}
+
+/* Release the widgets of a row which is not displayed any more so they can be
+ * reused by another one. */
+void
+empathy_roster_contact_depopulate (EmpathyRosterContact *self)
+{
+  RowContent *content = self->priv->content;
+
+  if (content == NULL)
+    return;
+
+  self->priv->content = NULL;
+
+  gtk_container_remove (GTK_CONTAINER (self), content->alig);
+  row_content_recycle (content);
 }
@@ -62,6 +62,10 @@ void empathy_roster_contact_set_event_icon (EmpathyRosterContact *self,
 GdkPixbuf * empathy_roster_contact_get_avatar_pixbuf (
     EmpathyRosterContact *self);
 
+gboolean empathy_roster_contact_is_populated (EmpathyRosterContact *self);
+void empathy_roster_contact_populate (EmpathyRosterContact *self);
+void empathy_roster_contact_depopulate (EmpathyRosterContact *self);
+
 G_END_DECLS
 
 #endif /* #ifndef __EMPATHY_ROSTER_CONTACT_H__*/
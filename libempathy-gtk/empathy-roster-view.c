@@ -6,6 +6,7 @@
 #include "empathy-contact-groups.h"
 #include "empathy-roster-contact.h"
 #include "empathy-roster-group.h"
+#include "empathy-timer-wheel.h"
 #include "empathy-ui-utils.h"
 
 G_DEFINE_TYPE (EmpathyRosterView, empathy_roster_view, GTK_TYPE_LIST_BOX)
@@ -494,8 +495,10 @@ start_flashing (EmpathyRosterView *self)
 
   self->priv->display_flash_event = TRUE;
 
-  self->priv->flash_id = g_timeout_add (FLASH_TIMEOUT,
-      flash_cb, self);
+  /* Use the shared timer wheel so flashing is synchronized with the other
+   * periodic roster updates rather than waking up on its own. */
+  self->priv->flash_id = empathy_timer_wheel_add (
+      empathy_timer_wheel_get_default (), FLASH_TIMEOUT, flash_cb, self);
 }
 
 static void
@@ -504,7 +507,8 @@ stop_flashing (EmpathyRosterView *self)
   if (self->priv->flash_id == 0)
     return;
 
-  g_source_remove (self->priv->flash_id);
+  empathy_timer_wheel_remove (empathy_timer_wheel_get_default (),
+      self->priv->flash_id);
   self->priv->flash_id = 0;
 }
 
@@ -900,12 +904,21 @@ filter_contact (EmpathyRosterView *self,
           /* When searching, always display even if the group is closed */
           if (!is_searching (self) &&
               !gtk_expander_get_expanded (group->expander))
-            displayed = FALSE;
+            {
+              displayed = FALSE;
+
+              /* The group has been collapsed, no need to keep the widgets of
+               * its contacts around. */
+              empathy_roster_contact_depopulate (contact);
+            }
         }
     }
 
   if (displayed)
     {
+      /* Rows are created empty, only create their widgets once they are
+       * actually displayed. */
+      empathy_roster_contact_populate (contact);
       add_to_displayed (self, contact);
     }
   else
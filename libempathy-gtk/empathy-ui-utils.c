@@ -720,33 +720,25 @@ void
 empathy_send_file_from_uri_list (EmpathyContact *contact,
     const gchar *uri_list)
 {
-  const gchar *nl;
-  GFile *file;
+  gchar **uris;
+  guint i;
 
-  /* Only handle a single file for now. It would be wicked cool to be
-     able to do multiple files, offering to zip them or whatever like
-     nautilus-sendto does. Note that text/uri-list is defined to have
-     each line terminated by \r\n, but we can be tolerant of applications
-     that only use \n or don't terminate single-line entries.
-  */
-  nl = strstr (uri_list, "\r\n");
-  if (!nl)
-    nl = strchr (uri_list, '\n');
-
-  if (nl)
-    {
-      gchar *uri = g_strndup (uri_list, nl - uri_list);
-      file = g_file_new_for_uri (uri);
-      g_free (uri);
-    }
-  else
+  /* text/uri-list is defined to have each line terminated by \r\n, but
+   * g_uri_list_extract_uris() is tolerant of applications that only use \n
+   * or don't terminate single-line entries. Every file is handed to the
+   * factory; the transfer manager queues them so they don't all hash and
+   * get offered at once. */
+  uris = g_uri_list_extract_uris (uri_list);
+
+  for (i = 0; uris[i] != NULL; i++)
     {
-      file = g_file_new_for_uri (uri_list);
-    }
+      GFile *file = g_file_new_for_uri (uris[i]);
 
-  empathy_send_file (contact, file);
+      empathy_send_file (contact, file);
+      g_object_unref (file);
+    }
 
-  g_object_unref (file);
+  g_strfreev (uris);
 }
 
 static void
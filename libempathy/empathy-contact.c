@@ -29,6 +29,7 @@
 #endif
 
 #include "empathy-location.h"
+#include "empathy-log-catalog.h"
 #include "empathy-utils.h"
 #include "empathy-enum-types.h"
 
@@ -115,6 +116,23 @@ static guint signals[LAST_SIGNAL];
 
 /* TpContact* -> EmpathyContact*, both borrowed ref */
 static GHashTable *contacts_table = NULL;
+/* owned "account path\nidentifier" -> EmpathyContact*, borrowed ref; the
+ * same contacts as contacts_table */
+static GHashTable *contacts_by_id = NULL;
+
+/* Contacts created from log entities are kept for a few seconds, as the
+ * events of a log day or of a backlog come from the same few senders.
+ * owned key -> owned EmpathyContact */
+static GHashTable *tpl_contacts = NULL;
+
+#define TPL_CONTACTS_TIMEOUT 5
+#define MAX_TPL_CONTACTS 256
+
+typedef struct
+{
+  TpContact *tp_contact;
+  gchar *key;
+} ContactKeys;
 
 static void
 tp_contact_notify_cb (TpContact *tp_contact,
@@ -631,17 +649,36 @@ contact_set_property (GObject *object,
     };
 }
 
+static gchar *
+contact_key (TpAccount *account,
+    const gchar *id)
+{
+  return g_strdup_printf ("%s\n%s", tp_proxy_get_object_path (account), id);
+}
+
 static void
 remove_tp_contact (gpointer data,
     GObject *object)
 {
-  g_hash_table_remove (contacts_table, data);
+  ContactKeys *keys = data;
+
+  g_hash_table_remove (contacts_table, keys->tp_contact);
+
+  /* Don't remove another contact with the same id */
+  if (keys->key != NULL &&
+      g_hash_table_lookup (contacts_by_id, keys->key) == object)
+    g_hash_table_remove (contacts_by_id, keys->key);
+
+  g_free (keys->key);
+  g_slice_free (ContactKeys, keys);
 }
 
 static EmpathyContact *
 empathy_contact_new (TpContact *tp_contact)
 {
   EmpathyContact *retval;
+  TpAccount *account;
+  ContactKeys *keys;
 
   g_return_val_if_fail (TP_IS_CONTACT (tp_contact), NULL);
 
@@ -649,33 +686,19 @@ empathy_contact_new (TpContact *tp_contact)
       "tp-contact", tp_contact,
       NULL);
 
-  g_object_weak_ref (G_OBJECT (retval), remove_tp_contact, tp_contact);
-
-  return retval;
-}
-
-typedef struct
-{
-  TplEntity *entity;
-  TpAccount *account;
-} FindContactData;
-
-static gboolean
-contact_is_tpl_entity (gpointer key,
-    gpointer value,
-    gpointer user_data)
-{
-  EmpathyContact *contact = value;
-  FindContactData *data = user_data;
-  TpAccount *account = empathy_contact_get_account (contact);
-  const gchar *path = NULL;
+  keys = g_slice_new0 (ContactKeys);
+  keys->tp_contact = tp_contact;
 
+  account = tp_connection_get_account (tp_contact_get_connection (tp_contact));
   if (account != NULL)
-    path = tp_proxy_get_object_path (account);
+    {
+      keys->key = contact_key (account, tp_contact_get_identifier (tp_contact));
+      g_hash_table_insert (contacts_by_id, g_strdup (keys->key), retval);
+    }
 
-  return !tp_strdiff (empathy_contact_get_id (contact),
-              tpl_entity_get_identifier (data->entity)) &&
-         !tp_strdiff (tp_proxy_get_object_path (data->account), path);
+  g_object_weak_ref (G_OBJECT (retval), remove_tp_contact, keys);
+
+  return retval;
 }
 
 static void
@@ -711,25 +734,44 @@ out:
   tp_weak_ref_destroy (wr);
 }
 
-EmpathyContact *
-empathy_contact_from_tpl_contact (TpAccount *account,
+static gboolean
+tpl_contacts_timeout_cb (gpointer user_data)
+{
+  tp_clear_pointer (&tpl_contacts, g_hash_table_unref);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gchar *
+tpl_contact_key (TpAccount *account,
+    TplEntity *tpl_entity)
+{
+  const gchar *alias = tpl_entity_get_alias (tpl_entity);
+  const gchar *token = tpl_entity_get_avatar_token (tpl_entity);
+
+  return g_strdup_printf ("%s\n%s\n%u\n%s\n%s",
+      tp_proxy_get_object_path (account),
+      tpl_entity_get_identifier (tpl_entity),
+      tpl_entity_get_entity_type (tpl_entity),
+      alias != NULL ? alias : "",
+      token != NULL ? token : "");
+}
+
+static EmpathyContact *
+contact_from_tpl_contact (TpAccount *account,
     TplEntity *tpl_entity)
 {
   EmpathyContact *retval;
   gboolean is_user;
   EmpathyContact *existing_contact = NULL;
 
-  g_return_val_if_fail (TPL_IS_ENTITY (tpl_entity), NULL);
-
-  if (contacts_table != NULL)
+  if (contacts_by_id != NULL)
     {
-      FindContactData data;
-
-      data.entity = tpl_entity;
-      data.account = account;
+      gchar *key = contact_key (account,
+          tpl_entity_get_identifier (tpl_entity));
 
-      existing_contact = g_hash_table_find (contacts_table,
-        contact_is_tpl_entity, &data);
+      existing_contact = g_hash_table_lookup (contacts_by_id, key);
+      g_free (key);
     }
 
   if (existing_contact != NULL)
@@ -777,6 +819,48 @@ empathy_contact_from_tpl_contact (TpAccount *account,
   return retval;
 }
 
+EmpathyContact *
+empathy_contact_from_tpl_contact (TpAccount *account,
+    TplEntity *tpl_entity)
+{
+  EmpathyContact *retval;
+  gchar *key;
+
+  g_return_val_if_fail (TP_IS_ACCOUNT (account), NULL);
+  g_return_val_if_fail (TPL_IS_ENTITY (tpl_entity), NULL);
+
+  key = tpl_contact_key (account, tpl_entity);
+
+  if (tpl_contacts != NULL)
+    {
+      retval = g_hash_table_lookup (tpl_contacts, key);
+
+      if (retval != NULL)
+        {
+          g_free (key);
+          return g_object_ref (retval);
+        }
+    }
+
+  retval = contact_from_tpl_contact (account, tpl_entity);
+
+  if (tpl_contacts == NULL)
+    {
+      tpl_contacts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+          g_object_unref);
+      g_timeout_add_seconds (TPL_CONTACTS_TIMEOUT, tpl_contacts_timeout_cb,
+          NULL);
+    }
+  else if (g_hash_table_size (tpl_contacts) >= MAX_TPL_CONTACTS)
+    {
+      g_hash_table_remove_all (tpl_contacts);
+    }
+
+  g_hash_table_insert (tpl_contacts, key, g_object_ref (retval));
+
+  return retval;
+}
+
 TpContact *
 empathy_contact_get_tp_contact (EmpathyContact *contact)
 {
@@ -1270,19 +1354,16 @@ empathy_contact_can_use_rfb_stream_tube (EmpathyContact *contact)
 static gboolean
 contact_has_log (EmpathyContact *contact)
 {
-  TplLogManager *manager;
-  TplEntity *entity;
+  EmpathyLogCatalog *catalog;
   gboolean have_log;
 
-  manager = tpl_log_manager_dup_singleton ();
-  entity = tpl_entity_new (empathy_contact_get_id (contact),
-      TPL_ENTITY_CONTACT, NULL, NULL);
+  catalog = empathy_log_catalog_dup_singleton ();
 
-  have_log = tpl_log_manager_exists (manager,
-      empathy_contact_get_account (contact), entity, TPL_EVENT_MASK_TEXT);
+  have_log = empathy_log_catalog_has_logs (catalog,
+      empathy_contact_get_account (contact),
+      empathy_contact_get_id (contact));
 
-  g_object_unref (entity);
-  g_object_unref (manager);
+  g_object_unref (catalog);
 
   return have_log;
 }
@@ -1779,9 +1860,15 @@ empathy_contact_dup_from_tp_contact (TpContact *tp_contact)
   g_return_val_if_fail (TP_IS_CONTACT (tp_contact), NULL);
 
   if (contacts_table == NULL)
-    contacts_table = g_hash_table_new (g_direct_hash, g_direct_equal);
+    {
+      contacts_table = g_hash_table_new (g_direct_hash, g_direct_equal);
+      contacts_by_id = g_hash_table_new_full (g_str_hash, g_str_equal,
+          g_free, NULL);
+    }
   else
-    contact = g_hash_table_lookup (contacts_table, tp_contact);
+    {
+      contact = g_hash_table_lookup (contacts_table, tp_contact);
+    }
 
   if (contact == NULL)
     {
@@ -27,6 +27,14 @@
 
 static EmpathyDebugFlags flags = 0;
 
+/* The flags for which DEBUG() does something: all of them while a debugger
+ * is listening to the debug sender, the ones set by EMPATHY_DEBUG
+ * otherwise */
+EmpathyDebugFlags _empathy_debug_active_flags = 0;
+
+/* Kept to know whether a debugger is listening */
+static TpDebugSender *debug_sender = NULL;
+
 static GDebugKey keys[] = {
   { "Tp", EMPATHY_DEBUG_TP },
   { "Chat", EMPATHY_DEBUG_CHAT },
@@ -46,10 +54,32 @@ static GDebugKey keys[] = {
   { 0, }
 };
 
+static void
+debug_update_active_flags (void)
+{
+  gboolean listening = FALSE;
+
+  if (debug_sender != NULL)
+    g_object_get (debug_sender, "enabled", &listening, NULL);
+
+  g_atomic_int_set ((gint *) &_empathy_debug_active_flags,
+      listening ? ~0 : flags);
+}
+
+static void
+debug_sender_enabled_changed_cb (GObject *sender,
+    GParamSpec *spec,
+    gpointer user_data)
+{
+  debug_update_active_flags ();
+}
+
 static void
 debug_set_flags (EmpathyDebugFlags new_flags)
 {
   flags |= new_flags;
+
+  debug_update_active_flags ();
 }
 
 void
@@ -62,8 +92,17 @@ empathy_debug_set_flags (const gchar *flags_string)
   tp_debug_set_flags (flags_string);
   tpaw_debug_set_flags (flags_string);
 
+  if (debug_sender == NULL)
+    {
+      debug_sender = tp_debug_sender_dup ();
+      g_signal_connect (debug_sender, "notify::enabled",
+          G_CALLBACK (debug_sender_enabled_changed_cb), NULL);
+    }
+
   if (flags_string)
       debug_set_flags (g_parse_debug_string (flags_string, keys, nkeys));
+  else
+      debug_update_active_flags ();
 }
 
 gboolean
@@ -72,37 +111,54 @@ empathy_debug_flag_is_set (EmpathyDebugFlags flag)
   return (flag & flags) != 0;
 }
 
-GHashTable *flag_to_keys = NULL;
+/* "empathy/Chat" etc, interned, indexed by the bit of their flag */
+static const gchar *flag_domains[32];
 
 static const gchar *
-debug_flag_to_key (EmpathyDebugFlags flag)
+debug_flag_to_domain (EmpathyDebugFlags flag)
 {
-  if (flag_to_keys == NULL)
+  static gsize initialized = 0;
+  gint bit;
+
+  if (g_once_init_enter (&initialized))
     {
       guint i;
 
-      flag_to_keys = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-          NULL, g_free);
-
       for (i = 0; keys[i].value; i++)
         {
-          GDebugKey key = (GDebugKey) keys[i];
-          g_hash_table_insert (flag_to_keys, GUINT_TO_POINTER (key.value),
-              g_strdup (key.key));
+          gint bit = g_bit_nth_lsf (keys[i].value, -1);
+          gchar *domain;
+
+          /* Flags sharing a bit keep the domain of the first one */
+          if (flag_domains[bit] != NULL)
+            continue;
+
+          domain = g_strdup_printf ("%s/%s", G_LOG_DOMAIN, keys[i].key);
+          flag_domains[bit] = g_intern_string (domain);
+          g_free (domain);
         }
+
+      g_once_init_leave (&initialized, 1);
     }
 
-  return g_hash_table_lookup (flag_to_keys, GUINT_TO_POINTER (flag));
+  bit = g_bit_nth_lsf (flag, -1);
+  if (bit < 0 || flag_domains[bit] == NULL)
+    return G_LOG_DOMAIN;
+
+  return flag_domains[bit];
 }
 
 void
 empathy_debug_free (void)
 {
-  if (flag_to_keys == NULL)
+  if (debug_sender == NULL)
     return;
 
-  g_hash_table_unref (flag_to_keys);
-  flag_to_keys = NULL;
+  g_signal_handlers_disconnect_by_func (debug_sender,
+      debug_sender_enabled_changed_cb, NULL);
+  g_clear_object (&debug_sender);
+
+  debug_update_active_flags ();
 }
 
 static void
@@ -110,18 +166,15 @@ log_to_debug_sender (EmpathyDebugFlags flag,
     const gchar *message)
 {
   TpDebugSender *sender;
-  gchar *domain;
   GTimeVal now;
 
   sender = tp_debug_sender_dup ();
 
   g_get_current_time (&now);
 
-  domain = g_strdup_printf ("%s/%s", G_LOG_DOMAIN, debug_flag_to_key (flag));
-
-  tp_debug_sender_add_message (sender, &now, domain, G_LOG_LEVEL_DEBUG, message);
+  tp_debug_sender_add_message (sender, &now, debug_flag_to_domain (flag),
+      G_LOG_LEVEL_DEBUG, message);
 
-  g_free (domain);
   g_object_unref (sender);
 }
 
@@ -133,6 +186,11 @@ empathy_debug (EmpathyDebugFlags flag,
   gchar *message;
   va_list args;
 
+  /* DEBUG() already checked it, but empathy_debug() can be called
+   * directly */
+  if (!_EMPATHY_DEBUG_IS_ACTIVE (flag))
+    return;
+
   va_start (args, format);
   message = g_strdup_vprintf (format, args);
   va_end (args);
@@ -147,6 +205,8 @@ empathy_debug (EmpathyDebugFlags flag,
 
 #else
 
+EmpathyDebugFlags _empathy_debug_active_flags = 0;
+
 gboolean
 empathy_debug_flag_is_set (EmpathyDebugFlags flag)
 {
@@ -163,5 +223,10 @@ empathy_debug_set_flags (const gchar *flags_string)
 {
 }
 
+void
+empathy_debug_free (void)
+{
+}
+
 #endif /* ENABLE_DEBUG */
 
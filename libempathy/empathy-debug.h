@@ -47,6 +47,13 @@ typedef enum
   EMPATHY_DEBUG_CAMERA = 1 << 15,
 } EmpathyDebugFlags;
 
+/* Private: checked by DEBUG() before formatting anything */
+extern EmpathyDebugFlags _empathy_debug_active_flags;
+
+#define _EMPATHY_DEBUG_IS_ACTIVE(flag) \
+  G_UNLIKELY ((g_atomic_int_get ((gint *) &_empathy_debug_active_flags) & \
+      (flag)) != 0)
+
 gboolean empathy_debug_flag_is_set (EmpathyDebugFlags flag);
 void empathy_debug (EmpathyDebugFlags flag, const gchar *format, ...)
     G_GNUC_PRINTF (2, 3);
@@ -79,7 +86,10 @@ G_END_DECLS
 
 #undef DEBUG
 #define DEBUG(format, ...) \
-  empathy_debug (DEBUG_FLAG, "%s: " format, G_STRFUNC, ##__VA_ARGS__)
+  G_STMT_START { \
+    if (_EMPATHY_DEBUG_IS_ACTIVE (DEBUG_FLAG)) \
+      empathy_debug (DEBUG_FLAG, "%s: " format, G_STRFUNC, ##__VA_ARGS__); \
+  } G_STMT_END
 
 #undef DEBUGGING
 #define DEBUGGING empathy_debug_flag_is_set (DEBUG_FLAG)
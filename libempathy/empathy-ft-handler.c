@@ -25,10 +25,10 @@
 #include "empathy-ft-handler.h"
 
 #include <glib/gi18n-lib.h>
-#include <tp-account-widgets/tpaw-time.h>
 #include <tp-account-widgets/tpaw-utils.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
+#include "empathy-ft-hash.h"
 #include "empathy-utils.h"
 
 #define DEBUG_FLAG EMPATHY_DEBUG_FT
@@ -71,7 +71,29 @@ G_DEFINE_TYPE (EmpathyFTHandler, empathy_ft_handler, G_TYPE_OBJECT)
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyFTHandler)
 
-#define BUFFER_SIZE 4096
+/* how much of an incoming file is hashed at once while receiving it */
+#define INCOMING_HASH_STEP (4 * 1024 * 1024)
+
+/* The speed is sampled at most this often (in microseconds) and smoothed
+ * over about this many seconds, so the remaining time doesn't jump around
+ * with the bursts of the connection */
+#define SPEED_SAMPLE_INTERVAL (250 * 1000)
+#define SPEED_TIME_CONSTANT 3.0
+
+/* Incoming transfers which broke before the end are recorded in this key
+ * file, in a group named after the URI of their destination, so they can
+ * be resumed if the same file is received there again */
+#define RESUME_RECORDS_FILENAME "ft-resume"
+
+/* What a new incoming transfer has received is recorded at most this
+ * often (in microseconds) while it runs, so it can still be resumed if
+ * Empathy doesn't get to record it when the transfer breaks */
+#define RESUME_RECORD_INTERVAL (10 * G_USEC_PER_SEC)
+
+/* telepathy-glib writes an accepted file from its start whatever the
+ * offset, so a resumed transfer is received next to its destination with
+ * this suffix and appended to it afterwards */
+#define RESUME_PART_SUFFIX ".part"
 
 enum {
   PROP_CHANNEL = 1,
@@ -99,10 +121,7 @@ enum {
 
 typedef struct {
   GInputStream *stream;
-  GError *error /* comment to make the style checker happy */;
-  guchar *buffer;
   GChecksum *checksum;
-  gssize total_read;
   guint64 total_bytes;
   EmpathyFTHandler *handler;
 } HashingData;
@@ -118,6 +137,8 @@ typedef struct {
   gboolean dispose_run;
 
   GFile *gfile;
+  /* the info of an outgoing file when it started being sent */
+  GFileInfo *gfile_info;
   TpFileTransferChannel *channel;
   GCancellable *cancellable;
   gboolean use_hash;
@@ -136,20 +157,79 @@ typedef struct {
   gchar *content_hash;
   TpFileHashType content_hash_type;
 
+  /* incoming files are hashed while they are being received */
+  GInputStream *incoming_stream;
+  GChecksum *incoming_checksum;
+  guint64 incoming_hashed_bytes;
+  gboolean incoming_hashing;
+  /* bytes asked to the step being hashed */
+  guint64 incoming_step_bytes;
+  /* the transfer is complete, hash until the end of the file */
+  gboolean incoming_verify;
+  gboolean incoming_hashing_to_end;
+
   gint64 user_action_time;
 
-  /* time and speed */
+  /* time and speed, the speed is in bytes per second and negative until
+   * it can be estimated */
   gdouble speed;
   guint remaining_time;
-  gint64 last_update_time;
+  gint64 last_sample_time;
+  guint64 last_sample_bytes;
+
+  /* where the data starts in the file, when resuming a transfer;
+   * transferred_bytes includes it */
+  guint64 initial_offset;
+  gboolean transfer_started;
+  /* where an incoming transfer being resumed is received */
+  GFile *resume_part;
+  /* the MD5 of what has been received so far, for the resume record */
+  GInputStream *resume_stream;
+  GChecksum *resume_checksum;
+  guint64 resume_hashed_bytes;
+  gint64 resume_recorded_time;
+  gboolean resume_hashing;
 
   gboolean is_completed;
 } EmpathyFTHandlerPriv;
 
+typedef struct {
+  EmpathyFTHandler *handler;
+  GInputStream *stream;
+  GChecksum *checksum;
+  guint64 received;
+  gchar *md5;
+} ResumeData;
+
+typedef struct {
+  GFile *part;
+  GFile *file;
+  guint64 offset;
+} ResumeMergeData;
+
+typedef struct {
+  GFile *file;
+  guint64 size;
+} ResumeTruncateData;
+
+typedef struct {
+  GFile *file;
+  GInputStream *stream;
+  GChecksum *checksum;
+  gchar *contact;
+  gchar *filename;
+  guint64 size;
+  gchar *content_hash;
+} ResumeRecordData;
+
 static guint signals[LAST_SIGNAL] = { 0 };
 
-static gboolean do_hash_job_incoming (GIOSchedulerJob *job,
-    GCancellable *cancellable, gpointer user_data);
+static void check_hash_incoming (EmpathyFTHandler *handler);
+static void incoming_hash_next (EmpathyFTHandler *handler);
+static void resume_record_store (EmpathyFTHandler *handler);
+static void resume_record_forget (EmpathyFTHandler *handler);
+static void resume_record_progress (EmpathyFTHandler *handler);
+static void resume_record_progress_stop (EmpathyFTHandler *handler);
 
 /* GObject implementations */
 static void
@@ -262,6 +342,11 @@ do_dispose (GObject *object)
     priv->gfile = NULL;
   }
 
+  g_clear_object (&priv->gfile_info);
+  g_clear_object (&priv->incoming_stream);
+  g_clear_object (&priv->resume_part);
+  g_clear_object (&priv->resume_stream);
+
   if (priv->channel != NULL) {
     tp_channel_close_async (TP_CHANNEL (priv->channel), NULL, NULL);
     g_object_unref (priv->channel);
@@ -297,6 +382,12 @@ do_finalize (GObject *object)
   g_free (priv->content_hash);
   priv->content_hash = NULL;
 
+  if (priv->incoming_checksum != NULL)
+    g_checksum_free (priv->incoming_checksum);
+
+  if (priv->resume_checksum != NULL)
+    g_checksum_free (priv->resume_checksum);
+
   G_OBJECT_CLASS (empathy_ft_handler_parent_class)->finalize (object);
 }
 
@@ -477,7 +568,8 @@ empathy_ft_handler_class_init (EmpathyFTHandlerClass *klass)
    * @total_bytes: the total bytes of the handler
    * @remaining_time: the number of seconds remaining for the transfer
    * to be completed
-   * @speed: the current speed of the transfer (in KB/s)
+   * @speed: the current speed of the transfer (in bytes per second), see
+   * empathy_ft_handler_get_speed()
    *
    * This signal is emitted to notify clients of the progress of the
    * transfer.
@@ -544,6 +636,7 @@ empathy_ft_handler_init (EmpathyFTHandler *self)
 
   self->priv = priv;
   priv->cancellable = g_cancellable_new ();
+  priv->speed = -1;
 }
 
 /* private functions */
@@ -551,17 +644,12 @@ empathy_ft_handler_init (EmpathyFTHandler *self)
 static void
 hash_data_free (HashingData *data)
 {
-  g_free (data->buffer);
-
   if (data->stream != NULL)
     g_object_unref (data->stream);
 
   if (data->checksum != NULL)
     g_checksum_free (data->checksum);
 
-  if (data->error != NULL)
-    g_error_free (data->error);
-
   if (data->handler != NULL)
     g_object_unref (data->handler);
 
@@ -593,27 +681,6 @@ tp_file_hash_to_g_checksum (TpFileHashType type)
   return retval;
 }
 
-static void
-check_hash_incoming (EmpathyFTHandler *handler)
-{
-  HashingData *hash_data;
-  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
-
-  if (!TPAW_STR_EMPTY (priv->content_hash))
-    {
-      hash_data = g_slice_new0 (HashingData);
-      hash_data->total_bytes = priv->total_bytes;
-      hash_data->handler = g_object_ref (handler);
-      hash_data->checksum = g_checksum_new
-        (tp_file_hash_to_g_checksum (priv->content_hash_type));
-
-      g_signal_emit (handler, signals[HASHING_STARTED], 0);
-
-      g_io_scheduler_push_job (do_hash_job_incoming, hash_data, NULL,
-                               G_PRIORITY_DEFAULT, priv->cancellable);
-    }
-}
-
 static void
 emit_error_signal (EmpathyFTHandler *handler,
     const GError *error)
@@ -628,31 +695,43 @@ emit_error_signal (EmpathyFTHandler *handler,
   g_signal_emit (handler, signals[TRANSFER_ERROR], 0, error);
 }
 
+/* Exponentially weighted moving average of the speed, with the weight of
+ * each sample depending on the time it covers as the CM reports progress
+ * at irregular intervals */
 static void
 update_remaining_time_and_speed (EmpathyFTHandler *handler,
     guint64 transferred_bytes)
 {
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
-  gint64 elapsed_time, current_time;
-  guint64 transferred, last_transferred_bytes;
-  gdouble speed;
-  gint remaining_time;
+  gint64 current_time;
+  gdouble elapsed, sample, weight;
 
-  last_transferred_bytes = priv->transferred_bytes;
   priv->transferred_bytes = transferred_bytes;
 
-  current_time = tpaw_time_get_current ();
-  elapsed_time = current_time - priv->last_update_time;
+  current_time = g_get_monotonic_time ();
+  if (current_time - priv->last_sample_time < SPEED_SAMPLE_INTERVAL)
+    return;
+
+  elapsed = (gdouble) (current_time - priv->last_sample_time) /
+    G_USEC_PER_SEC;
+  sample = (gdouble) (transferred_bytes - priv->last_sample_bytes) / elapsed;
 
-  if (elapsed_time >= 1)
+  if (priv->speed < 0)
     {
-      transferred = transferred_bytes - last_transferred_bytes;
-      speed = (gdouble) transferred / (gdouble) elapsed_time;
-      remaining_time = (priv->total_bytes - priv->transferred_bytes) / speed;
-      priv->speed = speed;
-      priv->remaining_time = remaining_time;
-      priv->last_update_time = current_time;
+      priv->speed = sample;
     }
+  else
+    {
+      weight = elapsed / (elapsed + SPEED_TIME_CONSTANT);
+      priv->speed += weight * (sample - priv->speed);
+    }
+
+  if (priv->speed > 0)
+    priv->remaining_time = (priv->total_bytes - transferred_bytes) /
+      priv->speed;
+
+  priv->last_sample_time = current_time;
+  priv->last_sample_bytes = transferred_bytes;
 }
 
 static void
@@ -666,14 +745,29 @@ ft_transfer_transferred_bytes_cb (TpFileTransferChannel *channel,
   if (empathy_ft_handler_is_cancelled (handler))
     return;
 
-  bytes = tp_file_transfer_channel_get_transferred_bytes (channel);
-
-  if (priv->transferred_bytes == 0)
+  if (!priv->transfer_started)
     {
-      priv->last_update_time = tpaw_time_get_current ();
+      /* The offset agreed with the peer, which may not have accepted to
+       * resume an incoming transfer or asked to resume an outgoing one. */
+      g_object_get (channel, "initial-offset", &priv->initial_offset, NULL);
+
+      if (priv->initial_offset > 0)
+        DEBUG ("Resuming transfer at byte %" G_GUINT64_FORMAT,
+            priv->initial_offset);
+
+      priv->transfer_started = TRUE;
+      priv->transferred_bytes = priv->initial_offset;
+      priv->last_sample_bytes = priv->initial_offset;
+      priv->last_sample_time = g_get_monotonic_time ();
+      priv->resume_recorded_time = priv->last_sample_time;
       g_signal_emit (handler, signals[TRANSFER_STARTED], 0, channel);
     }
 
+  /* the channel counts the bytes transferred since the initial offset */
+  bytes = MIN (priv->initial_offset +
+      tp_file_transfer_channel_get_transferred_bytes (channel),
+      priv->total_bytes);
+
   if (priv->transferred_bytes != bytes)
     {
       update_remaining_time_and_speed (handler, bytes);
@@ -681,6 +775,15 @@ ft_transfer_transferred_bytes_cb (TpFileTransferChannel *channel,
       g_signal_emit (handler, signals[TRANSFER_PROGRESS], 0,
           bytes, priv->total_bytes, priv->remaining_time,
           priv->speed);
+
+      /* the destination of a resumed transfer is only complete once the
+       * part received has been appended, it's hashed at once then */
+      if (empathy_ft_handler_is_incoming (handler) && priv->use_hash &&
+          !TPAW_STR_EMPTY (priv->content_hash) && priv->resume_part == NULL)
+        incoming_hash_next (handler);
+
+      if (empathy_ft_handler_is_incoming (handler))
+        resume_record_progress (handler);
     }
 }
 
@@ -755,6 +858,151 @@ error_from_state_change_reason (TpFileTransferStateChangeReason reason)
   return retval;
 }
 
+static void
+resume_merge_data_free (ResumeMergeData *data)
+{
+  g_object_unref (data->part);
+  g_object_unref (data->file);
+  g_slice_free (ResumeMergeData, data);
+}
+
+static void
+resume_merge_thread (GSimpleAsyncResult *simple,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  ResumeMergeData *data = g_simple_async_result_get_op_res_gpointer (simple);
+  GFileInputStream *input = NULL;
+  GFileOutputStream *output = NULL;
+  GError *error = NULL;
+
+  /* the peer didn't agree to resume, the part is the file from its start */
+  if (data->offset == 0)
+    {
+      if (!g_file_move (data->part, data->file, G_FILE_COPY_OVERWRITE, NULL,
+              NULL, NULL, &error))
+        g_simple_async_result_take_error (simple, error);
+
+      return;
+    }
+
+  input = g_file_read (data->part, NULL, &error);
+  if (input == NULL)
+    goto out;
+
+  output = g_file_append_to (data->file, G_FILE_CREATE_NONE, NULL, &error);
+  if (output == NULL)
+    goto out;
+
+  if (g_output_stream_splice (G_OUTPUT_STREAM (output),
+          G_INPUT_STREAM (input), G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+          G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET, NULL, &error) < 0)
+    goto out;
+
+  g_file_delete (data->part, NULL, &error);
+
+out:
+  if (error != NULL)
+    g_simple_async_result_take_error (simple, error);
+
+  g_clear_object (&input);
+  g_clear_object (&output);
+}
+
+/* Appends what a resumed transfer received to the start of the file which
+ * was already there. This doesn't use the cancellable of the handler, as
+ * it's also done once the transfer has been cancelled. */
+static void
+resume_merge_async (EmpathyFTHandler *handler,
+    GAsyncReadyCallback callback)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GSimpleAsyncResult *simple;
+  ResumeMergeData *data;
+
+  data = g_slice_new0 (ResumeMergeData);
+  data->part = g_object_ref (priv->resume_part);
+  data->file = g_object_ref (priv->gfile);
+  g_object_get (priv->channel, "initial-offset", &data->offset, NULL);
+
+  DEBUG ("Appending the data received from byte %" G_GUINT64_FORMAT,
+      data->offset);
+
+  simple = g_simple_async_result_new (G_OBJECT (handler), callback, NULL,
+      resume_merge_async);
+  g_simple_async_result_set_op_res_gpointer (simple, data,
+      (GDestroyNotify) resume_merge_data_free);
+  g_simple_async_result_run_in_thread (simple, resume_merge_thread,
+      G_PRIORITY_DEFAULT, NULL);
+  g_object_unref (simple);
+}
+
+static gboolean
+resume_merge_finish (EmpathyFTHandler *handler,
+    GAsyncResult *result,
+    GError **error)
+{
+  return !g_simple_async_result_propagate_error (
+      G_SIMPLE_ASYNC_RESULT (result), error);
+}
+
+static void
+ft_transfer_completed (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  priv->is_completed = TRUE;
+
+  if (empathy_ft_handler_is_incoming (handler))
+    {
+      resume_record_progress_stop (handler);
+      resume_record_forget (handler);
+    }
+
+  g_signal_emit (handler, signals[TRANSFER_DONE], 0, priv->channel);
+
+  if (empathy_ft_handler_is_incoming (handler) && priv->use_hash)
+    {
+      check_hash_incoming (handler);
+    }
+}
+
+static void
+ft_transfer_completed_merge_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyFTHandler *handler = EMPATHY_FT_HANDLER (source);
+  GError *error = NULL;
+
+  if (!resume_merge_finish (handler, result, &error))
+    {
+      DEBUG ("Failed to append the data received: %s", error->message);
+      emit_error_signal (handler, error);
+      g_error_free (error);
+      return;
+    }
+
+  ft_transfer_completed (handler);
+}
+
+static void
+ft_transfer_cancelled_merge_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyFTHandler *handler = EMPATHY_FT_HANDLER (source);
+  GError *error = NULL;
+
+  if (!resume_merge_finish (handler, result, &error))
+    {
+      DEBUG ("Failed to append the data received: %s", error->message);
+      g_error_free (error);
+    }
+
+  resume_record_store (handler);
+}
+
 static void
 ft_transfer_state_cb (TpFileTransferChannel *channel,
     GParamSpec *pspec,
@@ -767,19 +1015,32 @@ ft_transfer_state_cb (TpFileTransferChannel *channel,
 
   if (state == TP_FILE_TRANSFER_STATE_COMPLETED)
     {
-      priv->is_completed = TRUE;
-      g_signal_emit (handler, signals[TRANSFER_DONE], 0, channel);
-
       tp_channel_close_async (TP_CHANNEL (channel), NULL, NULL);
 
-      if (empathy_ft_handler_is_incoming (handler) && priv->use_hash)
-        {
-          check_hash_incoming (handler);
-        }
+      if (priv->resume_part != NULL)
+        resume_merge_async (handler, ft_transfer_completed_merge_cb);
+      else
+        ft_transfer_completed (handler);
     }
   else if (state == TP_FILE_TRANSFER_STATE_CANCELLED)
     {
       GError *error = error_from_state_change_reason (reason);
+
+      resume_record_progress_stop (handler);
+
+      /* keep what has been received to be able to resume later */
+      if (empathy_ft_handler_is_incoming (handler) && priv->transfer_started)
+        {
+          if (priv->resume_part != NULL)
+            resume_merge_async (handler, ft_transfer_cancelled_merge_cb);
+          else
+            resume_record_store (handler);
+        }
+      else if (priv->resume_part != NULL)
+        {
+          g_file_delete (priv->resume_part, NULL, NULL);
+        }
+
       emit_error_signal (handler, error);
       g_clear_error (&error);
     }
@@ -860,35 +1121,26 @@ ft_handler_populate_outgoing_request (EmpathyFTHandler *handler)
   g_free (uri);
 }
 
-static gboolean
-hash_job_done (gpointer user_data)
+static void
+ft_handler_hashing_done (EmpathyFTHandler *handler,
+    GChecksum *checksum,
+    GError *error)
 {
-  HashingData *hash_data = user_data;
-  EmpathyFTHandler *handler = hash_data->handler;
-  EmpathyFTHandlerPriv *priv;
-  GError *error = NULL;
-
-  DEBUG ("Closing stream after hashing.");
-
-  priv = GET_PRIV (handler);
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
 
-  if (hash_data->error != NULL)
-    {
-      error = hash_data->error;
-      hash_data->error = NULL;
-      goto cleanup;
-    }
+  if (error != NULL)
+    goto cleanup;
 
-  DEBUG ("Got file hash %s", g_checksum_get_string (hash_data->checksum));
+  DEBUG ("Got file hash %s", g_checksum_get_string (checksum));
 
   if (empathy_ft_handler_is_incoming (handler))
     {
-      if (g_strcmp0 (g_checksum_get_string (hash_data->checksum),
+      if (g_strcmp0 (g_checksum_get_string (checksum),
                      priv->content_hash))
         {
           DEBUG ("Hash mismatch when checking incoming handler: "
                  "received %s, calculated %s", priv->content_hash,
-                 g_checksum_get_string (hash_data->checksum));
+                 g_checksum_get_string (checksum));
 
           error = g_error_new_literal (EMPATHY_FT_ERROR_QUARK,
               EMPATHY_FT_ERROR_HASH_MISMATCH,
@@ -899,7 +1151,7 @@ hash_job_done (gpointer user_data)
         {
           DEBUG ("Hash verification matched, received %s, calculated %s",
                  priv->content_hash,
-                 g_checksum_get_string (hash_data->checksum));
+                 g_checksum_get_string (checksum));
         }
     }
   else
@@ -908,7 +1160,10 @@ hash_job_done (gpointer user_data)
        * org.freedesktop.Telepathy.Channel.Type.FileTransfer.ContentHash
        */
       tp_account_channel_request_set_file_transfer_hash (priv->request,
-          TP_FILE_HASH_TYPE_MD5, g_checksum_get_string (hash_data->checksum));
+          TP_FILE_HASH_TYPE_MD5, g_checksum_get_string (checksum));
+
+      empathy_ft_hash_cache_store (priv->gfile, priv->gfile_info,
+          G_CHECKSUM_MD5, g_checksum_get_string (checksum));
     }
 
 cleanup:
@@ -926,155 +1181,955 @@ cleanup:
         /* the request is complete now, push it to the dispatcher */
         ft_handler_push_to_dispatcher (handler);
     }
+}
 
-  hash_data_free (hash_data);
+static void
+hash_job_done (HashingData *hash_data,
+    GError *error)
+{
+  DEBUG ("Closing stream after hashing.");
+
+  if (hash_data->stream != NULL)
+    g_input_stream_close (hash_data->stream, NULL, NULL);
+
+  ft_handler_hashing_done (hash_data->handler, hash_data->checksum, error);
 
-  return FALSE;
+  hash_data_free (hash_data);
 }
 
-static gboolean
-emit_hashing_progress (gpointer user_data)
+static void
+hashing_progress_cb (guint64 hashed_bytes,
+    gpointer user_data)
 {
   HashingData *hash_data = user_data;
 
   g_signal_emit (hash_data->handler, signals[HASHING_PROGRESS], 0,
-      (guint64) hash_data->total_read, (guint64) hash_data->total_bytes);
-
-  return FALSE;
+      hashed_bytes, hash_data->total_bytes);
 }
 
-static gboolean
-do_hash_job (GIOSchedulerJob *job,
-    GCancellable *cancellable,
+static void
+ft_handler_hash_cb (GObject *source,
+    GAsyncResult *result,
     gpointer user_data)
 {
   HashingData *hash_data = user_data;
-  gssize bytes_read;
+  guint64 hashed_bytes;
   GError *error = NULL;
 
-again:
-  if (hash_data->buffer == NULL)
-    hash_data->buffer = g_malloc0 (BUFFER_SIZE);
+  if (empathy_ft_hash_finish (result, &hashed_bytes, &error))
+    {
+      /* Progress is throttled, make sure the last one is reported */
+      hashing_progress_cb (hashed_bytes, hash_data);
+    }
 
-  bytes_read = g_input_stream_read (hash_data->stream, hash_data->buffer,
-                                    BUFFER_SIZE, cancellable, &error);
-  if (error != NULL)
-    goto out;
+  hash_job_done (hash_data, error);
+}
 
-  hash_data->total_read += bytes_read;
+static void
+ft_handler_start_hashing (HashingData *hash_data)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (hash_data->handler);
 
-  /* we now have the chunk */
-  if (bytes_read > 0)
-    {
-      g_checksum_update (hash_data->checksum, hash_data->buffer, bytes_read);
-      g_io_scheduler_job_send_to_mainloop_async (job, emit_hashing_progress,
-          hash_data, NULL);
+  empathy_ft_hash_async (hash_data->stream, hash_data->checksum,
+      G_MAXUINT64, priv->cancellable, hashing_progress_cb,
+      ft_handler_hash_cb, hash_data);
+}
 
-      g_free (hash_data->buffer);
-      hash_data->buffer = NULL;
+static void
+incoming_hash_progress_cb (guint64 hashed_bytes,
+    gpointer user_data)
+{
+  EmpathyFTHandler *handler = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
 
-      goto again;
-    }
-  else
-  {
-    g_input_stream_close (hash_data->stream, cancellable, &error);
-  }
+  g_signal_emit (handler, signals[HASHING_PROGRESS], 0,
+      priv->incoming_hashed_bytes + hashed_bytes, priv->total_bytes);
+}
 
-out:
-  if (error != NULL)
-    hash_data->error = error;
+/* Starts again from the beginning of the file once it has been received */
+static void
+incoming_hash_reset (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
 
-  g_io_scheduler_job_send_to_mainloop_async (job, hash_job_done,
-      hash_data, NULL);
+  if (priv->incoming_stream != NULL)
+    g_input_stream_close (priv->incoming_stream, NULL, NULL);
 
-  return FALSE;
+  g_clear_object (&priv->incoming_stream);
+  g_checksum_reset (priv->incoming_checksum);
+  priv->incoming_hashed_bytes = 0;
 }
 
-static gboolean
-do_hash_job_incoming (GIOSchedulerJob *job,
-    GCancellable *cancellable,
-    gpointer user_data)
+static void
+incoming_hash_failed (EmpathyFTHandler *handler,
+    GError *error)
 {
-  HashingData *hash_data = user_data;
-  EmpathyFTHandler *handler = hash_data->handler;
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
-  GError *error = NULL;
 
-  DEBUG ("checking integrity for incoming handler");
-
-  /* need to get the stream first */
-  hash_data->stream =
-    G_INPUT_STREAM (g_file_read (priv->gfile, cancellable, &error));
+  if (priv->incoming_verify)
+    {
+      ft_handler_hashing_done (handler, priv->incoming_checksum, error);
+      return;
+    }
 
-  if (error != NULL)
+  if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
     {
-      hash_data->error = error;
-      g_io_scheduler_job_send_to_mainloop_async (job, hash_job_done,
-          hash_data, NULL);
-      return FALSE;
+      DEBUG ("Failed to hash the file while receiving it: %s",
+          error->message);
+      incoming_hash_reset (handler);
     }
 
-  return do_hash_job (job, cancellable, user_data);
+  g_error_free (error);
 }
 
 static void
-ft_handler_read_async_cb (GObject *source,
-    GAsyncResult *res,
+incoming_hash_cb (GObject *source,
+    GAsyncResult *result,
     gpointer user_data)
 {
-  GFileInputStream *stream;
-  GError *error = NULL;
-  HashingData *hash_data;
   EmpathyFTHandler *handler = user_data;
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  guint64 hashed_bytes;
+  GError *error = NULL;
 
-  DEBUG ("GFile read async CB.");
+  priv->incoming_hashing = FALSE;
 
-  stream = g_file_read_finish (priv->gfile, res, &error);
-  if (error != NULL)
+  if (!empathy_ft_hash_finish (result, &hashed_bytes, &error))
     {
-      emit_error_signal (handler, error);
-      g_clear_error (&error);
+      incoming_hash_failed (handler, error);
+      goto out;
+    }
 
-      return;
+  priv->incoming_hashed_bytes += hashed_bytes;
+
+  if (priv->incoming_hashing_to_end)
+    {
+      DEBUG ("Closing stream after hashing.");
+
+      g_signal_emit (handler, signals[HASHING_PROGRESS], 0,
+          priv->incoming_hashed_bytes, priv->total_bytes);
+
+      g_input_stream_close (priv->incoming_stream, NULL, NULL);
+      g_clear_object (&priv->incoming_stream);
+
+      ft_handler_hashing_done (handler, priv->incoming_checksum, NULL);
+      goto out;
     }
 
-  hash_data = g_slice_new0 (HashingData);
-  hash_data->stream = G_INPUT_STREAM (stream);
-  hash_data->total_bytes = priv->total_bytes;
-  hash_data->handler = g_object_ref (handler);
-  /* FIXME: MD5 is the only ContentHashType supported right now */
-  hash_data->checksum = g_checksum_new (G_CHECKSUM_MD5);
+  /* The file on disk can lag behind the bytes the CM reports as
+   * transferred: rather than reading the end of the file again and again
+   * until it catches up, wait for the next progress notification. */
+  if (hashed_bytes < priv->incoming_step_bytes && !priv->incoming_verify)
+    goto out;
 
-  g_signal_emit (handler, signals[HASHING_STARTED], 0);
+  /* more may have been received in the meantime */
+  incoming_hash_next (handler);
 
-  g_io_scheduler_push_job (do_hash_job, hash_data, NULL,
-      G_PRIORITY_DEFAULT, priv->cancellable);
+out:
+  g_object_unref (handler);
 }
 
 static void
-callbacks_data_free (gpointer user_data)
+incoming_read_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
 {
-  CallbacksData *data = user_data;
+  EmpathyFTHandler *handler = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GFileInputStream *stream;
+  GError *error = NULL;
 
-  if (data->handler != NULL)
-    g_object_unref (data->handler);
+  priv->incoming_hashing = FALSE;
 
-  g_slice_free (CallbacksData, data);
+  stream = g_file_read_finish (G_FILE (source), res, &error);
+  if (stream == NULL)
+    {
+      incoming_hash_failed (handler, error);
+    }
+  else
+    {
+      priv->incoming_stream = G_INPUT_STREAM (stream);
+      incoming_hash_next (handler);
+    }
+
+  g_object_unref (handler);
 }
 
-static gboolean
-set_content_hash_type_from_classes (EmpathyFTHandler *handler,
-    GPtrArray *classes)
+/* Hashes what has been received since the last time, in big enough
+ * steps, or all the rest once the transfer is complete */
+static void
+incoming_hash_next (EmpathyFTHandler *handler)
 {
-  GArray *possible_values;
-  guint value;
-  gboolean valid;
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
-  gboolean support_ft = FALSE;
-  guint i;
+  guint64 max_bytes;
 
-  possible_values = g_array_new (TRUE, TRUE, sizeof (guint));
+  if (priv->incoming_hashing ||
+      g_cancellable_is_cancelled (priv->cancellable))
+    return;
+
+  if (priv->incoming_checksum == NULL)
+    priv->incoming_checksum = g_checksum_new (
+        tp_file_hash_to_g_checksum (priv->content_hash_type));
+
+  if (priv->incoming_stream == NULL)
+    {
+      if (!priv->incoming_verify &&
+          priv->transferred_bytes < INCOMING_HASH_STEP)
+        return;
+
+      priv->incoming_hashing = TRUE;
+      g_file_read_async (priv->gfile, G_PRIORITY_DEFAULT, priv->cancellable,
+          incoming_read_cb, g_object_ref (handler));
+      return;
+    }
+
+  if (priv->incoming_verify)
+    {
+      max_bytes = G_MAXUINT64;
+    }
+  else
+    {
+      if (priv->transferred_bytes <
+          priv->incoming_hashed_bytes + INCOMING_HASH_STEP)
+        return;
+
+      max_bytes = priv->transferred_bytes - priv->incoming_hashed_bytes;
+    }
+
+  priv->incoming_hashing = TRUE;
+  priv->incoming_hashing_to_end = priv->incoming_verify;
+  priv->incoming_step_bytes = max_bytes;
+
+  /* the progress is only shown once the transfer is complete */
+  empathy_ft_hash_async (priv->incoming_stream, priv->incoming_checksum,
+      max_bytes, priv->cancellable,
+      priv->incoming_verify ? incoming_hash_progress_cb : NULL,
+      incoming_hash_cb, g_object_ref (handler));
+}
+
+static void
+check_hash_incoming (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  if (TPAW_STR_EMPTY (priv->content_hash))
+    return;
+
+  g_signal_emit (handler, signals[HASHING_STARTED], 0);
+
+  DEBUG ("checking integrity for incoming handler, %" G_GUINT64_FORMAT
+      " bytes already hashed", priv->incoming_hashed_bytes);
+
+  /* if a step is being hashed, the rest will be once it's done */
+  priv->incoming_verify = TRUE;
+  incoming_hash_next (handler);
+}
+
+static gchar *
+resume_records_get_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), PACKAGE_NAME,
+      RESUME_RECORDS_FILENAME, NULL);
+}
+
+static GKeyFile *
+resume_records_load (void)
+{
+  GKeyFile *records;
+  gchar *path;
+
+  records = g_key_file_new ();
+  path = resume_records_get_path ();
+
+  /* a missing file just means there is nothing to resume */
+  g_key_file_load_from_file (records, path, G_KEY_FILE_NONE, NULL);
+
+  g_free (path);
+  return records;
+}
+
+static void
+resume_records_save (GKeyFile *records)
+{
+  gchar *path, *dir, *data;
+  gsize length;
+  GError *error = NULL;
+
+  path = resume_records_get_path ();
+  dir = g_path_get_dirname (path);
+  g_mkdir_with_parents (dir, 0700);
+
+  data = g_key_file_to_data (records, &length, NULL);
+
+  if (!g_file_set_contents (path, data, length, &error))
+    {
+      DEBUG ("Failed to save the transfers to resume: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_free (data);
+  g_free (dir);
+  g_free (path);
+}
+
+/* Identifies the sender of a file, to not resume it with another one */
+static gchar *
+resume_contact_key (EmpathyContact *contact)
+{
+  return g_strdup_printf ("%s %s",
+      tp_proxy_get_object_path (empathy_contact_get_account (contact)),
+      empathy_contact_get_id (contact));
+}
+
+static void
+resume_record_data_free (ResumeRecordData *data)
+{
+  if (data->stream != NULL)
+    g_input_stream_close (data->stream, NULL, NULL);
+
+  g_clear_object (&data->stream);
+  g_object_unref (data->file);
+  g_checksum_free (data->checksum);
+  g_free (data->contact);
+  g_free (data->filename);
+  g_free (data->content_hash);
+  g_slice_free (ResumeRecordData, data);
+}
+
+/* Records that the first @received bytes of @file, with this @md5, can be
+ * resumed if the same file is received there again */
+static void
+resume_record_write (GFile *file,
+    const gchar *contact,
+    const gchar *filename,
+    guint64 size,
+    const gchar *content_hash,
+    guint64 received,
+    const gchar *md5)
+{
+  GKeyFile *records;
+  gchar *uri;
+
+  uri = g_file_get_uri (file);
+  records = resume_records_load ();
+
+  g_key_file_set_string (records, uri, "contact", contact);
+  g_key_file_set_string (records, uri, "filename", filename);
+  g_key_file_set_uint64 (records, uri, "size", size);
+  g_key_file_set_string (records, uri, "hash",
+      content_hash != NULL ? content_hash : "");
+  g_key_file_set_uint64 (records, uri, "received", received);
+  g_key_file_set_string (records, uri, "md5", md5);
+
+  DEBUG ("%" G_GUINT64_FORMAT " bytes of %s can be resumed", received, uri);
+
+  resume_records_save (records);
+
+  g_key_file_free (records);
+  g_free (uri);
+}
+
+static void
+resume_record_hash_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  ResumeRecordData *data = user_data;
+  guint64 hashed_bytes;
+  GError *error = NULL;
+
+  if (!empathy_ft_hash_finish (result, &hashed_bytes, &error))
+    {
+      DEBUG ("Failed to hash the partial file: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  if (hashed_bytes == 0)
+    goto out;
+
+  resume_record_write (data->file, data->contact, data->filename,
+      data->size, data->content_hash, hashed_bytes,
+      g_checksum_get_string (data->checksum));
+
+out:
+  resume_record_data_free (data);
+}
+
+static void
+resume_record_read_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  ResumeRecordData *data = user_data;
+  GFileInputStream *stream;
+  GError *error = NULL;
+
+  stream = g_file_read_finish (data->file, res, &error);
+  if (stream == NULL)
+    {
+      DEBUG ("Failed to open the partial file: %s", error->message);
+      g_error_free (error);
+      resume_record_data_free (data);
+      return;
+    }
+
+  data->stream = G_INPUT_STREAM (stream);
+
+  empathy_ft_hash_async (data->stream, data->checksum, G_MAXUINT64, NULL,
+      NULL, resume_record_hash_cb, data);
+}
+
+/* Hashes what has been received of a broken incoming transfer, so it can
+ * be checked before resuming it. This doesn't use the cancellable of the
+ * handler, which is cancelled by then, nor need the handler to stay alive. */
+static void
+resume_record_store (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  ResumeRecordData *data;
+
+  if (priv->gfile == NULL || priv->is_completed)
+    return;
+
+  data = g_slice_new0 (ResumeRecordData);
+  data->file = g_object_ref (priv->gfile);
+  data->checksum = g_checksum_new (G_CHECKSUM_MD5);
+  data->contact = resume_contact_key (priv->contact);
+  data->filename = g_strdup (priv->filename);
+  data->size = priv->total_bytes;
+  data->content_hash = g_strdup (priv->content_hash);
+
+  g_file_read_async (data->file, G_PRIORITY_LOW, NULL,
+      resume_record_read_cb, data);
+}
+
+static void
+resume_record_progress_stop (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  /* the stream is still being read otherwise, this is called again once
+   * it's done */
+  if (priv->resume_hashing)
+    return;
+
+  if (priv->resume_stream != NULL)
+    g_input_stream_close (priv->resume_stream, NULL, NULL);
+
+  g_clear_object (&priv->resume_stream);
+  tp_clear_pointer (&priv->resume_checksum, g_checksum_free);
+  priv->resume_hashed_bytes = 0;
+}
+
+static void
+resume_record_progress_hash_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyFTHandler *handler = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  guint64 hashed_bytes;
+  GError *error = NULL;
+
+  priv->resume_hashing = FALSE;
+
+  if (!empathy_ft_hash_finish (result, &hashed_bytes, &error))
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        DEBUG ("Failed to hash what has been received: %s", error->message);
+
+      g_error_free (error);
+
+      /* start again from the beginning next time */
+      resume_record_progress_stop (handler);
+      goto out;
+    }
+
+  priv->resume_hashed_bytes += hashed_bytes;
+
+  /* the transfer broke or completed meanwhile, which is recorded or
+   * forgotten without this */
+  if (empathy_ft_handler_is_cancelled (handler) || priv->is_completed)
+    {
+      resume_record_progress_stop (handler);
+      goto out;
+    }
+
+  if (priv->resume_hashed_bytes > 0)
+    {
+      GChecksum *checksum = g_checksum_copy (priv->resume_checksum);
+      gchar *contact = resume_contact_key (priv->contact);
+
+      resume_record_write (priv->gfile, contact, priv->filename,
+          priv->total_bytes, priv->content_hash, priv->resume_hashed_bytes,
+          g_checksum_get_string (checksum));
+
+      g_free (contact);
+      g_checksum_free (checksum);
+    }
+
+out:
+  g_object_unref (handler);
+}
+
+static void
+resume_record_progress_hash (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  priv->resume_hashing = TRUE;
+  empathy_ft_hash_async (priv->resume_stream, priv->resume_checksum,
+      priv->transferred_bytes - priv->resume_hashed_bytes, priv->cancellable,
+      NULL, resume_record_progress_hash_cb, g_object_ref (handler));
+}
+
+static void
+resume_record_progress_read_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  EmpathyFTHandler *handler = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GFileInputStream *stream;
+  GError *error = NULL;
+
+  priv->resume_hashing = FALSE;
+
+  stream = g_file_read_finish (G_FILE (source), res, &error);
+  if (stream == NULL)
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        DEBUG ("Can't read what has been received: %s", error->message);
+
+      g_error_free (error);
+    }
+  else
+    {
+      priv->resume_stream = G_INPUT_STREAM (stream);
+      priv->resume_checksum = g_checksum_new (G_CHECKSUM_MD5);
+
+      if (!empathy_ft_handler_is_cancelled (handler) && !priv->is_completed)
+        resume_record_progress_hash (handler);
+      else
+        resume_record_progress_stop (handler);
+    }
+
+  g_object_unref (handler);
+}
+
+/* Records now and then what a new incoming transfer has received, hashing
+ * only what arrived since the last time. A resumed transfer is received
+ * in the part file, the destination keeps matching the record it was
+ * resumed from meanwhile. */
+static void
+resume_record_progress (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  gint64 now;
+
+  if (priv->resume_hashing || priv->resume_part != NULL ||
+      priv->gfile == NULL || empathy_ft_handler_is_cancelled (handler))
+    return;
+
+  now = g_get_monotonic_time ();
+  if (now - priv->resume_recorded_time < RESUME_RECORD_INTERVAL ||
+      priv->transferred_bytes <= priv->resume_hashed_bytes)
+    return;
+
+  priv->resume_recorded_time = now;
+
+  if (priv->resume_stream == NULL)
+    {
+      priv->resume_hashing = TRUE;
+      g_file_read_async (priv->gfile, G_PRIORITY_LOW, priv->cancellable,
+          resume_record_progress_read_cb, g_object_ref (handler));
+      return;
+    }
+
+  resume_record_progress_hash (handler);
+}
+
+static void
+resume_record_forget (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GKeyFile *records;
+  gchar *uri;
+
+  if (priv->gfile == NULL)
+    return;
+
+  uri = g_file_get_uri (priv->gfile);
+  records = resume_records_load ();
+
+  if (g_key_file_remove_group (records, uri, NULL))
+    resume_records_save (records);
+
+  g_key_file_free (records);
+  g_free (uri);
+}
+
+static gboolean
+resume_record_has_string (GKeyFile *records,
+    const gchar *uri,
+    const gchar *key,
+    const gchar *expected)
+{
+  gchar *value;
+  gboolean retval;
+
+  value = g_key_file_get_string (records, uri, key, NULL);
+  retval = !tp_strdiff (value, expected);
+  g_free (value);
+
+  return retval;
+}
+
+/* Returns the number of bytes of the destination file which can be resumed
+ * if they are still what was received, and the MD5 they had then */
+static guint64
+resume_record_lookup (EmpathyFTHandler *handler,
+    gchar **md5)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GKeyFile *records;
+  gchar *uri, *contact;
+  guint64 received = 0;
+
+  uri = g_file_get_uri (priv->gfile);
+  records = resume_records_load ();
+
+  if (!g_key_file_has_group (records, uri))
+    goto out;
+
+  contact = resume_contact_key (priv->contact);
+
+  if (resume_record_has_string (records, uri, "contact", contact) &&
+      resume_record_has_string (records, uri, "filename", priv->filename) &&
+      resume_record_has_string (records, uri, "hash",
+        priv->content_hash != NULL ? priv->content_hash : "") &&
+      g_key_file_get_uint64 (records, uri, "size", NULL) == priv->total_bytes)
+    {
+      received = g_key_file_get_uint64 (records, uri, "received", NULL);
+      *md5 = g_key_file_get_string (records, uri, "md5", NULL);
+
+      if (*md5 == NULL || received >= priv->total_bytes)
+        {
+          g_free (*md5);
+          *md5 = NULL;
+          received = 0;
+        }
+    }
+  else
+    {
+      DEBUG ("%s was being received from somewhere else", uri);
+    }
+
+  g_free (contact);
+
+out:
+  g_key_file_free (records);
+  g_free (uri);
+
+  return received;
+}
+
+static void
+ft_handler_accept_file (EmpathyFTHandler *handler,
+    guint64 offset)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GFile *file = priv->gfile;
+
+  DEBUG ("Accepting the file at offset %" G_GUINT64_FORMAT, offset);
+
+  if (offset > 0)
+    {
+      gchar *uri, *part_uri;
+
+      uri = g_file_get_uri (priv->gfile);
+      part_uri = g_strconcat (uri, RESUME_PART_SUFFIX, NULL);
+      priv->resume_part = g_file_new_for_uri (part_uri);
+      file = priv->resume_part;
+
+      g_free (uri);
+      g_free (part_uri);
+    }
+
+  tp_file_transfer_channel_accept_file_async (priv->channel,
+      file, offset, ft_transfer_accept_cb, handler);
+
+  tp_g_signal_connect_object (priv->channel, "notify::state",
+      G_CALLBACK (ft_transfer_state_cb), handler, 0);
+  tp_g_signal_connect_object (priv->channel, "notify::transferred-bytes",
+      G_CALLBACK (ft_transfer_transferred_bytes_cb), handler, 0);
+}
+
+static void
+resume_data_free (ResumeData *data)
+{
+  if (data->stream != NULL)
+    g_input_stream_close (data->stream, NULL, NULL);
+
+  g_clear_object (&data->stream);
+  g_object_unref (data->handler);
+  g_checksum_free (data->checksum);
+  g_free (data->md5);
+  g_slice_free (ResumeData, data);
+}
+
+static void
+resume_truncate_data_free (ResumeTruncateData *data)
+{
+  g_object_unref (data->file);
+  g_slice_free (ResumeTruncateData, data);
+}
+
+static void
+resume_truncate_thread (GSimpleAsyncResult *simple,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  ResumeTruncateData *data = g_simple_async_result_get_op_res_gpointer (
+      simple);
+  GFileIOStream *stream;
+  GError *error = NULL;
+
+  stream = g_file_open_readwrite (data->file, cancellable, &error);
+  if (stream != NULL)
+    {
+      g_seekable_truncate (G_SEEKABLE (stream), data->size, cancellable,
+          &error);
+      g_io_stream_close (G_IO_STREAM (stream), NULL, NULL);
+      g_object_unref (stream);
+    }
+
+  if (error != NULL)
+    g_simple_async_result_take_error (simple, error);
+}
+
+/* Drops whatever was written after the verified data */
+static void
+resume_truncate_async (EmpathyFTHandler *handler,
+    guint64 size,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GSimpleAsyncResult *simple;
+  ResumeTruncateData *data;
+
+  data = g_slice_new0 (ResumeTruncateData);
+  data->file = g_object_ref (priv->gfile);
+  data->size = size;
+
+  simple = g_simple_async_result_new (G_OBJECT (handler), callback,
+      user_data, resume_truncate_async);
+  g_simple_async_result_set_op_res_gpointer (simple, data,
+      (GDestroyNotify) resume_truncate_data_free);
+  g_simple_async_result_run_in_thread (simple, resume_truncate_thread,
+      G_PRIORITY_DEFAULT, priv->cancellable);
+  g_object_unref (simple);
+}
+
+static gboolean
+resume_truncate_finish (EmpathyFTHandler *handler,
+    GAsyncResult *result,
+    GError **error)
+{
+  return !g_simple_async_result_propagate_error (
+      G_SIMPLE_ASYNC_RESULT (result), error);
+}
+
+static void
+resume_truncate_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  ResumeData *data = user_data;
+  guint64 offset = 0;
+  GError *error = NULL;
+
+  if (resume_truncate_finish (data->handler, result, &error))
+    {
+      offset = data->received;
+    }
+  else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      g_error_free (error);
+      goto out;
+    }
+  else
+    {
+      DEBUG ("Can't truncate the partial file: %s", error->message);
+      g_error_free (error);
+    }
+
+  ft_handler_accept_file (data->handler, offset);
+
+out:
+  resume_data_free (data);
+}
+
+static void
+resume_check_hash_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  ResumeData *data = user_data;
+  EmpathyFTHandler *handler = data->handler;
+  guint64 hashed_bytes;
+  GError *error = NULL;
+
+  if (!empathy_ft_hash_finish (result, &hashed_bytes, &error))
+    {
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_error_free (error);
+          resume_data_free (data);
+          return;
+        }
+
+      DEBUG ("Failed to check the partial file: %s", error->message);
+      g_error_free (error);
+    }
+  else if (hashed_bytes != data->received ||
+      tp_strdiff (g_checksum_get_string (data->checksum), data->md5))
+    {
+      DEBUG ("The partial file changed, receiving it again");
+    }
+  else
+    {
+      g_input_stream_close (data->stream, NULL, NULL);
+      g_clear_object (&data->stream);
+
+      resume_truncate_async (handler, data->received, resume_truncate_cb,
+          data);
+      return;
+    }
+
+  ft_handler_accept_file (handler, 0);
+  resume_data_free (data);
+}
+
+static void
+resume_check_read_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  ResumeData *data = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (data->handler);
+  GFileInputStream *stream;
+  GError *error = NULL;
+
+  stream = g_file_read_finish (priv->gfile, res, &error);
+  if (stream == NULL)
+    {
+      DEBUG ("Can't read the partial file: %s", error->message);
+
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        ft_handler_accept_file (data->handler, 0);
+
+      g_error_free (error);
+      resume_data_free (data);
+      return;
+    }
+
+  data->stream = G_INPUT_STREAM (stream);
+
+  empathy_ft_hash_async (data->stream, data->checksum, data->received,
+      priv->cancellable, NULL, resume_check_hash_cb, data);
+}
+
+/* Resumes an incoming transfer which broke before the end if the start of
+ * the destination still is what was received, and receives it from the
+ * start otherwise */
+static void
+ft_handler_incoming_resume_or_accept (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  ResumeData *data;
+  guint64 received;
+  gchar *md5 = NULL;
+
+  received = resume_record_lookup (handler, &md5);
+  if (received == 0)
+    {
+      ft_handler_accept_file (handler, 0);
+      return;
+    }
+
+  DEBUG ("Checking the %" G_GUINT64_FORMAT " bytes already received",
+      received);
+
+  data = g_slice_new0 (ResumeData);
+  data->handler = g_object_ref (handler);
+  data->checksum = g_checksum_new (G_CHECKSUM_MD5);
+  data->received = received;
+  data->md5 = md5;
+
+  g_file_read_async (priv->gfile, G_PRIORITY_DEFAULT, priv->cancellable,
+      resume_check_read_cb, data);
+}
+
+static void
+ft_handler_read_async_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  GFileInputStream *stream;
+  GError *error = NULL;
+  HashingData *hash_data;
+  EmpathyFTHandler *handler = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  DEBUG ("GFile read async CB.");
+
+  stream = g_file_read_finish (priv->gfile, res, &error);
+  if (error != NULL)
+    {
+      emit_error_signal (handler, error);
+      g_clear_error (&error);
+
+      return;
+    }
+
+  hash_data = g_slice_new0 (HashingData);
+  hash_data->stream = G_INPUT_STREAM (stream);
+  hash_data->total_bytes = priv->total_bytes;
+  hash_data->handler = g_object_ref (handler);
+  /* FIXME: MD5 is the only ContentHashType supported right now */
+  hash_data->checksum = g_checksum_new (G_CHECKSUM_MD5);
+
+  g_signal_emit (handler, signals[HASHING_STARTED], 0);
+
+  ft_handler_start_hashing (hash_data);
+}
+
+static void
+callbacks_data_free (gpointer user_data)
+{
+  CallbacksData *data = user_data;
+
+  if (data->handler != NULL)
+    g_object_unref (data->handler);
+
+  g_slice_free (CallbacksData, data);
+}
+
+static gboolean
+set_content_hash_type_from_classes (EmpathyFTHandler *handler,
+    GPtrArray *classes)
+{
+  GArray *possible_values;
+  guint value;
+  gboolean valid;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  gboolean support_ft = FALSE;
+  guint i;
+
+  possible_values = g_array_new (TRUE, TRUE, sizeof (guint));
 
   for (i = 0; i < classes->len; i++)
     {
@@ -1200,12 +2255,36 @@ ft_handler_complete_request (EmpathyFTHandler *handler)
   ft_handler_populate_outgoing_request (handler);
 
   if (priv->use_hash)
-    /* start hashing the file */
-    g_file_read_async (priv->gfile, G_PRIORITY_DEFAULT,
-        priv->cancellable, ft_handler_read_async_cb, handler);
+    {
+      gchar *hash;
+
+      hash = empathy_ft_hash_cache_lookup (priv->gfile, priv->gfile_info,
+          G_CHECKSUM_MD5);
+
+      if (hash != NULL)
+        {
+          DEBUG ("File already hashed: %s", hash);
+
+          g_signal_emit (handler, signals[HASHING_STARTED], 0);
+
+          tp_account_channel_request_set_file_transfer_hash (priv->request,
+              TP_FILE_HASH_TYPE_MD5, hash);
+          g_free (hash);
+
+          g_signal_emit (handler, signals[HASHING_DONE], 0);
+          ft_handler_push_to_dispatcher (handler);
+          return;
+        }
+
+      /* start hashing the file */
+      g_file_read_async (priv->gfile, G_PRIORITY_DEFAULT,
+          priv->cancellable, ft_handler_read_async_cb, handler);
+    }
   else
-    /* push directly the handler to the dispatcher */
-    ft_handler_push_to_dispatcher (handler);
+    {
+      /* push directly the handler to the dispatcher */
+      ft_handler_push_to_dispatcher (handler);
+    }
 }
 
 static void
@@ -1225,6 +2304,9 @@ ft_handler_gfile_ready_cb (GObject *source,
   if (error != NULL)
     goto out;
 
+  /* kept to look up the hash of the file */
+  priv->gfile_info = info;
+
   if (g_file_info_get_file_type (info) != G_FILE_TYPE_REGULAR)
     {
       error = g_error_new_literal (EMPATHY_FT_ERROR_QUARK,
@@ -1249,8 +2331,6 @@ ft_handler_gfile_ready_cb (GObject *source,
   priv->transferred_bytes = 0;
   priv->description = NULL;
 
-  g_object_unref (info);
-
 out:
   if (error != NULL)
     {
@@ -1350,7 +2430,9 @@ empathy_ft_handler_new_outgoing (EmpathyContact *contact,
       G_FILE_ATTRIBUTE_STANDARD_SIZE ","
       G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE ","
       G_FILE_ATTRIBUTE_STANDARD_TYPE ","
-      G_FILE_ATTRIBUTE_TIME_MODIFIED,
+      G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+      G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC ","
+      G_FILE_ATTRIBUTE_UNIX_INODE,
       G_FILE_QUERY_INFO_NONE, G_PRIORITY_DEFAULT,
       NULL, (GAsyncReadyCallback) ft_handler_gfile_ready_cb, data);
 }
@@ -1411,6 +2493,8 @@ empathy_ft_handler_new_incoming (TpFileTransferChannel *channel,
  *
  * Starts the transfer machinery. After this call, the transfer and hashing
  * signals will be emitted by the handler.
+ * If an incoming transfer of the same file to the same destination broke
+ * before the end, it is resumed after checking the data already received.
  */
 void
 empathy_ft_handler_start_transfer (EmpathyFTHandler *handler)
@@ -1427,14 +2511,7 @@ empathy_ft_handler_start_transfer (EmpathyFTHandler *handler)
     }
   else
     {
-      /* TODO: add support for resume. */
-      tp_file_transfer_channel_accept_file_async (priv->channel,
-          priv->gfile, 0, ft_transfer_accept_cb, handler);
-
-      tp_g_signal_connect_object (priv->channel, "notify::state",
-          G_CALLBACK (ft_transfer_state_cb), handler, 0);
-      tp_g_signal_connect_object (priv->channel, "notify::transferred-bytes",
-          G_CALLBACK (ft_transfer_transferred_bytes_cb), handler, 0);
+      ft_handler_incoming_resume_or_accept (handler);
     }
 }
 
@@ -1641,6 +2718,49 @@ empathy_ft_handler_get_transferred_bytes (EmpathyFTHandler *handler)
   return priv->transferred_bytes;
 }
 
+/**
+ * empathy_ft_handler_get_speed:
+ * @handler: an #EmpathyFTHandler
+ *
+ * Returns the speed of the transfer, averaged over the last few seconds so
+ * it doesn't follow every burst of the connection.
+ *
+ * Return value: the speed of the transfer in bytes per second, or a negative
+ * value if it is not known yet
+ */
+gdouble
+empathy_ft_handler_get_speed (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_FT_HANDLER (handler), -1);
+
+  priv = GET_PRIV (handler);
+
+  return priv->speed;
+}
+
+/**
+ * empathy_ft_handler_get_remaining_time:
+ * @handler: an #EmpathyFTHandler
+ *
+ * Returns the estimated time until the end of the transfer, based on the
+ * speed returned by empathy_ft_handler_get_speed().
+ *
+ * Return value: the number of seconds remaining, or 0 if it is not known yet
+ */
+guint
+empathy_ft_handler_get_remaining_time (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_FT_HANDLER (handler), 0);
+
+  priv = GET_PRIV (handler);
+
+  return priv->remaining_time;
+}
+
 /**
  * empathy_ft_handler_get_total_bytes:
  * @handler: an #EmpathyFTHandler
@@ -105,6 +105,8 @@ gboolean empathy_ft_handler_get_use_hash (EmpathyFTHandler *handler);
 gboolean empathy_ft_handler_is_incoming (EmpathyFTHandler *handler);
 guint64 empathy_ft_handler_get_transferred_bytes (EmpathyFTHandler *handler);
 guint64 empathy_ft_handler_get_total_bytes (EmpathyFTHandler *handler);
+gdouble empathy_ft_handler_get_speed (EmpathyFTHandler *handler);
+guint empathy_ft_handler_get_remaining_time (EmpathyFTHandler *handler);
 gboolean empathy_ft_handler_is_completed (EmpathyFTHandler *handler);
 gboolean empathy_ft_handler_is_cancelled (EmpathyFTHandler *handler);
 
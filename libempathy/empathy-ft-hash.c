@@ -0,0 +1,568 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Hashes a stream in a thread, reading it in large chunks through a single
+ * buffer. The progress is reported to the main context of the caller at
+ * most every HASH_PROGRESS_INTERVAL, so hashing a big file doesn't flood
+ * it with callbacks. */
+
+#include "config.h"
+#include "empathy-ft-hash.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+#include <telepathy-glib/telepathy-glib.h>
+
+#define DEBUG_FLAG EMPATHY_DEBUG_FT
+#include "empathy-debug.h"
+
+#define HASH_BUFFER_SIZE (1024 * 1024)
+/* In microseconds */
+#define HASH_PROGRESS_INTERVAL (100 * 1000)
+
+typedef struct
+{
+  GInputStream *stream;
+  /* borrowed, only used by the thread until the job is done */
+  GChecksum *checksum;
+  guint64 max_bytes;
+
+  GMainContext *context;
+  EmpathyFTHashProgressCallback progress_callback;
+  GAsyncReadyCallback callback;
+  gpointer user_data;
+
+  /* Protected by the mutex, as read by the progress callback */
+  GMutex mutex;
+  guint64 hashed_bytes;
+  gboolean progress_pending;
+
+  /* No progress is reported once the callback has been called */
+  gboolean done;
+
+  /* Released when both the job and the pending progress are done */
+  gint ref_count;
+} HashJob;
+
+static HashJob *
+hash_job_ref (HashJob *job)
+{
+  g_atomic_int_inc (&job->ref_count);
+  return job;
+}
+
+static void
+hash_job_unref (HashJob *job)
+{
+  if (!g_atomic_int_dec_and_test (&job->ref_count))
+    return;
+
+  g_object_unref (job->stream);
+  g_main_context_unref (job->context);
+  g_mutex_clear (&job->mutex);
+  g_slice_free (HashJob, job);
+}
+
+static gboolean
+report_progress_cb (gpointer user_data)
+{
+  HashJob *job = user_data;
+  guint64 hashed_bytes;
+
+  g_mutex_lock (&job->mutex);
+  hashed_bytes = job->hashed_bytes;
+  job->progress_pending = FALSE;
+  g_mutex_unlock (&job->mutex);
+
+  if (!job->done)
+    job->progress_callback (hashed_bytes, job->user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Called by the thread; at most one report is pending at a time */
+static void
+queue_progress (HashJob *job,
+    guint64 hashed_bytes)
+{
+  gboolean queue;
+
+  g_mutex_lock (&job->mutex);
+  job->hashed_bytes = hashed_bytes;
+  queue = !job->progress_pending;
+  job->progress_pending = TRUE;
+  g_mutex_unlock (&job->mutex);
+
+  if (queue)
+    {
+      GSource *source = g_idle_source_new ();
+
+      g_source_set_callback (source, report_progress_cb, hash_job_ref (job),
+          (GDestroyNotify) hash_job_unref);
+      g_source_attach (source, job->context);
+      g_source_unref (source);
+    }
+}
+
+static void
+hash_thread (GSimpleAsyncResult *simple,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  HashJob *job = g_simple_async_result_get_op_res_gpointer (simple);
+  guchar *buffer;
+  guint64 hashed_bytes = 0;
+  gint64 last_report = g_get_monotonic_time ();
+  GError *error = NULL;
+
+  buffer = g_malloc (HASH_BUFFER_SIZE);
+
+  while (hashed_bytes < job->max_bytes)
+    {
+      gssize bytes_read;
+      gint64 now;
+
+      bytes_read = g_input_stream_read (job->stream, buffer,
+          MIN (HASH_BUFFER_SIZE, job->max_bytes - hashed_bytes),
+          cancellable, &error);
+
+      if (bytes_read <= 0)
+        break;
+
+      g_checksum_update (job->checksum, buffer, bytes_read);
+      hashed_bytes += bytes_read;
+
+      now = g_get_monotonic_time ();
+      if (job->progress_callback != NULL &&
+          now - last_report >= HASH_PROGRESS_INTERVAL)
+        {
+          queue_progress (job, hashed_bytes);
+          last_report = now;
+        }
+    }
+
+  g_free (buffer);
+
+  /* The final progress is up to the caller, once the job is done */
+  g_mutex_lock (&job->mutex);
+  job->hashed_bytes = hashed_bytes;
+  g_mutex_unlock (&job->mutex);
+
+  if (error != NULL)
+    g_simple_async_result_take_error (simple, error);
+}
+
+static void
+hash_done_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  HashJob *job = user_data;
+
+  job->done = TRUE;
+  job->callback (NULL, result, job->user_data);
+}
+
+/**
+ * empathy_ft_hash_async:
+ * @stream: a #GInputStream to hash from its current position
+ * @checksum: the #GChecksum to update, which must not be used until the
+ * hashing is done
+ * @max_bytes: the number of bytes to hash, or %G_MAXUINT64 to hash until
+ * the end of @stream
+ * @cancellable: (allow-none): a #GCancellable
+ * @progress_callback: (allow-none): called with the number of bytes hashed
+ * so far, from the thread-default main context of the caller
+ * @callback: a callback to call when the hashing is done
+ * @user_data: data to pass to @progress_callback and @callback
+ *
+ * Hashes @stream in a thread. @stream isn't closed.
+ */
+void
+empathy_ft_hash_async (GInputStream *stream,
+    GChecksum *checksum,
+    guint64 max_bytes,
+    GCancellable *cancellable,
+    EmpathyFTHashProgressCallback progress_callback,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GSimpleAsyncResult *simple;
+  HashJob *job;
+
+  g_return_if_fail (G_IS_INPUT_STREAM (stream));
+  g_return_if_fail (checksum != NULL);
+
+  job = g_slice_new0 (HashJob);
+  job->stream = g_object_ref (stream);
+  job->checksum = checksum;
+  job->max_bytes = max_bytes;
+  job->context = g_main_context_ref_thread_default ();
+  job->progress_callback = progress_callback;
+  job->callback = callback;
+  job->user_data = user_data;
+  job->ref_count = 1;
+  g_mutex_init (&job->mutex);
+
+  simple = g_simple_async_result_new (NULL, hash_done_cb, job,
+      empathy_ft_hash_async);
+  g_simple_async_result_set_op_res_gpointer (simple, job,
+      (GDestroyNotify) hash_job_unref);
+
+  g_simple_async_result_run_in_thread (simple, hash_thread,
+      G_PRIORITY_DEFAULT, cancellable);
+  g_object_unref (simple);
+}
+
+/**
+ * empathy_ft_hash_finish:
+ * @result: the #GAsyncResult passed to the callback
+ * @hashed_bytes: (out) (allow-none): the number of bytes which have been
+ * hashed, which may be less than requested if the end of the stream has
+ * been reached
+ * @error: a #GError to fill
+ *
+ * Returns: %TRUE if the stream could be read
+ */
+gboolean
+empathy_ft_hash_finish (GAsyncResult *result,
+    guint64 *hashed_bytes,
+    GError **error)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+  HashJob *job;
+
+  g_return_val_if_fail (g_simple_async_result_is_valid (result, NULL,
+        empathy_ft_hash_async), FALSE);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return FALSE;
+
+  job = g_simple_async_result_get_op_res_gpointer (simple);
+
+  if (hashed_bytes != NULL)
+    *hashed_bytes = job->hashed_bytes;
+
+  return TRUE;
+}
+
+/* Cache of the hashes of the files sent, so a file sent again doesn't have
+ * to be hashed again. A file is assumed to be unchanged if its inode, size
+ * and modification time are the same.
+ *
+ * The cache is a text file, each new hash being appended as a
+ * "type\tinode\tsize\tmtime\tusec\thash\turi" line, so the latest line of
+ * an URI wins. It's rewritten once it has too many outdated lines. */
+
+#define HASH_CACHE_HEADER "EMPATHY-FT-HASHES 1"
+#define MAX_CACHED_HASHES 1000
+
+typedef struct
+{
+  guint64 inode;
+  guint64 size;
+  guint64 mtime;
+  guint32 mtime_usec;
+  gchar *hash;
+  /* The most recently stored hashes are kept */
+  guint64 serial;
+} CachedHash;
+
+/* owned "type uri" -> owned CachedHash */
+static GHashTable *hash_cache = NULL;
+static guint64 hash_cache_serial = 0;
+static guint n_hash_cache_lines = 0;
+
+static void
+cached_hash_free (CachedHash *cached)
+{
+  g_free (cached->hash);
+  g_slice_free (CachedHash, cached);
+}
+
+static gchar *
+hash_cache_get_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), PACKAGE_NAME,
+      "ft-hashes", NULL);
+}
+
+static gchar *
+hash_cache_key (GChecksumType type,
+    const gchar *uri)
+{
+  return g_strdup_printf ("%u %s", type, uri);
+}
+
+static void
+hash_cache_fill_from_info (CachedHash *cached,
+    GFileInfo *info)
+{
+  GTimeVal mtime;
+
+  g_file_info_get_modification_time (info, &mtime);
+
+  cached->inode = g_file_info_get_attribute_uint64 (info,
+      G_FILE_ATTRIBUTE_UNIX_INODE);
+  cached->size = g_file_info_get_size (info);
+  cached->mtime = mtime.tv_sec;
+  cached->mtime_usec = mtime.tv_usec;
+}
+
+static void
+hash_cache_evict_oldest (void)
+{
+  GHashTableIter iter;
+  gpointer key, value, oldest = NULL;
+  guint64 oldest_serial = G_MAXUINT64;
+
+  g_hash_table_iter_init (&iter, hash_cache);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      CachedHash *cached = value;
+
+      if (cached->serial < oldest_serial)
+        {
+          oldest_serial = cached->serial;
+          oldest = key;
+        }
+    }
+
+  if (oldest != NULL)
+    g_hash_table_remove (hash_cache, oldest);
+}
+
+static void
+hash_cache_insert (gchar *key,
+    CachedHash *cached)
+{
+  cached->serial = hash_cache_serial++;
+  g_hash_table_replace (hash_cache, key, cached);
+
+  if (g_hash_table_size (hash_cache) > MAX_CACHED_HASHES)
+    hash_cache_evict_oldest ();
+}
+
+static void
+hash_cache_parse_line (const gchar *line)
+{
+  gchar **fields;
+  CachedHash *cached;
+
+  fields = g_strsplit (line, "\t", 7);
+
+  if (g_strv_length (fields) == 7)
+    {
+      cached = g_slice_new0 (CachedHash);
+      cached->inode = g_ascii_strtoull (fields[1], NULL, 10);
+      cached->size = g_ascii_strtoull (fields[2], NULL, 10);
+      cached->mtime = g_ascii_strtoull (fields[3], NULL, 10);
+      cached->mtime_usec = g_ascii_strtoull (fields[4], NULL, 10);
+      cached->hash = g_strdup (fields[5]);
+
+      hash_cache_insert (
+          hash_cache_key (g_ascii_strtoull (fields[0], NULL, 10), fields[6]),
+          cached);
+    }
+
+  g_strfreev (fields);
+}
+
+static void
+hash_cache_ensure_loaded (void)
+{
+  gchar *path, *contents, **lines;
+  guint i;
+
+  if (hash_cache != NULL)
+    return;
+
+  hash_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) cached_hash_free);
+
+  path = hash_cache_get_path ();
+
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      lines = g_strsplit (contents, "\n", -1);
+
+      if (!tp_strdiff (lines[0], HASH_CACHE_HEADER))
+        {
+          for (i = 1; lines[i] != NULL; i++)
+            {
+              if (lines[i][0] != '\0')
+                {
+                  hash_cache_parse_line (lines[i]);
+                  n_hash_cache_lines++;
+                }
+            }
+        }
+
+      DEBUG ("Loaded %u cached file hashes", g_hash_table_size (hash_cache));
+
+      g_strfreev (lines);
+      g_free (contents);
+    }
+
+  g_free (path);
+}
+
+static void
+hash_cache_append_line (GString *string,
+    const gchar *key,
+    CachedHash *cached)
+{
+  const gchar *uri = strchr (key, ' ') + 1;
+
+  g_string_append_printf (string, "%.*s\t%" G_GUINT64_FORMAT "\t%"
+      G_GUINT64_FORMAT "\t%" G_GUINT64_FORMAT "\t%u\t%s\t%s\n",
+      (gint) (uri - key - 1), key, cached->inode, cached->size,
+      cached->mtime, cached->mtime_usec, cached->hash, uri);
+}
+
+static void
+hash_cache_save (const gchar *key,
+    CachedHash *cached)
+{
+  GString *string;
+  gchar *path, *dir;
+  GError *error = NULL;
+
+  path = hash_cache_get_path ();
+  dir = g_path_get_dirname (path);
+  g_mkdir_with_parents (dir, 0700);
+
+  string = g_string_new (NULL);
+
+  if (n_hash_cache_lines >= 2 * MAX_CACHED_HASHES ||
+      !g_file_test (path, G_FILE_TEST_EXISTS))
+    {
+      GHashTableIter iter;
+      gpointer k, v;
+
+      /* Drop the outdated lines */
+      g_string_append (string, HASH_CACHE_HEADER "\n");
+
+      g_hash_table_iter_init (&iter, hash_cache);
+      while (g_hash_table_iter_next (&iter, &k, &v))
+        hash_cache_append_line (string, k, v);
+
+      n_hash_cache_lines = g_hash_table_size (hash_cache);
+
+      if (!g_file_set_contents (path, string->str, string->len, &error))
+        {
+          DEBUG ("Failed to save the file hashes: %s", error->message);
+          g_error_free (error);
+        }
+    }
+  else
+    {
+      FILE *file;
+
+      hash_cache_append_line (string, key, cached);
+
+      file = g_fopen (path, "a");
+      if (file != NULL)
+        {
+          fwrite (string->str, string->len, 1, file);
+          fclose (file);
+          n_hash_cache_lines++;
+        }
+    }
+
+  g_string_free (string, TRUE);
+  g_free (dir);
+  g_free (path);
+}
+
+/**
+ * empathy_ft_hash_cache_lookup:
+ * @file: a #GFile
+ * @info: the #GFileInfo of @file, with its size, modification time and
+ * inode
+ * @type: the type of hash
+ *
+ * Returns: the hash of @file stored by empathy_ft_hash_cache_store() if
+ * the file didn't change since then, or %NULL
+ */
+gchar *
+empathy_ft_hash_cache_lookup (GFile *file,
+    GFileInfo *info,
+    GChecksumType type)
+{
+  CachedHash *cached, current;
+  gchar *uri, *key;
+
+  g_return_val_if_fail (G_IS_FILE (file), NULL);
+  g_return_val_if_fail (G_IS_FILE_INFO (info), NULL);
+
+  hash_cache_ensure_loaded ();
+
+  uri = g_file_get_uri (file);
+  key = hash_cache_key (type, uri);
+  cached = g_hash_table_lookup (hash_cache, key);
+  g_free (key);
+  g_free (uri);
+
+  if (cached == NULL)
+    return NULL;
+
+  hash_cache_fill_from_info (&current, info);
+
+  if (cached->inode != current.inode ||
+      cached->size != current.size ||
+      cached->mtime != current.mtime ||
+      cached->mtime_usec != current.mtime_usec)
+    return NULL;
+
+  return g_strdup (cached->hash);
+}
+
+/**
+ * empathy_ft_hash_cache_store:
+ * @file: a #GFile
+ * @info: the #GFileInfo of @file when it started being hashed
+ * @type: the type of hash
+ * @hash: the hash of @file
+ */
+void
+empathy_ft_hash_cache_store (GFile *file,
+    GFileInfo *info,
+    GChecksumType type,
+    const gchar *hash)
+{
+  CachedHash *cached;
+  gchar *uri, *key;
+
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (G_IS_FILE_INFO (info));
+  g_return_if_fail (hash != NULL);
+
+  hash_cache_ensure_loaded ();
+
+  cached = g_slice_new0 (CachedHash);
+  hash_cache_fill_from_info (cached, info);
+  cached->hash = g_strdup (hash);
+
+  uri = g_file_get_uri (file);
+  key = hash_cache_key (type, uri);
+  g_free (uri);
+
+  hash_cache_insert (key, cached);
+  hash_cache_save (key, cached);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_FT_HASH_H__
+#define __EMPATHY_FT_HASH_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef void (*EmpathyFTHashProgressCallback) (guint64 hashed_bytes,
+    gpointer user_data);
+
+void empathy_ft_hash_async (GInputStream *stream,
+    GChecksum *checksum,
+    guint64 max_bytes,
+    GCancellable *cancellable,
+    EmpathyFTHashProgressCallback progress_callback,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+gboolean empathy_ft_hash_finish (GAsyncResult *result,
+    guint64 *hashed_bytes,
+    GError **error);
+
+gchar * empathy_ft_hash_cache_lookup (GFile *file,
+    GFileInfo *info,
+    GChecksumType type);
+void empathy_ft_hash_cache_store (GFile *file,
+    GFileInfo *info,
+    GChecksumType type,
+    const gchar *hash);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_FT_HASH_H__ */
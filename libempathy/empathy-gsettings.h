@@ -30,6 +30,9 @@ G_BEGIN_DECLS
 #define EMPATHY_PREFS_AUTOCONNECT                  "autoconnect"
 #define EMPATHY_PREFS_AUTOAWAY                     "autoaway"
 #define EMPATHY_PREFS_FILE_TRANSFER_DEFAULT_FOLDER "file-transfer-default-folder"
+#define EMPATHY_PREFS_FILE_TRANSFER_MAX_HASHING "file-transfer-max-hashing"
+#define EMPATHY_PREFS_FILE_TRANSFER_MAX_PER_CONTACT "file-transfer-max-per-contact"
+#define EMPATHY_PREFS_FILE_TRANSFER_MAX_PER_ACCOUNT "file-transfer-max-per-account"
 #define EMPATHY_PREFS_SANITY_CLEANING_NUMBER       "sanity-cleaning-number"
 
 #define EMPATHY_PREFS_NOTIFICATIONS_SCHEMA EMPATHY_PREFS_SCHEMA ".notifications"
@@ -77,6 +80,8 @@ G_BEGIN_DECLS
 #define EMPATHY_PREFS_UI_CHAT_WINDOW_PANED_POS     "chat-window-paned-pos"
 #define EMPATHY_PREFS_UI_SHOW_OFFLINE              "show-offline"
 #define EMPATHY_PREFS_UI_SHOW_GROUPS               "show-groups"
+#define EMPATHY_PREFS_UI_DEBUG_MAX_MESSAGES        "debug-window-max-messages"
+#define EMPATHY_PREFS_UI_DEBUG_MAX_KBYTES          "debug-window-max-kbytes"
 
 #define EMPATHY_PREFS_HINTS_SCHEMA EMPATHY_PREFS_SCHEMA ".hints"
 #define EMPATHY_PREFS_HINTS_CLOSE_MAIN_WINDOW      "close-main-window"
@@ -45,6 +45,23 @@
 /* The constant DAY_IN_SECONDS represents the seconds in a day */
 #define DAY_IN_SECONDS 86400
 
+/* Popularities decay with time even if nothing changes, so they are ranked
+ * again that often (in seconds) */
+#define RANK_INTERVAL 3600
+
+/* Maximum number of individuals added or removed in one members-changed
+ * signal when emitting batched changes */
+#define MEMBERS_CHANGED_CHUNK_SIZE 200
+
+/* Individuals added or removed which have not been announced yet */
+typedef struct
+{
+  /* reffed FolksIndividual, in the order they have been queued */
+  GQueue queue;
+  /* FolksIndividual (borrowed) -> GList (borrowed) link in queue */
+  GHashTable *links;
+} PendingMembers;
+
 /* This class only stores and refs Individuals who contain an EmpathyContact.
  *
  * This class merely forwards along signals from the aggregator and individuals
@@ -55,17 +72,44 @@ typedef struct
   GHashTable *individuals; /* Individual.id -> Individual */
   gboolean contacts_loaded;
 
-  /* reffed FolksIndividual sorted by popularity (most popular first) */
+  /* owned PopularityEntry sorted by popularity (most popular first) */
   GSequence *individuals_pop;
+  /* FolksIndividual (borrowed) -> GSequenceIter (borrowed) of its entry in
+   * individuals_pop */
+  GHashTable *individuals_pop_iters;
   /* The TOP_INDIVIDUALS_LEN first FolksIndividual (borrowed) from
    * individuals_pop */
   GList *top_individuals;
-  guint global_interaction_counter;
+  /* When individuals have last been ranked, in seconds */
+  gint64 rank_time;
+  guint rank_id;
+
+  /* If TRUE, members-changed is not emitted until the aggregator is
+   * quiescent; changes are then emitted in chunks from an idle callback. */
+  gboolean batch_members_changed;
+  gboolean aggregator_quiescent;
+  PendingMembers pending_added;
+  PendingMembers pending_removed;
+  guint flush_id;
+
+  /* Instrumentation of the initial loading of the individuals */
+  gint64 prepare_time;
+  guint initial_changes;
+  guint initial_individuals;
 } EmpathyIndividualManagerPriv;
 
+typedef struct
+{
+  /* owned */
+  FolksIndividual *individual;
+  /* Cached result of compute_popularity() */
+  guint popularity;
+} PopularityEntry;
+
 enum
 {
   PROP_TOP_INDIVIDUALS = 1,
+  PROP_BATCH_MEMBERS_CHANGED,
   N_PROPS
 };
 
@@ -98,12 +142,229 @@ individual_manager_get_property (GObject *object,
     {
       case PROP_TOP_INDIVIDUALS:
         g_value_set_pointer (value, priv->top_individuals);
+        break;
+      case PROP_BATCH_MEMBERS_CHANGED:
+        g_value_set_boolean (value, priv->batch_members_changed);
+        break;
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
     }
 }
 
+static void flush_all_pending_members (EmpathyIndividualManager *self);
+
+static void
+individual_manager_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  EmpathyIndividualManager *self = EMPATHY_INDIVIDUAL_MANAGER (object);
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+
+  switch (property_id)
+    {
+      case PROP_BATCH_MEMBERS_CHANGED:
+        priv->batch_members_changed = g_value_get_boolean (value);
+
+        if (!priv->batch_members_changed)
+          flush_all_pending_members (self);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+pending_members_init (PendingMembers *pending)
+{
+  g_queue_init (&pending->queue);
+  pending->links = g_hash_table_new (NULL, NULL);
+}
+
+static void
+pending_members_clear (PendingMembers *pending)
+{
+  g_queue_foreach (&pending->queue, (GFunc) g_object_unref, NULL);
+  g_queue_clear (&pending->queue);
+  tp_clear_pointer (&pending->links, g_hash_table_unref);
+}
+
+static void
+pending_members_add (PendingMembers *pending,
+    FolksIndividual *individual)
+{
+  if (g_hash_table_contains (pending->links, individual))
+    return;
+
+  g_queue_push_tail (&pending->queue, g_object_ref (individual));
+  g_hash_table_insert (pending->links, individual,
+      g_queue_peek_tail_link (&pending->queue));
+}
+
+/* Returns TRUE if @individual was pending */
+static gboolean
+pending_members_remove (PendingMembers *pending,
+    FolksIndividual *individual)
+{
+  GList *link;
+
+  link = g_hash_table_lookup (pending->links, individual);
+  if (link == NULL)
+    return FALSE;
+
+  g_hash_table_remove (pending->links, individual);
+  g_queue_delete_link (&pending->queue, link);
+  g_object_unref (individual);
+  return TRUE;
+}
+
+/* Returns a list of at most @max reffed FolksIndividual */
+static GList *
+pending_members_pop (PendingMembers *pending,
+    guint max)
+{
+  GList *list = NULL;
+  guint i;
+
+  for (i = 0; i < max && !g_queue_is_empty (&pending->queue); i++)
+    {
+      FolksIndividual *individual = g_queue_pop_head (&pending->queue);
+
+      g_hash_table_remove (pending->links, individual);
+      list = g_list_prepend (list, individual);
+    }
+
+  return g_list_reverse (list);
+}
+
+static void
+emit_contacts_loaded (EmpathyIndividualManager *self)
+{
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+
+  priv->contacts_loaded = TRUE;
+
+  DEBUG ("Initial population: %u individuals in %u changes, took %"
+      G_GINT64_FORMAT " ms", priv->initial_individuals, priv->initial_changes,
+      (g_get_monotonic_time () - priv->prepare_time) / 1000);
+
+  g_signal_emit (self, signals[CONTACTS_LOADED], 0);
+}
+
+static gboolean
+flush_pending_members_cb (gpointer user_data)
+{
+  EmpathyIndividualManager *self = user_data;
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GList *added = NULL, *removed;
+
+  /* Handle the removals first, as in aggregator_individuals_changed_cb() */
+  removed = pending_members_pop (&priv->pending_removed,
+      MEMBERS_CHANGED_CHUNK_SIZE);
+  if (removed == NULL)
+    added = pending_members_pop (&priv->pending_added,
+        MEMBERS_CHANGED_CHUNK_SIZE);
+
+  if (added == NULL && removed == NULL)
+    {
+      priv->flush_id = 0;
+
+      if (!priv->contacts_loaded)
+        emit_contacts_loaded (self);
+
+      return G_SOURCE_REMOVE;
+    }
+
+  g_signal_emit (self, signals[MEMBERS_CHANGED], 0, NULL, added, removed,
+      TP_CHANNEL_GROUP_CHANGE_REASON_NONE);
+
+  g_list_free_full (added, g_object_unref);
+  g_list_free_full (removed, g_object_unref);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Announces all the queued changes at once, so the ones which come next
+ * don't overtake them once batching has been turned off */
+static void
+flush_all_pending_members (EmpathyIndividualManager *self)
+{
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GList *added, *removed;
+
+  if (priv->flush_id != 0)
+    {
+      g_source_remove (priv->flush_id);
+      priv->flush_id = 0;
+    }
+
+  removed = pending_members_pop (&priv->pending_removed, G_MAXUINT);
+  added = pending_members_pop (&priv->pending_added, G_MAXUINT);
+
+  if (added != NULL || removed != NULL)
+    g_signal_emit (self, signals[MEMBERS_CHANGED], 0, NULL, added, removed,
+        TP_CHANNEL_GROUP_CHANGE_REASON_NONE);
+
+  g_list_free_full (added, g_object_unref);
+  g_list_free_full (removed, g_object_unref);
+
+  if (priv->aggregator_quiescent && !priv->contacts_loaded)
+    emit_contacts_loaded (self);
+}
+
+static void
+start_flushing_pending_members (EmpathyIndividualManager *self)
+{
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+
+  if (priv->flush_id != 0)
+    return;
+
+  priv->flush_id = g_idle_add (flush_pending_members_cb, self);
+}
+
+/* Emit members-changed, or queue the changes if we are batching them */
+static void
+members_changed (EmpathyIndividualManager *self,
+    GList *added,
+    GList *removed)
+{
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GList *l;
+
+  if (added == NULL && removed == NULL)
+    return;
+
+  if (!priv->batch_members_changed ||
+      (priv->aggregator_quiescent && priv->flush_id == 0))
+    {
+      g_signal_emit (self, signals[MEMBERS_CHANGED], 0, NULL, added, removed,
+          TP_CHANNEL_GROUP_CHANGE_REASON_NONE /* FIXME */);
+      return;
+    }
+
+  /* An individual added and removed before being announced doesn't have to be
+   * announced at all. */
+  for (l = removed; l != NULL; l = g_list_next (l))
+    {
+      if (!pending_members_remove (&priv->pending_added, l->data))
+        pending_members_add (&priv->pending_removed, l->data);
+    }
+
+  for (l = added; l != NULL; l = g_list_next (l))
+    {
+      if (!pending_members_remove (&priv->pending_removed, l->data))
+        pending_members_add (&priv->pending_added, l->data);
+    }
+
+  /* Don't let changes happening while flushing overtake the queued ones */
+  if (priv->aggregator_quiescent)
+    start_flushing_pending_members (self);
+}
+
 static void
 individual_group_changed_cb (FolksIndividual *individual,
     gchar *group,
@@ -126,23 +387,43 @@ individual_notify_is_favourite_cb (FolksIndividual *individual,
 }
 
 
+static PopularityEntry *
+popularity_entry_new (FolksIndividual *individual,
+    guint popularity)
+{
+  PopularityEntry *entry = g_slice_new (PopularityEntry);
+
+  entry->individual = g_object_ref (individual);
+  entry->popularity = popularity;
+  return entry;
+}
+
+static void
+popularity_entry_free (PopularityEntry *entry)
+{
+  g_object_unref (entry->individual);
+  g_slice_free (PopularityEntry, entry);
+}
+
 /* Contacts that have been interacted with within the last 30 days and have
  * have an interaction count > INTERACTION_COUNT_COMPRESS_FACTOR have a
- * popularity value of the count/INTERACTION_COUNT_COMPRESS_FACTOR */
+ * popularity value of the count/INTERACTION_COUNT_COMPRESS_FACTOR.
+ *
+ * @current_timestamp is the current time, in seconds, so it's fetched only
+ * once when ranking several individuals. */
 static guint
-compute_popularity (FolksIndividual *individual)
+compute_popularity (FolksIndividual *individual,
+    gint64 current_timestamp)
 {
   FolksInteractionDetails *details = FOLKS_INTERACTION_DETAILS (individual);
   GDateTime *last;
-  guint  current_timestamp, count;
+  guint count;
   float timediff;
 
   last = folks_interaction_details_get_last_im_interaction_datetime (details);
   if (last == NULL)
     return 0;
 
-  /* Convert g_get_real_time () fro microseconds to seconds */
-  current_timestamp = g_get_real_time () / 1000000;
   timediff = current_timestamp - g_date_time_to_unix (last);
 
   if (timediff / DAY_IN_SECONDS > 30)
@@ -172,12 +453,11 @@ check_top_individuals (EmpathyIndividualManager *self)
    * still the same as the ones in top_individuals */
   for (i = 0; i < TOP_INDIVIDUALS_LEN && !g_sequence_iter_is_end (iter); i++)
     {
-      FolksIndividual *individual = g_sequence_get (iter);
-      guint pop;
+      PopularityEntry *entry = g_sequence_get (iter);
+      FolksIndividual *individual = entry->individual;
 
       /* Don't include individual having 0 as pop */
-      pop = compute_popularity (individual);
-      if (pop <= 0)
+      if (entry->popularity == 0)
         break;
 
       if (!modified)
@@ -210,10 +490,16 @@ check_top_individuals (EmpathyIndividualManager *self)
       for (l = priv->top_individuals; l != NULL; l = g_list_next (l))
         {
           FolksIndividual *individual = l->data;
+          GSequenceIter *pop_iter;
+          PopularityEntry *entry;
+
+          pop_iter = g_hash_table_lookup (priv->individuals_pop_iters,
+              individual);
+          entry = g_sequence_get (pop_iter);
 
           DEBUG ("  %s (%u)",
               folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)),
-              compute_popularity (individual));
+              entry->popularity);
         }
 
       g_object_notify (G_OBJECT (self), "top-individuals");
@@ -225,12 +511,65 @@ compare_individual_by_pop (gconstpointer a,
     gconstpointer b,
     gpointer user_data)
 {
-  guint pop_a, pop_b;
+  const PopularityEntry *entry_a = a, *entry_b = b;
 
-  pop_a = compute_popularity (FOLKS_INDIVIDUAL (a));
-  pop_b = compute_popularity (FOLKS_INDIVIDUAL (b));
+  if (entry_a->popularity == entry_b->popularity)
+    return 0;
 
-  return pop_b - pop_a;
+  return entry_a->popularity > entry_b->popularity ? -1 : 1;
+}
+
+static gint64
+get_current_timestamp (void)
+{
+  /* Convert g_get_real_time () from microseconds to seconds */
+  return g_get_real_time () / G_USEC_PER_SEC;
+}
+
+/* Recompute the popularity of all the individuals, for example because some
+ * of them may have not been interacted with for more than 30 days now. */
+static void
+rank_individuals (EmpathyIndividualManager *self)
+{
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GSequenceIter *iter;
+  gint64 now;
+
+  now = get_current_timestamp ();
+  priv->rank_time = now;
+
+  for (iter = g_sequence_get_begin_iter (priv->individuals_pop);
+      !g_sequence_iter_is_end (iter);
+      iter = g_sequence_iter_next (iter))
+    {
+      PopularityEntry *entry = g_sequence_get (iter);
+
+      entry->popularity = compute_popularity (entry->individual, now);
+    }
+
+  g_sequence_sort (priv->individuals_pop, compare_individual_by_pop, NULL);
+
+  check_top_individuals (self);
+}
+
+static gboolean
+rank_individuals_cb (gpointer user_data)
+{
+  rank_individuals (user_data);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Rank the individuals again if it's been too long, in case the periodic
+ * ranking has been delayed, for instance by a suspended computer */
+static void
+rank_individuals_if_stale (EmpathyIndividualManager *self)
+{
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+
+  if (priv->aggregator_quiescent &&
+      get_current_timestamp () - priv->rank_time > RANK_INTERVAL)
+    rank_individuals (self);
 }
 
 static void
@@ -239,31 +578,53 @@ individual_notify_im_interaction_count (FolksIndividual *individual,
     EmpathyIndividualManager *self)
 {
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GSequenceIter *iter;
+  PopularityEntry *entry;
+  guint pop;
+  gboolean was_top;
 
-  /* We don't use g_sequence_sort_changed() because we'll first have to find
-   * the iter of @individual using g_sequence_lookup() but the lookup function
-   * won't work as it assumes that the sequence is sorted which is no longer
-   * the case at this point as @individual's popularity just changed. */
-  g_sequence_sort (priv->individuals_pop, compare_individual_by_pop, NULL);
+  iter = g_hash_table_lookup (priv->individuals_pop_iters, individual);
+  if (iter == NULL)
+    return;
+
+  entry = g_sequence_get (iter);
+
+  pop = compute_popularity (individual, get_current_timestamp ());
+  if (pop == entry->popularity)
+    /* The interaction count is compressed so most of the changes don't
+     * affect the popularity */
+    return;
 
-  /* Only check for top individuals after 10 interaction events happen */
-  if (priv->global_interaction_counter % 10 == 0)
+  was_top = (g_list_find (priv->top_individuals, individual) != NULL);
+
+  /* Only move @individual, the others are still sorted */
+  entry->popularity = pop;
+  g_sequence_sort_changed (iter, compare_individual_by_pop, NULL);
+
+  /* The top individuals can only change if @individual entered or left
+   * them. */
+  if (was_top || g_sequence_iter_get_position (iter) < TOP_INDIVIDUALS_LEN)
     check_top_individuals (self);
-  priv->global_interaction_counter++;
 }
 
 static void
 add_individual (EmpathyIndividualManager *self, FolksIndividual *individual)
 {
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GSequenceIter *iter;
 
   g_hash_table_insert (priv->individuals,
       g_strdup (folks_individual_get_id (individual)),
       g_object_ref (individual));
 
-  g_sequence_insert_sorted (priv->individuals_pop, g_object_ref (individual),
+  iter = g_sequence_insert_sorted (priv->individuals_pop,
+      popularity_entry_new (individual,
+        compute_popularity (individual, get_current_timestamp ())),
       compare_individual_by_pop, NULL);
-  check_top_individuals (self);
+  g_hash_table_insert (priv->individuals_pop_iters, individual, iter);
+
+  if (g_sequence_iter_get_position (iter) < TOP_INDIVIDUALS_LEN)
+    check_top_individuals (self);
 
   g_signal_connect (individual, "group-changed",
       G_CALLBACK (individual_group_changed_cb), self);
@@ -279,17 +640,24 @@ remove_individual (EmpathyIndividualManager *self, FolksIndividual *individual)
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
   GSequenceIter *iter;
 
-  iter = g_sequence_lookup (priv->individuals_pop, individual,
-      compare_individual_by_pop, NULL);
+  iter = g_hash_table_lookup (priv->individuals_pop_iters, individual);
   if (iter != NULL)
     {
+      gboolean was_top;
+
+      was_top = (g_list_find (priv->top_individuals, individual) != NULL);
+
       /* priv->top_individuals borrows its reference from
        * priv->individuals_pop so we take a reference on the individual while
        * removing it to make sure it stays alive while calling
        * check_top_individuals(). */
       g_object_ref (individual);
+      g_hash_table_remove (priv->individuals_pop_iters, individual);
       g_sequence_remove (iter);
-      check_top_individuals (self);
+
+      if (was_top)
+        check_top_individuals (self);
+
       g_object_unref (individual);
     }
 
@@ -325,8 +693,7 @@ individual_notify_personas_cb (FolksIndividual *individual,
 
       /* The Individual has lost its EmpathyContact */
       removed = g_list_prepend (removed, individual);
-      g_signal_emit (self, signals[MEMBERS_CHANGED], 0, NULL, NULL, removed,
-          TP_CHANNEL_GROUP_CHANGE_REASON_NONE /* FIXME */);
+      members_changed (self, NULL, removed);
       g_list_free (removed);
 
       remove_individual (self, individual);
@@ -339,8 +706,7 @@ individual_notify_personas_cb (FolksIndividual *individual,
       add_individual (self, individual);
 
       added = g_list_prepend (added, individual);
-      g_signal_emit (self, signals[MEMBERS_CHANGED], 0, NULL, added, NULL,
-          TP_CHANNEL_GROUP_CHANGE_REASON_NONE /* FIXME */);
+      members_changed (self, added, NULL);
       g_list_free (added);
     }
 }
@@ -354,7 +720,11 @@ aggregator_individuals_changed_cb (FolksIndividualAggregator *aggregator,
   GeeIterator *iter;
   GeeSet *removed;
   GeeCollection *added;
-  GList *added_set = NULL, *added_filtered = NULL, *removed_list = NULL;
+  GHashTable *added_set;
+  GList *added_filtered = NULL, *removed_list = NULL;
+
+  if (!priv->aggregator_quiescent)
+    priv->initial_changes++;
 
   /* We're not interested in the relationships between the added and removed
    * individuals, so just extract collections of them. Note that the added
@@ -387,15 +757,16 @@ aggregator_individuals_changed_cb (FolksIndividualAggregator *aggregator,
   g_clear_object (&iter);
 
   /* Filter the individuals for ones which contain EmpathyContacts */
+  added_set = g_hash_table_new (NULL, NULL);
   iter = gee_iterable_iterator (GEE_ITERABLE (added));
   while (gee_iterator_next (iter))
     {
       FolksIndividual *ind = gee_iterator_get (iter);
 
       /* Make sure we handle each added individual only once. */
-      if (ind == NULL || g_list_find (added_set, ind) != NULL)
+      if (ind == NULL || g_hash_table_contains (added_set, ind))
         goto while_next;
-      added_set = g_list_prepend (added_set, ind);
+      g_hash_table_add (added_set, ind);
 
       g_signal_connect (ind, "notify::personas",
           G_CALLBACK (individual_notify_personas_cb), self);
@@ -411,21 +782,18 @@ while_next:
     }
   g_clear_object (&iter);
 
-  g_list_free (added_set);
+  g_hash_table_unref (added_set);
 
   g_object_unref (added);
   g_object_unref (removed);
 
-  /* Bail if we have no individuals left */
-  if (added_filtered == NULL && removed == NULL)
-    return;
+  if (!priv->aggregator_quiescent)
+    priv->initial_individuals = g_hash_table_size (priv->individuals);
 
   added_filtered = g_list_reverse (added_filtered);
 
-  g_signal_emit (self, signals[MEMBERS_CHANGED], 0, NULL,
-      added_filtered, removed_list,
-      TP_CHANNEL_GROUP_CHANGE_REASON_NONE,
-      TRUE);
+  /* Does nothing if we have no individuals left */
+  members_changed (self, added_filtered, removed_list);
 
   g_list_free (added_filtered);
   g_list_free (removed_list);
@@ -436,7 +804,22 @@ individual_manager_dispose (GObject *object)
 {
   EmpathyIndividualManagerPriv *priv = GET_PRIV (object);
 
-  g_hash_table_unref (priv->individuals);
+  if (priv->flush_id != 0)
+    {
+      g_source_remove (priv->flush_id);
+      priv->flush_id = 0;
+    }
+
+  if (priv->rank_id != 0)
+    {
+      g_source_remove (priv->rank_id);
+      priv->rank_id = 0;
+    }
+
+  pending_members_clear (&priv->pending_added);
+  pending_members_clear (&priv->pending_removed);
+
+  tp_clear_pointer (&priv->individuals, g_hash_table_unref);
 
   tp_clear_object (&priv->aggregator);
 
@@ -448,6 +831,7 @@ individual_manager_finalize (GObject *object)
 {
   EmpathyIndividualManagerPriv *priv = GET_PRIV (object);
 
+  g_hash_table_unref (priv->individuals_pop_iters);
   g_sequence_free (priv->individuals_pop);
 
   G_OBJECT_CLASS (empathy_individual_manager_parent_class)->finalize (object);
@@ -501,6 +885,7 @@ empathy_individual_manager_class_init (EmpathyIndividualManagerClass *klass)
   GParamSpec *spec;
 
   object_class->get_property = individual_manager_get_property;
+  object_class->set_property = individual_manager_set_property;
   object_class->dispose = individual_manager_dispose;
   object_class->finalize = individual_manager_finalize;
   object_class->constructor = individual_manager_constructor;
@@ -510,6 +895,15 @@ empathy_individual_manager_class_init (EmpathyIndividualManagerClass *klass)
       G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
   g_object_class_install_property (object_class, PROP_TOP_INDIVIDUALS, spec);
 
+  spec = g_param_spec_boolean ("batch-members-changed",
+      "batch members changed",
+      "Delay members-changed until all the individuals are loaded and then "
+      "emit it in chunks",
+      FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_BATCH_MEMBERS_CHANGED,
+      spec);
+
   signals[GROUPS_CHANGED] =
       g_signal_new ("groups-changed",
           G_TYPE_FROM_CLASS (klass),
@@ -560,7 +954,7 @@ aggregator_is_quiescent_notify_cb (FolksIndividualAggregator *aggregator,
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
   gboolean is_quiescent;
 
-  if (priv->contacts_loaded)
+  if (priv->aggregator_quiescent)
     return;
 
   g_object_get (aggregator, "is-quiescent", &is_quiescent, NULL);
@@ -568,9 +962,25 @@ aggregator_is_quiescent_notify_cb (FolksIndividualAggregator *aggregator,
   if (!is_quiescent)
     return;
 
-  priv->contacts_loaded = TRUE;
+  priv->aggregator_quiescent = TRUE;
 
-  g_signal_emit (self, signals[CONTACTS_LOADED], 0);
+  /* Popularities have been computed as individuals were added; rank them
+   * again now that everything is loaded, and from time to time as they
+   * decay. */
+  rank_individuals (self);
+  priv->rank_id = g_timeout_add_seconds (RANK_INTERVAL, rank_individuals_cb,
+      self);
+
+  if (!g_queue_is_empty (&priv->pending_added.queue) ||
+      !g_queue_is_empty (&priv->pending_removed.queue))
+    {
+      /* contacts-loaded will be emitted once all the batched changes have
+       * been announced. */
+      start_flushing_pending_members (self);
+      return;
+    }
+
+  emit_contacts_loaded (self);
 }
 
 static void
@@ -583,13 +993,19 @@ empathy_individual_manager_init (EmpathyIndividualManager *self)
   priv->individuals = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, g_object_unref);
 
-  priv->individuals_pop = g_sequence_new (g_object_unref);
+  priv->individuals_pop = g_sequence_new (
+      (GDestroyNotify) popularity_entry_free);
+  priv->individuals_pop_iters = g_hash_table_new (NULL, NULL);
+
+  pending_members_init (&priv->pending_added);
+  pending_members_init (&priv->pending_removed);
 
   priv->aggregator = folks_individual_aggregator_dup ();
   tp_g_signal_connect_object (priv->aggregator, "individuals-changed-detailed",
       G_CALLBACK (aggregator_individuals_changed_cb), self, 0);
   tp_g_signal_connect_object (priv->aggregator, "notify::is-quiescent",
       G_CALLBACK (aggregator_is_quiescent_notify_cb), self, 0);
+  priv->prepare_time = g_get_monotonic_time ();
   folks_individual_aggregator_prepare (priv->aggregator, NULL, NULL);
 }
 
@@ -603,10 +1019,30 @@ GList *
 empathy_individual_manager_get_members (EmpathyIndividualManager *self)
 {
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GHashTableIter iter;
+  gpointer individual;
+  GList *members = NULL, *l;
 
   g_return_val_if_fail (EMPATHY_IS_INDIVIDUAL_MANAGER (self), NULL);
 
-  return g_hash_table_get_values (priv->individuals);
+  /* disposed */
+  if (priv->individuals == NULL)
+    return NULL;
+
+  /* Only return the individuals announced by members-changed, so callers
+   * listening to it afterwards don't get them twice, or miss removals. */
+  g_hash_table_iter_init (&iter, priv->individuals);
+  while (g_hash_table_iter_next (&iter, NULL, &individual))
+    {
+      if (priv->pending_added.links == NULL ||
+          !g_hash_table_contains (priv->pending_added.links, individual))
+        members = g_list_prepend (members, individual);
+    }
+
+  for (l = priv->pending_removed.queue.head; l != NULL; l = g_list_next (l))
+    members = g_list_prepend (members, l->data);
+
+  return members;
 }
 
 FolksIndividual *
@@ -617,6 +1053,9 @@ empathy_individual_manager_lookup_member (EmpathyIndividualManager *self,
 
   g_return_val_if_fail (EMPATHY_IS_INDIVIDUAL_MANAGER (self), NULL);
 
+  if (priv->individuals == NULL)
+    return NULL;
+
   return g_hash_table_lookup (priv->individuals, id);
 }
 
@@ -906,6 +1345,8 @@ empathy_individual_manager_get_top_individuals (EmpathyIndividualManager *self)
 {
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
 
+  rank_individuals_if_stale (self);
+
   return priv->top_individuals;
 }
 
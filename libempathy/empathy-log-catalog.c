@@ -0,0 +1,479 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Remembers which contacts and rooms of each account have logs, so menus
+ * and account choosers can tell without asking the logger synchronously.
+ * The logs of all the accounts are listed when the catalog is created,
+ * and the channels observed afterwards are added to it. */
+
+#include "config.h"
+#include "empathy-log-catalog.h"
+
+#include <telepathy-logger/telepathy-logger.h>
+#include <tp-account-widgets/tpaw-utils.h>
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+G_DEFINE_TYPE (EmpathyLogCatalog, empathy_log_catalog, G_TYPE_OBJECT);
+
+struct _EmpathyLogCatalogPriv
+{
+  TpAccountManager *account_manager;
+  TplLogManager *log_manager;
+  TpBaseClient *observer;
+
+  /* owned account path -> owned AccountLogs */
+  GHashTable *accounts;
+};
+
+typedef struct
+{
+  /* owned identifiers of the contacts and rooms with logs */
+  GHashTable *ids;
+  gboolean listing;
+  gboolean listed;
+  /* The logs, or the whole account, have been removed while listing
+   * them: what's being listed is gone */
+  gboolean cleared;
+  gboolean removed;
+  /* owned GSimpleAsyncResult waiting for the listing to be done */
+  GList *waiting;
+} AccountLogs;
+
+typedef struct
+{
+  EmpathyLogCatalog *self;
+  TpAccount *account;
+} ListCtx;
+
+static void
+account_logs_free (AccountLogs *logs)
+{
+  g_hash_table_unref (logs->ids);
+  g_list_free_full (logs->waiting, g_object_unref);
+  g_slice_free (AccountLogs, logs);
+}
+
+static AccountLogs *
+ensure_account (EmpathyLogCatalog *self,
+    TpAccount *account)
+{
+  const gchar *path = tp_proxy_get_object_path (account);
+  AccountLogs *logs;
+
+  logs = g_hash_table_lookup (self->priv->accounts, path);
+  if (logs == NULL)
+    {
+      logs = g_slice_new0 (AccountLogs);
+      logs->ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+          NULL);
+      g_hash_table_insert (self->priv->accounts, g_strdup (path), logs);
+    }
+
+  return logs;
+}
+
+static void
+got_entities_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  ListCtx *ctx = user_data;
+  AccountLogs *logs;
+  GList *entities = NULL, *waiting, *l;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_entities_finish (TPL_LOG_MANAGER (source),
+        result, &entities, &error))
+    {
+      DEBUG ("Failed to list the logs of %s: %s",
+          tp_proxy_get_object_path (ctx->account), error->message);
+      g_error_free (error);
+    }
+
+  /* Channels may have been added to the account in the meantime */
+  logs = ensure_account (ctx->self, ctx->account);
+
+  for (l = entities; l != NULL && !logs->cleared; l = l->next)
+    g_hash_table_add (logs->ids,
+        g_strdup (tpl_entity_get_identifier (l->data)));
+
+  g_list_free_full (entities, g_object_unref);
+
+  DEBUG ("%s has logs with %u contacts and rooms",
+      tp_proxy_get_object_path (ctx->account),
+      g_hash_table_size (logs->ids));
+
+  logs->listing = FALSE;
+  logs->listed = TRUE;
+  logs->cleared = FALSE;
+
+  waiting = logs->waiting;
+  logs->waiting = NULL;
+
+  for (l = waiting; l != NULL; l = l->next)
+    g_simple_async_result_complete (l->data);
+
+  g_list_free_full (waiting, g_object_unref);
+
+  if (logs->removed)
+    g_hash_table_remove (ctx->self->priv->accounts,
+        tp_proxy_get_object_path (ctx->account));
+
+  g_object_unref (ctx->account);
+  g_object_unref (ctx->self);
+  g_slice_free (ListCtx, ctx);
+}
+
+static AccountLogs *
+list_account (EmpathyLogCatalog *self,
+    TpAccount *account)
+{
+  AccountLogs *logs;
+  ListCtx *ctx;
+
+  logs = ensure_account (self, account);
+
+  if (logs->listing || logs->listed)
+    return logs;
+
+  logs->listing = TRUE;
+
+  ctx = g_slice_new0 (ListCtx);
+  ctx->self = g_object_ref (self);
+  ctx->account = g_object_ref (account);
+
+  tpl_log_manager_get_entities_async (self->priv->log_manager, account,
+      got_entities_cb, ctx);
+
+  return logs;
+}
+
+static void
+account_manager_prepared_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogCatalog *self = user_data;
+  GList *accounts, *l;
+  GError *error = NULL;
+
+  if (!tp_proxy_prepare_finish (source, result, &error))
+    {
+      DEBUG ("Failed to prepare the account manager: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  accounts = tp_account_manager_dup_valid_accounts (
+      TP_ACCOUNT_MANAGER (source));
+
+  for (l = accounts; l != NULL; l = l->next)
+    list_account (self, l->data);
+
+  g_list_free_full (accounts, g_object_unref);
+
+out:
+  g_object_unref (self);
+}
+
+static void
+account_removed_cb (TpAccountManager *account_manager,
+    TpAccount *account,
+    EmpathyLogCatalog *self)
+{
+  AccountLogs *logs;
+
+  logs = g_hash_table_lookup (self->priv->accounts,
+      tp_proxy_get_object_path (account));
+
+  /* The listing in progress still needs it, and will drop it once done
+   * rather than adding the logs it found */
+  if (logs != NULL && logs->listing)
+    {
+      g_hash_table_remove_all (logs->ids);
+      logs->cleared = TRUE;
+      logs->removed = TRUE;
+    }
+  else
+    g_hash_table_remove (self->priv->accounts,
+        tp_proxy_get_object_path (account));
+}
+
+static void
+observe_channels_cb (TpSimpleObserver *observer,
+    TpAccount *account,
+    TpConnection *connection,
+    GList *channels,
+    TpChannelDispatchOperation *dispatch_operation,
+    GList *requests,
+    TpObserveChannelsContext *context,
+    gpointer user_data)
+{
+  EmpathyLogCatalog *self = user_data;
+  GList *l;
+
+  /* The logger keeps the events of these channels, the catalog may be a
+   * bit optimistic if nothing is said in it */
+  for (l = channels; l != NULL; l = l->next)
+    {
+      const gchar *id = tp_channel_get_identifier (l->data);
+
+      if (!tp_str_empty (id))
+        empathy_log_catalog_add (self, account, id);
+    }
+
+  tp_observe_channels_context_accept (context);
+}
+
+static void
+empathy_log_catalog_constructed (GObject *object)
+{
+  EmpathyLogCatalog *self = EMPATHY_LOG_CATALOG (object);
+  GError *error = NULL;
+
+  G_OBJECT_CLASS (empathy_log_catalog_parent_class)->constructed (object);
+
+  self->priv->account_manager = tp_account_manager_dup ();
+  self->priv->log_manager = tpl_log_manager_dup_singleton ();
+
+  tp_g_signal_connect_object (self->priv->account_manager, "account-removed",
+      G_CALLBACK (account_removed_cb), self, 0);
+
+  tp_proxy_prepare_async (self->priv->account_manager, NULL,
+      account_manager_prepared_cb, g_object_ref (self));
+
+  self->priv->observer = tp_simple_observer_new_with_am (
+      self->priv->account_manager, TRUE, "Empathy.LogCatalog", TRUE,
+      observe_channels_cb, self, NULL);
+
+  tp_base_client_take_observer_filter (self->priv->observer,
+      tp_asv_new (
+          TP_PROP_CHANNEL_CHANNEL_TYPE, G_TYPE_STRING,
+            TP_IFACE_CHANNEL_TYPE_TEXT,
+          NULL));
+  tp_base_client_take_observer_filter (self->priv->observer,
+      tp_asv_new (
+          TP_PROP_CHANNEL_CHANNEL_TYPE, G_TYPE_STRING,
+            TP_IFACE_CHANNEL_TYPE_CALL,
+          NULL));
+
+  if (!tp_base_client_register (self->priv->observer, &error))
+    {
+      DEBUG ("Failed to register the observer: %s", error->message);
+      g_error_free (error);
+    }
+}
+
+static void
+empathy_log_catalog_dispose (GObject *object)
+{
+  EmpathyLogCatalog *self = EMPATHY_LOG_CATALOG (object);
+
+  if (self->priv->observer != NULL)
+    {
+      tp_base_client_unregister (self->priv->observer);
+      tp_clear_object (&self->priv->observer);
+    }
+
+  tp_clear_object (&self->priv->account_manager);
+  tp_clear_object (&self->priv->log_manager);
+
+  G_OBJECT_CLASS (empathy_log_catalog_parent_class)->dispose (object);
+}
+
+static void
+empathy_log_catalog_finalize (GObject *object)
+{
+  EmpathyLogCatalog *self = EMPATHY_LOG_CATALOG (object);
+
+  g_hash_table_unref (self->priv->accounts);
+
+  G_OBJECT_CLASS (empathy_log_catalog_parent_class)->finalize (object);
+}
+
+static void
+empathy_log_catalog_class_init (EmpathyLogCatalogClass *klass)
+{
+  GObjectClass *oclass = G_OBJECT_CLASS (klass);
+
+  oclass->constructed = empathy_log_catalog_constructed;
+  oclass->dispose = empathy_log_catalog_dispose;
+  oclass->finalize = empathy_log_catalog_finalize;
+
+  g_type_class_add_private (klass, sizeof (EmpathyLogCatalogPriv));
+}
+
+static void
+empathy_log_catalog_init (EmpathyLogCatalog *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_LOG_CATALOG, EmpathyLogCatalogPriv);
+
+  self->priv->accounts = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) account_logs_free);
+}
+
+EmpathyLogCatalog *
+empathy_log_catalog_dup_singleton (void)
+{
+  static EmpathyLogCatalog *catalog = NULL;
+
+  if (G_LIKELY (catalog != NULL))
+      return g_object_ref (catalog);
+
+  catalog = g_object_new (EMPATHY_TYPE_LOG_CATALOG, NULL);
+
+  g_object_add_weak_pointer (G_OBJECT (catalog), (gpointer *) &catalog);
+  return catalog;
+}
+
+/**
+ * empathy_log_catalog_has_logs:
+ * @self: a #EmpathyLogCatalog
+ * @account: a #TpAccount
+ * @id: the identifier of a contact or a room
+ *
+ * Never blocks: if the logs of @account haven't been listed yet, they
+ * start being listed and %FALSE is returned.
+ *
+ * Returns: %TRUE if there are logs with @id on @account
+ */
+gboolean
+empathy_log_catalog_has_logs (EmpathyLogCatalog *self,
+    TpAccount *account,
+    const gchar *id)
+{
+  AccountLogs *logs;
+
+  g_return_val_if_fail (EMPATHY_IS_LOG_CATALOG (self), FALSE);
+  g_return_val_if_fail (TP_IS_ACCOUNT (account), FALSE);
+
+  if (id == NULL)
+    return FALSE;
+
+  logs = list_account (self, account);
+
+  /* Channels observed while listing are already there */
+  return g_hash_table_contains (logs->ids, id);
+}
+
+/* Calls back once the logs of @account have been listed */
+void
+empathy_log_catalog_prepare_account_async (EmpathyLogCatalog *self,
+    TpAccount *account,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GSimpleAsyncResult *result;
+  AccountLogs *logs;
+
+  g_return_if_fail (EMPATHY_IS_LOG_CATALOG (self));
+  g_return_if_fail (TP_IS_ACCOUNT (account));
+
+  result = g_simple_async_result_new (G_OBJECT (self), callback, user_data,
+      empathy_log_catalog_prepare_account_async);
+
+  logs = list_account (self, account);
+
+  if (logs->listed)
+    {
+      g_simple_async_result_complete_in_idle (result);
+      g_object_unref (result);
+      return;
+    }
+
+  logs->waiting = g_list_prepend (logs->waiting, result);
+}
+
+gboolean
+empathy_log_catalog_prepare_account_finish (EmpathyLogCatalog *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  tpaw_implement_finish_void (self,
+      empathy_log_catalog_prepare_account_async);
+}
+
+/* Returns: %TRUE if @account is known to have logs */
+gboolean
+empathy_log_catalog_account_has_logs (EmpathyLogCatalog *self,
+    TpAccount *account)
+{
+  AccountLogs *logs;
+
+  g_return_val_if_fail (EMPATHY_IS_LOG_CATALOG (self), FALSE);
+  g_return_val_if_fail (TP_IS_ACCOUNT (account), FALSE);
+
+  logs = g_hash_table_lookup (self->priv->accounts,
+      tp_proxy_get_object_path (account));
+
+  return logs != NULL && g_hash_table_size (logs->ids) > 0;
+}
+
+/* To be called when events with @id are logged on @account */
+void
+empathy_log_catalog_add (EmpathyLogCatalog *self,
+    TpAccount *account,
+    const gchar *id)
+{
+  AccountLogs *logs;
+
+  g_return_if_fail (EMPATHY_IS_LOG_CATALOG (self));
+  g_return_if_fail (TP_IS_ACCOUNT (account));
+  g_return_if_fail (id != NULL);
+
+  logs = ensure_account (self, account);
+
+  if (!g_hash_table_contains (logs->ids, id))
+    g_hash_table_add (logs->ids, g_strdup (id));
+}
+
+/* To be called when the logs of @account, or of all the accounts if it's
+ * %NULL, have been removed */
+void
+empathy_log_catalog_clear (EmpathyLogCatalog *self,
+    TpAccount *account)
+{
+  GHashTableIter iter;
+  AccountLogs *logs;
+
+  g_return_if_fail (EMPATHY_IS_LOG_CATALOG (self));
+
+  if (account != NULL)
+    {
+      logs = g_hash_table_lookup (self->priv->accounts,
+          tp_proxy_get_object_path (account));
+
+      if (logs != NULL)
+        {
+          g_hash_table_remove_all (logs->ids);
+          logs->cleared = logs->listing;
+        }
+
+      return;
+    }
+
+  g_hash_table_iter_init (&iter, self->priv->accounts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &logs))
+    {
+      g_hash_table_remove_all (logs->ids);
+      logs->cleared = logs->listing;
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_LOG_CATALOG_H__
+#define __EMPATHY_LOG_CATALOG_H__
+
+#include <gio/gio.h>
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathyLogCatalog EmpathyLogCatalog;
+typedef struct _EmpathyLogCatalogClass EmpathyLogCatalogClass;
+typedef struct _EmpathyLogCatalogPriv EmpathyLogCatalogPriv;
+
+struct _EmpathyLogCatalogClass
+{
+  GObjectClass parent_class;
+};
+
+struct _EmpathyLogCatalog
+{
+  GObject parent;
+  EmpathyLogCatalogPriv *priv;
+};
+
+GType empathy_log_catalog_get_type (void);
+
+#define EMPATHY_TYPE_LOG_CATALOG \
+  (empathy_log_catalog_get_type ())
+#define EMPATHY_LOG_CATALOG(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), EMPATHY_TYPE_LOG_CATALOG, \
+    EmpathyLogCatalog))
+#define EMPATHY_LOG_CATALOG_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), EMPATHY_TYPE_LOG_CATALOG, \
+    EmpathyLogCatalogClass))
+#define EMPATHY_IS_LOG_CATALOG(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), EMPATHY_TYPE_LOG_CATALOG))
+#define EMPATHY_IS_LOG_CATALOG_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), EMPATHY_TYPE_LOG_CATALOG))
+#define EMPATHY_LOG_CATALOG_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), EMPATHY_TYPE_LOG_CATALOG, \
+    EmpathyLogCatalogClass))
+
+EmpathyLogCatalog * empathy_log_catalog_dup_singleton (void);
+
+gboolean empathy_log_catalog_has_logs (EmpathyLogCatalog *self,
+    TpAccount *account,
+    const gchar *id);
+
+void empathy_log_catalog_prepare_account_async (EmpathyLogCatalog *self,
+    TpAccount *account,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+gboolean empathy_log_catalog_prepare_account_finish (EmpathyLogCatalog *self,
+    GAsyncResult *result,
+    GError **error);
+
+gboolean empathy_log_catalog_account_has_logs (EmpathyLogCatalog *self,
+    TpAccount *account);
+
+void empathy_log_catalog_add (EmpathyLogCatalog *self,
+    TpAccount *account,
+    const gchar *id);
+
+void empathy_log_catalog_clear (EmpathyLogCatalog *self,
+    TpAccount *account);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_LOG_CATALOG_H__ */
@@ -0,0 +1,1288 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Exports the logs of some accounts to an archive made of one gzip member
+ * per conversation day, so it can be read as a whole with zcat and new
+ * days can be appended to it. Alongside, ARCHIVE.index has one line per
+ * member, "date\taccount path\tidentifier\toffset\tlength", to read a day
+ * without uncompressing the whole archive.
+ *
+ * A member starts with a "# account date identifier" line, followed by one
+ * line per event: "timestamp\tkind\tsender id\tsender alias\tcontent", the
+ * tabs, new lines and backslashes being escaped.
+ *
+ * Only one day of events is fetched while the previous one is compressed
+ * and written by a thread, so exporting years of logs doesn't take more
+ * memory than a couple of days.
+ *
+ * Exporting the same logs again appends new copies of their days, so the
+ * archive can be compacted to keep only the latest copy of each. */
+
+#include "config.h"
+#include "empathy-log-exporter.h"
+
+#include <string.h>
+#include <telepathy-logger/telepathy-logger.h>
+#include <tp-account-widgets/tpaw-utils.h>
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+G_DEFINE_TYPE (EmpathyLogExporter, empathy_log_exporter, G_TYPE_OBJECT);
+
+enum
+{
+  PROP_ARCHIVE = 1,
+};
+
+enum
+{
+  SIG_PROGRESS,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+typedef struct
+{
+  TpAccount *account;
+  /* owned identifiers to export, or NULL to export all of them */
+  GHashTable *ids;
+} Selection;
+
+typedef enum
+{
+  STEP_GET_ENTITIES,
+  STEP_GET_DATES,
+  STEP_GET_EVENTS,
+} ExportStep;
+
+typedef struct
+{
+  ExportStep step;
+  Selection *selection;
+  TplEntity *entity;
+  GDate *date;
+} ExportCtx;
+
+/* The events of a day, to be compressed and written */
+typedef struct
+{
+  gchar *index_line_prefix;
+  GBytes *data;
+} Chunk;
+
+struct _EmpathyLogExporterPriv
+{
+  GFile *archive;
+  GFile *index;
+
+  /* owned Selection */
+  GPtrArray *selections;
+
+  /* Only used while exporting */
+  TplLogManager *log_manager;
+  GCancellable *cancellable;
+  GSimpleAsyncResult *result;
+  GError *error;
+
+  /* owned ExportCtx listing the entities and dates to export */
+  GQueue listing;
+  /* owned ExportCtx of STEP_GET_EVENTS */
+  GQueue dates;
+  guint n_dates;
+  guint n_exported;
+
+  gboolean fetching;
+  gboolean writing;
+  gboolean closing;
+  /* Events fetched while the previous ones are being written */
+  Chunk *pending_chunk;
+
+  /* Only used by the writing thread, one job at a time */
+  GOutputStream *archive_stream;
+  GOutputStream *index_stream;
+  guint64 offset;
+};
+
+static void
+selection_free (Selection *selection)
+{
+  g_object_unref (selection->account);
+  tp_clear_pointer (&selection->ids, g_hash_table_unref);
+  g_slice_free (Selection, selection);
+}
+
+static ExportCtx *
+export_ctx_new (ExportStep step,
+    Selection *selection,
+    TplEntity *entity,
+    GDate *date)
+{
+  ExportCtx *ctx = g_slice_new0 (ExportCtx);
+
+  ctx->step = step;
+  ctx->selection = selection;
+  if (entity != NULL)
+    ctx->entity = g_object_ref (entity);
+  if (date != NULL)
+    ctx->date = g_date_new_julian (g_date_get_julian (date));
+
+  return ctx;
+}
+
+static void
+export_ctx_free (ExportCtx *ctx)
+{
+  tp_clear_object (&ctx->entity);
+  tp_clear_pointer (&ctx->date, g_date_free);
+  g_slice_free (ExportCtx, ctx);
+}
+
+static void
+chunk_free (Chunk *chunk)
+{
+  g_free (chunk->index_line_prefix);
+  g_bytes_unref (chunk->data);
+  g_slice_free (Chunk, chunk);
+}
+
+static void
+empathy_log_exporter_get_property (GObject *object,
+    guint property_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  EmpathyLogExporter *self = EMPATHY_LOG_EXPORTER (object);
+
+  switch (property_id)
+    {
+      case PROP_ARCHIVE:
+        g_value_set_object (value, self->priv->archive);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+empathy_log_exporter_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  EmpathyLogExporter *self = EMPATHY_LOG_EXPORTER (object);
+
+  switch (property_id)
+    {
+      case PROP_ARCHIVE:
+        g_assert (self->priv->archive == NULL); /* construct only */
+        self->priv->archive = g_value_dup_object (value);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+empathy_log_exporter_constructed (GObject *object)
+{
+  EmpathyLogExporter *self = EMPATHY_LOG_EXPORTER (object);
+  gchar *uri, *index_uri;
+
+  G_OBJECT_CLASS (empathy_log_exporter_parent_class)->constructed (object);
+
+  uri = g_file_get_uri (self->priv->archive);
+  index_uri = g_strconcat (uri, ".index", NULL);
+  self->priv->index = g_file_new_for_uri (index_uri);
+
+  g_free (uri);
+  g_free (index_uri);
+}
+
+static void
+empathy_log_exporter_finalize (GObject *object)
+{
+  EmpathyLogExporter *self = EMPATHY_LOG_EXPORTER (object);
+
+  /* The export holds a ref until it's done */
+  g_assert (self->priv->result == NULL);
+
+  g_object_unref (self->priv->archive);
+  g_object_unref (self->priv->index);
+  g_ptr_array_unref (self->priv->selections);
+
+  G_OBJECT_CLASS (empathy_log_exporter_parent_class)->finalize (object);
+}
+
+static void
+empathy_log_exporter_class_init (EmpathyLogExporterClass *klass)
+{
+  GObjectClass *oclass = G_OBJECT_CLASS (klass);
+  GParamSpec *spec;
+
+  oclass->get_property = empathy_log_exporter_get_property;
+  oclass->set_property = empathy_log_exporter_set_property;
+  oclass->constructed = empathy_log_exporter_constructed;
+  oclass->finalize = empathy_log_exporter_finalize;
+
+  spec = g_param_spec_object ("archive", "Archive",
+      "File the logs are appended to",
+      G_TYPE_FILE,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (oclass, PROP_ARCHIVE, spec);
+
+  /**
+   * EmpathyLogExporter::progress
+   * @self: the object which has received the signal
+   * @n_exported: the number of conversation days written
+   * @n_dates: the number of conversation days to export
+   *
+   * Emitted once all the days to export are known, then each time one
+   * of them has been written.
+   */
+  signals[SIG_PROGRESS] =
+    g_signal_new ("progress", G_TYPE_FROM_CLASS (klass),
+        G_SIGNAL_RUN_LAST, 0, NULL, NULL,
+        g_cclosure_marshal_generic,
+        G_TYPE_NONE,
+        2, G_TYPE_UINT, G_TYPE_UINT);
+
+  g_type_class_add_private (klass, sizeof (EmpathyLogExporterPriv));
+}
+
+static void
+empathy_log_exporter_init (EmpathyLogExporter *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_LOG_EXPORTER, EmpathyLogExporterPriv);
+
+  self->priv->selections = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) selection_free);
+
+  g_queue_init (&self->priv->listing);
+  g_queue_init (&self->priv->dates);
+}
+
+/**
+ * empathy_log_exporter_new:
+ * @archive: the file to append the logs to
+ *
+ * Returns: a new #EmpathyLogExporter
+ */
+EmpathyLogExporter *
+empathy_log_exporter_new (GFile *archive)
+{
+  g_return_val_if_fail (G_IS_FILE (archive), NULL);
+
+  return g_object_new (EMPATHY_TYPE_LOG_EXPORTER,
+      "archive", archive,
+      NULL);
+}
+
+/* Returns: (transfer none): the file indexing the days of the archive */
+GFile *
+empathy_log_exporter_get_index (EmpathyLogExporter *self)
+{
+  g_return_val_if_fail (EMPATHY_IS_LOG_EXPORTER (self), NULL);
+
+  return self->priv->index;
+}
+
+/**
+ * empathy_log_exporter_add_account:
+ * @self: a #EmpathyLogExporter
+ * @account: a #TpAccount whose logs should be exported
+ * @ids: (allow-none): the identifiers of the contacts and rooms to export,
+ * or %NULL to export all of them
+ */
+void
+empathy_log_exporter_add_account (EmpathyLogExporter *self,
+    TpAccount *account,
+    const gchar * const *ids)
+{
+  Selection *selection;
+
+  g_return_if_fail (EMPATHY_IS_LOG_EXPORTER (self));
+  g_return_if_fail (TP_IS_ACCOUNT (account));
+  g_return_if_fail (self->priv->result == NULL);
+
+  selection = g_slice_new0 (Selection);
+  selection->account = g_object_ref (account);
+
+  if (ids != NULL)
+    {
+      guint i;
+
+      selection->ids = g_hash_table_new_full (g_str_hash, g_str_equal,
+          g_free, NULL);
+
+      for (i = 0; ids[i] != NULL; i++)
+        g_hash_table_add (selection->ids, g_strdup (ids[i]));
+    }
+
+  g_ptr_array_add (self->priv->selections, selection);
+}
+
+/* Serializing, in the main thread */
+
+static void
+append_escaped (GString *string,
+    const gchar *text)
+{
+  const gchar *p;
+
+  if (text == NULL)
+    return;
+
+  for (p = text; *p != '\0'; p++)
+    {
+      switch (*p)
+        {
+          case '\\':
+            g_string_append (string, "\\\\");
+            break;
+          case '\t':
+            g_string_append (string, "\\t");
+            break;
+          case '\n':
+            g_string_append (string, "\\n");
+            break;
+          case '\r':
+            g_string_append (string, "\\r");
+            break;
+          default:
+            g_string_append_c (string, *p);
+            break;
+        }
+    }
+}
+
+static const gchar *
+text_event_kind (TplTextEvent *event)
+{
+  switch (tpl_text_event_get_message_type (event))
+    {
+      case TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION:
+        return "action";
+      case TP_CHANNEL_TEXT_MESSAGE_TYPE_NOTICE:
+        return "notice";
+      default:
+        return "text";
+    }
+}
+
+static void
+append_event (GString *string,
+    TplEvent *event)
+{
+  TplEntity *sender = tpl_event_get_sender (event);
+
+  g_string_append_printf (string, "%" G_GINT64_FORMAT "\t%s\t",
+      tpl_event_get_timestamp (event),
+      TPL_IS_TEXT_EVENT (event) ?
+        text_event_kind (TPL_TEXT_EVENT (event)) : "call");
+
+  append_escaped (string, tpl_entity_get_identifier (sender));
+  g_string_append_c (string, '\t');
+  append_escaped (string, tpl_entity_get_alias (sender));
+  g_string_append_c (string, '\t');
+
+  if (TPL_IS_TEXT_EVENT (event))
+    {
+      append_escaped (string,
+          tpl_text_event_get_message (TPL_TEXT_EVENT (event)));
+    }
+  else
+    {
+      TplCallEvent *call = TPL_CALL_EVENT (event);
+
+      g_string_append_printf (string, "duration=%" G_GINT64_FORMAT
+          " reason=%u", (gint64) tpl_call_event_get_duration (call),
+          tpl_call_event_get_end_reason (call));
+    }
+
+  g_string_append_c (string, '\n');
+}
+
+static Chunk *
+chunk_new (ExportCtx *ctx,
+    GList *events)
+{
+  Chunk *chunk = g_slice_new0 (Chunk);
+  const gchar *account_path;
+  gchar date[11];
+  GString *string;
+  GList *l;
+
+  account_path = tp_proxy_get_object_path (ctx->selection->account);
+  g_date_strftime (date, sizeof (date), "%Y-%m-%d", ctx->date);
+
+  string = g_string_new ("# ");
+  append_escaped (string, account_path);
+  g_string_append_printf (string, " %s ", date);
+  append_escaped (string, tpl_entity_get_identifier (ctx->entity));
+  g_string_append_c (string, '\n');
+
+  for (l = events; l != NULL; l = g_list_next (l))
+    {
+      if (TPL_IS_TEXT_EVENT (l->data) || TPL_IS_CALL_EVENT (l->data))
+        append_event (string, l->data);
+    }
+
+  chunk->data = g_bytes_new (string->str, string->len);
+  g_string_free (string, TRUE);
+
+  /* The offset and length are added once written */
+  string = g_string_new (date);
+  g_string_append_c (string, '\t');
+  append_escaped (string, account_path);
+  g_string_append_c (string, '\t');
+  append_escaped (string, tpl_entity_get_identifier (ctx->entity));
+  chunk->index_line_prefix = g_string_free (string, FALSE);
+
+  return chunk;
+}
+
+/* Writing, in a thread */
+
+static gboolean
+open_streams (EmpathyLogExporter *self,
+    GCancellable *cancellable,
+    GError **error)
+{
+  GFileOutputStream *stream;
+  GFileInfo *info;
+
+  stream = g_file_append_to (self->priv->archive, G_FILE_CREATE_NONE,
+      cancellable, error);
+  if (stream == NULL)
+    return FALSE;
+
+  self->priv->archive_stream = G_OUTPUT_STREAM (stream);
+
+  /* Appended members start where the archive ends */
+  info = g_file_output_stream_query_info (stream,
+      G_FILE_ATTRIBUTE_STANDARD_SIZE, cancellable, error);
+  if (info == NULL)
+    return FALSE;
+
+  self->priv->offset = g_file_info_get_size (info);
+  g_object_unref (info);
+
+  stream = g_file_append_to (self->priv->index, G_FILE_CREATE_NONE,
+      cancellable, error);
+  if (stream == NULL)
+    return FALSE;
+
+  self->priv->index_stream = G_OUTPUT_STREAM (stream);
+
+  return TRUE;
+}
+
+static GBytes *
+compress (GBytes *data,
+    GCancellable *cancellable,
+    GError **error)
+{
+  GZlibCompressor *compressor;
+  GOutputStream *memory, *stream;
+  GBytes *compressed = NULL;
+
+  compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+  memory = g_memory_output_stream_new_resizable ();
+  stream = g_converter_output_stream_new (memory, G_CONVERTER (compressor));
+
+  /* Closing the stream flushes the compressor and closes memory */
+  if (g_output_stream_write_all (stream, g_bytes_get_data (data, NULL),
+        g_bytes_get_size (data), NULL, cancellable, error) &&
+      g_output_stream_close (stream, cancellable, error))
+    compressed = g_memory_output_stream_steal_as_bytes (
+        G_MEMORY_OUTPUT_STREAM (memory));
+
+  g_object_unref (stream);
+  g_object_unref (memory);
+  g_object_unref (compressor);
+
+  return compressed;
+}
+
+static gboolean
+write_chunk (EmpathyLogExporter *self,
+    Chunk *chunk,
+    GCancellable *cancellable,
+    GError **error)
+{
+  GBytes *compressed;
+  gchar *line;
+  gboolean result = FALSE;
+
+  if (self->priv->archive_stream == NULL &&
+      !open_streams (self, cancellable, error))
+    return FALSE;
+
+  compressed = compress (chunk->data, cancellable, error);
+  if (compressed == NULL)
+    return FALSE;
+
+  line = g_strdup_printf ("%s\t%" G_GUINT64_FORMAT "\t%" G_GSIZE_FORMAT "\n",
+      chunk->index_line_prefix, self->priv->offset,
+      g_bytes_get_size (compressed));
+
+  /* The index only refers to members which have been fully written */
+  if (!g_output_stream_write_all (self->priv->archive_stream,
+        g_bytes_get_data (compressed, NULL), g_bytes_get_size (compressed),
+        NULL, cancellable, error))
+    goto out;
+
+  self->priv->offset += g_bytes_get_size (compressed);
+
+  if (!g_output_stream_write_all (self->priv->index_stream, line,
+        strlen (line), NULL, cancellable, error))
+    goto out;
+
+  result = TRUE;
+
+out:
+  g_free (line);
+  g_bytes_unref (compressed);
+
+  return result;
+}
+
+static void
+close_streams (EmpathyLogExporter *self,
+    GError **error)
+{
+  /* Report the first error only */
+  if (self->priv->archive_stream != NULL)
+    g_output_stream_close (self->priv->archive_stream, NULL, error);
+
+  if (self->priv->index_stream != NULL)
+    g_output_stream_close (self->priv->index_stream, NULL,
+        error != NULL && *error == NULL ? error : NULL);
+
+  g_clear_object (&self->priv->archive_stream);
+  g_clear_object (&self->priv->index_stream);
+}
+
+/* Writes the Chunk of the result, or closes the streams if there is none */
+static void
+write_chunk_thread (GSimpleAsyncResult *simple,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  EmpathyLogExporter *self = EMPATHY_LOG_EXPORTER (object);
+  Chunk *chunk = g_simple_async_result_get_op_res_gpointer (simple);
+  GError *error = NULL;
+
+  if (chunk != NULL)
+    write_chunk (self, chunk, cancellable, &error);
+  else
+    close_streams (self, &error);
+
+  if (error != NULL)
+    g_simple_async_result_take_error (simple, error);
+}
+
+/* Exporting, in the main thread */
+
+static void export_next (EmpathyLogExporter *self);
+
+static void
+export_done (EmpathyLogExporter *self)
+{
+  GSimpleAsyncResult *result = self->priv->result;
+
+  g_queue_foreach (&self->priv->listing, (GFunc) export_ctx_free, NULL);
+  g_queue_clear (&self->priv->listing);
+  g_queue_foreach (&self->priv->dates, (GFunc) export_ctx_free, NULL);
+  g_queue_clear (&self->priv->dates);
+
+  if (self->priv->error != NULL)
+    {
+      DEBUG ("Failed to export the logs: %s", self->priv->error->message);
+      g_simple_async_result_take_error (result, self->priv->error);
+      self->priv->error = NULL;
+    }
+  else
+    {
+      DEBUG ("Exported %u conversation days", self->priv->n_exported);
+    }
+
+  tp_clear_object (&self->priv->log_manager);
+  tp_clear_object (&self->priv->cancellable);
+  self->priv->result = NULL;
+  self->priv->closing = FALSE;
+
+  g_simple_async_result_complete (result);
+  g_object_unref (result);
+
+  /* Ref taken in empathy_log_exporter_export_async() */
+  g_object_unref (self);
+}
+
+static void
+streams_closed_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogExporter *self = EMPATHY_LOG_EXPORTER (source);
+  GError *error = NULL;
+
+  if (g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result),
+        &error) && self->priv->error == NULL)
+    self->priv->error = error;
+  else
+    g_clear_error (&error);
+
+  export_done (self);
+}
+
+static void
+chunk_written_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogExporter *self = EMPATHY_LOG_EXPORTER (source);
+  GError *error = NULL;
+
+  self->priv->writing = FALSE;
+
+  if (g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result),
+        &error))
+    {
+      if (self->priv->error == NULL)
+        self->priv->error = error;
+      else
+        g_error_free (error);
+    }
+  else
+    {
+      self->priv->n_exported++;
+      g_signal_emit (self, signals[SIG_PROGRESS], 0, self->priv->n_exported,
+          self->priv->n_dates);
+    }
+
+  export_next (self);
+}
+
+static void
+run_writer (EmpathyLogExporter *self,
+    Chunk *chunk,
+    GAsyncReadyCallback callback)
+{
+  GSimpleAsyncResult *simple;
+
+  simple = g_simple_async_result_new (G_OBJECT (self), callback, NULL,
+      run_writer);
+
+  if (chunk != NULL)
+    g_simple_async_result_set_op_res_gpointer (simple, chunk,
+        (GDestroyNotify) chunk_free);
+
+  /* The streams have to be closed even if the export has been cancelled */
+  g_simple_async_result_run_in_thread (simple, write_chunk_thread,
+      G_PRIORITY_DEFAULT, chunk != NULL ? self->priv->cancellable : NULL);
+  g_object_unref (simple);
+}
+
+static void
+got_events_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogExporter *self = user_data;
+  ExportCtx *ctx = g_queue_pop_head (&self->priv->dates);
+  GList *events;
+  GError *error = NULL;
+
+  self->priv->fetching = FALSE;
+
+  if (!tpl_log_manager_get_events_for_date_finish (TPL_LOG_MANAGER (manager),
+        result, &events, &error))
+    {
+      if (self->priv->error == NULL)
+        self->priv->error = error;
+      else
+        g_error_free (error);
+    }
+  else
+    {
+      if (self->priv->error == NULL)
+        self->priv->pending_chunk = chunk_new (ctx, events);
+
+      g_list_free_full (events, g_object_unref);
+    }
+
+  export_ctx_free (ctx);
+
+  export_next (self);
+}
+
+/* At most one day is being written while the next one is being fetched */
+static void
+export_next (EmpathyLogExporter *self)
+{
+  if (self->priv->error == NULL)
+    g_cancellable_set_error_if_cancelled (self->priv->cancellable,
+        &self->priv->error);
+
+  if (self->priv->error != NULL)
+    tp_clear_pointer (&self->priv->pending_chunk, chunk_free);
+
+  if (!self->priv->writing && self->priv->pending_chunk != NULL)
+    {
+      self->priv->writing = TRUE;
+      run_writer (self, self->priv->pending_chunk, chunk_written_cb);
+      self->priv->pending_chunk = NULL;
+    }
+
+  if (self->priv->error == NULL && !self->priv->fetching &&
+      self->priv->pending_chunk == NULL &&
+      !g_queue_is_empty (&self->priv->dates))
+    {
+      ExportCtx *ctx = g_queue_peek_head (&self->priv->dates);
+
+      self->priv->fetching = TRUE;
+      tpl_log_manager_get_events_for_date_async (self->priv->log_manager,
+          ctx->selection->account, ctx->entity, TPL_EVENT_MASK_ANY,
+          ctx->date, got_events_cb, self);
+    }
+
+  if (self->priv->fetching || self->priv->writing || self->priv->closing)
+    return;
+
+  /* Nothing left to fetch nor to write */
+  self->priv->closing = TRUE;
+  run_writer (self, NULL, streams_closed_cb);
+}
+
+static void list_next (EmpathyLogExporter *self);
+
+static void
+got_entities_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogExporter *self = user_data;
+  ExportCtx *ctx = g_queue_pop_head (&self->priv->listing);
+  GHashTable *ids = ctx->selection->ids;
+  GList *entities, *l;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_entities_finish (TPL_LOG_MANAGER (manager),
+        result, &entities, &error))
+    {
+      DEBUG ("Failed to get entities of %s: %s",
+          tp_proxy_get_object_path (ctx->selection->account),
+          error->message);
+      g_clear_error (&error);
+      entities = NULL;
+    }
+
+  for (l = entities; l != NULL; l = g_list_next (l))
+    {
+      if (ids == NULL ||
+          g_hash_table_contains (ids, tpl_entity_get_identifier (l->data)))
+        g_queue_push_tail (&self->priv->listing,
+            export_ctx_new (STEP_GET_DATES, ctx->selection, l->data, NULL));
+    }
+
+  g_list_free_full (entities, g_object_unref);
+  export_ctx_free (ctx);
+
+  list_next (self);
+}
+
+static void
+got_dates_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogExporter *self = user_data;
+  ExportCtx *ctx = g_queue_pop_head (&self->priv->listing);
+  GList *dates, *l;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_dates_finish (TPL_LOG_MANAGER (manager),
+        result, &dates, &error))
+    {
+      DEBUG ("Failed to get dates of %s: %s",
+          tpl_entity_get_identifier (ctx->entity), error->message);
+      g_clear_error (&error);
+      dates = NULL;
+    }
+
+  for (l = dates; l != NULL; l = g_list_next (l))
+    {
+      g_queue_push_tail (&self->priv->dates,
+          export_ctx_new (STEP_GET_EVENTS, ctx->selection, ctx->entity,
+            l->data));
+      self->priv->n_dates++;
+    }
+
+  g_list_free_full (dates, (GDestroyNotify) g_date_free);
+  export_ctx_free (ctx);
+
+  list_next (self);
+}
+
+/* Lists all the days to export first, so the progress can be reported */
+static void
+list_next (EmpathyLogExporter *self)
+{
+  ExportCtx *ctx;
+
+  ctx = g_queue_peek_head (&self->priv->listing);
+  if (ctx == NULL ||
+      g_cancellable_is_cancelled (self->priv->cancellable))
+    {
+      DEBUG ("Exporting %u conversation days", self->priv->n_dates);
+
+      g_signal_emit (self, signals[SIG_PROGRESS], 0, 0, self->priv->n_dates);
+      export_next (self);
+      return;
+    }
+
+  switch (ctx->step)
+    {
+      case STEP_GET_ENTITIES:
+        tpl_log_manager_get_entities_async (self->priv->log_manager,
+            ctx->selection->account, got_entities_cb, self);
+        break;
+      case STEP_GET_DATES:
+        tpl_log_manager_get_dates_async (self->priv->log_manager,
+            ctx->selection->account, ctx->entity, TPL_EVENT_MASK_ANY,
+            got_dates_cb, self);
+        break;
+      case STEP_GET_EVENTS:
+        g_assert_not_reached ();
+        break;
+    }
+}
+
+/**
+ * empathy_log_exporter_export_async:
+ * @self: a #EmpathyLogExporter
+ * @cancellable: (allow-none): a #GCancellable
+ * @callback: a callback to call when the export is done
+ * @user_data: data to pass to @callback
+ *
+ * Appends the logs of the accounts added with
+ * empathy_log_exporter_add_account() to the archive, and indexes them.
+ * The days written before an error or a cancellation stay in the archive.
+ */
+void
+empathy_log_exporter_export_async (EmpathyLogExporter *self,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  guint i;
+
+  g_return_if_fail (EMPATHY_IS_LOG_EXPORTER (self));
+
+  if (self->priv->result != NULL)
+    {
+      g_simple_async_report_error_in_idle (G_OBJECT (self), callback,
+          user_data, G_IO_ERROR, G_IO_ERROR_PENDING,
+          "The logs are already being exported");
+      return;
+    }
+
+  self->priv->result = g_simple_async_result_new (G_OBJECT (self), callback,
+      user_data, empathy_log_exporter_export_async);
+
+  self->priv->log_manager = tpl_log_manager_dup_singleton ();
+  if (cancellable != NULL)
+    self->priv->cancellable = g_object_ref (cancellable);
+
+  self->priv->n_dates = 0;
+  self->priv->n_exported = 0;
+
+  for (i = 0; i < self->priv->selections->len; i++)
+    g_queue_push_tail (&self->priv->listing,
+        export_ctx_new (STEP_GET_ENTITIES,
+          g_ptr_array_index (self->priv->selections, i), NULL, NULL));
+
+  /* Released in export_done() */
+  g_object_ref (self);
+
+  list_next (self);
+}
+
+gboolean
+empathy_log_exporter_export_finish (EmpathyLogExporter *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  tpaw_implement_finish_void (self, empathy_log_exporter_export_async);
+}
+
+/* Compacting, in a thread */
+
+#define COPY_BUFFER_SIZE (64 * 1024)
+
+/* A member of the archive, as indexed */
+typedef struct
+{
+  /* The index line without its offset and length, which identifies the
+   * day */
+  gchar *prefix;
+  guint64 offset;
+  guint64 length;
+  /* The same day has been exported again later */
+  gboolean superseded;
+} Member;
+
+static void
+member_free (Member *member)
+{
+  g_free (member->prefix);
+  g_slice_free (Member, member);
+}
+
+/* Returns: (transfer full): the owned Member of the index, in the order
+ * they have been written */
+static GPtrArray *
+read_index (EmpathyLogExporter *self,
+    GCancellable *cancellable,
+    GError **error)
+{
+  GFileInputStream *stream;
+  GDataInputStream *data;
+  GPtrArray *members;
+  /* borrowed prefix -> 1 + the position of its latest Member */
+  GHashTable *latest;
+  gchar *line;
+  GError *local_error = NULL;
+
+  stream = g_file_read (self->priv->index, cancellable, error);
+  if (stream == NULL)
+    return NULL;
+
+  data = g_data_input_stream_new (G_INPUT_STREAM (stream));
+  members = g_ptr_array_new_with_free_func ((GDestroyNotify) member_free);
+  latest = g_hash_table_new (g_str_hash, g_str_equal);
+
+  while ((line = g_data_input_stream_read_line (data, NULL, cancellable,
+          &local_error)) != NULL)
+    {
+      Member *member;
+      gchar *offset, *length;
+      gpointer previous;
+
+      /* The fields are escaped, so the last two tabs are separators */
+      length = strrchr (line, '\t');
+      offset = NULL;
+      if (length != NULL)
+        {
+          *length = '\0';
+          offset = strrchr (line, '\t');
+        }
+
+      if (offset == NULL)
+        {
+          DEBUG ("Ignoring invalid index line");
+          g_free (line);
+          continue;
+        }
+
+      *offset = '\0';
+
+      member = g_slice_new0 (Member);
+      member->prefix = line;
+      member->offset = g_ascii_strtoull (offset + 1, NULL, 10);
+      member->length = g_ascii_strtoull (length + 1, NULL, 10);
+
+      previous = g_hash_table_lookup (latest, member->prefix);
+      if (previous != NULL)
+        {
+          Member *old = g_ptr_array_index (members,
+              GPOINTER_TO_UINT (previous) - 1);
+
+          old->superseded = TRUE;
+        }
+
+      g_ptr_array_add (members, member);
+      /* Replace the key too, it's borrowed from the latest Member */
+      g_hash_table_replace (latest, member->prefix,
+          GUINT_TO_POINTER (members->len));
+    }
+
+  g_hash_table_unref (latest);
+  g_object_unref (data);
+  g_object_unref (stream);
+
+  if (local_error != NULL)
+    {
+      g_propagate_error (error, local_error);
+      g_ptr_array_unref (members);
+      return NULL;
+    }
+
+  return members;
+}
+
+static gboolean
+copy_member (GInputStream *input,
+    GOutputStream *output,
+    guint64 length,
+    gchar *buffer,
+    GCancellable *cancellable,
+    GError **error)
+{
+  while (length > 0)
+    {
+      gsize wanted = MIN (length, COPY_BUFFER_SIZE);
+      gsize n_read;
+
+      if (!g_input_stream_read_all (input, buffer, wanted, &n_read,
+            cancellable, error))
+        return FALSE;
+
+      if (n_read < wanted)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+              "The archive is shorter than its index says");
+          return FALSE;
+        }
+
+      if (!g_output_stream_write_all (output, buffer, n_read, NULL,
+            cancellable, error))
+        return FALSE;
+
+      length -= n_read;
+    }
+
+  return TRUE;
+}
+
+static GFile *
+sibling_file (GFile *file,
+    const gchar *suffix)
+{
+  gchar *uri, *sibling_uri;
+  GFile *sibling;
+
+  uri = g_file_get_uri (file);
+  sibling_uri = g_strconcat (uri, suffix, NULL);
+  sibling = g_file_new_for_uri (sibling_uri);
+
+  g_free (uri);
+  g_free (sibling_uri);
+
+  return sibling;
+}
+
+/* Writes the latest copy of each day to new files, then moves them over
+ * the archive and its index */
+static gboolean
+compact (EmpathyLogExporter *self,
+    GFile *archive_tmp,
+    GFile *index_tmp,
+    GCancellable *cancellable,
+    GError **error)
+{
+  GPtrArray *members;
+  GFileInputStream *input = NULL;
+  GFileOutputStream *archive_out = NULL, *index_out = NULL;
+  gchar *buffer = NULL;
+  guint64 offset = 0;
+  guint i, n_kept = 0;
+  gboolean result = FALSE;
+
+  members = read_index (self, cancellable, error);
+  if (members == NULL)
+    return FALSE;
+
+  input = g_file_read (self->priv->archive, cancellable, error);
+  if (input == NULL)
+    goto out;
+
+  archive_out = g_file_replace (archive_tmp, NULL, FALSE, G_FILE_CREATE_NONE,
+      cancellable, error);
+  if (archive_out == NULL)
+    goto out;
+
+  index_out = g_file_replace (index_tmp, NULL, FALSE, G_FILE_CREATE_NONE,
+      cancellable, error);
+  if (index_out == NULL)
+    goto out;
+
+  buffer = g_malloc (COPY_BUFFER_SIZE);
+
+  for (i = 0; i < members->len; i++)
+    {
+      Member *member = g_ptr_array_index (members, i);
+      gchar *line;
+      gboolean written;
+
+      if (member->superseded)
+        continue;
+
+      if (!g_seekable_seek (G_SEEKABLE (input), member->offset, G_SEEK_SET,
+            cancellable, error) ||
+          !copy_member (G_INPUT_STREAM (input), G_OUTPUT_STREAM (archive_out),
+            member->length, buffer, cancellable, error))
+        goto out;
+
+      line = g_strdup_printf ("%s\t%" G_GUINT64_FORMAT "\t%" G_GUINT64_FORMAT
+          "\n", member->prefix, offset, member->length);
+      written = g_output_stream_write_all (G_OUTPUT_STREAM (index_out), line,
+          strlen (line), NULL, cancellable, error);
+      g_free (line);
+
+      if (!written)
+        goto out;
+
+      offset += member->length;
+      n_kept++;
+    }
+
+  if (!g_output_stream_close (G_OUTPUT_STREAM (archive_out), cancellable,
+        error) ||
+      !g_output_stream_close (G_OUTPUT_STREAM (index_out), cancellable, error))
+    goto out;
+
+  /* FIXME: being interrupted between the two moves leaves an index which
+   * doesn't match the archive */
+  if (!g_file_move (archive_tmp, self->priv->archive, G_FILE_COPY_OVERWRITE,
+        cancellable, NULL, NULL, error) ||
+      !g_file_move (index_tmp, self->priv->index, G_FILE_COPY_OVERWRITE,
+        cancellable, NULL, NULL, error))
+    goto out;
+
+  DEBUG ("Kept %u of the %u archived conversation days", n_kept,
+      members->len);
+
+  result = TRUE;
+
+out:
+  g_free (buffer);
+  tp_clear_object (&input);
+  tp_clear_object (&archive_out);
+  tp_clear_object (&index_out);
+  g_ptr_array_unref (members);
+
+  return result;
+}
+
+static void
+compact_thread (GSimpleAsyncResult *simple,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  EmpathyLogExporter *self = EMPATHY_LOG_EXPORTER (object);
+  GFile *archive_tmp, *index_tmp;
+  GError *error = NULL;
+
+  archive_tmp = sibling_file (self->priv->archive, ".compacting");
+  index_tmp = sibling_file (self->priv->index, ".compacting");
+
+  if (!compact (self, archive_tmp, index_tmp, cancellable, &error))
+    {
+      /* Leave the archive as it was */
+      g_file_delete (archive_tmp, NULL, NULL);
+      g_file_delete (index_tmp, NULL, NULL);
+      g_simple_async_result_take_error (simple, error);
+    }
+
+  g_object_unref (archive_tmp);
+  g_object_unref (index_tmp);
+}
+
+static void
+compacted_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogExporter *self = EMPATHY_LOG_EXPORTER (source);
+  GSimpleAsyncResult *simple = self->priv->result;
+  GError *error = NULL;
+
+  if (g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result),
+        &error))
+    {
+      DEBUG ("Failed to compact the archive: %s", error->message);
+      g_simple_async_result_take_error (simple, error);
+    }
+
+  self->priv->result = NULL;
+
+  g_simple_async_result_complete (simple);
+  g_object_unref (simple);
+
+  /* Ref taken in empathy_log_exporter_compact_async() */
+  g_object_unref (self);
+}
+
+/**
+ * empathy_log_exporter_compact_async:
+ * @self: a #EmpathyLogExporter
+ * @cancellable: (allow-none): a #GCancellable
+ * @callback: a callback to call when the archive has been compacted
+ * @user_data: data to pass to @callback
+ *
+ * Rewrites the archive and its index keeping only the latest copy of each
+ * conversation day, as exporting the same logs again appends them. The
+ * bytes which aren't indexed, left by an interrupted export, are dropped
+ * too. The archive is left untouched on error or cancellation; it can't
+ * be exported to while being compacted.
+ */
+void
+empathy_log_exporter_compact_async (EmpathyLogExporter *self,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GSimpleAsyncResult *simple;
+
+  g_return_if_fail (EMPATHY_IS_LOG_EXPORTER (self));
+
+  if (self->priv->result != NULL)
+    {
+      g_simple_async_report_error_in_idle (G_OBJECT (self), callback,
+          user_data, G_IO_ERROR, G_IO_ERROR_PENDING,
+          "The logs are already being exported");
+      return;
+    }
+
+  self->priv->result = g_simple_async_result_new (G_OBJECT (self), callback,
+      user_data, empathy_log_exporter_compact_async);
+
+  /* Released in compacted_cb() */
+  g_object_ref (self);
+
+  simple = g_simple_async_result_new (G_OBJECT (self), compacted_cb, NULL,
+      compact_thread);
+  g_simple_async_result_run_in_thread (simple, compact_thread,
+      G_PRIORITY_DEFAULT, cancellable);
+  g_object_unref (simple);
+}
+
+gboolean
+empathy_log_exporter_compact_finish (EmpathyLogExporter *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  tpaw_implement_finish_void (self, empathy_log_exporter_compact_async);
+}
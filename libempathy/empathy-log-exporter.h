@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_LOG_EXPORTER_H__
+#define __EMPATHY_LOG_EXPORTER_H__
+
+#include <gio/gio.h>
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathyLogExporter EmpathyLogExporter;
+typedef struct _EmpathyLogExporterClass EmpathyLogExporterClass;
+typedef struct _EmpathyLogExporterPriv EmpathyLogExporterPriv;
+
+struct _EmpathyLogExporterClass
+{
+  GObjectClass parent_class;
+};
+
+struct _EmpathyLogExporter
+{
+  GObject parent;
+  EmpathyLogExporterPriv *priv;
+};
+
+GType empathy_log_exporter_get_type (void);
+
+#define EMPATHY_TYPE_LOG_EXPORTER \
+  (empathy_log_exporter_get_type ())
+#define EMPATHY_LOG_EXPORTER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), EMPATHY_TYPE_LOG_EXPORTER, \
+    EmpathyLogExporter))
+#define EMPATHY_LOG_EXPORTER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), EMPATHY_TYPE_LOG_EXPORTER, \
+    EmpathyLogExporterClass))
+#define EMPATHY_IS_LOG_EXPORTER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), EMPATHY_TYPE_LOG_EXPORTER))
+#define EMPATHY_IS_LOG_EXPORTER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), EMPATHY_TYPE_LOG_EXPORTER))
+#define EMPATHY_LOG_EXPORTER_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), EMPATHY_TYPE_LOG_EXPORTER, \
+    EmpathyLogExporterClass))
+
+EmpathyLogExporter * empathy_log_exporter_new (GFile *archive);
+
+GFile * empathy_log_exporter_get_index (EmpathyLogExporter *self);
+
+void empathy_log_exporter_add_account (EmpathyLogExporter *self,
+    TpAccount *account,
+    const gchar * const *ids);
+
+void empathy_log_exporter_export_async (EmpathyLogExporter *self,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+gboolean empathy_log_exporter_export_finish (EmpathyLogExporter *self,
+    GAsyncResult *result,
+    GError **error);
+
+void empathy_log_exporter_compact_async (EmpathyLogExporter *self,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+gboolean empathy_log_exporter_compact_finish (EmpathyLogExporter *self,
+    GAsyncResult *result,
+    GError **error);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_LOG_EXPORTER_H__ */
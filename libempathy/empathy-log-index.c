@@ -0,0 +1,1896 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Inverted index of the words of the text logs, mapping each word to the
+ * (account, target, date) triples in which it appears; that's all
+ * EmpathyLogWindow needs from a search.
+ *
+ * The index is stored in two files:
+ *  - 'index' is a complete snapshot, rewritten once an update is done;
+ *  - 'journal' gets a line appended for each message added between two
+ *    snapshots, and is replayed when the index is loaded.
+ *
+ * Empathy and empathy-rebuild-log-index can use the same index, so the
+ * files are only accessed with 'lock' held. Each snapshot has a random
+ * generation number: an index finding another generation on disk when
+ * saving reloads it first, rather than overwriting what another process
+ * has saved.
+ */
+
+#include "config.h"
+#include "empathy-log-index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <tp-account-widgets/tpaw-utils.h>
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+#define INDEX_HEADER "EMPATHY-LOG-INDEX 1"
+
+/* Longer words are most likely not words but URLs, keys, etc */
+#define MAX_WORD_LEN 64
+
+G_DEFINE_TYPE (EmpathyLogIndex, empathy_log_index, G_TYPE_OBJECT);
+
+enum
+{
+  PROP_DIRECTORY = 1,
+};
+
+typedef struct
+{
+  /* NULL if the target has been cleared */
+  gchar *account_path;
+  TplEntityType type;
+  gchar *id;
+
+  /* Julian day of the most recent date indexed from the logger; messages
+   * added since then may not all have been seen */
+  guint32 last_date;
+
+  /* guint32 julian day -> posting number + 1 */
+  GHashTable *postings;
+} Target;
+
+typedef struct
+{
+  guint target;
+  guint32 date;
+} Posting;
+
+typedef enum
+{
+  STEP_GET_ENTITIES,
+  STEP_GET_DATES,
+  STEP_GET_EVENTS,
+} UpdateStep;
+
+typedef struct
+{
+  UpdateStep step;
+  TpAccount *account;
+  TplEntity *entity;
+  GDate *date;
+} UpdateCtx;
+
+/* A caller of empathy_log_index_update_async() */
+typedef struct
+{
+  GSimpleAsyncResult *simple;
+  GCancellable *cancellable;
+} UpdateWaiter;
+
+struct _EmpathyLogIndexPriv
+{
+  gchar *directory;
+
+  gboolean loaded;
+  /* TRUE once all the logs have been indexed */
+  gboolean complete;
+
+  /* owned Target */
+  GPtrArray *targets;
+  /* owned "account-path id" -> target number + 1 */
+  GHashTable *targets_by_key;
+  /* Posting */
+  GArray *postings;
+  /* owned word -> owned sorted GArray of guint posting numbers */
+  GHashTable *words;
+
+  /* Generation of the snapshot loaded or saved last, 0 if none */
+  guint64 generation;
+
+  TpAccountManager *account_manager;
+
+  /* Set by empathy_log_index_observe_messages() */
+  TpBaseClient *observer;
+  /* owned TpChannel -> owned TpAccount */
+  GHashTable *channels;
+
+  /* Only used while updating */
+  TplLogManager *log_manager;
+  gboolean rebuilding;
+  /* TRUE if the index has been reloaded since the update started */
+  gboolean reloaded;
+  /* owned UpdateCtx still to be processed */
+  GQueue pending;
+  /* owned UpdateWaiter waiting for the update to finish */
+  GList *update_waiters;
+  /* owned UpdateWaiter waiting for a rebuild requested while updating */
+  GList *queued_waiters;
+  guint n_updated_dates;
+};
+
+static void
+target_free (Target *target)
+{
+  g_free (target->account_path);
+  g_free (target->id);
+  g_hash_table_unref (target->postings);
+  g_slice_free (Target, target);
+}
+
+static void
+postings_free (GArray *postings)
+{
+  g_array_unref (postings);
+}
+
+static UpdateCtx *
+update_ctx_new (UpdateStep step,
+    TpAccount *account,
+    TplEntity *entity,
+    GDate *date)
+{
+  UpdateCtx *ctx = g_slice_new0 (UpdateCtx);
+
+  ctx->step = step;
+  ctx->account = g_object_ref (account);
+  if (entity != NULL)
+    ctx->entity = g_object_ref (entity);
+  if (date != NULL)
+    ctx->date = g_date_new_julian (g_date_get_julian (date));
+
+  return ctx;
+}
+
+static void
+update_ctx_free (UpdateCtx *ctx)
+{
+  g_object_unref (ctx->account);
+  tp_clear_object (&ctx->entity);
+  tp_clear_pointer (&ctx->date, g_date_free);
+  g_slice_free (UpdateCtx, ctx);
+}
+
+static void
+update_waiter_complete (UpdateWaiter *waiter,
+    const GError *error)
+{
+  if (error != NULL)
+    g_simple_async_result_set_from_error (waiter->simple, error);
+
+  g_simple_async_result_complete_in_idle (waiter->simple);
+
+  g_object_unref (waiter->simple);
+  tp_clear_object (&waiter->cancellable);
+  g_slice_free (UpdateWaiter, waiter);
+}
+
+static gchar *
+get_file_path (EmpathyLogIndex *self,
+    const gchar *name)
+{
+  return g_build_filename (self->priv->directory, name, NULL);
+}
+
+/* Returns a file descriptor to pass to unlock_files(), or -1 if the lock
+ * can't be taken, in which case the caller goes ahead anyway. Must not be
+ * called with the lock already held. */
+static gint
+lock_files (EmpathyLogIndex *self)
+{
+  gchar *path;
+  gint fd;
+
+  if (g_mkdir_with_parents (self->priv->directory, 0700) != 0)
+    {
+      DEBUG ("Can't create %s: %s", self->priv->directory,
+          g_strerror (errno));
+      return -1;
+    }
+
+  path = get_file_path (self, "lock");
+  fd = g_open (path, O_RDWR | O_CREAT, 0600);
+  g_free (path);
+
+  if (fd < 0)
+    {
+      DEBUG ("Can't open the log index lock: %s", g_strerror (errno));
+      return -1;
+    }
+
+  while (flock (fd, LOCK_EX) != 0)
+    {
+      if (errno != EINTR)
+        {
+          DEBUG ("Can't lock the log index: %s", g_strerror (errno));
+          close (fd);
+          return -1;
+        }
+    }
+
+  return fd;
+}
+
+static void
+unlock_files (gint fd)
+{
+  /* Closing the file releases the lock */
+  if (fd >= 0)
+    close (fd);
+}
+
+static void
+reset (EmpathyLogIndex *self)
+{
+  tp_clear_pointer (&self->priv->targets, g_ptr_array_unref);
+  tp_clear_pointer (&self->priv->targets_by_key, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->postings, g_array_unref);
+  tp_clear_pointer (&self->priv->words, g_hash_table_unref);
+
+  self->priv->targets = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) target_free);
+  self->priv->targets_by_key = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, NULL);
+  self->priv->postings = g_array_new (FALSE, FALSE, sizeof (Posting));
+  self->priv->words = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) postings_free);
+
+  self->priv->complete = FALSE;
+}
+
+static gchar *
+make_target_key (const gchar *account_path,
+    const gchar *id)
+{
+  return g_strdup_printf ("%s %s", account_path, id);
+}
+
+static guint
+ensure_target (EmpathyLogIndex *self,
+    const gchar *account_path,
+    TplEntityType type,
+    const gchar *id)
+{
+  Target *target;
+  gchar *key;
+  gpointer n;
+
+  key = make_target_key (account_path, id);
+
+  n = g_hash_table_lookup (self->priv->targets_by_key, key);
+  if (n != NULL)
+    {
+      g_free (key);
+      return GPOINTER_TO_UINT (n) - 1;
+    }
+
+  target = g_slice_new0 (Target);
+  target->account_path = g_strdup (account_path);
+  target->type = type;
+  target->id = g_strdup (id);
+  target->postings = g_hash_table_new (NULL, NULL);
+
+  g_ptr_array_add (self->priv->targets, target);
+  g_hash_table_insert (self->priv->targets_by_key, key,
+      GUINT_TO_POINTER (self->priv->targets->len));
+
+  return self->priv->targets->len - 1;
+}
+
+static guint
+ensure_posting (EmpathyLogIndex *self,
+    guint target_nb,
+    guint32 date)
+{
+  Target *target = g_ptr_array_index (self->priv->targets, target_nb);
+  Posting posting;
+  gpointer n;
+
+  n = g_hash_table_lookup (target->postings, GUINT_TO_POINTER (date));
+  if (n != NULL)
+    return GPOINTER_TO_UINT (n) - 1;
+
+  posting.target = target_nb;
+  posting.date = date;
+  g_array_append_val (self->priv->postings, posting);
+
+  g_hash_table_insert (target->postings, GUINT_TO_POINTER (date),
+      GUINT_TO_POINTER (self->priv->postings->len));
+
+  return self->priv->postings->len - 1;
+}
+
+static void
+add_word_posting (EmpathyLogIndex *self,
+    const gchar *word,
+    guint posting)
+{
+  GArray *postings;
+  guint low, high;
+
+  postings = g_hash_table_lookup (self->priv->words, word);
+  if (postings == NULL)
+    {
+      postings = g_array_sized_new (FALSE, FALSE, sizeof (guint), 1);
+      g_hash_table_insert (self->priv->words, g_strdup (word), postings);
+    }
+
+  /* Messages are mostly indexed in chronological order so that's usually
+   * an append */
+  if (postings->len == 0 ||
+      g_array_index (postings, guint, postings->len - 1) < posting)
+    {
+      g_array_append_val (postings, posting);
+      return;
+    }
+
+  low = 0;
+  high = postings->len;
+  while (low < high)
+    {
+      guint mid = (low + high) / 2;
+
+      if (g_array_index (postings, guint, mid) < posting)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+
+  if (low < postings->len && g_array_index (postings, guint, low) == posting)
+    return;
+
+  g_array_insert_val (postings, low, posting);
+}
+
+/* Splits @text in casefolded words and adds them to @words */
+static void
+split_words (const gchar *text,
+    GHashTable *words)
+{
+  gchar *folded;
+  const gchar *p, *start = NULL;
+
+  folded = g_utf8_casefold (text, -1);
+
+  for (p = folded; ; p = g_utf8_next_char (p))
+    {
+      gunichar c = g_utf8_get_char (p);
+
+      if (c != 0 && g_unichar_isalnum (c))
+        {
+          if (start == NULL)
+            start = p;
+
+          continue;
+        }
+
+      if (start != NULL && p - start <= MAX_WORD_LEN)
+        g_hash_table_add (words, g_strndup (start, p - start));
+
+      start = NULL;
+
+      if (c == 0)
+        break;
+    }
+
+  g_free (folded);
+}
+
+static void
+index_words (EmpathyLogIndex *self,
+    guint target_nb,
+    guint32 date,
+    GHashTable *words)
+{
+  GHashTableIter iter;
+  gpointer word;
+  guint posting;
+
+  if (g_hash_table_size (words) == 0)
+    return;
+
+  posting = ensure_posting (self, target_nb, date);
+
+  g_hash_table_iter_init (&iter, words);
+  while (g_hash_table_iter_next (&iter, &word, NULL))
+    add_word_posting (self, word, posting);
+}
+
+static void
+index_text (EmpathyLogIndex *self,
+    guint target_nb,
+    guint32 date,
+    const gchar *text)
+{
+  GHashTable *words;
+
+  words = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  split_words (text, words);
+
+  index_words (self, target_nb, date, words);
+
+  g_hash_table_unref (words);
+}
+
+/* Journal lines are:
+ * account-path \t type \t escaped-id \t julian-day \t word word word... */
+static void
+replay_journal_line (EmpathyLogIndex *self,
+    const gchar *line)
+{
+  gchar **fields, **split, **w, *id;
+  GHashTable *words;
+  guint target_nb;
+
+  fields = g_strsplit (line, "\t", 5);
+  if (g_strv_length (fields) != 5)
+    goto out;
+
+  id = g_strcompress (fields[2]);
+  target_nb = ensure_target (self, fields[0], atoi (fields[1]), id);
+  g_free (id);
+
+  words = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  split = g_strsplit (fields[4], " ", -1);
+  for (w = split; *w != NULL; w++)
+    {
+      if (**w != '\0')
+        g_hash_table_add (words, g_strdup (*w));
+    }
+
+  g_strfreev (split);
+
+  index_words (self, target_nb, g_ascii_strtoull (fields[3], NULL, 10),
+      words);
+
+  g_hash_table_unref (words);
+
+out:
+  g_strfreev (fields);
+}
+
+static void
+parse_postings (EmpathyLogIndex *self,
+    const gchar *word,
+    const gchar *str)
+{
+  GArray *postings;
+  gchar *end;
+
+  postings = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  while (*str != '\0')
+    {
+      guint posting = g_ascii_strtoull (str, &end, 10);
+
+      if (end == str)
+        break;
+
+      if (posting < self->priv->postings->len)
+        g_array_append_val (postings, posting);
+
+      str = end;
+      while (*str == ' ')
+        str++;
+    }
+
+  g_hash_table_insert (self->priv->words, g_strdup (word), postings);
+}
+
+/* Index lines are, in that order:
+ *  g \t generation
+ *  c \t complete
+ *  t \t account-path \t type \t escaped-id \t last-julian-day
+ *  p \t target-number \t julian-day
+ *  w \t word \t posting-number posting-number...
+ * where targets and postings are numbered in the order they are listed. */
+static gboolean
+parse_index_line (EmpathyLogIndex *self,
+    const gchar *line)
+{
+  gchar **fields;
+  gboolean result = TRUE;
+
+  fields = g_strsplit (line, "\t", 5);
+
+  if (!tp_strdiff (fields[0], "g") && fields[1] != NULL)
+    {
+      self->priv->generation = g_ascii_strtoull (fields[1], NULL, 10);
+    }
+  else if (!tp_strdiff (fields[0], "c") && fields[1] != NULL)
+    {
+      self->priv->complete = atoi (fields[1]) != 0;
+    }
+  else if (!tp_strdiff (fields[0], "t") && g_strv_length (fields) == 5)
+    {
+      gchar *id = g_strcompress (fields[3]);
+      Target *target;
+
+      target = g_ptr_array_index (self->priv->targets,
+          ensure_target (self, fields[1], atoi (fields[2]), id));
+      target->last_date = g_ascii_strtoull (fields[4], NULL, 10);
+      g_free (id);
+    }
+  else if (!tp_strdiff (fields[0], "p") && g_strv_length (fields) == 3)
+    {
+      guint target_nb = g_ascii_strtoull (fields[1], NULL, 10);
+
+      if (target_nb < self->priv->targets->len)
+        ensure_posting (self, target_nb,
+            g_ascii_strtoull (fields[2], NULL, 10));
+      else
+        result = FALSE;
+    }
+  else if (!tp_strdiff (fields[0], "w") && g_strv_length (fields) == 3)
+    {
+      parse_postings (self, fields[1], fields[2]);
+    }
+  else
+    {
+      result = FALSE;
+    }
+
+  g_strfreev (fields);
+  return result;
+}
+
+static void
+foreach_line (gchar *contents,
+    gboolean (*func) (EmpathyLogIndex *, const gchar *),
+    EmpathyLogIndex *self)
+{
+  gchar *line = contents;
+
+  while (line != NULL && *line != '\0')
+    {
+      gchar *end = strchr (line, '\n');
+
+      if (end != NULL)
+        *end = '\0';
+
+      if (!func (self, line))
+        {
+          DEBUG ("Ignoring invalid line: %s", line);
+        }
+
+      line = end != NULL ? end + 1 : NULL;
+    }
+}
+
+static gboolean
+replay_journal_line_cb (EmpathyLogIndex *self,
+    const gchar *line)
+{
+  replay_journal_line (self, line);
+  return TRUE;
+}
+
+static void
+replay_journal (EmpathyLogIndex *self)
+{
+  gchar *path, *contents;
+
+  path = get_file_path (self, "journal");
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      foreach_line (contents, replay_journal_line_cb, self);
+      g_free (contents);
+    }
+
+  g_free (path);
+}
+
+/* Must be called with the files locked */
+static void
+load (EmpathyLogIndex *self)
+{
+  gchar *path, *contents;
+  GError *error = NULL;
+
+  self->priv->generation = 0;
+
+  path = get_file_path (self, "index");
+  if (g_file_get_contents (path, &contents, NULL, &error))
+    {
+      if (g_str_has_prefix (contents, INDEX_HEADER "\n"))
+        {
+          foreach_line (contents + strlen (INDEX_HEADER "\n"),
+              parse_index_line, self);
+        }
+      else
+        {
+          DEBUG ("%s has an unknown format, ignoring", path);
+        }
+
+      g_free (contents);
+    }
+  else
+    {
+      DEBUG ("Can't load the log index: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  g_free (path);
+
+  replay_journal (self);
+
+  DEBUG ("Loaded log index: %u targets, %u dates, %u words%s",
+      self->priv->targets->len, self->priv->postings->len,
+      g_hash_table_size (self->priv->words),
+      self->priv->complete ? "" : " (incomplete)");
+}
+
+static void
+ensure_loaded (EmpathyLogIndex *self)
+{
+  gint lock;
+
+  if (self->priv->loaded)
+    return;
+
+  self->priv->loaded = TRUE;
+
+  lock = lock_files (self);
+  load (self);
+  unlock_files (lock);
+}
+
+/* Only reads the beginning of the snapshot */
+static guint64
+read_generation (EmpathyLogIndex *self)
+{
+  gchar *path;
+  gchar line[64];
+  FILE *file;
+  guint64 generation = 0;
+
+  path = get_file_path (self, "index");
+  file = g_fopen (path, "r");
+  g_free (path);
+
+  if (file == NULL)
+    return 0;
+
+  if (fgets (line, sizeof (line), file) != NULL &&
+      !tp_strdiff (line, INDEX_HEADER "\n") &&
+      fgets (line, sizeof (line), file) != NULL &&
+      g_str_has_prefix (line, "g\t"))
+    generation = g_ascii_strtoull (line + 2, NULL, 10);
+
+  fclose (file);
+
+  return generation;
+}
+
+/* Picks up what other processes have written since the index was loaded
+ * or saved. If another snapshot has been saved, the index is reloaded from
+ * it, unless @keep_snapshot is set. Must be called with the files locked. */
+static void
+sync_with_disk (EmpathyLogIndex *self,
+    gboolean keep_snapshot)
+{
+  if (!keep_snapshot && read_generation (self) != self->priv->generation)
+    {
+      DEBUG ("The log index has been saved by another process, reloading");
+
+      reset (self);
+      load (self);
+
+      self->priv->reloaded = TRUE;
+      return;
+    }
+
+  /* Lines this process wrote are already in the index, indexing them
+   * again doesn't change it */
+  replay_journal (self);
+}
+
+static void
+empathy_log_index_get_property (GObject *object,
+    guint property_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  switch (property_id)
+    {
+      case PROP_DIRECTORY:
+        g_value_set_string (value, self->priv->directory);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+empathy_log_index_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  switch (property_id)
+    {
+      case PROP_DIRECTORY:
+        g_assert (self->priv->directory == NULL); /* construct only */
+        self->priv->directory = g_value_dup_string (value);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+empathy_log_index_constructed (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  if (self->priv->directory == NULL)
+    self->priv->directory = g_build_filename (g_get_user_cache_dir (),
+        PACKAGE_NAME, "log-index", NULL);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->constructed (object);
+}
+
+static void
+empathy_log_index_dispose (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  if (self->priv->observer != NULL)
+    {
+      tp_base_client_unregister (self->priv->observer);
+      tp_clear_object (&self->priv->observer);
+    }
+
+  tp_clear_pointer (&self->priv->channels, g_hash_table_unref);
+  tp_clear_object (&self->priv->account_manager);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->dispose (object);
+}
+
+static void
+empathy_log_index_finalize (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  g_ptr_array_unref (self->priv->targets);
+  g_hash_table_unref (self->priv->targets_by_key);
+  g_array_unref (self->priv->postings);
+  g_hash_table_unref (self->priv->words);
+
+  g_free (self->priv->directory);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->finalize (object);
+}
+
+static void
+empathy_log_index_class_init (EmpathyLogIndexClass *klass)
+{
+  GObjectClass *oclass = G_OBJECT_CLASS (klass);
+  GParamSpec *spec;
+
+  oclass->get_property = empathy_log_index_get_property;
+  oclass->set_property = empathy_log_index_set_property;
+  oclass->constructed = empathy_log_index_constructed;
+  oclass->dispose = empathy_log_index_dispose;
+  oclass->finalize = empathy_log_index_finalize;
+
+  spec = g_param_spec_string ("directory", "Directory",
+      "Directory where the index is stored",
+      NULL,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (oclass, PROP_DIRECTORY, spec);
+
+  g_type_class_add_private (klass, sizeof (EmpathyLogIndexPriv));
+}
+
+static void
+empathy_log_index_init (EmpathyLogIndex *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexPriv);
+
+  g_queue_init (&self->priv->pending);
+
+  reset (self);
+}
+
+/**
+ * empathy_log_index_new:
+ * @directory: (allow-none): the directory where the index is stored, or
+ * %NULL to use the default one
+ *
+ * Returns: a new #EmpathyLogIndex
+ */
+EmpathyLogIndex *
+empathy_log_index_new (const gchar *directory)
+{
+  return g_object_new (EMPATHY_TYPE_LOG_INDEX,
+      "directory", directory,
+      NULL);
+}
+
+EmpathyLogIndex *
+empathy_log_index_dup_singleton (void)
+{
+  static EmpathyLogIndex *index = NULL;
+
+  if (G_LIKELY (index != NULL))
+      return g_object_ref (index);
+
+  index = empathy_log_index_new (NULL);
+
+  g_object_add_weak_pointer (G_OBJECT (index), (gpointer *) &index);
+  return index;
+}
+
+static TplLogSearchHit *
+create_hit (EmpathyLogIndex *self,
+    const Posting *posting)
+{
+  Target *target = g_ptr_array_index (self->priv->targets, posting->target);
+  TplLogSearchHit tmp, *hit;
+
+  tmp.account = tp_account_manager_ensure_account (
+      self->priv->account_manager, target->account_path);
+  if (tmp.account == NULL)
+    return NULL;
+
+  if (target->type == TPL_ENTITY_ROOM)
+    tmp.target = tpl_entity_new_from_room_id (target->id);
+  else
+    tmp.target = tpl_entity_new (target->id, target->type, NULL, NULL);
+
+  tmp.date = g_date_new_julian (posting->date);
+
+  hit = tpl_log_manager_search_hit_copy (&tmp);
+
+  g_object_unref (tmp.target);
+  g_date_free (tmp.date);
+
+  return hit;
+}
+
+/**
+ * empathy_log_index_search:
+ * @self: a #EmpathyLogIndex
+ * @text: the text to look for
+ * @hits: (out) (transfer full): a #GList of #TplLogSearchHit, free with
+ * tpl_log_manager_search_free()
+ *
+ * Looks for the dates at which messages containing all the words of @text
+ * have been logged. As with tpl_log_manager_search_async(), the match is
+ * case insensitive and each word of @text can be a part of a logged word.
+ * Unlike it, the words don't have to be next to each other, or even in the
+ * same message: if @text has several words, the hits are only candidates
+ * whose events have to be checked for the whole text.
+ *
+ * Returns: %FALSE if the index can't answer, because the logs haven't been
+ * indexed yet or @text has no word; tpl_log_manager_search_async() should
+ * be used instead.
+ */
+gboolean
+empathy_log_index_search (EmpathyLogIndex *self,
+    const gchar *text,
+    GList **hits)
+{
+  GHashTable *query;
+  GHashTableIter query_iter;
+  gpointer query_word;
+  guint n_words, i, q = 0;
+  guint *matched;
+
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), FALSE);
+  g_return_val_if_fail (hits != NULL, FALSE);
+
+  *hits = NULL;
+
+  ensure_loaded (self);
+
+  if (!self->priv->complete)
+    return FALSE;
+
+  query = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  split_words (text, query);
+
+  n_words = g_hash_table_size (query);
+  if (n_words == 0)
+    {
+      g_hash_table_unref (query);
+      return FALSE;
+    }
+
+  if (self->priv->account_manager == NULL)
+    self->priv->account_manager = tp_account_manager_dup ();
+
+  /* matched[p] is the number of query words found in posting p so far */
+  matched = g_new0 (guint, self->priv->postings->len);
+
+  g_hash_table_iter_init (&query_iter, query);
+  while (g_hash_table_iter_next (&query_iter, &query_word, NULL))
+    {
+      GHashTableIter iter;
+      gpointer word, value;
+
+      /* The vocabulary is way smaller than the logs so scanning it for
+       * partial matches is cheap */
+      g_hash_table_iter_init (&iter, self->priv->words);
+      while (g_hash_table_iter_next (&iter, &word, &value))
+        {
+          GArray *postings = value;
+
+          if (strstr (word, query_word) == NULL)
+            continue;
+
+          for (i = 0; i < postings->len; i++)
+            {
+              guint p = g_array_index (postings, guint, i);
+
+              if (matched[p] == q)
+                matched[p] = q + 1;
+            }
+        }
+
+      q++;
+    }
+
+  for (i = self->priv->postings->len; i > 0; i--)
+    {
+      const Posting *posting;
+      Target *target;
+      TplLogSearchHit *hit;
+
+      if (matched[i - 1] != n_words)
+        continue;
+
+      posting = &g_array_index (self->priv->postings, Posting, i - 1);
+      target = g_ptr_array_index (self->priv->targets, posting->target);
+
+      /* The target has been cleared */
+      if (target->account_path == NULL)
+        continue;
+
+      hit = create_hit (self, posting);
+      if (hit != NULL)
+        *hits = g_list_prepend (*hits, hit);
+    }
+
+  g_free (matched);
+  g_hash_table_unref (query);
+
+  return TRUE;
+}
+
+static void
+append_to_journal (EmpathyLogIndex *self,
+    const gchar *account_path,
+    TplEntityType type,
+    const gchar *id,
+    guint32 date,
+    GHashTable *words)
+{
+  GString *line;
+  GHashTableIter iter;
+  gpointer word;
+  gchar *escaped, *path;
+  GFile *file;
+  GFileOutputStream *journal;
+  GError *error = NULL;
+  gint lock;
+
+  escaped = g_strescape (id, NULL);
+  line = g_string_new (NULL);
+  g_string_printf (line, "%s\t%d\t%s\t%u\t", account_path, type, escaped,
+      date);
+  g_free (escaped);
+
+  g_hash_table_iter_init (&iter, words);
+  while (g_hash_table_iter_next (&iter, &word, NULL))
+    {
+      g_string_append (line, word);
+      g_string_append_c (line, ' ');
+    }
+
+  g_string_append_c (line, '\n');
+
+  /* The journal is reopened each time as another process may have saved
+   * a snapshot and removed it in the meantime */
+  lock = lock_files (self);
+
+  path = get_file_path (self, "journal");
+  file = g_file_new_for_path (path);
+  g_free (path);
+
+  journal = g_file_append_to (file, G_FILE_CREATE_PRIVATE, NULL, &error);
+  g_object_unref (file);
+
+  if (journal == NULL)
+    {
+      DEBUG ("Can't open the log index journal: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  if (!g_output_stream_write_all (G_OUTPUT_STREAM (journal), line->str,
+        line->len, NULL, NULL, &error) ||
+      !g_output_stream_close (G_OUTPUT_STREAM (journal), NULL, &error))
+    {
+      DEBUG ("Failed to write to the log index journal: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_object_unref (journal);
+
+out:
+  unlock_files (lock);
+  g_string_free (line, TRUE);
+}
+
+/**
+ * empathy_log_index_add_message:
+ * @self: a #EmpathyLogIndex
+ * @account: the account the message has been sent or received on
+ * @target_id: the identifier of the contact or room
+ * @target_type: the #TplEntityType of @target_id
+ * @timestamp: when the message has been sent, as a Unix timestamp
+ * @text: the text of the message
+ *
+ * Adds a message which has just been logged to the index.
+ */
+void
+empathy_log_index_add_message (EmpathyLogIndex *self,
+    TpAccount *account,
+    const gchar *target_id,
+    TplEntityType target_type,
+    gint64 timestamp,
+    const gchar *text)
+{
+  const gchar *account_path;
+  GDateTime *datetime;
+  GDate *date;
+  GHashTable *words;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+  g_return_if_fail (TP_IS_ACCOUNT (account));
+  g_return_if_fail (target_id != NULL);
+
+  if (text == NULL)
+    return;
+
+  ensure_loaded (self);
+
+  words = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  split_words (text, words);
+
+  if (g_hash_table_size (words) == 0)
+    goto out;
+
+  /* The logger files its logs by UTC date */
+  datetime = g_date_time_new_from_unix_utc (timestamp);
+  date = g_date_new_dmy (g_date_time_get_day_of_month (datetime),
+      g_date_time_get_month (datetime), g_date_time_get_year (datetime));
+
+  account_path = tp_proxy_get_object_path (account);
+
+  index_words (self,
+      ensure_target (self, account_path, target_type, target_id),
+      g_date_get_julian (date), words);
+
+  append_to_journal (self, account_path, target_type, target_id,
+      g_date_get_julian (date), words);
+
+  g_date_free (date);
+  g_date_time_unref (datetime);
+
+out:
+  g_hash_table_unref (words);
+}
+
+/* Must be called with the files locked, after sync_with_disk() */
+static gboolean
+write_snapshot (EmpathyLogIndex *self,
+    GError **error)
+{
+  GString *str;
+  guint *target_map, *posting_map;
+  guint i, n_targets = 0, n_postings = 0;
+  GHashTableIter iter;
+  gpointer word, value;
+  gchar *path;
+  gboolean result;
+  guint64 generation;
+
+  if (g_mkdir_with_parents (self->priv->directory, 0700) != 0)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+          "Can't create %s: %s", self->priv->directory, g_strerror (errno));
+      return FALSE;
+    }
+
+  do
+    generation = ((guint64) g_random_int () << 32) | g_random_int ();
+  while (generation == 0 || generation == self->priv->generation);
+
+  str = g_string_new (INDEX_HEADER "\n");
+  g_string_append_printf (str, "g\t%" G_GUINT64_FORMAT "\n", generation);
+  g_string_append_printf (str, "c\t%d\n", self->priv->complete);
+
+  /* Renumber targets and postings, skipping the cleared ones */
+  target_map = g_new (guint, self->priv->targets->len);
+  for (i = 0; i < self->priv->targets->len; i++)
+    {
+      Target *target = g_ptr_array_index (self->priv->targets, i);
+      gchar *escaped;
+
+      if (target->account_path == NULL)
+        {
+          target_map[i] = G_MAXUINT;
+          continue;
+        }
+
+      target_map[i] = n_targets++;
+
+      escaped = g_strescape (target->id, NULL);
+      g_string_append_printf (str, "t\t%s\t%d\t%s\t%u\n",
+          target->account_path, target->type, escaped, target->last_date);
+      g_free (escaped);
+    }
+
+  posting_map = g_new (guint, self->priv->postings->len);
+  for (i = 0; i < self->priv->postings->len; i++)
+    {
+      Posting *posting = &g_array_index (self->priv->postings, Posting, i);
+
+      if (target_map[posting->target] == G_MAXUINT)
+        {
+          posting_map[i] = G_MAXUINT;
+          continue;
+        }
+
+      posting_map[i] = n_postings++;
+
+      g_string_append_printf (str, "p\t%u\t%u\n",
+          target_map[posting->target], posting->date);
+    }
+
+  g_hash_table_iter_init (&iter, self->priv->words);
+  while (g_hash_table_iter_next (&iter, &word, &value))
+    {
+      GArray *postings = value;
+      gsize len = str->len;
+      gboolean empty = TRUE;
+
+      g_string_append_printf (str, "w\t%s\t", (const gchar *) word);
+
+      for (i = 0; i < postings->len; i++)
+        {
+          guint p = posting_map[g_array_index (postings, guint, i)];
+
+          if (p == G_MAXUINT)
+            continue;
+
+          g_string_append_printf (str, empty ? "%u" : " %u", p);
+          empty = FALSE;
+        }
+
+      if (empty)
+        g_string_truncate (str, len);
+      else
+        g_string_append_c (str, '\n');
+    }
+
+  g_free (target_map);
+  g_free (posting_map);
+
+  path = get_file_path (self, "index");
+  result = g_file_set_contents (path, str->str, str->len, error);
+  g_free (path);
+
+  g_string_free (str, TRUE);
+
+  if (!result)
+    return FALSE;
+
+  self->priv->generation = generation;
+
+  /* Everything in the journal is now in the snapshot */
+  path = get_file_path (self, "journal");
+  g_unlink (path);
+  g_free (path);
+
+  DEBUG ("Saved log index: %u targets, %u dates, %u words", n_targets,
+      n_postings, g_hash_table_size (self->priv->words));
+
+  return TRUE;
+}
+
+/**
+ * empathy_log_index_clear:
+ * @self: a #EmpathyLogIndex
+ * @account: (allow-none): the account whose logs have been deleted, or %NULL
+ * if all the logs have been deleted
+ *
+ * Removes the logs of @account from the index.
+ */
+void
+empathy_log_index_clear (EmpathyLogIndex *self,
+    TpAccount *account)
+{
+  const gchar *account_path = NULL;
+  GError *error = NULL;
+  guint i;
+  gint lock;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+
+  ensure_loaded (self);
+
+  if (account != NULL)
+    account_path = tp_proxy_get_object_path (account);
+
+  lock = lock_files (self);
+  sync_with_disk (self, FALSE);
+
+  /* Postings of the cleared targets are dropped when saving */
+  for (i = 0; i < self->priv->targets->len; i++)
+    {
+      Target *target = g_ptr_array_index (self->priv->targets, i);
+      gchar *key;
+
+      if (target->account_path == NULL)
+        continue;
+
+      if (account_path != NULL &&
+          tp_strdiff (account_path, target->account_path))
+        continue;
+
+      key = make_target_key (target->account_path, target->id);
+      g_hash_table_remove (self->priv->targets_by_key, key);
+      g_free (key);
+
+      tp_clear_pointer (&target->account_path, g_free);
+    }
+
+  /* Save right away so the journal doesn't bring the messages back */
+  if (!write_snapshot (self, &error))
+    {
+      DEBUG ("Failed to save the log index: %s", error->message);
+      g_error_free (error);
+    }
+
+  unlock_files (lock);
+}
+
+/**
+ * empathy_log_index_save:
+ * @self: a #EmpathyLogIndex
+ * @error: a #GError to fill
+ *
+ * Writes a snapshot of the index to disk and empties the journal. If
+ * another process saved the index since it's been loaded, the index is
+ * reloaded first.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+empathy_log_index_save (EmpathyLogIndex *self,
+    GError **error)
+{
+  gboolean result;
+  gint lock;
+
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), FALSE);
+
+  ensure_loaded (self);
+
+  lock = lock_files (self);
+  sync_with_disk (self, FALSE);
+  result = write_snapshot (self, error);
+  unlock_files (lock);
+
+  return result;
+}
+
+/**
+ * empathy_log_index_get_stats:
+ * @self: a #EmpathyLogIndex
+ * @n_targets: (out) (allow-none): number of contacts and rooms
+ * @n_dates: (out) (allow-none): number of (contact or room, date) pairs
+ * @n_words: (out) (allow-none): number of distinct words
+ */
+void
+empathy_log_index_get_stats (EmpathyLogIndex *self,
+    guint *n_targets,
+    guint *n_dates,
+    guint *n_words)
+{
+  ensure_loaded (self);
+
+  if (n_targets != NULL)
+    *n_targets = g_hash_table_size (self->priv->targets_by_key);
+  if (n_dates != NULL)
+    *n_dates = self->priv->postings->len;
+  if (n_words != NULL)
+    *n_words = g_hash_table_size (self->priv->words);
+}
+
+void
+empathy_log_index_mark_complete (EmpathyLogIndex *self)
+{
+  ensure_loaded (self);
+
+  self->priv->complete = TRUE;
+}
+
+/* Update */
+
+static void update_next (EmpathyLogIndex *self);
+
+static void start_update (EmpathyLogIndex *self,
+    gboolean rebuild);
+
+static void
+update_done (EmpathyLogIndex *self,
+    const GError *error)
+{
+  GList *waiters, *l;
+
+  g_queue_foreach (&self->priv->pending, (GFunc) update_ctx_free, NULL);
+  g_queue_clear (&self->priv->pending);
+
+  if (error == NULL)
+    {
+      GError *save_error = NULL;
+      gint lock;
+
+      DEBUG ("Log index updated, %u dates (re)indexed",
+          self->priv->n_updated_dates);
+
+      lock = lock_files (self);
+
+      /* A rebuild supersedes whatever has been saved since it started */
+      sync_with_disk (self, self->priv->rebuilding);
+
+      /* Dates indexed before a reload are lost, so only the snapshot which
+       * got loaded knows whether all the logs are in */
+      if (self->priv->reloaded)
+        DEBUG ("The log index has been reloaded while updating");
+      else
+        self->priv->complete = TRUE;
+
+      if (!write_snapshot (self, &save_error))
+        {
+          DEBUG ("Failed to save the log index: %s", save_error->message);
+          g_error_free (save_error);
+        }
+
+      unlock_files (lock);
+    }
+  else
+    {
+      DEBUG ("Failed to update the log index: %s", error->message);
+    }
+
+  tp_clear_object (&self->priv->log_manager);
+
+  waiters = self->priv->update_waiters;
+  self->priv->update_waiters = NULL;
+
+  for (l = waiters; l != NULL; l = g_list_next (l))
+    update_waiter_complete (l->data, error);
+
+  g_list_free (waiters);
+
+  /* A rebuild has been requested while updating */
+  if (self->priv->queued_waiters != NULL)
+    {
+      self->priv->update_waiters = self->priv->queued_waiters;
+      self->priv->queued_waiters = NULL;
+
+      start_update (self, TRUE);
+    }
+
+  /* Ref taken in start_update() */
+  g_object_unref (self);
+}
+
+static void
+got_entities_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  UpdateCtx *ctx = g_queue_pop_head (&self->priv->pending);
+  GList *entities, *l;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_entities_finish (TPL_LOG_MANAGER (manager),
+        result, &entities, &error))
+    {
+      DEBUG ("Failed to get entities of %s: %s",
+          tp_proxy_get_object_path (ctx->account), error->message);
+      g_clear_error (&error);
+      entities = NULL;
+    }
+
+  /* Index the account one entity at a time */
+  for (l = entities; l != NULL; l = g_list_next (l))
+    g_queue_push_head (&self->priv->pending,
+        update_ctx_new (STEP_GET_DATES, ctx->account, l->data, NULL));
+
+  g_list_free_full (entities, g_object_unref);
+  update_ctx_free (ctx);
+
+  update_next (self);
+}
+
+static void
+got_dates_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  UpdateCtx *ctx = g_queue_pop_head (&self->priv->pending);
+  GList *dates, *l;
+  GError *error = NULL;
+  Target *target;
+
+  if (!tpl_log_manager_get_dates_finish (TPL_LOG_MANAGER (manager),
+        result, &dates, &error))
+    {
+      DEBUG ("Failed to get dates of %s: %s",
+          tpl_entity_get_identifier (ctx->entity), error->message);
+      g_clear_error (&error);
+      dates = NULL;
+    }
+
+  target = g_ptr_array_index (self->priv->targets,
+      ensure_target (self, tp_proxy_get_object_path (ctx->account),
+        tpl_entity_get_entity_type (ctx->entity),
+        tpl_entity_get_identifier (ctx->entity)));
+
+  /* The most recent indexed date may have got more messages since. Dates
+   * are pushed from the most recent one so they are indexed in order and
+   * last_date is never past a date which hasn't been indexed yet. */
+  for (l = g_list_last (dates); l != NULL; l = g_list_previous (l))
+    {
+      if (g_date_get_julian (l->data) >= target->last_date)
+        g_queue_push_head (&self->priv->pending,
+            update_ctx_new (STEP_GET_EVENTS, ctx->account, ctx->entity,
+              l->data));
+    }
+
+  g_list_free_full (dates, (GDestroyNotify) g_date_free);
+  update_ctx_free (ctx);
+
+  update_next (self);
+}
+
+static void
+got_events_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  UpdateCtx *ctx = g_queue_pop_head (&self->priv->pending);
+  GList *events, *l;
+  GError *error = NULL;
+  guint target_nb;
+  Target *target;
+
+  if (!tpl_log_manager_get_events_for_date_finish (TPL_LOG_MANAGER (manager),
+        result, &events, &error))
+    {
+      DEBUG ("Failed to get events of %s: %s",
+          tpl_entity_get_identifier (ctx->entity), error->message);
+      g_clear_error (&error);
+      events = NULL;
+    }
+
+  target_nb = ensure_target (self, tp_proxy_get_object_path (ctx->account),
+      tpl_entity_get_entity_type (ctx->entity),
+      tpl_entity_get_identifier (ctx->entity));
+
+  for (l = events; l != NULL; l = g_list_next (l))
+    {
+      if (!TPL_IS_TEXT_EVENT (l->data))
+        continue;
+
+      index_text (self, target_nb, g_date_get_julian (ctx->date),
+          tpl_text_event_get_message (l->data));
+    }
+
+  target = g_ptr_array_index (self->priv->targets, target_nb);
+  target->last_date = MAX (target->last_date, g_date_get_julian (ctx->date));
+
+  self->priv->n_updated_dates++;
+
+  g_list_free_full (events, g_object_unref);
+  update_ctx_free (ctx);
+
+  update_next (self);
+}
+
+/* The step being processed stays at the head of the queue until its
+ * callback pops it */
+/* Completes the waiters whose cancellable has been cancelled and returns
+ * the others */
+static GList *
+drop_cancelled_waiters (GList *waiters)
+{
+  GList *l = waiters;
+
+  while (l != NULL)
+    {
+      GList *next = g_list_next (l);
+      UpdateWaiter *waiter = l->data;
+      GError *error = NULL;
+
+      if (g_cancellable_set_error_if_cancelled (waiter->cancellable, &error))
+        {
+          update_waiter_complete (waiter, error);
+          g_error_free (error);
+
+          waiters = g_list_delete_link (waiters, l);
+        }
+
+      l = next;
+    }
+
+  return waiters;
+}
+
+static void
+update_next (EmpathyLogIndex *self)
+{
+  UpdateCtx *ctx;
+  GError *error = NULL;
+
+  /* Each caller can give up on the update without cancelling it for the
+   * others */
+  self->priv->update_waiters = drop_cancelled_waiters (
+      self->priv->update_waiters);
+  self->priv->queued_waiters = drop_cancelled_waiters (
+      self->priv->queued_waiters);
+
+  if (self->priv->update_waiters == NULL)
+    {
+      g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+          "All the callers have cancelled the update");
+      update_done (self, error);
+      g_error_free (error);
+      return;
+    }
+
+  ctx = g_queue_peek_head (&self->priv->pending);
+  if (ctx == NULL)
+    {
+      update_done (self, NULL);
+      return;
+    }
+
+  switch (ctx->step)
+    {
+      case STEP_GET_ENTITIES:
+        tpl_log_manager_get_entities_async (self->priv->log_manager,
+            ctx->account, got_entities_cb, self);
+        break;
+      case STEP_GET_DATES:
+        tpl_log_manager_get_dates_async (self->priv->log_manager,
+            ctx->account, ctx->entity, TPL_EVENT_MASK_TEXT,
+            got_dates_cb, self);
+        break;
+      case STEP_GET_EVENTS:
+        tpl_log_manager_get_events_for_date_async (self->priv->log_manager,
+            ctx->account, ctx->entity, TPL_EVENT_MASK_TEXT, ctx->date,
+            got_events_cb, self);
+        break;
+    }
+}
+
+static void
+account_manager_prepared_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  GList *accounts, *l;
+  GError *error = NULL;
+
+  if (!tp_proxy_prepare_finish (source, result, &error))
+    {
+      update_done (self, error);
+      g_error_free (error);
+      return;
+    }
+
+  accounts = tp_account_manager_dup_valid_accounts (
+      TP_ACCOUNT_MANAGER (source));
+
+  for (l = accounts; l != NULL; l = g_list_next (l))
+    g_queue_push_tail (&self->priv->pending,
+        update_ctx_new (STEP_GET_ENTITIES, l->data, NULL, NULL));
+
+  g_list_free_full (accounts, g_object_unref);
+
+  update_next (self);
+}
+
+static void
+start_update (EmpathyLogIndex *self,
+    gboolean rebuild)
+{
+  ensure_loaded (self);
+
+  if (rebuild)
+    {
+      reset (self);
+    }
+  else
+    {
+      gint lock;
+
+      /* Start from what empathy-rebuild-log-index or another Empathy
+       * process may have saved */
+      lock = lock_files (self);
+      sync_with_disk (self, FALSE);
+      unlock_files (lock);
+    }
+
+  self->priv->rebuilding = rebuild;
+  self->priv->reloaded = FALSE;
+  self->priv->log_manager = tpl_log_manager_dup_singleton ();
+  self->priv->n_updated_dates = 0;
+
+  if (self->priv->account_manager == NULL)
+    self->priv->account_manager = tp_account_manager_dup ();
+
+  /* Released in update_done() */
+  tp_proxy_prepare_async (self->priv->account_manager, NULL,
+      account_manager_prepared_cb, g_object_ref (self));
+}
+
+/**
+ * empathy_log_index_update_async:
+ * @self: a #EmpathyLogIndex
+ * @rebuild: if %TRUE, discard the index and index all the logs again
+ * @cancellable: (allow-none): a #GCancellable
+ * @callback: a callback to call when the update is done
+ * @user_data: data to pass to @callback
+ *
+ * Indexes the logs which have been written since the last update (or since
+ * the last message added using empathy_log_index_add_message() for each
+ * contact).
+ *
+ * If an update is already in progress, @callback is called once it's done;
+ * if @rebuild is set and that update isn't a rebuild, once a rebuild
+ * started after it is done. Cancelling @cancellable only completes this
+ * call: the update goes on as long as another caller is waiting for it.
+ */
+void
+empathy_log_index_update_async (EmpathyLogIndex *self,
+    gboolean rebuild,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  UpdateWaiter *waiter;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+
+  waiter = g_slice_new0 (UpdateWaiter);
+  waiter->simple = g_simple_async_result_new (G_OBJECT (self), callback,
+      user_data, empathy_log_index_update_async);
+
+  if (cancellable != NULL)
+    waiter->cancellable = g_object_ref (cancellable);
+
+  if (self->priv->update_waiters == NULL)
+    {
+      self->priv->update_waiters = g_list_prepend (NULL, waiter);
+      start_update (self, rebuild);
+    }
+  else if (rebuild && !self->priv->rebuilding)
+    {
+      self->priv->queued_waiters = g_list_prepend (
+          self->priv->queued_waiters, waiter);
+    }
+  else
+    {
+      self->priv->update_waiters = g_list_prepend (
+          self->priv->update_waiters, waiter);
+    }
+}
+
+gboolean
+empathy_log_index_update_finish (EmpathyLogIndex *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  tpaw_implement_finish_void (self, empathy_log_index_update_async);
+}
+
+/* Observer */
+
+static void
+index_message (EmpathyLogIndex *self,
+    TpChannel *channel,
+    TpMessage *message)
+{
+  TpAccount *account;
+  TpHandleType handle_type;
+  gint64 timestamp;
+  gchar *text;
+
+  account = g_hash_table_lookup (self->priv->channels, channel);
+  if (account == NULL)
+    return;
+
+  tp_channel_get_handle (channel, &handle_type);
+
+  timestamp = tp_message_get_sent_timestamp (message);
+  if (timestamp == 0)
+    timestamp = tp_message_get_received_timestamp (message);
+  if (timestamp == 0)
+    timestamp = g_get_real_time () / G_USEC_PER_SEC;
+
+  text = tp_message_to_text (message, NULL);
+
+  empathy_log_index_add_message (self, account,
+      tp_channel_get_identifier (channel),
+      handle_type == TP_HANDLE_TYPE_ROOM ? TPL_ENTITY_ROOM : TPL_ENTITY_CONTACT,
+      timestamp, text);
+
+  g_free (text);
+}
+
+static void
+message_sent_cb (TpTextChannel *channel,
+    TpSignalledMessage *message,
+    guint flags,
+    gchar *token,
+    EmpathyLogIndex *self)
+{
+  index_message (self, TP_CHANNEL (channel), TP_MESSAGE (message));
+}
+
+static void
+message_received_cb (TpTextChannel *channel,
+    TpSignalledMessage *message,
+    EmpathyLogIndex *self)
+{
+  TpChannelTextMessageType type;
+
+  type = tp_message_get_message_type (TP_MESSAGE (message));
+
+  if (type != TP_CHANNEL_TEXT_MESSAGE_TYPE_NORMAL &&
+      type != TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION)
+    return;
+
+  index_message (self, TP_CHANNEL (channel), TP_MESSAGE (message));
+}
+
+static void
+channel_invalidated_cb (TpChannel *channel,
+    guint domain,
+    gint code,
+    gchar *message,
+    EmpathyLogIndex *self)
+{
+  g_hash_table_remove (self->priv->channels, channel);
+}
+
+static void
+observe_channels_cb (TpSimpleObserver *observer,
+    TpAccount *account,
+    TpConnection *connection,
+    GList *channels,
+    TpChannelDispatchOperation *dispatch_operation,
+    GList *requests,
+    TpObserveChannelsContext *context,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  GList *l;
+
+  for (l = channels; l != NULL; l = g_list_next (l))
+    {
+      TpChannel *channel = l->data;
+
+      if (!TP_IS_TEXT_CHANNEL (channel))
+        continue;
+
+      g_hash_table_insert (self->priv->channels, g_object_ref (channel),
+          g_object_ref (account));
+
+      tp_g_signal_connect_object (channel, "message-sent",
+          G_CALLBACK (message_sent_cb), self, 0);
+      tp_g_signal_connect_object (channel, "message-received",
+          G_CALLBACK (message_received_cb), self, 0);
+      tp_g_signal_connect_object (channel, "invalidated",
+          G_CALLBACK (channel_invalidated_cb), self, 0);
+    }
+
+  tp_observe_channels_context_accept (context);
+}
+
+/**
+ * empathy_log_index_observe_messages:
+ * @self: a #EmpathyLogIndex
+ *
+ * Adds the messages sent and received from now on to the index, so that
+ * searches find them without waiting for the next update. A single
+ * process, living as long as possible, should do it.
+ */
+void
+empathy_log_index_observe_messages (EmpathyLogIndex *self)
+{
+  GError *error = NULL;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+
+  if (self->priv->observer != NULL)
+    return;
+
+  if (self->priv->account_manager == NULL)
+    self->priv->account_manager = tp_account_manager_dup ();
+
+  self->priv->channels = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, g_object_unref);
+
+  self->priv->observer = tp_simple_observer_new_with_am (
+      self->priv->account_manager, TRUE, "Empathy.LogIndex", TRUE,
+      observe_channels_cb, self, NULL);
+
+  tp_base_client_take_observer_filter (self->priv->observer,
+      tp_asv_new (
+          TP_PROP_CHANNEL_CHANNEL_TYPE, G_TYPE_STRING,
+            TP_IFACE_CHANNEL_TYPE_TEXT,
+          NULL));
+
+  if (!tp_base_client_register (self->priv->observer, &error))
+    {
+      DEBUG ("Failed to register the observer: %s", error->message);
+      g_error_free (error);
+    }
+}
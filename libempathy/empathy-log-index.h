@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_LOG_INDEX_H__
+#define __EMPATHY_LOG_INDEX_H__
+
+#include <gio/gio.h>
+#include <telepathy-glib/telepathy-glib.h>
+#include <telepathy-logger/telepathy-logger.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathyLogIndex EmpathyLogIndex;
+typedef struct _EmpathyLogIndexClass EmpathyLogIndexClass;
+typedef struct _EmpathyLogIndexPriv EmpathyLogIndexPriv;
+
+struct _EmpathyLogIndexClass
+{
+  GObjectClass parent_class;
+};
+
+struct _EmpathyLogIndex
+{
+  GObject parent;
+  EmpathyLogIndexPriv *priv;
+};
+
+GType empathy_log_index_get_type (void);
+
+#define EMPATHY_TYPE_LOG_INDEX \
+  (empathy_log_index_get_type ())
+#define EMPATHY_LOG_INDEX(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), EMPATHY_TYPE_LOG_INDEX, \
+    EmpathyLogIndex))
+#define EMPATHY_LOG_INDEX_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), EMPATHY_TYPE_LOG_INDEX, \
+    EmpathyLogIndexClass))
+#define EMPATHY_IS_LOG_INDEX(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), EMPATHY_TYPE_LOG_INDEX))
+#define EMPATHY_IS_LOG_INDEX_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), EMPATHY_TYPE_LOG_INDEX))
+#define EMPATHY_LOG_INDEX_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), EMPATHY_TYPE_LOG_INDEX, \
+    EmpathyLogIndexClass))
+
+EmpathyLogIndex * empathy_log_index_new (const gchar *directory);
+EmpathyLogIndex * empathy_log_index_dup_singleton (void);
+
+gboolean empathy_log_index_search (EmpathyLogIndex *self,
+    const gchar *text,
+    GList **hits);
+
+void empathy_log_index_add_message (EmpathyLogIndex *self,
+    TpAccount *account,
+    const gchar *target_id,
+    TplEntityType target_type,
+    gint64 timestamp,
+    const gchar *text);
+
+void empathy_log_index_clear (EmpathyLogIndex *self,
+    TpAccount *account);
+
+void empathy_log_index_observe_messages (EmpathyLogIndex *self);
+
+void empathy_log_index_update_async (EmpathyLogIndex *self,
+    gboolean rebuild,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+gboolean empathy_log_index_update_finish (EmpathyLogIndex *self,
+    GAsyncResult *result,
+    GError **error);
+
+gboolean empathy_log_index_save (EmpathyLogIndex *self,
+    GError **error);
+
+void empathy_log_index_get_stats (EmpathyLogIndex *self,
+    guint *n_targets,
+    guint *n_dates,
+    guint *n_words);
+
+/* Restricted: for benchmarks feeding the index themselves */
+void empathy_log_index_mark_complete (EmpathyLogIndex *self);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_LOG_INDEX_H__ */
@@ -0,0 +1,330 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-timer-wheel.h"
+
+/* Resolution of the default wheel, in milliseconds */
+#define DEFAULT_RESOLUTION 250
+
+typedef struct
+{
+  guint id;
+  /* Monotonic time, in microseconds, rounded to the wheel's resolution */
+  gint64 deadline;
+  /* in milliseconds */
+  guint interval;
+
+  GSourceFunc func;
+  gpointer user_data;
+  GDestroyNotify notify;
+
+  /* NULL while the entry is being dispatched */
+  GSequenceIter *iter;
+  /* TRUE if the entry has been removed while being dispatched */
+  gboolean removed;
+} Entry;
+
+struct _EmpathyTimerWheel
+{
+  /* in microseconds */
+  gint64 resolution;
+
+  guint last_id;
+  /* guint id -> owned Entry */
+  GHashTable *entries;
+  /* borrowed Entry sorted by deadline */
+  GSequence *queue;
+
+  guint source_id;
+  /* Deadline source_id has been armed for */
+  gint64 armed_deadline;
+};
+
+static void
+entry_free (Entry *entry)
+{
+  if (entry->notify != NULL)
+    entry->notify (entry->user_data);
+
+  g_slice_free (Entry, entry);
+}
+
+static gint
+compare_entries (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  const Entry *entry_a = a, *entry_b = b;
+
+  if (entry_a->deadline != entry_b->deadline)
+    return entry_a->deadline < entry_b->deadline ? -1 : 1;
+
+  /* Keep timeouts expiring in the same slot in insertion order */
+  if (entry_a->id != entry_b->id)
+    return entry_a->id < entry_b->id ? -1 : 1;
+
+  return 0;
+}
+
+static gint64
+compute_deadline (EmpathyTimerWheel *self,
+    gint64 now,
+    guint interval)
+{
+  gint64 deadline;
+
+  deadline = now + (gint64) MAX (interval, 1) * 1000;
+
+  /* Round to the nearest slot, so a timeout is at most half a slot late or
+   * early, rather than up to a whole slot late */
+  deadline = ((deadline + self->resolution / 2) / self->resolution) *
+    self->resolution;
+
+  /* Make sure a repeating timeout doesn't expire again in the same slot */
+  if (deadline <= now)
+    deadline += self->resolution;
+
+  return deadline;
+}
+
+static Entry *
+get_first_entry (EmpathyTimerWheel *self)
+{
+  GSequenceIter *first = g_sequence_get_begin_iter (self->queue);
+
+  if (g_sequence_iter_is_end (first))
+    return NULL;
+
+  return g_sequence_get (first);
+}
+
+static void arm (EmpathyTimerWheel *self);
+
+static gboolean
+dispatch_cb (gpointer user_data)
+{
+  EmpathyTimerWheel *self = user_data;
+  gint64 now;
+
+  self->source_id = 0;
+
+  now = g_get_monotonic_time ();
+
+  while (TRUE)
+    {
+      Entry *entry = get_first_entry (self);
+      gboolean again;
+
+      if (entry == NULL || entry->deadline > now)
+        break;
+
+      g_sequence_remove (entry->iter);
+      entry->iter = NULL;
+
+      again = entry->func (entry->user_data);
+
+      if (entry->removed || !again)
+        {
+          /* Removing it from the hash table frees it */
+          if (!entry->removed)
+            g_hash_table_remove (self->entries, GUINT_TO_POINTER (entry->id));
+          else
+            entry_free (entry);
+
+          continue;
+        }
+
+      entry->deadline = compute_deadline (self, now, entry->interval);
+      entry->iter = g_sequence_insert_sorted (self->queue, entry,
+          compare_entries, NULL);
+    }
+
+  arm (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Make sure the source is set to wake us up for the first deadline */
+static void
+arm (EmpathyTimerWheel *self)
+{
+  Entry *first;
+  gint64 now, delay;
+
+  first = get_first_entry (self);
+  if (first == NULL)
+    {
+      if (self->source_id != 0)
+        {
+          g_source_remove (self->source_id);
+          self->source_id = 0;
+        }
+
+      return;
+    }
+
+  if (self->source_id != 0)
+    {
+      if (self->armed_deadline <= first->deadline)
+        /* We'll wake up early enough */
+        return;
+
+      g_source_remove (self->source_id);
+    }
+
+  now = g_get_monotonic_time ();
+  delay = MAX (first->deadline - now, 0);
+
+  self->armed_deadline = first->deadline;
+  self->source_id = g_timeout_add ((delay + 999) / 1000, dispatch_cb, self);
+}
+
+EmpathyTimerWheel *
+empathy_timer_wheel_new (guint resolution)
+{
+  EmpathyTimerWheel *self;
+
+  g_return_val_if_fail (resolution > 0, NULL);
+
+  self = g_slice_new0 (EmpathyTimerWheel);
+
+  self->resolution = (gint64) resolution * 1000;
+  self->entries = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) entry_free);
+  self->queue = g_sequence_new (NULL);
+
+  return self;
+}
+
+void
+empathy_timer_wheel_free (EmpathyTimerWheel *self)
+{
+  if (self->source_id != 0)
+    g_source_remove (self->source_id);
+
+  g_sequence_free (self->queue);
+  g_hash_table_unref (self->entries);
+
+  g_slice_free (EmpathyTimerWheel, self);
+}
+
+/**
+ * empathy_timer_wheel_get_default:
+ *
+ * Returns: (transfer none): the wheel shared by all the components of the
+ * process.
+ */
+EmpathyTimerWheel *
+empathy_timer_wheel_get_default (void)
+{
+  static EmpathyTimerWheel *wheel = NULL;
+
+  if (wheel == NULL)
+    wheel = empathy_timer_wheel_new (DEFAULT_RESOLUTION);
+
+  return wheel;
+}
+
+/**
+ * empathy_timer_wheel_add_full:
+ * @self: a #EmpathyTimerWheel
+ * @interval: the time between calls to @func, in milliseconds
+ * @func: function to call; as for g_timeout_add(), the timeout is removed if
+ * it returns %FALSE
+ * @user_data: data to pass to @func
+ * @notify: (allow-none): function to call when the timeout is removed
+ *
+ * Like g_timeout_add_full() but @func may be called up to the wheel's
+ * resolution later than requested.
+ *
+ * Returns: the ID of the timeout, to be used with
+ * empathy_timer_wheel_remove()
+ */
+guint
+empathy_timer_wheel_add_full (EmpathyTimerWheel *self,
+    guint interval,
+    GSourceFunc func,
+    gpointer user_data,
+    GDestroyNotify notify)
+{
+  Entry *entry;
+
+  g_return_val_if_fail (func != NULL, 0);
+
+  entry = g_slice_new0 (Entry);
+  entry->id = ++self->last_id;
+  entry->interval = interval;
+  entry->deadline = compute_deadline (self, g_get_monotonic_time (),
+      interval);
+  entry->func = func;
+  entry->user_data = user_data;
+  entry->notify = notify;
+
+  g_hash_table_insert (self->entries, GUINT_TO_POINTER (entry->id), entry);
+  entry->iter = g_sequence_insert_sorted (self->queue, entry,
+      compare_entries, NULL);
+
+  arm (self);
+
+  return entry->id;
+}
+
+guint
+empathy_timer_wheel_add (EmpathyTimerWheel *self,
+    guint interval,
+    GSourceFunc func,
+    gpointer user_data)
+{
+  return empathy_timer_wheel_add_full (self, interval, func, user_data, NULL);
+}
+
+gboolean
+empathy_timer_wheel_remove (EmpathyTimerWheel *self,
+    guint id)
+{
+  Entry *entry;
+
+  entry = g_hash_table_lookup (self->entries, GUINT_TO_POINTER (id));
+  if (entry == NULL)
+    return FALSE;
+
+  if (entry->iter == NULL)
+    {
+      /* The entry is being dispatched, dispatch_cb() will free it */
+      g_hash_table_steal (self->entries, GUINT_TO_POINTER (id));
+      entry->removed = TRUE;
+      return TRUE;
+    }
+
+  g_sequence_remove (entry->iter);
+  g_hash_table_remove (self->entries, GUINT_TO_POINTER (id));
+
+  /* No need to re-arm; waking up for nothing once is cheaper than
+   * re-creating the source each time a timeout is removed. */
+  if (get_first_entry (self) == NULL)
+    arm (self);
+
+  return TRUE;
+}
+
+guint
+empathy_timer_wheel_get_size (EmpathyTimerWheel *self)
+{
+  return g_hash_table_size (self->entries);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_TIMER_WHEEL_H__
+#define __EMPATHY_TIMER_WHEEL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A set of timeouts sharing one main loop source. Deadlines are rounded to
+ * the nearest multiple of the wheel's resolution so timeouts expiring close
+ * to each other are dispatched in the same wake up. */
+typedef struct _EmpathyTimerWheel EmpathyTimerWheel;
+
+EmpathyTimerWheel * empathy_timer_wheel_new (guint resolution);
+void empathy_timer_wheel_free (EmpathyTimerWheel *self);
+
+EmpathyTimerWheel * empathy_timer_wheel_get_default (void);
+
+guint empathy_timer_wheel_add_full (EmpathyTimerWheel *self,
+    guint interval,
+    GSourceFunc func,
+    gpointer user_data,
+    GDestroyNotify notify);
+guint empathy_timer_wheel_add (EmpathyTimerWheel *self,
+    guint interval,
+    GSourceFunc func,
+    gpointer user_data);
+gboolean empathy_timer_wheel_remove (EmpathyTimerWheel *self,
+    guint id);
+
+guint empathy_timer_wheel_get_size (EmpathyTimerWheel *self);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_TIMER_WHEEL_H__ */
@@ -28,6 +28,7 @@
 #include "empathy-bus-names.h"
 #include "empathy-chat-manager.h"
 #include "empathy-chat-resources.h"
+#include "empathy-log-catalog.h"
 #include "empathy-presence-manager.h"
 #include "empathy-theme-manager.h"
 #include "empathy-ui-utils.h"
@@ -94,6 +95,7 @@ main (int argc,
 #endif
   GError *error = NULL;
   EmpathyPresenceManager *presence_mgr;
+  EmpathyLogCatalog *log_catalog;
   EmpathyThemeManager *theme_mgr;
   gint retval;
 
@@ -140,6 +142,10 @@ main (int argc,
   /* Keep the theme manager alive as it does some caching */
   theme_mgr = empathy_theme_manager_dup_singleton ();
 
+  /* Keep the log catalog alive so the contact menus don't list the logs
+   * again */
+  log_catalog = empathy_log_catalog_dup_singleton ();
+
   if (g_getenv ("EMPATHY_PERSIST") != NULL)
     {
       DEBUG ("Disable timer");
@@ -159,6 +165,7 @@ main (int argc,
   g_object_unref (app);
   g_object_unref (presence_mgr);
   g_object_unref (theme_mgr);
+  g_object_unref (log_catalog);
   tp_clear_object (&chat_mgr);
 
 #ifdef ENABLE_DEBUG
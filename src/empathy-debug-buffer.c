@@ -0,0 +1,579 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Bounded buffer of debug messages, exposed as a flat GtkTreeModel with a
+ * single TpDebugMessage column.
+ *
+ * Messages are kept in a ring of pointers: appending one past the limits
+ * evicts the oldest ones, so a chatty service can't make the debugger grow
+ * without bound. Rows are identified by a serial number increasing with
+ * each appended message; the row of a serial is its distance to the serial
+ * of the oldest message, so iters stay valid until their row is evicted.
+ *
+ * The time of each message is kept next to it, clamped so it never goes
+ * back in time within the buffer; EmpathyDebugMerge relies on it to merge
+ * buffers with binary searches.
+ *
+ * The size of each message is kept too, with what has been charged to it
+ * by the structures kept alongside, such as EmpathyDebugIndex, so the
+ * size limit covers them as well. */
+
+#include "config.h"
+#include "empathy-debug-buffer.h"
+
+#include <string.h>
+
+/* Rough per-message cost of the TpDebugMessage and its strings, on top of
+ * the text itself */
+#define MESSAGE_OVERHEAD 128
+
+#define MIN_CAPACITY 256
+
+struct _EmpathyDebugBufferPriv
+{
+  /* capacity slots, owning a ref on the length messages starting at first
+   * (wrapping around) */
+  TpDebugMessage **ring;
+  /* in microseconds, in the same slots as ring */
+  gint64 *times;
+  /* bytes counted for each message, in the same slots as ring */
+  gsize *sizes;
+  gint64 last_time;
+  guint capacity;
+  guint first;
+  guint length;
+
+  /* serial of ring[first] */
+  guint64 first_serial;
+
+  gsize bytes;
+
+  /* 0 means unlimited */
+  guint max_messages;
+  gsize max_bytes;
+
+  gint stamp;
+};
+
+static void empathy_debug_buffer_tree_model_init (GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (EmpathyDebugBuffer, empathy_debug_buffer,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL,
+        empathy_debug_buffer_tree_model_init))
+
+static gsize
+message_size (TpDebugMessage *msg)
+{
+  const gchar *domain = tp_debug_message_get_domain (msg);
+  const gchar *category = tp_debug_message_get_category (msg);
+
+  return MESSAGE_OVERHEAD + strlen (tp_debug_message_get_message (msg)) +
+    (domain != NULL ? strlen (domain) : 0) +
+    (category != NULL ? strlen (category) : 0);
+}
+
+static TpDebugMessage *
+buffer_nth (EmpathyDebugBuffer *self,
+    guint n)
+{
+  return self->priv->ring[(self->priv->first + n) % self->priv->capacity];
+}
+
+static void
+buffer_fill_iter (EmpathyDebugBuffer *self,
+    guint n,
+    GtkTreeIter *iter)
+{
+  guint64 serial = self->priv->first_serial + n;
+
+  iter->stamp = self->priv->stamp;
+  iter->user_data = GUINT_TO_POINTER ((guint) serial);
+  iter->user_data2 = GUINT_TO_POINTER ((guint) (serial >> 32));
+  iter->user_data3 = NULL;
+}
+
+/* Returns the row of @iter, or -1 if it has been evicted */
+static gint
+buffer_iter_to_row (EmpathyDebugBuffer *self,
+    GtkTreeIter *iter)
+{
+  guint64 serial;
+
+  g_return_val_if_fail (iter->stamp == self->priv->stamp, -1);
+
+  serial = GPOINTER_TO_UINT (iter->user_data) |
+    ((guint64) GPOINTER_TO_UINT (iter->user_data2) << 32);
+
+  if (serial < self->priv->first_serial ||
+      serial - self->priv->first_serial >= self->priv->length)
+    return -1;
+
+  return serial - self->priv->first_serial;
+}
+
+static void
+buffer_evict_first (EmpathyDebugBuffer *self)
+{
+  EmpathyDebugBufferPriv *priv = self->priv;
+  TpDebugMessage *msg;
+  GtkTreePath *path;
+
+  msg = priv->ring[priv->first];
+  priv->ring[priv->first] = NULL;
+  priv->bytes -= priv->sizes[priv->first];
+  priv->first = (priv->first + 1) % priv->capacity;
+  priv->length--;
+  priv->first_serial++;
+
+  g_object_unref (msg);
+
+  path = gtk_tree_path_new_from_indices (0, -1);
+  gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+  gtk_tree_path_free (path);
+}
+
+static void
+buffer_enforce_limits (EmpathyDebugBuffer *self)
+{
+  EmpathyDebugBufferPriv *priv = self->priv;
+
+  while (priv->max_messages > 0 && priv->length > priv->max_messages)
+    buffer_evict_first (self);
+
+  /* Always keep the last message, even if it's bigger than the limit */
+  while (priv->max_bytes > 0 && priv->bytes > priv->max_bytes &&
+      priv->length > 1)
+    buffer_evict_first (self);
+}
+
+/* Grows the ring, moving the messages at its start */
+static void
+buffer_grow (EmpathyDebugBuffer *self)
+{
+  EmpathyDebugBufferPriv *priv = self->priv;
+  TpDebugMessage **ring;
+  gint64 *times;
+  gsize *sizes;
+  guint capacity, n;
+
+  capacity = MAX (priv->capacity * 2, MIN_CAPACITY);
+  if (priv->max_messages > 0)
+    capacity = MIN (capacity, priv->max_messages);
+
+  ring = g_new0 (TpDebugMessage *, capacity);
+  times = g_new (gint64, capacity);
+  sizes = g_new (gsize, capacity);
+
+  for (n = 0; n < priv->length; n++)
+    {
+      guint slot = (priv->first + n) % priv->capacity;
+
+      ring[n] = priv->ring[slot];
+      times[n] = priv->times[slot];
+      sizes[n] = priv->sizes[slot];
+    }
+
+  g_free (priv->ring);
+  g_free (priv->times);
+  g_free (priv->sizes);
+  priv->ring = ring;
+  priv->times = times;
+  priv->sizes = sizes;
+  priv->capacity = capacity;
+  priv->first = 0;
+}
+
+static GtkTreeModelFlags
+debug_buffer_get_flags (GtkTreeModel *model)
+{
+  return GTK_TREE_MODEL_LIST_ONLY | GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+static gint
+debug_buffer_get_n_columns (GtkTreeModel *model)
+{
+  return 1;
+}
+
+static GType
+debug_buffer_get_column_type (GtkTreeModel *model,
+    gint column)
+{
+  g_return_val_if_fail (column == 0, G_TYPE_INVALID);
+
+  return TP_TYPE_DEBUG_MESSAGE;
+}
+
+static gboolean
+debug_buffer_iter_nth_child (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreeIter *parent,
+    gint n)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (model);
+
+  if (parent != NULL || n < 0 || (guint) n >= self->priv->length)
+    return FALSE;
+
+  buffer_fill_iter (self, n, iter);
+  return TRUE;
+}
+
+static gboolean
+debug_buffer_get_iter (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreePath *path)
+{
+  if (gtk_tree_path_get_depth (path) != 1)
+    return FALSE;
+
+  return debug_buffer_iter_nth_child (model, iter, NULL,
+      gtk_tree_path_get_indices (path)[0]);
+}
+
+static GtkTreePath *
+debug_buffer_get_path (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  gint row = buffer_iter_to_row (EMPATHY_DEBUG_BUFFER (model), iter);
+
+  g_return_val_if_fail (row >= 0, NULL);
+
+  return gtk_tree_path_new_from_indices (row, -1);
+}
+
+static void
+debug_buffer_get_value (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    gint column,
+    GValue *value)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (model);
+  gint row = buffer_iter_to_row (self, iter);
+
+  g_value_init (value, TP_TYPE_DEBUG_MESSAGE);
+
+  g_return_if_fail (column == 0);
+  g_return_if_fail (row >= 0);
+
+  g_value_set_object (value, buffer_nth (self, row));
+}
+
+static gboolean
+debug_buffer_iter_next (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (model);
+  gint row = buffer_iter_to_row (self, iter);
+
+  if (row < 0 || (guint) row + 1 >= self->priv->length)
+    {
+      iter->stamp = 0;
+      return FALSE;
+    }
+
+  buffer_fill_iter (self, row + 1, iter);
+  return TRUE;
+}
+
+static gboolean
+debug_buffer_iter_previous (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (model);
+  gint row = buffer_iter_to_row (self, iter);
+
+  if (row <= 0)
+    {
+      iter->stamp = 0;
+      return FALSE;
+    }
+
+  buffer_fill_iter (self, row - 1, iter);
+  return TRUE;
+}
+
+static gboolean
+debug_buffer_iter_children (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreeIter *parent)
+{
+  return debug_buffer_iter_nth_child (model, iter, parent, 0);
+}
+
+static gboolean
+debug_buffer_iter_has_child (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  return FALSE;
+}
+
+static gint
+debug_buffer_iter_n_children (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  if (iter != NULL)
+    return 0;
+
+  return EMPATHY_DEBUG_BUFFER (model)->priv->length;
+}
+
+static gboolean
+debug_buffer_iter_parent (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreeIter *child)
+{
+  return FALSE;
+}
+
+static void
+empathy_debug_buffer_tree_model_init (GtkTreeModelIface *iface)
+{
+  iface->get_flags = debug_buffer_get_flags;
+  iface->get_n_columns = debug_buffer_get_n_columns;
+  iface->get_column_type = debug_buffer_get_column_type;
+  iface->get_iter = debug_buffer_get_iter;
+  iface->get_path = debug_buffer_get_path;
+  iface->get_value = debug_buffer_get_value;
+  iface->iter_next = debug_buffer_iter_next;
+  iface->iter_previous = debug_buffer_iter_previous;
+  iface->iter_children = debug_buffer_iter_children;
+  iface->iter_has_child = debug_buffer_iter_has_child;
+  iface->iter_n_children = debug_buffer_iter_n_children;
+  iface->iter_nth_child = debug_buffer_iter_nth_child;
+  iface->iter_parent = debug_buffer_iter_parent;
+}
+
+static void
+empathy_debug_buffer_finalize (GObject *object)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (object);
+  guint n;
+
+  for (n = 0; n < self->priv->length; n++)
+    g_object_unref (buffer_nth (self, n));
+
+  g_free (self->priv->ring);
+  g_free (self->priv->times);
+  g_free (self->priv->sizes);
+
+  G_OBJECT_CLASS (empathy_debug_buffer_parent_class)->finalize (object);
+}
+
+static void
+empathy_debug_buffer_class_init (EmpathyDebugBufferClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = empathy_debug_buffer_finalize;
+
+  g_type_class_add_private (klass, sizeof (EmpathyDebugBufferPriv));
+}
+
+static void
+empathy_debug_buffer_init (EmpathyDebugBuffer *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_DEBUG_BUFFER, EmpathyDebugBufferPriv);
+
+  self->priv->stamp = g_random_int ();
+}
+
+EmpathyDebugBuffer *
+empathy_debug_buffer_new (guint max_messages,
+    gsize max_bytes)
+{
+  EmpathyDebugBuffer *self;
+
+  self = g_object_new (EMPATHY_TYPE_DEBUG_BUFFER, NULL);
+  self->priv->max_messages = max_messages;
+  self->priv->max_bytes = max_bytes;
+
+  return self;
+}
+
+void
+empathy_debug_buffer_set_limits (EmpathyDebugBuffer *self,
+    guint max_messages,
+    gsize max_bytes)
+{
+  g_return_if_fail (EMPATHY_IS_DEBUG_BUFFER (self));
+
+  self->priv->max_messages = max_messages;
+  self->priv->max_bytes = max_bytes;
+
+  buffer_enforce_limits (self);
+}
+
+void
+empathy_debug_buffer_append (EmpathyDebugBuffer *self,
+    TpDebugMessage *message)
+{
+  EmpathyDebugBufferPriv *priv;
+  GtkTreePath *path;
+  GtkTreeIter iter;
+  GDateTime *time;
+  guint slot;
+
+  g_return_if_fail (EMPATHY_IS_DEBUG_BUFFER (self));
+  g_return_if_fail (TP_IS_DEBUG_MESSAGE (message));
+
+  priv = self->priv;
+
+  /* Make room first, so the ring doesn't grow past the limit */
+  if (priv->max_messages > 0 && priv->length >= priv->max_messages)
+    buffer_evict_first (self);
+
+  if (priv->length == priv->capacity)
+    buffer_grow (self);
+
+  time = tp_debug_message_get_time (message);
+  priv->last_time = MAX (priv->last_time,
+      g_date_time_to_unix (time) * G_USEC_PER_SEC +
+      g_date_time_get_microsecond (time));
+
+  slot = (priv->first + priv->length) % priv->capacity;
+  priv->ring[slot] = g_object_ref (message);
+  priv->times[slot] = priv->last_time;
+  priv->sizes[slot] = message_size (message);
+  priv->length++;
+  priv->bytes += priv->sizes[slot];
+
+  buffer_fill_iter (self, priv->length - 1, &iter);
+  path = gtk_tree_path_new_from_indices (priv->length - 1, -1);
+  gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+  gtk_tree_path_free (path);
+
+  buffer_enforce_limits (self);
+}
+
+void
+empathy_debug_buffer_clear (EmpathyDebugBuffer *self)
+{
+  g_return_if_fail (EMPATHY_IS_DEBUG_BUFFER (self));
+
+  while (self->priv->length > 0)
+    buffer_evict_first (self);
+}
+
+/* Counts @bytes more for the @index-th oldest message against the size
+ * limit, for memory kept alongside it such as its index entries. They are
+ * released when the message is evicted; the limits are only enforced again
+ * when a message is appended or they are changed. */
+void
+empathy_debug_buffer_charge (EmpathyDebugBuffer *self,
+    guint index,
+    gsize bytes)
+{
+  EmpathyDebugBufferPriv *priv;
+
+  g_return_if_fail (EMPATHY_IS_DEBUG_BUFFER (self));
+  g_return_if_fail (index < self->priv->length);
+
+  priv = self->priv;
+  priv->sizes[(priv->first + index) % priv->capacity] += bytes;
+  priv->bytes += bytes;
+}
+
+guint
+empathy_debug_buffer_get_length (EmpathyDebugBuffer *self)
+{
+  g_return_val_if_fail (EMPATHY_IS_DEBUG_BUFFER (self), 0);
+
+  return self->priv->length;
+}
+
+/* Returns a borrowed reference on the @index-th oldest message */
+TpDebugMessage *
+empathy_debug_buffer_get_message (EmpathyDebugBuffer *self,
+    guint index)
+{
+  g_return_val_if_fail (EMPATHY_IS_DEBUG_BUFFER (self), NULL);
+  g_return_val_if_fail (index < self->priv->length, NULL);
+
+  return buffer_nth (self, index);
+}
+
+/* Returns the time of the @index-th oldest message, in microseconds since
+ * the epoch; it is never older than the time of the previous message */
+gint64
+empathy_debug_buffer_get_time (EmpathyDebugBuffer *self,
+    guint index)
+{
+  g_return_val_if_fail (EMPATHY_IS_DEBUG_BUFFER (self), 0);
+  g_return_val_if_fail (index < self->priv->length, 0);
+
+  return self->priv->times[
+    (self->priv->first + index) % self->priv->capacity];
+}
+
+guint64
+empathy_debug_buffer_get_serial (EmpathyDebugBuffer *self,
+    guint index)
+{
+  g_return_val_if_fail (EMPATHY_IS_DEBUG_BUFFER (self), 0);
+
+  return self->priv->first_serial + index;
+}
+
+/* Returns FALSE if the message of @serial has been evicted */
+gboolean
+empathy_debug_buffer_lookup_serial (EmpathyDebugBuffer *self,
+    guint64 serial,
+    guint *index)
+{
+  g_return_val_if_fail (EMPATHY_IS_DEBUG_BUFFER (self), FALSE);
+
+  if (serial < self->priv->first_serial ||
+      serial - self->priv->first_serial >= self->priv->length)
+    return FALSE;
+
+  *index = serial - self->priv->first_serial;
+  return TRUE;
+}
+
+/* Returns the number of messages older than @time, or not newer than it if
+ * @or_equal is TRUE */
+guint
+empathy_debug_buffer_count_before (EmpathyDebugBuffer *self,
+    gint64 time,
+    gboolean or_equal)
+{
+  EmpathyDebugBufferPriv *priv;
+  guint low, high;
+
+  g_return_val_if_fail (EMPATHY_IS_DEBUG_BUFFER (self), 0);
+
+  priv = self->priv;
+  low = 0;
+  high = priv->length;
+
+  while (low < high)
+    {
+      guint middle = low + (high - low) / 2;
+      gint64 t = priv->times[(priv->first + middle) % priv->capacity];
+
+      if (t < time || (or_equal && t == time))
+        low = middle + 1;
+      else
+        high = middle;
+    }
+
+  return low;
+}
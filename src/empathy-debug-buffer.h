@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_DEBUG_BUFFER_H__
+#define __EMPATHY_DEBUG_BUFFER_H__
+
+#include <gtk/gtk.h>
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathyDebugBuffer EmpathyDebugBuffer;
+typedef struct _EmpathyDebugBufferClass EmpathyDebugBufferClass;
+typedef struct _EmpathyDebugBufferPriv EmpathyDebugBufferPriv;
+
+struct _EmpathyDebugBufferClass
+{
+  GObjectClass parent_class;
+};
+
+struct _EmpathyDebugBuffer
+{
+  GObject parent;
+  EmpathyDebugBufferPriv *priv;
+};
+
+GType empathy_debug_buffer_get_type (void);
+
+#define EMPATHY_TYPE_DEBUG_BUFFER \
+  (empathy_debug_buffer_get_type ())
+#define EMPATHY_DEBUG_BUFFER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), EMPATHY_TYPE_DEBUG_BUFFER, \
+    EmpathyDebugBuffer))
+#define EMPATHY_DEBUG_BUFFER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), EMPATHY_TYPE_DEBUG_BUFFER, \
+    EmpathyDebugBufferClass))
+#define EMPATHY_IS_DEBUG_BUFFER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), EMPATHY_TYPE_DEBUG_BUFFER))
+#define EMPATHY_IS_DEBUG_BUFFER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), EMPATHY_TYPE_DEBUG_BUFFER))
+#define EMPATHY_DEBUG_BUFFER_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), EMPATHY_TYPE_DEBUG_BUFFER, \
+    EmpathyDebugBufferClass))
+
+EmpathyDebugBuffer * empathy_debug_buffer_new (guint max_messages,
+    gsize max_bytes);
+
+void empathy_debug_buffer_set_limits (EmpathyDebugBuffer *self,
+    guint max_messages,
+    gsize max_bytes);
+
+void empathy_debug_buffer_append (EmpathyDebugBuffer *self,
+    TpDebugMessage *message);
+
+void empathy_debug_buffer_clear (EmpathyDebugBuffer *self);
+
+void empathy_debug_buffer_charge (EmpathyDebugBuffer *self,
+    guint index,
+    gsize bytes);
+
+guint empathy_debug_buffer_get_length (EmpathyDebugBuffer *self);
+
+TpDebugMessage * empathy_debug_buffer_get_message (EmpathyDebugBuffer *self,
+    guint index);
+
+gint64 empathy_debug_buffer_get_time (EmpathyDebugBuffer *self,
+    guint index);
+
+guint64 empathy_debug_buffer_get_serial (EmpathyDebugBuffer *self,
+    guint index);
+
+gboolean empathy_debug_buffer_lookup_serial (EmpathyDebugBuffer *self,
+    guint64 serial,
+    guint *index);
+
+guint empathy_debug_buffer_count_before (EmpathyDebugBuffer *self,
+    gint64 time,
+    gboolean or_equal);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_DEBUG_BUFFER_H__ */
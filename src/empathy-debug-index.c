@@ -0,0 +1,769 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Index of the words of the messages of an EmpathyDebugBuffer, kept up to
+ * date as messages are appended and evicted, to find the messages
+ * containing some text without looking at all of them.
+ *
+ * Words are the runs of characters between spaces and TOKEN_DELIMITERS,
+ * lowercased, in the text, domain and category of the messages. Each word
+ * maps to the serials of the messages containing it, in the order they
+ * were appended. Searching for some text looks up the words containing
+ * each of its own words, then checks the text against the few messages
+ * having all of them.
+ *
+ * The words containing some text are found with a binary search among
+ * the sorted suffixes of all the words: they are those having a suffix
+ * starting with the text. Suffixes of new words are only merged into the
+ * sorted array once there are MAX_UNSORTED_WORDS of them, the words not
+ * merged yet are looked at one by one.
+ *
+ * What the index takes is charged to the messages of the buffer, so it is
+ * covered by the size limit of the buffer.
+ *
+ * While searching, the messages matching the search are kept in a set
+ * shared with the caller, adding new messages as they come and removing
+ * evicted ones. */
+
+#include "config.h"
+#include "empathy-debug-index.h"
+
+#include <string.h>
+
+#define TOKEN_DELIMITERS "<>()[]{}\"'=,;"
+
+/* Stale serials are removed from the word lists once at least that many
+ * messages have been evicted, and as many as there are messages left */
+#define MIN_EVICTIONS_BEFORE_SWEEP 1024
+
+/* New words are looked at one by one until there are that many */
+#define MAX_UNSORTED_WORDS 1024
+
+/* Rough cost of a Word, its GArray and its node in the hash table, on top
+ * of its text and its suffixes */
+#define WORD_OVERHEAD 96
+
+typedef struct
+{
+  gchar *text;
+  /* guint64 serials of the messages containing the word, in order */
+  GArray *serials;
+  /* Last lookup having found the word, not to add its serials twice */
+  guint lookup_stamp;
+  /* All its messages have been evicted, while sweeping */
+  gboolean dead;
+} Word;
+
+typedef struct
+{
+  /* not owned */
+  Word *word;
+  guint offset;
+} Suffix;
+
+typedef struct
+{
+  guint64 serial;
+  /* not owned: only used as a key in the set of matches */
+  TpDebugMessage *msg;
+} Match;
+
+struct _EmpathyDebugIndexPriv
+{
+  /* not owned: it owns us */
+  EmpathyDebugBuffer *buffer;
+
+  /* borrowed gchar * text => owned Word */
+  GHashTable *words;
+  /* Suffix of the words, sorted */
+  GArray *suffixes;
+  /* borrowed Word whose suffixes aren't in suffixes yet */
+  GPtrArray *unsorted_words;
+  guint lookup_stamp;
+
+  /* serial of the oldest message of the buffer */
+  guint64 first_serial;
+  guint evicted_since_sweep;
+
+  /* Lowercased text searched, or NULL */
+  gchar *search;
+  gchar **search_terms;
+  /* owned Match, ordered by serial */
+  GQueue search_matches;
+  /* Borrowed TpDebugMessage set shared with the searcher */
+  GHashTable *matches;
+
+  GString *word;
+};
+
+G_DEFINE_TYPE (EmpathyDebugIndex, empathy_debug_index, G_TYPE_OBJECT);
+
+static void
+word_free (Word *word)
+{
+  g_free (word->text);
+  g_array_unref (word->serials);
+  g_slice_free (Word, word);
+}
+
+static const gchar *
+suffix_text (const Suffix *suffix)
+{
+  return suffix->word->text + suffix->offset;
+}
+
+static gint
+compare_suffixes (gconstpointer a,
+    gconstpointer b)
+{
+  return strcmp (suffix_text (a), suffix_text (b));
+}
+
+static gboolean
+is_delimiter (gchar c)
+{
+  return g_ascii_isspace (c) || strchr (TOKEN_DELIMITERS, c) != NULL;
+}
+
+/* Merges the suffixes of the unsorted words into the sorted ones */
+static void
+index_sort_words (EmpathyDebugIndex *self)
+{
+  EmpathyDebugIndexPriv *priv = self->priv;
+  GArray *added, *merged;
+  guint i, j;
+
+  added = g_array_new (FALSE, FALSE, sizeof (Suffix));
+
+  for (i = 0; i < priv->unsorted_words->len; i++)
+    {
+      Suffix suffix;
+
+      suffix.word = g_ptr_array_index (priv->unsorted_words, i);
+
+      for (suffix.offset = 0; suffix.word->text[suffix.offset] != '\0';
+           suffix.offset++)
+        g_array_append_val (added, suffix);
+    }
+
+  g_array_sort (added, compare_suffixes);
+
+  merged = g_array_sized_new (FALSE, FALSE, sizeof (Suffix),
+      priv->suffixes->len + added->len);
+
+  i = 0;
+  j = 0;
+  while (i < priv->suffixes->len && j < added->len)
+    {
+      Suffix *a = &g_array_index (priv->suffixes, Suffix, i);
+      Suffix *b = &g_array_index (added, Suffix, j);
+
+      if (compare_suffixes (a, b) <= 0)
+        {
+          g_array_append_vals (merged, a, 1);
+          i++;
+        }
+      else
+        {
+          g_array_append_vals (merged, b, 1);
+          j++;
+        }
+    }
+
+  g_array_append_vals (merged, priv->suffixes->data + i * sizeof (Suffix),
+      priv->suffixes->len - i);
+  g_array_append_vals (merged, added->data + j * sizeof (Suffix),
+      added->len - j);
+
+  g_array_unref (priv->suffixes);
+  g_array_unref (added);
+  priv->suffixes = merged;
+  g_ptr_array_set_size (priv->unsorted_words, 0);
+}
+
+/* Returns the number of bytes the index took for it */
+static gsize
+index_add_word (EmpathyDebugIndex *self,
+    guint64 serial)
+{
+  GString *text = self->priv->word;
+  Word *word;
+  gsize bytes = 0;
+
+  word = g_hash_table_lookup (self->priv->words, text->str);
+
+  if (word == NULL)
+    {
+      word = g_slice_new0 (Word);
+      word->text = g_strndup (text->str, text->len);
+      word->serials = g_array_new (FALSE, FALSE, sizeof (guint64));
+      g_hash_table_insert (self->priv->words, word->text, word);
+
+      bytes += WORD_OVERHEAD + text->len * (1 + sizeof (Suffix));
+
+      g_ptr_array_add (self->priv->unsorted_words, word);
+      if (self->priv->unsorted_words->len >= MAX_UNSORTED_WORDS)
+        index_sort_words (self);
+    }
+
+  /* The same word can appear more than once in a message */
+  if (word->serials->len > 0 &&
+      g_array_index (word->serials, guint64, word->serials->len - 1) ==
+        serial)
+    return bytes;
+
+  g_array_append_val (word->serials, serial);
+
+  return bytes + sizeof (guint64);
+}
+
+/* Returns the number of bytes the index took for it */
+static gsize
+index_add_text (EmpathyDebugIndex *self,
+    guint64 serial,
+    const gchar *text)
+{
+  GString *word = self->priv->word;
+  gsize bytes = 0;
+  const gchar *p;
+
+  if (text == NULL)
+    return 0;
+
+  g_string_truncate (word, 0);
+
+  for (p = text; ; p++)
+    {
+      if (*p != '\0' && !is_delimiter (*p))
+        {
+          g_string_append_c (word, g_ascii_tolower (*p));
+          continue;
+        }
+
+      if (word->len > 0)
+        {
+          bytes += index_add_word (self, serial);
+          g_string_truncate (word, 0);
+        }
+
+      if (*p == '\0')
+        break;
+    }
+
+  return bytes;
+}
+
+/* Indexes the @index-th message of the buffer, and charges it for that */
+static void
+index_add_message (EmpathyDebugIndex *self,
+    guint index)
+{
+  EmpathyDebugBuffer *buffer = self->priv->buffer;
+  TpDebugMessage *msg;
+  guint64 serial;
+  gsize bytes;
+
+  msg = empathy_debug_buffer_get_message (buffer, index);
+  serial = empathy_debug_buffer_get_serial (buffer, index);
+
+  bytes = index_add_text (self, serial, tp_debug_message_get_message (msg));
+  bytes += index_add_text (self, serial, tp_debug_message_get_domain (msg));
+  bytes += index_add_text (self, serial,
+      tp_debug_message_get_category (msg));
+
+  empathy_debug_buffer_charge (buffer, index, bytes);
+}
+
+/* Whether @haystack contains @needle, which is lowercase, ignoring the
+ * case of ASCII letters */
+static gboolean
+contains_ascii_casefold (const gchar *haystack,
+    const gchar *needle)
+{
+  gsize len = strlen (needle);
+  const gchar *p;
+
+  if (haystack == NULL)
+    return FALSE;
+
+  for (p = haystack; *p != '\0'; p++)
+    {
+      if (g_ascii_strncasecmp (p, needle, len) == 0)
+        return TRUE;
+    }
+
+  return len == 0;
+}
+
+static gboolean
+index_message_matches (EmpathyDebugIndex *self,
+    TpDebugMessage *msg)
+{
+  guint i;
+
+  for (i = 0; self->priv->search_terms[i] != NULL; i++)
+    {
+      const gchar *term = self->priv->search_terms[i];
+
+      if (!contains_ascii_casefold (tp_debug_message_get_message (msg),
+              term) &&
+          !contains_ascii_casefold (tp_debug_message_get_domain (msg),
+              term) &&
+          !contains_ascii_casefold (tp_debug_message_get_category (msg),
+              term))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Adds the message of @serial to the matches if it matches the search */
+static void
+index_check_message (EmpathyDebugIndex *self,
+    guint64 serial)
+{
+  TpDebugMessage *msg;
+  Match *match;
+  guint index;
+
+  if (!empathy_debug_buffer_lookup_serial (self->priv->buffer, serial,
+          &index))
+    return;
+
+  msg = empathy_debug_buffer_get_message (self->priv->buffer, index);
+
+  if (!index_message_matches (self, msg))
+    return;
+
+  match = g_slice_new (Match);
+  match->serial = serial;
+  match->msg = msg;
+  g_queue_push_tail (&self->priv->search_matches, match);
+
+  g_hash_table_add (self->priv->matches, msg);
+}
+
+static gint
+compare_serials (gconstpointer a,
+    gconstpointer b)
+{
+  guint64 serial_a = *(const guint64 *) a;
+  guint64 serial_b = *(const guint64 *) b;
+
+  if (serial_a == serial_b)
+    return 0;
+
+  return serial_a < serial_b ? -1 : 1;
+}
+
+static void
+append_word_serials (GArray *result,
+    Word *word,
+    guint stamp)
+{
+  /* Found through another of its suffixes already */
+  if (word->lookup_stamp == stamp)
+    return;
+
+  word->lookup_stamp = stamp;
+  g_array_append_vals (result, word->serials->data, word->serials->len);
+}
+
+/* Returns the sorted serials of the messages having a word containing
+ * @part */
+static GArray *
+index_lookup_part (EmpathyDebugIndex *self,
+    const gchar *part)
+{
+  EmpathyDebugIndexPriv *priv = self->priv;
+  GArray *result;
+  guint stamp, low, high, i, j;
+
+  result = g_array_new (FALSE, FALSE, sizeof (guint64));
+  stamp = ++priv->lookup_stamp;
+
+  /* The first suffix not before @part */
+  low = 0;
+  high = priv->suffixes->len;
+  while (low < high)
+    {
+      guint middle = low + (high - low) / 2;
+
+      if (strcmp (suffix_text (&g_array_index (priv->suffixes, Suffix,
+                middle)), part) < 0)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+
+  for (i = low; i < priv->suffixes->len; i++)
+    {
+      Suffix *suffix = &g_array_index (priv->suffixes, Suffix, i);
+
+      if (!g_str_has_prefix (suffix_text (suffix), part))
+        break;
+
+      append_word_serials (result, suffix->word, stamp);
+    }
+
+  for (i = 0; i < priv->unsorted_words->len; i++)
+    {
+      Word *word = g_ptr_array_index (priv->unsorted_words, i);
+
+      if (strstr (word->text, part) != NULL)
+        append_word_serials (result, word, stamp);
+    }
+
+  g_array_sort (result, compare_serials);
+
+  /* Remove duplicates */
+  for (i = 0, j = 0; i < result->len; i++)
+    {
+      if (j > 0 && g_array_index (result, guint64, j - 1) ==
+          g_array_index (result, guint64, i))
+        continue;
+
+      g_array_index (result, guint64, j++) = g_array_index (result, guint64,
+          i);
+    }
+  g_array_set_size (result, j);
+
+  return result;
+}
+
+/* Keeps the serials of @a which are also in @b, both being sorted */
+static void
+intersect_serials (GArray *a,
+    GArray *b)
+{
+  guint i = 0, j = 0, n = 0;
+
+  while (i < a->len && j < b->len)
+    {
+      guint64 serial_a = g_array_index (a, guint64, i);
+      guint64 serial_b = g_array_index (b, guint64, j);
+
+      if (serial_a < serial_b)
+        {
+          i++;
+        }
+      else if (serial_a > serial_b)
+        {
+          j++;
+        }
+      else
+        {
+          g_array_index (a, guint64, n++) = serial_a;
+          i++;
+          j++;
+        }
+    }
+
+  g_array_set_size (a, n);
+}
+
+/* Returns the sorted serials of the messages which may match the search,
+ * or NULL if the index can't tell */
+static GArray *
+index_lookup_candidates (EmpathyDebugIndex *self)
+{
+  GArray *candidates = NULL;
+  guint i, j;
+
+  for (i = 0; self->priv->search_terms[i] != NULL; i++)
+    {
+      gchar **parts;
+
+      /* The words of a term, as they would be indexed */
+      parts = g_strsplit_set (self->priv->search_terms[i], TOKEN_DELIMITERS,
+          -1);
+
+      for (j = 0; parts[j] != NULL; j++)
+        {
+          GArray *serials;
+
+          if (parts[j][0] == '\0')
+            continue;
+
+          serials = index_lookup_part (self, parts[j]);
+
+          if (candidates == NULL)
+            {
+              candidates = serials;
+            }
+          else
+            {
+              intersect_serials (candidates, serials);
+              g_array_unref (serials);
+            }
+        }
+
+      g_strfreev (parts);
+    }
+
+  return candidates;
+}
+
+static void
+index_stop_search (EmpathyDebugIndex *self)
+{
+  Match *match;
+
+  while ((match = g_queue_pop_head (&self->priv->search_matches)) != NULL)
+    g_slice_free (Match, match);
+
+  tp_clear_pointer (&self->priv->matches, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->search, g_free);
+  tp_clear_pointer (&self->priv->search_terms, g_strfreev);
+}
+
+static void
+index_sweep (EmpathyDebugIndex *self)
+{
+  EmpathyDebugIndexPriv *priv = self->priv;
+  GHashTableIter iter;
+  gpointer value;
+  guint i, n, n_dead = 0;
+
+  g_hash_table_iter_init (&iter, priv->words);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      Word *word = value;
+
+      n = 0;
+      while (n < word->serials->len &&
+          g_array_index (word->serials, guint64, n) < priv->first_serial)
+        n++;
+
+      if (n == word->serials->len)
+        {
+          word->dead = TRUE;
+          n_dead++;
+        }
+      else if (n > 0)
+        {
+          g_array_remove_range (word->serials, 0, n);
+        }
+    }
+
+  if (n_dead > 0)
+    {
+      /* Drop their suffixes before freeing them, keeping the order */
+      for (i = 0, n = 0; i < priv->suffixes->len; i++)
+        {
+          Suffix *suffix = &g_array_index (priv->suffixes, Suffix, i);
+
+          if (!suffix->word->dead)
+            g_array_index (priv->suffixes, Suffix, n++) = *suffix;
+        }
+      g_array_set_size (priv->suffixes, n);
+
+      for (i = 0, n = 0; i < priv->unsorted_words->len; i++)
+        {
+          Word *word = g_ptr_array_index (priv->unsorted_words, i);
+
+          if (!word->dead)
+            g_ptr_array_index (priv->unsorted_words, n++) = word;
+        }
+      g_ptr_array_set_size (priv->unsorted_words, n);
+
+      g_hash_table_iter_init (&iter, priv->words);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          if (((Word *) value)->dead)
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+
+  priv->evicted_since_sweep = 0;
+}
+
+static void
+index_buffer_row_inserted_cb (GtkTreeModel *buffer,
+    GtkTreePath *path,
+    GtkTreeIter *iter,
+    EmpathyDebugIndex *self)
+{
+  guint index = gtk_tree_path_get_indices (path)[0];
+
+  index_add_message (self, index);
+
+  if (self->priv->search != NULL)
+    index_check_message (self,
+        empathy_debug_buffer_get_serial (self->priv->buffer, index));
+}
+
+/* EmpathyDebugBuffer only ever deletes its oldest message */
+static void
+index_buffer_row_deleted_cb (GtkTreeModel *buffer,
+    GtkTreePath *path,
+    EmpathyDebugIndex *self)
+{
+  Match *match;
+
+  self->priv->first_serial++;
+  self->priv->evicted_since_sweep++;
+
+  match = g_queue_peek_head (&self->priv->search_matches);
+  if (match != NULL && match->serial < self->priv->first_serial)
+    {
+      g_hash_table_remove (self->priv->matches, match->msg);
+      g_slice_free (Match, g_queue_pop_head (&self->priv->search_matches));
+    }
+
+  if (self->priv->evicted_since_sweep >= MAX (MIN_EVICTIONS_BEFORE_SWEEP,
+          empathy_debug_buffer_get_length (self->priv->buffer)))
+    index_sweep (self);
+}
+
+static void
+empathy_debug_index_finalize (GObject *object)
+{
+  EmpathyDebugIndex *self = EMPATHY_DEBUG_INDEX (object);
+
+  index_stop_search (self);
+  g_hash_table_unref (self->priv->words);
+  g_array_unref (self->priv->suffixes);
+  g_ptr_array_unref (self->priv->unsorted_words);
+  g_string_free (self->priv->word, TRUE);
+
+  G_OBJECT_CLASS (empathy_debug_index_parent_class)->finalize (object);
+}
+
+static void
+empathy_debug_index_class_init (EmpathyDebugIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = empathy_debug_index_finalize;
+
+  g_type_class_add_private (klass, sizeof (EmpathyDebugIndexPriv));
+}
+
+static void
+empathy_debug_index_init (EmpathyDebugIndex *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_DEBUG_INDEX, EmpathyDebugIndexPriv);
+
+  self->priv->words = g_hash_table_new_full (g_str_hash, g_str_equal,
+      NULL, (GDestroyNotify) word_free);
+  self->priv->suffixes = g_array_new (FALSE, FALSE, sizeof (Suffix));
+  self->priv->unsorted_words = g_ptr_array_new ();
+  self->priv->word = g_string_new (NULL);
+}
+
+/* The index must not outlive @buffer; storing it as data of the buffer
+ * does the trick */
+EmpathyDebugIndex *
+empathy_debug_index_new (EmpathyDebugBuffer *buffer)
+{
+  EmpathyDebugIndex *self;
+  guint i, n;
+
+  g_return_val_if_fail (EMPATHY_IS_DEBUG_BUFFER (buffer), NULL);
+
+  self = g_object_new (EMPATHY_TYPE_DEBUG_INDEX, NULL);
+  self->priv->buffer = buffer;
+  self->priv->first_serial = empathy_debug_buffer_get_serial (buffer, 0);
+
+  n = empathy_debug_buffer_get_length (buffer);
+  for (i = 0; i < n; i++)
+    index_add_message (self, i);
+
+  tp_g_signal_connect_object (buffer, "row-inserted",
+      G_CALLBACK (index_buffer_row_inserted_cb), self, 0);
+  tp_g_signal_connect_object (buffer, "row-deleted",
+      G_CALLBACK (index_buffer_row_deleted_cb), self, 0);
+
+  return self;
+}
+
+/* Adds the messages of the buffer containing each of the words of @text
+ * to @matches, a set of TpDebugMessage, and keeps it up to date as
+ * messages come and go until the next search. An empty @text stops
+ * searching. */
+void
+empathy_debug_index_search (EmpathyDebugIndex *self,
+    const gchar *text,
+    GHashTable *matches)
+{
+  EmpathyDebugIndexPriv *priv;
+  GQueue previous_matches = G_QUEUE_INIT;
+  gboolean refining;
+  gchar *search;
+  Match *match;
+
+  g_return_if_fail (EMPATHY_IS_DEBUG_INDEX (self));
+
+  priv = self->priv;
+
+  search = g_ascii_strdown (text != NULL ? text : "", -1);
+  g_strstrip (search);
+
+  /* Typing more of the text can only narrow the matches down */
+  refining = priv->search != NULL && g_str_has_prefix (search, priv->search);
+  if (refining)
+    {
+      previous_matches = priv->search_matches;
+      g_queue_init (&priv->search_matches);
+    }
+
+  index_stop_search (self);
+
+  if (search[0] == '\0')
+    {
+      g_free (search);
+      return;
+    }
+
+  priv->search = search;
+  priv->search_terms = g_strsplit_set (search, " \t\n\r", -1);
+  priv->matches = g_hash_table_ref (matches);
+
+  if (refining)
+    {
+      while ((match = g_queue_pop_head (&previous_matches)) != NULL)
+        {
+          index_check_message (self, match->serial);
+          g_slice_free (Match, match);
+        }
+    }
+  else
+    {
+      GArray *candidates = index_lookup_candidates (self);
+      guint i, n;
+
+      if (candidates != NULL)
+        {
+          for (i = 0; i < candidates->len; i++)
+            index_check_message (self,
+                g_array_index (candidates, guint64, i));
+
+          g_array_unref (candidates);
+        }
+      else
+        {
+          /* Only delimiters were typed: check every message */
+          n = empathy_debug_buffer_get_length (priv->buffer);
+          for (i = 0; i < n; i++)
+            index_check_message (self,
+                empathy_debug_buffer_get_serial (priv->buffer, i));
+        }
+    }
+}
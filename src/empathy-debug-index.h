@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_DEBUG_INDEX_H__
+#define __EMPATHY_DEBUG_INDEX_H__
+
+#include "empathy-debug-buffer.h"
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathyDebugIndex EmpathyDebugIndex;
+typedef struct _EmpathyDebugIndexClass EmpathyDebugIndexClass;
+typedef struct _EmpathyDebugIndexPriv EmpathyDebugIndexPriv;
+
+struct _EmpathyDebugIndexClass
+{
+  GObjectClass parent_class;
+};
+
+struct _EmpathyDebugIndex
+{
+  GObject parent;
+  EmpathyDebugIndexPriv *priv;
+};
+
+GType empathy_debug_index_get_type (void);
+
+#define EMPATHY_TYPE_DEBUG_INDEX \
+  (empathy_debug_index_get_type ())
+#define EMPATHY_DEBUG_INDEX(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), EMPATHY_TYPE_DEBUG_INDEX, \
+    EmpathyDebugIndex))
+#define EMPATHY_DEBUG_INDEX_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), EMPATHY_TYPE_DEBUG_INDEX, \
+    EmpathyDebugIndexClass))
+#define EMPATHY_IS_DEBUG_INDEX(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), EMPATHY_TYPE_DEBUG_INDEX))
+#define EMPATHY_IS_DEBUG_INDEX_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), EMPATHY_TYPE_DEBUG_INDEX))
+#define EMPATHY_DEBUG_INDEX_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), EMPATHY_TYPE_DEBUG_INDEX, \
+    EmpathyDebugIndexClass))
+
+EmpathyDebugIndex * empathy_debug_index_new (EmpathyDebugBuffer *buffer);
+
+void empathy_debug_index_search (EmpathyDebugIndex *self,
+    const gchar *text,
+    GHashTable *matches);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_DEBUG_INDEX_H__ */
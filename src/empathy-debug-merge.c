@@ -0,0 +1,645 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Read-only GtkTreeModel listing the messages of several
+ * EmpathyDebugBuffers by time, without copying them.
+ *
+ * Messages are ordered by time, then by buffer, then by age within their
+ * buffer. As times never go back within a buffer, the row of a message is
+ * the sum of binary searches in each buffer. Views mostly visit rows one
+ * after the other, so a cursor remembers how many messages of each buffer
+ * come before the row visited last: moving it to the next or previous row
+ * only compares the messages at the edge of each buffer. */
+
+#include "config.h"
+#include "empathy-debug-merge.h"
+
+/* Farther rows are found with binary searches rather than by moving the
+ * cursor one row at a time */
+#define CURSOR_MAX_STEPS 64
+
+struct _EmpathyDebugMergePriv
+{
+  /* owned EmpathyDebugBuffer */
+  GPtrArray *buffers;
+
+  /* time of the oldest message of each buffer, to find its row once it
+   * has been evicted */
+  gint64 *first_times;
+
+  /* cursor_positions[i] messages of buffers[i] come before the row of the
+   * cursor */
+  guint *cursor_positions;
+  guint cursor;
+  gboolean cursor_valid;
+
+  gint stamp;
+};
+
+static void empathy_debug_merge_tree_model_init (GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (EmpathyDebugMerge, empathy_debug_merge,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL,
+        empathy_debug_merge_tree_model_init))
+
+static EmpathyDebugBuffer *
+merge_get_buffer (EmpathyDebugMerge *self,
+    guint b)
+{
+  return g_ptr_array_index (self->priv->buffers, b);
+}
+
+static guint
+merge_get_length (EmpathyDebugMerge *self)
+{
+  guint b, length = 0;
+
+  for (b = 0; b < self->priv->buffers->len; b++)
+    length += empathy_debug_buffer_get_length (merge_get_buffer (self, b));
+
+  return length;
+}
+
+/* Returns the number of messages of buffers[b] coming before a message of
+ * buffers[other] sent at @time */
+static guint
+merge_count_before (EmpathyDebugMerge *self,
+    guint b,
+    guint other,
+    gint64 time)
+{
+  return empathy_debug_buffer_count_before (merge_get_buffer (self, b), time,
+      b < other);
+}
+
+/* Whether the @i-th message of buffers[a] comes before the @j-th message of
+ * buffers[b] */
+static gboolean
+merge_message_before (EmpathyDebugMerge *self,
+    guint a,
+    guint i,
+    guint b,
+    guint j)
+{
+  gint64 time_a, time_b;
+
+  time_a = empathy_debug_buffer_get_time (merge_get_buffer (self, a), i);
+  time_b = empathy_debug_buffer_get_time (merge_get_buffer (self, b), j);
+
+  if (time_a != time_b)
+    return time_a < time_b;
+
+  if (a != b)
+    return a < b;
+
+  return i < j;
+}
+
+/* Returns the row of the @index-th message of buffers[b]. If @positions is
+ * not NULL, it's filled with the number of messages of each buffer coming
+ * before that row. */
+static guint
+merge_get_row (EmpathyDebugMerge *self,
+    guint b,
+    guint index,
+    guint *positions)
+{
+  gint64 time;
+  guint i, row = 0;
+
+  time = empathy_debug_buffer_get_time (merge_get_buffer (self, b), index);
+
+  for (i = 0; i < self->priv->buffers->len; i++)
+    {
+      guint n;
+
+      if (i == b)
+        n = index;
+      else
+        n = merge_count_before (self, i, b, time);
+
+      if (positions != NULL)
+        positions[i] = n;
+
+      row += n;
+    }
+
+  return row;
+}
+
+static void
+merge_set_cursor (EmpathyDebugMerge *self,
+    guint b,
+    guint index)
+{
+  self->priv->cursor = merge_get_row (self, b, index,
+      self->priv->cursor_positions);
+  self->priv->cursor_valid = TRUE;
+}
+
+/* Returns the buffer of the message at the cursor's row, or -1 if the
+ * cursor is past the last row */
+static gint
+merge_cursor_head (EmpathyDebugMerge *self)
+{
+  guint *positions = self->priv->cursor_positions;
+  gint head = -1;
+  guint b;
+
+  for (b = 0; b < self->priv->buffers->len; b++)
+    {
+      if (positions[b] >=
+          empathy_debug_buffer_get_length (merge_get_buffer (self, b)))
+        continue;
+
+      if (head < 0 ||
+          merge_message_before (self, b, positions[b], head, positions[head]))
+        head = b;
+    }
+
+  return head;
+}
+
+static gboolean
+merge_cursor_is_on (EmpathyDebugMerge *self,
+    guint b,
+    guint index)
+{
+  return self->priv->cursor_valid &&
+    self->priv->cursor_positions[b] == index &&
+    merge_cursor_head (self) == (gint) b;
+}
+
+static gboolean
+merge_cursor_next (EmpathyDebugMerge *self)
+{
+  gint head = merge_cursor_head (self);
+
+  if (head < 0)
+    return FALSE;
+
+  self->priv->cursor_positions[head]++;
+  self->priv->cursor++;
+  return TRUE;
+}
+
+static gboolean
+merge_cursor_previous (EmpathyDebugMerge *self)
+{
+  guint *positions = self->priv->cursor_positions;
+  gint tail = -1;
+  guint b;
+
+  for (b = 0; b < self->priv->buffers->len; b++)
+    {
+      if (positions[b] == 0)
+        continue;
+
+      if (tail < 0 || merge_message_before (self, tail, positions[tail] - 1,
+              b, positions[b] - 1))
+        tail = b;
+    }
+
+  if (tail < 0)
+    return FALSE;
+
+  positions[tail]--;
+  self->priv->cursor--;
+  return TRUE;
+}
+
+static gboolean
+merge_move_cursor (EmpathyDebugMerge *self,
+    guint row)
+{
+  EmpathyDebugMergePriv *priv = self->priv;
+  guint b;
+
+  if (row >= merge_get_length (self))
+    return FALSE;
+
+  if (priv->cursor_valid &&
+      MAX (row, priv->cursor) - MIN (row, priv->cursor) <= CURSOR_MAX_STEPS)
+    {
+      while (priv->cursor < row)
+        merge_cursor_next (self);
+      while (priv->cursor > row)
+        merge_cursor_previous (self);
+
+      return TRUE;
+    }
+
+  for (b = 0; b < priv->buffers->len; b++)
+    {
+      guint low = 0;
+      guint high = empathy_debug_buffer_get_length (merge_get_buffer (self, b));
+
+      /* Find the newest message of the buffer not coming after @row */
+      while (low < high)
+        {
+          guint middle = low + (high - low) / 2;
+
+          if (merge_get_row (self, b, middle, NULL) <= row)
+            low = middle + 1;
+          else
+            high = middle;
+        }
+
+      if (low > 0 && merge_get_row (self, b, low - 1, NULL) == row)
+        {
+          merge_set_cursor (self, b, low - 1);
+          return TRUE;
+        }
+    }
+
+  g_return_val_if_reached (FALSE);
+}
+
+static void
+merge_fill_iter (EmpathyDebugMerge *self,
+    guint b,
+    guint index,
+    GtkTreeIter *iter)
+{
+  guint64 serial;
+
+  serial = empathy_debug_buffer_get_serial (merge_get_buffer (self, b),
+      index);
+
+  iter->stamp = self->priv->stamp;
+  iter->user_data = GUINT_TO_POINTER (b);
+  iter->user_data2 = GUINT_TO_POINTER ((guint) serial);
+  iter->user_data3 = GUINT_TO_POINTER ((guint) (serial >> 32));
+}
+
+/* Returns FALSE if the message of @iter has been evicted */
+static gboolean
+merge_iter_get_message (EmpathyDebugMerge *self,
+    GtkTreeIter *iter,
+    guint *b,
+    guint *index)
+{
+  guint64 serial;
+
+  g_return_val_if_fail (iter->stamp == self->priv->stamp, FALSE);
+
+  *b = GPOINTER_TO_UINT (iter->user_data);
+  serial = GPOINTER_TO_UINT (iter->user_data2) |
+    ((guint64) GPOINTER_TO_UINT (iter->user_data3) << 32);
+
+  return empathy_debug_buffer_lookup_serial (merge_get_buffer (self, *b),
+      serial, index);
+}
+
+static gint
+merge_find_buffer (EmpathyDebugMerge *self,
+    GtkTreeModel *buffer)
+{
+  guint b;
+
+  for (b = 0; b < self->priv->buffers->len; b++)
+    {
+      if (g_ptr_array_index (self->priv->buffers, b) == buffer)
+        return b;
+    }
+
+  g_return_val_if_reached (-1);
+}
+
+static void
+merge_buffer_row_inserted_cb (GtkTreeModel *buffer,
+    GtkTreePath *path,
+    GtkTreeIter *iter,
+    EmpathyDebugMerge *self)
+{
+  GtkTreePath *merge_path;
+  GtkTreeIter merge_iter;
+  guint index;
+  gint b;
+
+  b = merge_find_buffer (self, buffer);
+  if (b < 0)
+    return;
+
+  index = gtk_tree_path_get_indices (path)[0];
+
+  if (index == 0)
+    self->priv->first_times[b] = empathy_debug_buffer_get_time (
+        EMPATHY_DEBUG_BUFFER (buffer), 0);
+
+  self->priv->cursor_valid = FALSE;
+
+  merge_fill_iter (self, b, index, &merge_iter);
+  merge_path = gtk_tree_path_new_from_indices (
+      merge_get_row (self, b, index, NULL), -1);
+  gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), merge_path,
+      &merge_iter);
+  gtk_tree_path_free (merge_path);
+}
+
+/* EmpathyDebugBuffer only ever deletes its oldest message */
+static void
+merge_buffer_row_deleted_cb (GtkTreeModel *buffer,
+    GtkTreePath *path,
+    EmpathyDebugMerge *self)
+{
+  GtkTreePath *merge_path;
+  guint i, row = 0;
+  gint b;
+
+  b = merge_find_buffer (self, buffer);
+  if (b < 0)
+    return;
+
+  for (i = 0; i < self->priv->buffers->len; i++)
+    {
+      if (i != (guint) b)
+        row += merge_count_before (self, i, b, self->priv->first_times[b]);
+    }
+
+  if (empathy_debug_buffer_get_length (EMPATHY_DEBUG_BUFFER (buffer)) > 0)
+    self->priv->first_times[b] = empathy_debug_buffer_get_time (
+        EMPATHY_DEBUG_BUFFER (buffer), 0);
+
+  self->priv->cursor_valid = FALSE;
+
+  merge_path = gtk_tree_path_new_from_indices (row, -1);
+  gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), merge_path);
+  gtk_tree_path_free (merge_path);
+}
+
+static GtkTreeModelFlags
+debug_merge_get_flags (GtkTreeModel *model)
+{
+  return GTK_TREE_MODEL_LIST_ONLY | GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+static gint
+debug_merge_get_n_columns (GtkTreeModel *model)
+{
+  return 1;
+}
+
+static GType
+debug_merge_get_column_type (GtkTreeModel *model,
+    gint column)
+{
+  g_return_val_if_fail (column == 0, G_TYPE_INVALID);
+
+  return TP_TYPE_DEBUG_MESSAGE;
+}
+
+static gboolean
+debug_merge_iter_nth_child (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreeIter *parent,
+    gint n)
+{
+  EmpathyDebugMerge *self = EMPATHY_DEBUG_MERGE (model);
+  gint head;
+
+  if (parent != NULL || n < 0 || !merge_move_cursor (self, n))
+    return FALSE;
+
+  head = merge_cursor_head (self);
+  merge_fill_iter (self, head, self->priv->cursor_positions[head], iter);
+  return TRUE;
+}
+
+static gboolean
+debug_merge_get_iter (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreePath *path)
+{
+  if (gtk_tree_path_get_depth (path) != 1)
+    return FALSE;
+
+  return debug_merge_iter_nth_child (model, iter, NULL,
+      gtk_tree_path_get_indices (path)[0]);
+}
+
+static GtkTreePath *
+debug_merge_get_path (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugMerge *self = EMPATHY_DEBUG_MERGE (model);
+  guint b, index, row;
+
+  if (!merge_iter_get_message (self, iter, &b, &index))
+    g_return_val_if_reached (NULL);
+
+  if (merge_cursor_is_on (self, b, index))
+    row = self->priv->cursor;
+  else
+    row = merge_get_row (self, b, index, NULL);
+
+  return gtk_tree_path_new_from_indices (row, -1);
+}
+
+static void
+debug_merge_get_value (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    gint column,
+    GValue *value)
+{
+  EmpathyDebugMerge *self = EMPATHY_DEBUG_MERGE (model);
+  guint b, index;
+
+  g_value_init (value, TP_TYPE_DEBUG_MESSAGE);
+
+  g_return_if_fail (column == 0);
+
+  if (!merge_iter_get_message (self, iter, &b, &index))
+    g_return_if_reached ();
+
+  g_value_set_object (value,
+      empathy_debug_buffer_get_message (merge_get_buffer (self, b), index));
+}
+
+static gboolean
+debug_merge_iter_next (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugMerge *self = EMPATHY_DEBUG_MERGE (model);
+  guint b, index;
+  gint head;
+
+  if (!merge_iter_get_message (self, iter, &b, &index))
+    goto out;
+
+  if (!merge_cursor_is_on (self, b, index))
+    merge_set_cursor (self, b, index);
+
+  merge_cursor_next (self);
+
+  head = merge_cursor_head (self);
+  if (head < 0)
+    goto out;
+
+  merge_fill_iter (self, head, self->priv->cursor_positions[head], iter);
+  return TRUE;
+
+out:
+  iter->stamp = 0;
+  return FALSE;
+}
+
+static gboolean
+debug_merge_iter_previous (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugMerge *self = EMPATHY_DEBUG_MERGE (model);
+  guint b, index;
+  gint head;
+
+  if (!merge_iter_get_message (self, iter, &b, &index))
+    goto out;
+
+  if (!merge_cursor_is_on (self, b, index))
+    merge_set_cursor (self, b, index);
+
+  if (!merge_cursor_previous (self))
+    goto out;
+
+  head = merge_cursor_head (self);
+  merge_fill_iter (self, head, self->priv->cursor_positions[head], iter);
+  return TRUE;
+
+out:
+  iter->stamp = 0;
+  return FALSE;
+}
+
+static gboolean
+debug_merge_iter_children (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreeIter *parent)
+{
+  return debug_merge_iter_nth_child (model, iter, parent, 0);
+}
+
+static gboolean
+debug_merge_iter_has_child (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  return FALSE;
+}
+
+static gint
+debug_merge_iter_n_children (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  if (iter != NULL)
+    return 0;
+
+  return merge_get_length (EMPATHY_DEBUG_MERGE (model));
+}
+
+static gboolean
+debug_merge_iter_parent (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreeIter *child)
+{
+  return FALSE;
+}
+
+static void
+empathy_debug_merge_tree_model_init (GtkTreeModelIface *iface)
+{
+  iface->get_flags = debug_merge_get_flags;
+  iface->get_n_columns = debug_merge_get_n_columns;
+  iface->get_column_type = debug_merge_get_column_type;
+  iface->get_iter = debug_merge_get_iter;
+  iface->get_path = debug_merge_get_path;
+  iface->get_value = debug_merge_get_value;
+  iface->iter_next = debug_merge_iter_next;
+  iface->iter_previous = debug_merge_iter_previous;
+  iface->iter_children = debug_merge_iter_children;
+  iface->iter_has_child = debug_merge_iter_has_child;
+  iface->iter_n_children = debug_merge_iter_n_children;
+  iface->iter_nth_child = debug_merge_iter_nth_child;
+  iface->iter_parent = debug_merge_iter_parent;
+}
+
+static void
+empathy_debug_merge_finalize (GObject *object)
+{
+  EmpathyDebugMerge *self = EMPATHY_DEBUG_MERGE (object);
+  guint b;
+
+  for (b = 0; b < self->priv->buffers->len; b++)
+    g_signal_handlers_disconnect_by_data (merge_get_buffer (self, b), self);
+
+  g_ptr_array_unref (self->priv->buffers);
+  g_free (self->priv->first_times);
+  g_free (self->priv->cursor_positions);
+
+  G_OBJECT_CLASS (empathy_debug_merge_parent_class)->finalize (object);
+}
+
+static void
+empathy_debug_merge_class_init (EmpathyDebugMergeClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = empathy_debug_merge_finalize;
+
+  g_type_class_add_private (klass, sizeof (EmpathyDebugMergePriv));
+}
+
+static void
+empathy_debug_merge_init (EmpathyDebugMerge *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_DEBUG_MERGE, EmpathyDebugMergePriv);
+
+  self->priv->buffers = g_ptr_array_new_with_free_func (g_object_unref);
+  self->priv->stamp = g_random_int ();
+}
+
+/* @buffers: a GPtrArray of EmpathyDebugBuffer, which can't change once the
+ * model is created */
+EmpathyDebugMerge *
+empathy_debug_merge_new (GPtrArray *buffers)
+{
+  EmpathyDebugMerge *self;
+  guint b;
+
+  self = g_object_new (EMPATHY_TYPE_DEBUG_MERGE, NULL);
+
+  self->priv->first_times = g_new0 (gint64, buffers->len);
+  self->priv->cursor_positions = g_new0 (guint, buffers->len);
+
+  for (b = 0; b < buffers->len; b++)
+    {
+      EmpathyDebugBuffer *buffer = g_ptr_array_index (buffers, b);
+
+      g_ptr_array_add (self->priv->buffers, g_object_ref (buffer));
+
+      if (empathy_debug_buffer_get_length (buffer) > 0)
+        self->priv->first_times[b] = empathy_debug_buffer_get_time (buffer, 0);
+
+      g_signal_connect (buffer, "row-inserted",
+          G_CALLBACK (merge_buffer_row_inserted_cb), self);
+      g_signal_connect (buffer, "row-deleted",
+          G_CALLBACK (merge_buffer_row_deleted_cb), self);
+    }
+
+  return self;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_DEBUG_MERGE_H__
+#define __EMPATHY_DEBUG_MERGE_H__
+
+#include "empathy-debug-buffer.h"
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathyDebugMerge EmpathyDebugMerge;
+typedef struct _EmpathyDebugMergeClass EmpathyDebugMergeClass;
+typedef struct _EmpathyDebugMergePriv EmpathyDebugMergePriv;
+
+struct _EmpathyDebugMergeClass
+{
+  GObjectClass parent_class;
+};
+
+struct _EmpathyDebugMerge
+{
+  GObject parent;
+  EmpathyDebugMergePriv *priv;
+};
+
+GType empathy_debug_merge_get_type (void);
+
+#define EMPATHY_TYPE_DEBUG_MERGE \
+  (empathy_debug_merge_get_type ())
+#define EMPATHY_DEBUG_MERGE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), EMPATHY_TYPE_DEBUG_MERGE, \
+    EmpathyDebugMerge))
+#define EMPATHY_DEBUG_MERGE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), EMPATHY_TYPE_DEBUG_MERGE, \
+    EmpathyDebugMergeClass))
+#define EMPATHY_IS_DEBUG_MERGE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), EMPATHY_TYPE_DEBUG_MERGE))
+#define EMPATHY_IS_DEBUG_MERGE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), EMPATHY_TYPE_DEBUG_MERGE))
+#define EMPATHY_DEBUG_MERGE_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), EMPATHY_TYPE_DEBUG_MERGE, \
+    EmpathyDebugMergeClass))
+
+EmpathyDebugMerge * empathy_debug_merge_new (GPtrArray *buffers);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_DEBUG_MERGE_H__ */
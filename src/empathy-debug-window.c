@@ -27,7 +27,11 @@
 #include <tp-account-widgets/tpaw-utils.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
+#include "empathy-debug-buffer.h"
+#include "empathy-debug-index.h"
+#include "empathy-debug-merge.h"
 #include "empathy-geometry.h"
+#include "empathy-gsettings.h"
 #include "empathy-ui-utils.h"
 #include "empathy-utils.h"
 
@@ -37,6 +41,13 @@
 G_DEFINE_TYPE (EmpathyDebugWindow, empathy_debug_window,
     GTK_TYPE_WINDOW)
 
+/* Incoming messages are appended to the buffers about once per frame */
+#define FLUSH_INTERVAL 16 /* ms */
+
+/* Saved logs are formatted and written by chunks of that size */
+#define WRITE_CHUNK_SIZE (64 * 1024)
+#define WRITE_PROGRESS_INTERVAL 100 /* ms */
+
 typedef enum
 {
   SERVICE_TYPE_CM = 0,
@@ -44,6 +55,7 @@ typedef enum
   SERVICE_TYPE_MC,
 } ServiceType;
 
+/* The only column of EmpathyDebugBuffer */
 enum
 {
   COL_DEBUG_MESSAGE = 0,
@@ -80,6 +92,7 @@ struct _EmpathyDebugWindowPriv
   GtkToolItem *pause_button;
   GtkToolItem *level_label;
   GtkWidget *level_filter;
+  GtkWidget *search_entry;
 
   /* TreeView */
   GtkTreeModel *store_filter;
@@ -95,6 +108,15 @@ struct _EmpathyDebugWindowPriv
   /* Whether NewDebugMessage will be fired */
   gboolean paused;
 
+  /* Borrowed TpDebugMessage set of the messages matching the search entry,
+   * kept up to date by the index of each active buffer; NULL if not
+   * searching */
+  GHashTable *search_matches;
+
+  /* Owned PendingMessage received since the last flush */
+  GQueue pending_messages;
+  guint flush_id;
+
   /* Service (CM, Client) chooser store */
   GtkListStore *service_store;
 
@@ -105,10 +127,19 @@ struct _EmpathyDebugWindowPriv
   /* Debug to show upon creation */
   gchar *select_name;
 
+  /* Saving, copying or sending the messages shown */
+  GtkWidget *write_box;
+  GtkWidget *write_progress;
+  gpointer write_data;
+  GCancellable *write_cancellable;
+  guint write_progress_id;
+
   /* Misc. */
   gboolean dispose_run;
   TpAccountManager *am;
-  GtkListStore *all_active_buffer;
+  /* Merges the active buffers of all the services for "All" */
+  EmpathyDebugMerge *all_active_buffer;
+  GSettings *gsettings_ui;
 };
 
 static const gchar *
@@ -156,37 +187,34 @@ get_active_service_name (EmpathyDebugWindow *self)
   return name;
 }
 
-static gboolean
-copy_buffered_messages (GtkTreeModel *buffer,
-    GtkTreePath *path,
-    GtkTreeIter *iter,
-    gpointer data)
+static void
+copy_buffered_messages (EmpathyDebugBuffer *buffer,
+    EmpathyDebugBuffer *active_buffer)
 {
-  GtkListStore *active_buffer = data;
-  GtkTreeIter active_buffer_iter;
-  TpDebugMessage *msg;
-
-  gtk_tree_model_get (buffer, iter,
-      COL_DEBUG_MESSAGE, &msg,
-      -1);
-  gtk_list_store_insert_with_values (active_buffer, &active_buffer_iter, -1,
-      COL_DEBUG_MESSAGE, msg,
-      -1);
+  guint i, n;
 
-  g_object_unref (msg);
+  n = empathy_debug_buffer_get_length (buffer);
 
-  return FALSE;
+  for (i = 0; i < n; i++)
+    empathy_debug_buffer_append (active_buffer,
+        empathy_debug_buffer_get_message (buffer, i));
 }
 
 static void
-insert_values_in_buffer (GtkListStore *store,
+debug_window_append_message (EmpathyDebugWindow *self,
+    EmpathyDebugBuffer *active_buffer,
+    EmpathyDebugBuffer *pause_buffer,
     TpDebugMessage *msg)
 {
-  GtkTreeIter iter;
-
-  gtk_list_store_insert_with_values (store, &iter, -1,
-      COL_DEBUG_MESSAGE, msg,
-      -1);
+  if (self->priv->paused)
+    {
+      empathy_debug_buffer_append (pause_buffer, msg);
+    }
+  else
+    {
+      /* All's model shows it as well */
+      empathy_debug_buffer_append (active_buffer, msg);
+    }
 }
 
 static void
@@ -194,32 +222,83 @@ debug_window_add_message (EmpathyDebugWindow *self,
     TpDebugClient *debug,
     TpDebugMessage *msg)
 {
-  GtkListStore *active_buffer, *pause_buffer;
+  debug_window_append_message (self,
+      g_object_get_data (G_OBJECT (debug), "active-buffer"),
+      g_object_get_data (G_OBJECT (debug), "pause-buffer"),
+      msg);
+}
 
-  pause_buffer = g_object_get_data (G_OBJECT (debug), "pause-buffer");
-  active_buffer = g_object_get_data (G_OBJECT (debug), "active-buffer");
+typedef struct
+{
+  /* The buffers of the service when the message was received: they are
+   * replaced if it restarts */
+  EmpathyDebugBuffer *active_buffer;
+  EmpathyDebugBuffer *pause_buffer;
+  TpDebugMessage *msg;
+} PendingMessage;
 
-  if (self->priv->paused)
+static void
+pending_message_free (PendingMessage *pending)
+{
+  g_object_unref (pending->active_buffer);
+  g_object_unref (pending->pause_buffer);
+  g_object_unref (pending->msg);
+  g_slice_free (PendingMessage, pending);
+}
+
+/* Appends the messages received since the last flush. Each new row only
+ * goes through the filter's visible function once, and the view is
+ * redrawn once for all of them. */
+static void
+debug_window_flush_pending_messages (EmpathyDebugWindow *self)
+{
+  PendingMessage *pending;
+
+  if (self->priv->flush_id != 0)
     {
-      insert_values_in_buffer (pause_buffer, msg);
+      g_source_remove (self->priv->flush_id);
+      self->priv->flush_id = 0;
     }
-  else
-    {
-      /* Append 'this' message to this service's and All's active-buffers */
-      insert_values_in_buffer (active_buffer, msg);
 
-      insert_values_in_buffer (self->priv->all_active_buffer, msg);
+  while ((pending = g_queue_pop_head (&self->priv->pending_messages)) != NULL)
+    {
+      debug_window_append_message (self, pending->active_buffer,
+          pending->pause_buffer, pending->msg);
+      pending_message_free (pending);
     }
 }
 
+static gboolean
+debug_window_flush_cb (gpointer user_data)
+{
+  EmpathyDebugWindow *self = user_data;
+
+  self->priv->flush_id = 0;
+  debug_window_flush_pending_messages (self);
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 debug_window_new_debug_message_cb (TpDebugClient *debug,
     TpDebugMessage *msg,
     gpointer user_data)
 {
   EmpathyDebugWindow *self = user_data;
+  PendingMessage *pending;
+
+  pending = g_slice_new (PendingMessage);
+  pending->active_buffer = g_object_ref (
+      g_object_get_data (G_OBJECT (debug), "active-buffer"));
+  pending->pause_buffer = g_object_ref (
+      g_object_get_data (G_OBJECT (debug), "pause-buffer"));
+  pending->msg = g_object_ref (msg);
 
-  debug_window_add_message (self, debug, msg);
+  g_queue_push_tail (&self->priv->pending_messages, pending);
+
+  if (self->priv->flush_id == 0)
+    self->priv->flush_id = g_timeout_add (FLUSH_INTERVAL,
+        debug_window_flush_cb, self);
 }
 
 static void
@@ -263,6 +342,7 @@ debug_window_set_toolbar_sensitivity (EmpathyDebugWindow *self,
   gtk_widget_set_sensitive (GTK_WIDGET (self->priv->pause_button), sensitive);
   gtk_widget_set_sensitive (GTK_WIDGET (self->priv->level_label), sensitive);
   gtk_widget_set_sensitive (GTK_WIDGET (self->priv->level_filter), sensitive);
+  gtk_widget_set_sensitive (self->priv->search_entry, sensitive);
   gtk_widget_set_sensitive (GTK_WIDGET (self->priv->view), sensitive);
 
   if (sensitive && !self->priv->view_visible)
@@ -285,7 +365,7 @@ debug_window_set_toolbar_sensitivity (EmpathyDebugWindow *self,
 }
 
 static gboolean
-debug_window_get_iter_for_active_buffer (GtkListStore *active_buffer,
+debug_window_get_iter_for_active_buffer (EmpathyDebugBuffer *active_buffer,
     GtkTreeIter *iter,
     EmpathyDebugWindow *self)
 {
@@ -297,7 +377,7 @@ debug_window_get_iter_for_active_buffer (GtkListStore *active_buffer,
        valid_iter;
        valid_iter = gtk_tree_model_iter_next (model, iter))
     {
-      GtkListStore *stored_active_buffer;
+      EmpathyDebugBuffer *stored_active_buffer;
 
       gtk_tree_model_get (model, iter,
           COL_ACTIVE_BUFFER, &stored_active_buffer,
@@ -366,7 +446,7 @@ debug_window_get_messages_cb (GObject *object,
   EmpathyDebugWindow *self = user_data;
   gchar *active_service_name;
   guint i;
-  GtkListStore *active_buffer;
+  EmpathyDebugBuffer *active_buffer;
   gboolean valid_iter;
   GtkTreeIter iter;
   gchar *proxy_service_name;
@@ -430,11 +510,6 @@ debug_window_get_messages_cb (GObject *object,
   tp_g_signal_connect_object (debug, "new-debug-message",
       G_CALLBACK (debug_window_new_debug_message_cb), self, 0);
 
-  /* Now that active-buffer is up to date, we can see which messages are
-   * to be visible */
-  gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (
-        self->priv->store_filter));
-
   /* Set the proxy to signal for new debug messages */
   debug_window_set_enabled (debug, TRUE);
 }
@@ -507,11 +582,74 @@ finally:
   g_object_unref (pause_buffer);
 }
 
-static GtkListStore *
-new_list_store_for_service (void)
+/* Active buffers are indexed for the search entry, pause buffers are not
+ * displayed */
+static EmpathyDebugBuffer *
+new_buffer_for_service (EmpathyDebugWindow *self,
+    gboolean indexed)
 {
-  return gtk_list_store_new (NUM_DEBUG_COLS,
-             TP_TYPE_DEBUG_MESSAGE); /* COL_DEBUG_MESSAGE */
+  EmpathyDebugBuffer *buffer;
+  EmpathyDebugIndex *index;
+
+  buffer = empathy_debug_buffer_new (
+      g_settings_get_uint (self->priv->gsettings_ui,
+          EMPATHY_PREFS_UI_DEBUG_MAX_MESSAGES),
+      g_settings_get_uint (self->priv->gsettings_ui,
+          EMPATHY_PREFS_UI_DEBUG_MAX_KBYTES) * (gsize) 1024);
+
+  if (!indexed)
+    return buffer;
+
+  index = empathy_debug_index_new (buffer);
+  g_object_set_data_full (G_OBJECT (buffer), "index", index,
+      g_object_unref);
+
+  if (self->priv->search_matches != NULL)
+    empathy_debug_index_search (index,
+        gtk_entry_get_text (GTK_ENTRY (self->priv->search_entry)),
+        self->priv->search_matches);
+
+  return buffer;
+}
+
+static void
+debug_window_buffer_limits_changed_cb (GSettings *gsettings,
+    const gchar *key,
+    EmpathyDebugWindow *self)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->service_store);
+  guint max_messages;
+  gsize max_bytes;
+  gboolean valid_iter;
+  GtkTreeIter iter;
+
+  max_messages = g_settings_get_uint (gsettings,
+      EMPATHY_PREFS_UI_DEBUG_MAX_MESSAGES);
+  max_bytes = g_settings_get_uint (gsettings,
+      EMPATHY_PREFS_UI_DEBUG_MAX_KBYTES) * (gsize) 1024;
+
+  for (valid_iter = gtk_tree_model_get_iter_first (model, &iter);
+       valid_iter;
+       valid_iter = gtk_tree_model_iter_next (model, &iter))
+    {
+      EmpathyDebugBuffer *active_buffer, *pause_buffer;
+
+      gtk_tree_model_get (model, &iter,
+          COL_ACTIVE_BUFFER, &active_buffer,
+          COL_PAUSE_BUFFER, &pause_buffer,
+          -1);
+
+      /* "All" has no buffer in the store */
+      if (active_buffer != NULL)
+        empathy_debug_buffer_set_limits (active_buffer, max_messages,
+            max_bytes);
+      if (pause_buffer != NULL)
+        empathy_debug_buffer_set_limits (pause_buffer, max_messages,
+            max_bytes);
+
+      tp_clear_object (&active_buffer);
+      tp_clear_object (&pause_buffer);
+    }
 }
 
 static gboolean
@@ -536,6 +674,10 @@ debug_window_visible_func (GtkTreeModel *model,
       COL_LEVEL_VALUE, &filter_value, -1);
 
   result = (tp_debug_message_get_level (msg) <= filter_value);
+
+  if (result && self->priv->search_matches != NULL)
+    result = g_hash_table_contains (self->priv->search_matches, msg);
+
   g_object_unref (msg);
 
   return result;
@@ -574,13 +716,12 @@ tree_view_search_equal_func_cb (GtkTreeModel *model,
 
 static void
 update_store_filter (EmpathyDebugWindow *self,
-    GtkListStore *active_buffer)
+    GtkTreeModel *active_buffer)
 {
   debug_window_set_toolbar_sensitivity (self, FALSE);
 
   tp_clear_object (&self->priv->store_filter);
-  self->priv->store_filter = gtk_tree_model_filter_new (
-      GTK_TREE_MODEL (active_buffer), NULL);
+  self->priv->store_filter = gtk_tree_model_filter_new (active_buffer, NULL);
 
   gtk_tree_model_filter_set_visible_func (
       GTK_TREE_MODEL_FILTER (self->priv->store_filter),
@@ -604,9 +745,9 @@ refresh_all_buffer (EmpathyDebugWindow *self)
   gboolean valid_iter;
   GtkTreeIter iter;
   GtkTreeModel *service_store = GTK_TREE_MODEL (self->priv->service_store);
+  GPtrArray *buffers;
 
-  /* Clear All's active-buffer */
-  gtk_list_store_clear (self->priv->all_active_buffer);
+  buffers = g_ptr_array_new_with_free_func (g_object_unref);
 
   /* Skipping the first service store iter which is reserved for "All" */
   gtk_tree_model_get_iter_first (service_store, &iter);
@@ -615,7 +756,7 @@ refresh_all_buffer (EmpathyDebugWindow *self)
        valid_iter = gtk_tree_model_iter_next (service_store, &iter))
     {
       TpProxy *proxy = NULL;
-      GtkListStore *service_active_buffer;
+      EmpathyDebugBuffer *service_active_buffer;
       gboolean gone;
 
       gtk_tree_model_get (service_store, &iter,
@@ -624,42 +765,41 @@ refresh_all_buffer (EmpathyDebugWindow *self)
           COL_ACTIVE_BUFFER, &service_active_buffer,
           -1);
 
-      if (gone)
+      if (service_active_buffer == NULL)
         {
-          gtk_tree_model_foreach (GTK_TREE_MODEL (service_active_buffer),
-              copy_buffered_messages, self->priv->all_active_buffer);
+          tp_clear_object (&proxy);
+          continue;
         }
-      else
+
+      /* All's model shows the messages of this buffer */
+      g_ptr_array_add (buffers, service_active_buffer);
+
+      if (!gone && proxy == NULL)
         {
-          if (proxy != NULL)
-            {
-              if (service_active_buffer == NULL)
-                break;
+          GError *error = NULL;
+          TpDBusDaemon *dbus = tp_dbus_daemon_dup (&error);
 
-              /* Copy the debug messages to all_active_buffer */
-              gtk_tree_model_foreach (GTK_TREE_MODEL (service_active_buffer),
-                  copy_buffered_messages, self->priv->all_active_buffer);
-            }
-          else
+          if (error != NULL)
             {
-              GError *error = NULL;
-              TpDBusDaemon *dbus = tp_dbus_daemon_dup (&error);
-
-              if (error != NULL)
-                {
-                  DEBUG ("Failed at duping the dbus daemon: %s", error->message);
-                  g_error_free (error);
-                }
+              DEBUG ("Failed at duping the dbus daemon: %s", error->message);
+              g_error_free (error);
+            }
 
-              create_proxy_to_get_messages (self, &iter, dbus);
+          create_proxy_to_get_messages (self, &iter, dbus);
 
-              g_object_unref (dbus);
-            }
+          g_object_unref (dbus);
         }
 
-      g_object_unref (service_active_buffer);
       tp_clear_object (&proxy);
     }
+
+  g_clear_object (&self->priv->all_active_buffer);
+  self->priv->all_active_buffer = empathy_debug_merge_new (buffers);
+  g_ptr_array_unref (buffers);
+
+  if (gtk_combo_box_get_active (GTK_COMBO_BOX (self->priv->chooser)) == 0)
+    update_store_filter (self,
+        GTK_TREE_MODEL (self->priv->all_active_buffer));
 }
 
 static void
@@ -668,7 +808,7 @@ debug_window_service_chooser_changed_cb (GtkComboBox *chooser,
 {
   TpDBusDaemon *dbus;
   GError *error = NULL;
-  GtkListStore *stored_active_buffer = NULL;
+  EmpathyDebugBuffer *stored_active_buffer = NULL;
   gchar *name = NULL;
   GtkTreeIter iter;
   gboolean gone;
@@ -702,11 +842,12 @@ debug_window_service_chooser_changed_cb (GtkComboBox *chooser,
 
   if (!tp_strdiff (name, "All"))
     {
-      update_store_filter (self, self->priv->all_active_buffer);
+      update_store_filter (self,
+          GTK_TREE_MODEL (self->priv->all_active_buffer));
       goto finally;
     }
 
-  update_store_filter (self, stored_active_buffer);
+  update_store_filter (self, GTK_TREE_MODEL (stored_active_buffer));
 
   dbus = tp_dbus_daemon_dup (&error);
 
@@ -915,7 +1056,7 @@ debug_window_get_name_owner_cb (TpDBusDaemon *proxy,
   if (!debug_window_service_is_in_model (data->self, out, NULL, FALSE))
     {
       char *name;
-      GtkListStore *active_buffer, *pause_buffer;
+      EmpathyDebugBuffer *active_buffer, *pause_buffer;
 
       DEBUG ("Adding %s to list: %s at unique name: %s",
           service_type_to_string (data->type),
@@ -923,8 +1064,8 @@ debug_window_get_name_owner_cb (TpDBusDaemon *proxy,
 
       name = service_dup_display_name (self, data->type, data->name);
 
-      active_buffer = new_list_store_for_service ();
-      pause_buffer = new_list_store_for_service ();
+      active_buffer = new_buffer_for_service (self, TRUE);
+      pause_buffer = new_buffer_for_service (self, FALSE);
 
       gtk_list_store_insert_with_values (self->priv->service_store, &iter, -1,
           COL_NAME, name,
@@ -957,9 +1098,7 @@ debug_window_get_name_owner_cb (TpDBusDaemon *proxy,
             COL_ACTIVE_BUFFER, NULL,
             -1);
 
-        self->priv->all_active_buffer = new_list_store_for_service ();
-
-        /* Populate active buffers for all services */
+        /* Merge the active buffers of all services */
         refresh_all_buffer (self);
 
         gtk_combo_box_set_active (GTK_COMBO_BOX (self->priv->chooser), 0);
@@ -1008,12 +1147,12 @@ debug_window_name_owner_changed_cb (TpDBusDaemon *proxy,
            &found_at_iter, TRUE))
         {
           GtkTreeIter iter;
-          GtkListStore *active_buffer, *pause_buffer;
+          EmpathyDebugBuffer *active_buffer, *pause_buffer;
 
           DEBUG ("Adding new service '%s' at %s.", name, arg2);
 
-          active_buffer = new_list_store_for_service ();
-          pause_buffer = new_list_store_for_service ();
+          active_buffer = new_buffer_for_service (self, TRUE);
+          pause_buffer = new_buffer_for_service (self, FALSE);
 
           gtk_list_store_insert_with_values (self->priv->service_store,
               &iter, -1,
@@ -1033,13 +1172,13 @@ debug_window_name_owner_changed_cb (TpDBusDaemon *proxy,
           /* a service with the same name is already in the service_store,
            * update it and set it as re-enabled.
            */
-          GtkListStore *active_buffer, *pause_buffer;
+          EmpathyDebugBuffer *active_buffer, *pause_buffer;
           TpProxy *stored_proxy;
 
           DEBUG ("Refreshing CM '%s' at '%s'.", name, arg2);
 
-          active_buffer= new_list_store_for_service ();
-          pause_buffer = new_list_store_for_service ();
+          active_buffer = new_buffer_for_service (self, TRUE);
+          pause_buffer = new_buffer_for_service (self, FALSE);
 
           gtk_tree_model_get (GTK_TREE_MODEL (self->priv->service_store),
               found_at_iter, COL_PROXY, &stored_proxy, -1);
@@ -1178,6 +1317,9 @@ debug_window_pause_toggled_cb (GtkToggleToolButton *pause_,
   gboolean valid_iter;
   GtkTreeModel *model = GTK_TREE_MODEL (self->priv->service_store);
 
+  /* Messages received before the button was toggled */
+  debug_window_flush_pending_messages (self);
+
   self->priv->paused = gtk_toggle_tool_button_get_active (pause_);
 
   if (!self->priv->paused)
@@ -1191,19 +1333,16 @@ debug_window_pause_toggled_cb (GtkToggleToolButton *pause_,
            valid_iter;
            valid_iter = gtk_tree_model_iter_next (model, &iter))
         {
-          GtkListStore *pause_buffer, *active_buffer;
+          EmpathyDebugBuffer *pause_buffer, *active_buffer;
 
           gtk_tree_model_get (service_store, &iter,
               COL_PAUSE_BUFFER, &pause_buffer,
               COL_ACTIVE_BUFFER, &active_buffer,
               -1);
 
-          gtk_tree_model_foreach (GTK_TREE_MODEL (pause_buffer),
-              copy_buffered_messages, active_buffer);
-          gtk_tree_model_foreach (GTK_TREE_MODEL (pause_buffer),
-              copy_buffered_messages, self->priv->all_active_buffer);
+          copy_buffered_messages (pause_buffer, active_buffer);
 
-          gtk_list_store_clear (pause_buffer);
+          empathy_debug_buffer_clear (pause_buffer);
 
           g_object_unref (active_buffer);
           g_object_unref (pause_buffer);
@@ -1219,19 +1358,81 @@ debug_window_filter_changed_cb (GtkComboBox *filter,
       GTK_TREE_MODEL_FILTER (self->priv->store_filter));
 }
 
+static void
+debug_window_search_changed_cb (GtkEditable *entry,
+    EmpathyDebugWindow *self)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->service_store);
+  gboolean valid_iter;
+  GtkTreeIter iter;
+  gchar *text;
+
+  /* The index ignores leading and trailing spaces, so must we or only
+   * typing spaces would hide every message */
+  text = g_strstrip (g_strdup (gtk_entry_get_text (GTK_ENTRY (entry))));
+
+  tp_clear_pointer (&self->priv->search_matches, g_hash_table_unref);
+
+  if (!TPAW_STR_EMPTY (text))
+    self->priv->search_matches = g_hash_table_new (NULL, NULL);
+
+  /* Skipping the first iter which is reserved for "All" */
+  gtk_tree_model_get_iter_first (model, &iter);
+  for (valid_iter = gtk_tree_model_iter_next (model, &iter);
+       valid_iter;
+       valid_iter = gtk_tree_model_iter_next (model, &iter))
+    {
+      EmpathyDebugBuffer *active_buffer;
+
+      gtk_tree_model_get (model, &iter,
+          COL_ACTIVE_BUFFER, &active_buffer,
+          -1);
+
+      if (active_buffer == NULL)
+        continue;
+
+      empathy_debug_index_search (
+          g_object_get_data (G_OBJECT (active_buffer), "index"),
+          text, self->priv->search_matches);
+
+      g_object_unref (active_buffer);
+    }
+
+  if (self->priv->store_filter != NULL)
+    gtk_tree_model_filter_refilter (
+        GTK_TREE_MODEL_FILTER (self->priv->store_filter));
+
+  g_free (text);
+}
+
 static void
 debug_window_clear_clicked_cb (GtkToolButton *clear_button,
     EmpathyDebugWindow *self)
 {
   GtkTreeIter iter;
-  GtkListStore *active_buffer;
+  EmpathyDebugBuffer *active_buffer;
 
-  /* "All" is the first choice in the service chooser and it's buffer is
-   * not saved in the service-store but is accessed using a self->private
-   * reference */
+  /* "All" is the first choice in the service chooser and only merges the
+   * buffers of the services, so clear all of them */
   if (gtk_combo_box_get_active (GTK_COMBO_BOX (self->priv->chooser)) == 0)
     {
-      gtk_list_store_clear (self->priv->all_active_buffer);
+      GtkTreeModel *model = GTK_TREE_MODEL (self->priv->service_store);
+      gboolean valid_iter;
+
+      gtk_tree_model_get_iter_first (model, &iter);
+      for (valid_iter = gtk_tree_model_iter_next (model, &iter);
+           valid_iter;
+           valid_iter = gtk_tree_model_iter_next (model, &iter))
+        {
+          gtk_tree_model_get (model, &iter,
+              COL_ACTIVE_BUFFER, &active_buffer, -1);
+
+          if (active_buffer != NULL)
+            empathy_debug_buffer_clear (active_buffer);
+
+          tp_clear_object (&active_buffer);
+        }
+
       return;
     }
 
@@ -1239,7 +1440,7 @@ debug_window_clear_clicked_cb (GtkToolButton *clear_button,
   gtk_tree_model_get (GTK_TREE_MODEL (self->priv->service_store), &iter,
       COL_ACTIVE_BUFFER, &active_buffer, -1);
 
-  gtk_list_store_clear (active_buffer);
+  empathy_debug_buffer_clear (active_buffer);
 
   g_object_unref (active_buffer);
 }
@@ -1450,25 +1651,13 @@ debug_window_level_formatter (GtkTreeViewColumn *tree_column,
   g_object_unref (msg);
 }
 
-static gboolean
-debug_window_copy_model_foreach (GtkTreeModel *model,
-    GtkTreePath *path,
-    GtkTreeIter *iter,
-    gpointer user_data)
+static void
+debug_window_append_line (GString *text,
+    TpDebugMessage *msg)
 {
-  gchar **text = (gchar **) user_data;
-  gchar *tmp;
   gchar *level_upper;
   const gchar *level_str, *category;
-  gchar *line, *time_str;
-  TpDebugMessage *msg;
-
-  if (*text == NULL)
-    *text = g_strdup ("");
-
-  gtk_tree_model_get (model, iter,
-      COL_DEBUG_MESSAGE, &msg,
-      -1);
+  gchar *time_str;
 
   level_str = log_level_to_string (tp_debug_message_get_level (msg));
   level_upper = g_ascii_strup (level_str, -1);
@@ -1476,25 +1665,229 @@ debug_window_copy_model_foreach (GtkTreeModel *model,
   time_str = debug_window_format_timestamp (msg);
   category = tp_debug_message_get_category (msg);
 
-  line = g_strdup_printf ("%s%s%s-%s: %s: %s\n",
+  g_string_append_printf (text, "%s%s%s-%s: %s: %s\n",
       tp_debug_message_get_domain (msg),
-      category ? "" : "/", category ? category : "",
+      category ? "/" : "", category ? category : "",
       level_upper, time_str, tp_debug_message_get_message (msg));
 
   g_free (time_str);
+  g_free (level_upper);
+}
 
-  tmp = g_strconcat (*text, line, NULL);
+typedef struct
+{
+  /* owned TpDebugMessage, as shown when the write started */
+  GPtrArray *messages;
+  GOutputStream *output;
+  /* number of messages written, updated by the worker thread */
+  volatile gint written;
+} WriteData;
 
-  g_free (*text);
-  g_free (line);
-  g_free (level_upper);
-  g_object_unref (msg);
+static void
+write_data_free (WriteData *data)
+{
+  g_ptr_array_unref (data->messages);
+  g_object_unref (data->output);
+  g_slice_free (WriteData, data);
+}
 
-  *text = tmp;
+static gboolean
+debug_window_collect_messages_foreach (GtkTreeModel *model,
+    GtkTreePath *path,
+    GtkTreeIter *iter,
+    gpointer user_data)
+{
+  GPtrArray *messages = user_data;
+  TpDebugMessage *msg;
+
+  gtk_tree_model_get (model, iter, COL_DEBUG_MESSAGE, &msg, -1);
+  g_ptr_array_add (messages, msg);
 
   return FALSE;
 }
 
+/* Runs in a thread: formats the messages a chunk at a time so the memory
+ * used doesn't depend on the number of messages */
+static void
+debug_window_write_thread (GSimpleAsyncResult *result,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  WriteData *data = g_simple_async_result_get_op_res_gpointer (result);
+  GError *error = NULL;
+  GString *chunk;
+  guint i;
+
+  chunk = g_string_sized_new (WRITE_CHUNK_SIZE);
+
+  for (i = 0; i < data->messages->len; i++)
+    {
+      debug_window_append_line (chunk,
+          g_ptr_array_index (data->messages, i));
+
+      if (chunk->len < WRITE_CHUNK_SIZE && i + 1 < data->messages->len)
+        continue;
+
+      if (!g_output_stream_write_all (data->output, chunk->str, chunk->len,
+              NULL, cancellable, &error))
+        goto out;
+
+      g_string_truncate (chunk, 0);
+      g_atomic_int_set (&data->written, i + 1);
+    }
+
+  g_output_stream_close (data->output, cancellable, &error);
+
+out:
+  if (error != NULL)
+    {
+      /* Closing a file being replaced with a cancelled cancellable keeps
+       * the original one */
+      g_output_stream_close (data->output, cancellable, NULL);
+      g_simple_async_result_take_error (result, error);
+    }
+
+  g_string_free (chunk, TRUE);
+}
+
+static gboolean
+debug_window_write_progress_cb (gpointer user_data)
+{
+  EmpathyDebugWindow *self = user_data;
+  WriteData *data = self->priv->write_data;
+  gchar *text;
+
+  if (data->messages->len == 0)
+    return G_SOURCE_CONTINUE;
+
+  text = g_strdup_printf (_("Written %u of %u messages"),
+      (guint) g_atomic_int_get (&data->written), data->messages->len);
+
+  gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (self->priv->write_progress),
+      (gdouble) g_atomic_int_get (&data->written) / data->messages->len);
+  gtk_progress_bar_set_text (GTK_PROGRESS_BAR (self->priv->write_progress),
+      text);
+
+  g_free (text);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+debug_window_set_writing (EmpathyDebugWindow *self,
+    gboolean writing)
+{
+  gtk_widget_set_sensitive (GTK_WIDGET (self->priv->save_button), !writing);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->priv->send_to_pastebin),
+      !writing);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->priv->copy_button), !writing);
+
+  gtk_widget_set_visible (self->priv->write_box, writing);
+}
+
+/* Writes the lines of the messages shown in the view to @output, in a
+ * thread, then closes it. Only one write can be in progress. */
+static void
+debug_window_write_async (EmpathyDebugWindow *self,
+    GOutputStream *output,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GSimpleAsyncResult *result;
+  WriteData *data;
+
+  g_return_if_fail (self->priv->write_data == NULL);
+
+  data = g_slice_new0 (WriteData);
+  data->messages = g_ptr_array_new_with_free_func (g_object_unref);
+  data->output = g_object_ref (output);
+
+  if (self->priv->store_filter != NULL)
+    gtk_tree_model_foreach (self->priv->store_filter,
+        debug_window_collect_messages_foreach, data->messages);
+
+  self->priv->write_data = data;
+  self->priv->write_cancellable = g_cancellable_new ();
+  self->priv->write_progress_id = g_timeout_add (WRITE_PROGRESS_INTERVAL,
+      debug_window_write_progress_cb, self);
+
+  debug_window_write_progress_cb (self);
+  debug_window_set_writing (self, TRUE);
+
+  result = g_simple_async_result_new (G_OBJECT (self), callback, user_data,
+      debug_window_write_async);
+  g_simple_async_result_set_op_res_gpointer (result, data,
+      (GDestroyNotify) write_data_free);
+  g_simple_async_result_run_in_thread (result, debug_window_write_thread,
+      G_PRIORITY_DEFAULT, self->priv->write_cancellable);
+  g_object_unref (result);
+}
+
+static gboolean
+debug_window_write_finish (EmpathyDebugWindow *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  if (self->priv->write_progress_id != 0)
+    {
+      g_source_remove (self->priv->write_progress_id);
+      self->priv->write_progress_id = 0;
+    }
+
+  g_clear_object (&self->priv->write_cancellable);
+  self->priv->write_data = NULL;
+
+  if (!self->priv->dispose_run)
+    debug_window_set_writing (self, FALSE);
+
+  if (g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result),
+          error))
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+debug_window_write_cancel_clicked_cb (GtkButton *button,
+    EmpathyDebugWindow *self)
+{
+  if (self->priv->write_cancellable != NULL)
+    g_cancellable_cancel (self->priv->write_cancellable);
+}
+
+/* Returns the NUL-terminated data written to a GMemoryOutputStream */
+static gchar *
+memory_output_stream_steal_text (GOutputStream *output)
+{
+  GMemoryOutputStream *stream = G_MEMORY_OUTPUT_STREAM (output);
+  gsize size;
+  gchar *text;
+
+  size = g_memory_output_stream_get_data_size (stream);
+  text = g_realloc (g_memory_output_stream_steal_data (stream), size + 1);
+  text[size] = '\0';
+
+  return text;
+}
+
+static void
+debug_window_save_written_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyDebugWindow *self = EMPATHY_DEBUG_WINDOW (source);
+  GError *error = NULL;
+
+  if (!debug_window_write_finish (self, result, &error))
+    {
+      DEBUG ("Failed to write to file: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  DEBUG ("Log saved");
+}
+
 static void
 debug_window_save_file_chooser_response_cb (GtkDialog *dialog,
     gint response_id,
@@ -1502,10 +1895,9 @@ debug_window_save_file_chooser_response_cb (GtkDialog *dialog,
 {
   gchar *filename = NULL;
   GFile *gfile = NULL;
-  gchar *debug_data = NULL;
-  GFileOutputStream *output_stream = NULL;
+  GOutputStream *output = NULL;
+  GFileOutputStream *file_stream;
   GError *file_open_error = NULL;
-  GError *file_write_error = NULL;
 
   if (response_id != GTK_RESPONSE_ACCEPT)
     goto OUT;
@@ -1515,7 +1907,7 @@ debug_window_save_file_chooser_response_cb (GtkDialog *dialog,
   DEBUG ("Saving log as %s", filename);
 
   gfile = g_file_new_for_path (filename);
-  output_stream = g_file_replace (gfile, NULL, FALSE,
+  file_stream = g_file_replace (gfile, NULL, FALSE,
       G_FILE_CREATE_NONE, NULL, &file_open_error);
 
   if (file_open_error != NULL)
@@ -1525,25 +1917,32 @@ debug_window_save_file_chooser_response_cb (GtkDialog *dialog,
       goto OUT;
     }
 
-  gtk_tree_model_foreach (self->priv->store_filter,
-      debug_window_copy_model_foreach, &debug_data);
+  /* Compress the log if asked to with the file name */
+  if (g_str_has_suffix (filename, ".gz"))
+    {
+      GZlibCompressor *compressor;
 
-  g_output_stream_write (G_OUTPUT_STREAM (output_stream), debug_data,
-      strlen (debug_data), NULL, &file_write_error);
-  g_free (debug_data);
+      compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+      output = g_converter_output_stream_new (G_OUTPUT_STREAM (file_stream),
+          G_CONVERTER (compressor));
 
-  if (file_write_error != NULL)
+      g_object_unref (compressor);
+      g_object_unref (file_stream);
+    }
+  else
     {
-      DEBUG ("Failed to write to file: %s", file_write_error->message);
-      g_error_free (file_write_error);
+      output = G_OUTPUT_STREAM (file_stream);
     }
 
+  debug_window_write_async (self, output, debug_window_save_written_cb,
+      NULL);
+
 OUT:
   if (gfile != NULL)
     g_object_unref (gfile);
 
-  if (output_stream != NULL)
-    g_object_unref (output_stream);
+  if (output != NULL)
+    g_object_unref (output);
 
   if (filename != NULL)
     g_free (filename);
@@ -1561,6 +1960,9 @@ debug_window_save_clicked_cb (GtkToolButton *tool_button,
   time_t t;
   struct tm *tm_s;
 
+  if (self->priv->write_data != NULL)
+    return;
+
   file_chooser = gtk_file_chooser_dialog_new (_("Save"),
       GTK_WINDOW (self), GTK_FILE_CHOOSER_ACTION_SAVE,
       GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
@@ -1712,32 +2114,75 @@ debug_window_send_to_pastebin (EmpathyDebugWindow *self,
 }
 
 static void
-debug_window_send_to_pastebin_cb (GtkToolButton *tool_button,
-    EmpathyDebugWindow *self)
+debug_window_pastebin_written_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
 {
-  gchar *debug_data = NULL;
+  EmpathyDebugWindow *self = EMPATHY_DEBUG_WINDOW (source);
+  GOutputStream *output = user_data;
+  GError *error = NULL;
+  gchar *debug_data;
 
-  DEBUG ("Preparing debug data for sending to pastebin.");
+  if (!debug_window_write_finish (self, result, &error))
+    {
+      DEBUG ("Failed to prepare debug data: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
 
-  gtk_tree_model_foreach (self->priv->store_filter,
-      debug_window_copy_model_foreach, &debug_data);
+  if (self->priv->dispose_run)
+    goto out;
 
+  debug_data = memory_output_stream_steal_text (output);
   debug_window_send_to_pastebin (self, debug_data);
   g_free (debug_data);
+
+out:
+  g_object_unref (output);
 }
 
 static void
-debug_window_copy_clicked_cb (GtkToolButton *tool_button,
+debug_window_send_to_pastebin_cb (GtkToolButton *tool_button,
     EmpathyDebugWindow *self)
 {
+  GOutputStream *output;
+
+  /* The toolbar can be made sensitive again while writing */
+  if (self->priv->write_data != NULL)
+    return;
+
+  DEBUG ("Preparing debug data for sending to pastebin.");
+
+  output = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  debug_window_write_async (self, output, debug_window_pastebin_written_cb,
+      output);
+}
+
+static void
+debug_window_copy_written_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyDebugWindow *self = EMPATHY_DEBUG_WINDOW (source);
+  GOutputStream *output = user_data;
   GtkClipboard *clipboard;
-  gchar *text = NULL;
+  GError *error = NULL;
+  gchar *text;
+
+  if (!debug_window_write_finish (self, result, &error))
+    {
+      DEBUG ("Failed to prepare debug data: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  if (self->priv->dispose_run)
+    goto out;
 
-  gtk_tree_model_foreach (self->priv->store_filter,
-      debug_window_copy_model_foreach, &text);
+  text = memory_output_stream_steal_text (output);
 
   clipboard = gtk_clipboard_get_for_display (
-      gtk_widget_get_display (GTK_WIDGET (tool_button)),
+      gtk_widget_get_display (GTK_WIDGET (self)),
       GDK_SELECTION_CLIPBOARD);
 
   DEBUG ("Copying text to clipboard (length: %" G_GSIZE_FORMAT ")",
@@ -1746,6 +2191,23 @@ debug_window_copy_clicked_cb (GtkToolButton *tool_button,
   gtk_clipboard_set_text (clipboard, text, -1);
 
   g_free (text);
+
+out:
+  g_object_unref (output);
+}
+
+static void
+debug_window_copy_clicked_cb (GtkToolButton *tool_button,
+    EmpathyDebugWindow *self)
+{
+  GOutputStream *output;
+
+  if (self->priv->write_data != NULL)
+    return;
+
+  output = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  debug_window_write_async (self, output, debug_window_copy_written_cb,
+      output);
 }
 
 static gboolean
@@ -1810,6 +2272,7 @@ am_prepared_cb (GObject *am,
   GtkTreeIter iter;
   GError *error = NULL;
   GtkWidget *infobar, *content;
+  GtkWidget *button;
 
   if (!tp_proxy_prepare_finish (am, res, &error))
     {
@@ -1987,6 +2450,21 @@ am_prepared_cb (GObject *am,
   g_signal_connect (self->priv->level_filter, "changed",
       G_CALLBACK (debug_window_filter_changed_cb), object);
 
+  /* Search */
+  self->priv->search_entry = gtk_search_entry_new ();
+  gtk_entry_set_placeholder_text (GTK_ENTRY (self->priv->search_entry),
+      _("Search messages, domains and categories"));
+  gtk_entry_set_width_chars (GTK_ENTRY (self->priv->search_entry), 30);
+  gtk_widget_show (self->priv->search_entry);
+
+  item = gtk_tool_item_new ();
+  gtk_widget_show (GTK_WIDGET (item));
+  gtk_container_add (GTK_CONTAINER (item), self->priv->search_entry);
+  gtk_toolbar_insert (GTK_TOOLBAR (toolbar), item, -1);
+
+  g_signal_connect (self->priv->search_entry, "changed",
+      G_CALLBACK (debug_window_search_changed_cb), object);
+
   /* Info bar */
   infobar = gtk_info_bar_new ();
   gtk_info_bar_set_message_type (GTK_INFO_BAR (infobar), GTK_MESSAGE_INFO);
@@ -2013,6 +2491,26 @@ am_prepared_cb (GObject *am,
   gtk_widget_show (label);
   gtk_box_pack_start (GTK_BOX (vbox), infobar, FALSE, FALSE, 0);
 
+  /* Progress of the writes, shown while there is one */
+  self->priv->write_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
+  gtk_container_set_border_width (GTK_CONTAINER (self->priv->write_box), 6);
+  gtk_box_pack_end (GTK_BOX (vbox), self->priv->write_box, FALSE, FALSE, 0);
+
+  self->priv->write_progress = gtk_progress_bar_new ();
+  gtk_progress_bar_set_show_text (
+      GTK_PROGRESS_BAR (self->priv->write_progress), TRUE);
+  gtk_widget_set_valign (self->priv->write_progress, GTK_ALIGN_CENTER);
+  gtk_widget_show (self->priv->write_progress);
+  gtk_box_pack_start (GTK_BOX (self->priv->write_box),
+      self->priv->write_progress, TRUE, TRUE, 0);
+
+  button = gtk_button_new_from_stock (GTK_STOCK_CANCEL);
+  g_signal_connect (button, "clicked",
+      G_CALLBACK (debug_window_write_cancel_clicked_cb), object);
+  gtk_widget_show (button);
+  gtk_box_pack_start (GTK_BOX (self->priv->write_box), button,
+      FALSE, FALSE, 0);
+
   /* Debug treeview */
   self->priv->view = gtk_tree_view_new ();
   gtk_tree_view_set_rules_hint (GTK_TREE_VIEW (self->priv->view), TRUE);
@@ -2077,6 +2575,13 @@ am_prepared_cb (GObject *am,
 
   self->priv->all_active_buffer = NULL;
 
+  tp_g_signal_connect_object (self->priv->gsettings_ui,
+      "changed::" EMPATHY_PREFS_UI_DEBUG_MAX_MESSAGES,
+      G_CALLBACK (debug_window_buffer_limits_changed_cb), self, 0);
+  tp_g_signal_connect_object (self->priv->gsettings_ui,
+      "changed::" EMPATHY_PREFS_UI_DEBUG_MAX_KBYTES,
+      G_CALLBACK (debug_window_buffer_limits_changed_cb), self, 0);
+
   debug_window_set_toolbar_sensitivity (EMPATHY_DEBUG_WINDOW (object), FALSE);
   debug_window_fill_service_chooser (EMPATHY_DEBUG_WINDOW (object));
   gtk_widget_show (GTK_WIDGET (object));
@@ -2087,6 +2592,8 @@ debug_window_constructed (GObject *object)
 {
   EmpathyDebugWindow *self = EMPATHY_DEBUG_WINDOW (object);
 
+  self->priv->gsettings_ui = g_settings_new (EMPATHY_PREFS_UI_SCHEMA);
+
   self->priv->am = tp_account_manager_dup ();
   tp_proxy_prepare_async (self->priv->am, NULL, am_prepared_cb, object);
 }
@@ -2174,13 +2681,37 @@ debug_window_dispose (GObject *object)
     tp_proxy_signal_connection_disconnect (
         self->priv->name_owner_changed_signal);
 
+  self->priv->dispose_run = TRUE;
+
   /* Disable Debug on all proxies */
   disable_all_debug_clients (self);
 
+  /* The write finishes in its thread; its callback won't update the UI */
+  if (self->priv->write_cancellable != NULL)
+    g_cancellable_cancel (self->priv->write_cancellable);
+
+  if (self->priv->write_progress_id != 0)
+    {
+      g_source_remove (self->priv->write_progress_id);
+      self->priv->write_progress_id = 0;
+    }
+
+  if (self->priv->flush_id != 0)
+    {
+      g_source_remove (self->priv->flush_id);
+      self->priv->flush_id = 0;
+    }
+
+  g_queue_foreach (&self->priv->pending_messages,
+      (GFunc) pending_message_free, NULL);
+  g_queue_clear (&self->priv->pending_messages);
+
   g_clear_object (&self->priv->service_store);
   g_clear_object (&self->priv->dbus);
   g_clear_object (&self->priv->am);
   g_clear_object (&self->priv->all_active_buffer);
+  g_clear_object (&self->priv->gsettings_ui);
+  tp_clear_pointer (&self->priv->search_matches, g_hash_table_unref);
 
   (G_OBJECT_CLASS (empathy_debug_window_parent_class)->dispose) (object);
 }
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Appends the logs of some or all the accounts to a compressed archive,
+ * for instance to keep them once they have been removed from Empathy, or
+ * compacts an archive the same logs have been exported to several times. */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <glib/gi18n.h>
+
+#include "empathy-log-exporter.h"
+#include "empathy-utils.h"
+
+static gchar **account_paths = NULL;
+static gchar **ids = NULL;
+static gchar **archives = NULL;
+static gboolean compact = FALSE;
+
+static GOptionEntry entries[] =
+{
+  { "account", 'a', 0, G_OPTION_ARG_STRING_ARRAY, &account_paths,
+    N_("Only export the logs of the account with this object path"),
+    "PATH" },
+  { "contact", 'c', 0, G_OPTION_ARG_STRING_ARRAY, &ids,
+    N_("Only export the logs of the contact or room with this identifier"),
+    "ID" },
+  { "compact", 0, 0, G_OPTION_ARG_NONE, &compact,
+    N_("Keep only the latest export of each conversation day instead of "
+       "exporting"), NULL },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &archives,
+    NULL, NULL },
+  { NULL }
+};
+
+static GMainLoop *loop = NULL;
+static gint exit_status = EXIT_SUCCESS;
+static gint64 start_time;
+
+static void
+progress_cb (EmpathyLogExporter *exporter,
+    guint n_exported,
+    guint n_dates,
+    gpointer user_data)
+{
+  g_print ("\r%u/%u conversation days exported", n_exported, n_dates);
+}
+
+static void
+export_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogExporter *exporter = EMPATHY_LOG_EXPORTER (source);
+  GError *error = NULL;
+
+  g_print ("\n");
+
+  if (!empathy_log_exporter_export_finish (exporter, result, &error))
+    {
+      g_printerr ("Failed to export the logs: %s\n", error->message);
+      g_error_free (error);
+      exit_status = EXIT_FAILURE;
+    }
+  else
+    {
+      g_print ("Exported in %.1f s\n",
+          (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC);
+    }
+
+  g_main_loop_quit (loop);
+}
+
+static void
+compact_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogExporter *exporter = EMPATHY_LOG_EXPORTER (source);
+  GError *error = NULL;
+
+  if (!empathy_log_exporter_compact_finish (exporter, result, &error))
+    {
+      g_printerr ("Failed to compact the archive: %s\n", error->message);
+      g_error_free (error);
+      exit_status = EXIT_FAILURE;
+    }
+  else
+    {
+      g_print ("Compacted in %.1f s\n",
+          (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC);
+    }
+
+  g_main_loop_quit (loop);
+}
+
+static void
+account_manager_prepared_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogExporter *exporter = user_data;
+  GList *accounts, *l;
+  GError *error = NULL;
+
+  if (!tp_proxy_prepare_finish (source, result, &error))
+    {
+      g_printerr ("Failed to prepare the account manager: %s\n",
+          error->message);
+      g_error_free (error);
+      exit_status = EXIT_FAILURE;
+      g_main_loop_quit (loop);
+      return;
+    }
+
+  accounts = tp_account_manager_dup_valid_accounts (
+      TP_ACCOUNT_MANAGER (source));
+
+  for (l = accounts; l != NULL; l = g_list_next (l))
+    {
+      const gchar *path = tp_proxy_get_object_path (l->data);
+
+      if (account_paths == NULL ||
+          tp_strv_contains ((const gchar * const *) account_paths, path))
+        empathy_log_exporter_add_account (exporter, l->data,
+            (const gchar * const *) ids);
+    }
+
+  g_list_free_full (accounts, g_object_unref);
+
+  start_time = g_get_monotonic_time ();
+  empathy_log_exporter_export_async (exporter, NULL, export_cb, NULL);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  EmpathyLogExporter *exporter;
+  TpAccountManager *account_manager = NULL;
+  GFile *archive;
+  GError *error = NULL;
+
+  empathy_init ();
+
+  context = g_option_context_new (N_("ARCHIVE - export the conversation logs"));
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\nRun '%s --help' to see a full list of available "
+          "command line options.\n", error->message, argv[0]);
+      g_error_free (error);
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free (context);
+
+  if (archives == NULL || g_strv_length (archives) != 1)
+    {
+      g_printerr ("Exactly one archive must be given\n");
+      return EXIT_FAILURE;
+    }
+
+  if (compact && (account_paths != NULL || ids != NULL))
+    {
+      g_printerr ("--compact can't be used with --account or --contact\n");
+      return EXIT_FAILURE;
+    }
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  archive = g_file_new_for_commandline_arg (archives[0]);
+  exporter = empathy_log_exporter_new (archive);
+
+  if (compact)
+    {
+      start_time = g_get_monotonic_time ();
+      empathy_log_exporter_compact_async (exporter, NULL, compact_cb, NULL);
+    }
+  else
+    {
+      g_signal_connect (exporter, "progress", G_CALLBACK (progress_cb),
+          NULL);
+
+      account_manager = tp_account_manager_dup ();
+      tp_proxy_prepare_async (account_manager, NULL,
+          account_manager_prepared_cb, exporter);
+    }
+
+  g_main_loop_run (loop);
+
+  tp_clear_object (&account_manager);
+  g_object_unref (exporter);
+  g_object_unref (archive);
+  g_main_loop_unref (loop);
+  g_strfreev (account_paths);
+  g_strfreev (ids);
+  g_strfreev (archives);
+
+  return exit_status;
+}
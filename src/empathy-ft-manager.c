@@ -34,12 +34,16 @@
 #include <tp-account-widgets/tpaw-builder.h>
 
 #include "empathy-geometry.h"
+#include "empathy-gsettings.h"
 #include "empathy-ui-utils.h"
 #include "empathy-utils.h"
 
 #define DEBUG_FLAG EMPATHY_DEBUG_FT
 #include "empathy-debug.h"
 
+/* how often the progress of the transfers is shown, in milliseconds */
+#define PROGRESS_REFRESH_INTERVAL 500
+
 enum
 {
   COL_PERCENT,
@@ -49,10 +53,31 @@ enum
   COL_FT_OBJECT
 };
 
+/* An outgoing or incoming transfer which has been started */
+typedef struct {
+  gchar *account_path;
+  gchar *contact_id;
+  /* TRUE until the outgoing file has been hashed */
+  gboolean hashing;
+} ActiveTransfer;
+
 typedef struct {
   GtkTreeModel *model;
   GHashTable *ft_handler_to_row_ref;
 
+  /* Outgoing EmpathyFTHandler waiting for the limits of
+   * org.gnome.Empathy's file-transfer-max-* keys to let them start, in the
+   * order they will be started. */
+  GQueue queue;
+  /* owned EmpathyFTHandler -> owned ActiveTransfer */
+  GHashTable *active;
+  GSettings *gsettings;
+
+  /* set of owned EmpathyFTHandler which made progress since the list was
+   * last refreshed */
+  GHashTable *progressed;
+  guint refresh_id;
+
   /* Widgets */
   GtkWidget *window;
   GtkWidget *treeview;
@@ -77,6 +102,7 @@ static EmpathyFTManager *manager_singleton = NULL;
 
 static void ft_handler_hashing_started_cb (EmpathyFTHandler *handler,
     EmpathyFTManager *manager);
+static void ft_manager_schedule (EmpathyFTManager *manager);
 
 static gchar *
 ft_manager_format_interval (guint interval)
@@ -441,9 +467,13 @@ ft_handler_transfer_error_cb (EmpathyFTHandler *handler,
 {
   char *message;
   GtkTreeRowReference *row_ref;
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
 
   DEBUG ("Transfer error %s", error->message);
 
+  /* don't let a pending refresh overwrite the error */
+  g_hash_table_remove (priv->progressed, handler);
+
   row_ref = ft_manager_get_row_from_handler (manager, handler);
   g_return_if_fail (row_ref != NULL);
 
@@ -515,6 +545,10 @@ ft_handler_transfer_done_cb (EmpathyFTHandler *handler,
                              TpFileTransferChannel *channel,
                              EmpathyFTManager *manager)
 {
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+
+  g_hash_table_remove (priv->progressed, handler);
+
   if (empathy_ft_handler_is_incoming (handler) &&
       empathy_ft_handler_get_use_hash (handler))
     {
@@ -533,31 +567,29 @@ ft_handler_transfer_done_cb (EmpathyFTHandler *handler,
 }
 
 static void
-ft_handler_transfer_progress_cb (EmpathyFTHandler *handler,
-                                 guint64 current_bytes,
-                                 guint64 total_bytes,
-                                 guint remaining_time,
-                                 gdouble speed,
-                                 EmpathyFTManager *manager)
+ft_manager_show_transfer_progress (EmpathyFTManager *manager,
+                                   EmpathyFTHandler *handler)
 {
   char *first_line, *second_line, *message;
   int percentage;
+  guint remaining_time;
   GtkTreeRowReference *row_ref;
 
-  DEBUG ("Transfer progress");
-
   row_ref = ft_manager_get_row_from_handler (manager, handler);
   g_return_if_fail (row_ref != NULL);
 
   first_line = ft_manager_format_contact_info (handler);
   second_line = ft_manager_format_progress_bytes_and_percentage
-    (current_bytes, total_bytes, speed, &percentage);
+    (empathy_ft_handler_get_transferred_bytes (handler),
+     empathy_ft_handler_get_total_bytes (handler),
+     empathy_ft_handler_get_speed (handler), &percentage);
 
   message = g_strdup_printf ("%s\n%s", first_line, second_line);
 
   ft_manager_update_handler_message (manager, row_ref, message);
   ft_manager_update_handler_progress (manager, row_ref, percentage);
 
+  remaining_time = empathy_ft_handler_get_remaining_time (handler);
   if (remaining_time > 0)
     ft_manager_update_handler_time (manager, row_ref, remaining_time);
 
@@ -566,13 +598,55 @@ ft_handler_transfer_progress_cb (EmpathyFTHandler *handler,
   g_free (second_line);
 }
 
+static gboolean
+ft_manager_refresh_progress_cb (gpointer user_data)
+{
+  EmpathyFTManager *manager = user_data;
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  GHashTableIter iter;
+  gpointer handler;
+
+  /* stop until some progress is made again */
+  if (g_hash_table_size (priv->progressed) == 0)
+    {
+      priv->refresh_id = 0;
+      return FALSE;
+    }
+
+  g_hash_table_iter_init (&iter, priv->progressed);
+  while (g_hash_table_iter_next (&iter, &handler, NULL))
+    ft_manager_show_transfer_progress (manager, handler);
+
+  g_hash_table_remove_all (priv->progressed);
+
+  return TRUE;
+}
+
+/* The CM can report progress many times per second; the list is only
+ * refreshed a few times per second, with the latest values */
+static void
+ft_handler_transfer_progress_cb (EmpathyFTHandler *handler,
+                                 guint64 current_bytes,
+                                 guint64 total_bytes,
+                                 guint remaining_time,
+                                 gdouble speed,
+                                 EmpathyFTManager *manager)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+
+  if (!g_hash_table_contains (priv->progressed, handler))
+    g_hash_table_add (priv->progressed, g_object_ref (handler));
+
+  if (priv->refresh_id == 0)
+    priv->refresh_id = g_timeout_add (PROGRESS_REFRESH_INTERVAL,
+        ft_manager_refresh_progress_cb, manager);
+}
+
 static void
 ft_handler_transfer_started_cb (EmpathyFTHandler *handler,
                                 TpFileTransferChannel *channel,
                                 EmpathyFTManager *manager)
 {
-  guint64 transferred_bytes, total_bytes;
-
   DEBUG ("Transfer started");
 
   g_signal_connect (handler, "transfer-progress",
@@ -580,11 +654,7 @@ ft_handler_transfer_started_cb (EmpathyFTHandler *handler,
   g_signal_connect (handler, "transfer-done",
       G_CALLBACK (ft_handler_transfer_done_cb), manager);
 
-  transferred_bytes = empathy_ft_handler_get_transferred_bytes (handler);
-  total_bytes = empathy_ft_handler_get_total_bytes (handler);
-
-  ft_handler_transfer_progress_cb (handler, transferred_bytes, total_bytes,
-      0, -1, manager);
+  ft_manager_show_transfer_progress (manager, handler);
 }
 
 static void
@@ -686,10 +756,68 @@ ft_handler_hashing_started_cb (EmpathyFTHandler *handler,
   g_free (message);
 }
 
+static void
+active_transfer_free (ActiveTransfer *transfer)
+{
+  g_free (transfer->account_path);
+  g_free (transfer->contact_id);
+  g_slice_free (ActiveTransfer, transfer);
+}
+
+static void
+ft_manager_transfer_finished (EmpathyFTManager *manager,
+                              EmpathyFTHandler *handler)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+
+  if (!g_hash_table_remove (priv->active, handler))
+    return;
+
+  DEBUG ("%u transfers left", g_hash_table_size (priv->active));
+
+  ft_manager_schedule (manager);
+}
+
+static void
+scheduler_transfer_done_cb (EmpathyFTHandler *handler,
+                            TpFileTransferChannel *channel,
+                            EmpathyFTManager *manager)
+{
+  ft_manager_transfer_finished (manager, handler);
+}
+
+static void
+scheduler_transfer_error_cb (EmpathyFTHandler *handler,
+                             GError *error,
+                             EmpathyFTManager *manager)
+{
+  ft_manager_transfer_finished (manager, handler);
+}
+
+static void
+scheduler_hashing_done_cb (EmpathyFTHandler *handler,
+                           EmpathyFTManager *manager)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  ActiveTransfer *transfer;
+
+  /* Incoming transfers are hashed once they are done, and have already
+   * left the active ones */
+  transfer = g_hash_table_lookup (priv->active, handler);
+  if (transfer == NULL || !transfer->hashing)
+    return;
+
+  transfer->hashing = FALSE;
+  ft_manager_schedule (manager);
+}
+
 static void
 ft_manager_start_transfer (EmpathyFTManager *manager,
                            EmpathyFTHandler *handler)
 {
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  EmpathyContact *contact;
+  ActiveTransfer *transfer;
   gboolean is_outgoing;
 
   is_outgoing = !empathy_ft_handler_is_incoming (handler);
@@ -697,13 +825,30 @@ ft_manager_start_transfer (EmpathyFTManager *manager,
   DEBUG ("Start transfer, is outgoing %s",
       is_outgoing ? "True" : "False");
 
+  contact = empathy_ft_handler_get_contact (handler);
+
+  transfer = g_slice_new0 (ActiveTransfer);
+  transfer->account_path = g_strdup (tp_proxy_get_object_path (
+        empathy_contact_get_account (contact)));
+  transfer->contact_id = g_strdup (empathy_contact_get_id (contact));
+  transfer->hashing = is_outgoing && empathy_ft_handler_get_use_hash (handler);
+
+  g_hash_table_insert (priv->active, g_object_ref (handler), transfer);
+
   /* now connect the signals */
   g_signal_connect (handler, "transfer-error",
       G_CALLBACK (ft_handler_transfer_error_cb), manager);
 
+  g_signal_connect (handler, "transfer-done",
+      G_CALLBACK (scheduler_transfer_done_cb), manager);
+  g_signal_connect (handler, "transfer-error",
+      G_CALLBACK (scheduler_transfer_error_cb), manager);
+
   if (is_outgoing && empathy_ft_handler_get_use_hash (handler)) {
     g_signal_connect (handler, "hashing-started",
         G_CALLBACK (ft_handler_hashing_started_cb), manager);
+    g_signal_connect (handler, "hashing-done",
+        G_CALLBACK (scheduler_hashing_done_cb), manager);
   } else {
     /* either incoming or outgoing without hash */
     g_signal_connect (handler, "transfer-started",
@@ -713,6 +858,176 @@ ft_manager_start_transfer (EmpathyFTManager *manager,
   empathy_ft_handler_start_transfer (handler);
 }
 
+static void
+ft_manager_update_queued_messages (EmpathyFTManager *manager)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  GList *l;
+  guint position = 0;
+
+  for (l = priv->queue.head; l != NULL; l = l->next, position++)
+    {
+      EmpathyFTHandler *handler = l->data;
+      GtkTreeRowReference *row_ref;
+      char *first_line, *second_line, *message;
+
+      row_ref = ft_manager_get_row_from_handler (manager, handler);
+      if (row_ref == NULL)
+        continue;
+
+      first_line = ft_manager_format_contact_info (handler);
+
+      if (position == 0)
+        second_line = g_strdup (_("Queued, will be sent next"));
+      else
+        second_line = g_strdup_printf (ngettext (
+              "Queued behind %u other file", "Queued behind %u other files",
+              position), position);
+
+      message = g_strdup_printf ("%s\n%s", first_line, second_line);
+      ft_manager_update_handler_message (manager, row_ref, message);
+
+      g_free (message);
+      g_free (first_line);
+      g_free (second_line);
+    }
+}
+
+static gboolean
+ft_manager_can_start (EmpathyFTManager *manager,
+                      EmpathyFTHandler *handler)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  EmpathyContact *contact;
+  const gchar *account_path, *contact_id;
+  guint max_hashing, max_per_contact, max_per_account;
+  guint n_hashing = 0, n_contact = 0, n_account = 0;
+  GHashTableIter iter;
+  gpointer value;
+
+  contact = empathy_ft_handler_get_contact (handler);
+  account_path = tp_proxy_get_object_path (
+      empathy_contact_get_account (contact));
+  contact_id = empathy_contact_get_id (contact);
+
+  /* There are never more than a handful of active transfers */
+  g_hash_table_iter_init (&iter, priv->active);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      ActiveTransfer *transfer = value;
+
+      if (transfer->hashing)
+        n_hashing++;
+
+      if (tp_strdiff (transfer->account_path, account_path))
+        continue;
+
+      n_account++;
+
+      if (!tp_strdiff (transfer->contact_id, contact_id))
+        n_contact++;
+    }
+
+  /* 0 means no limit */
+  max_hashing = g_settings_get_uint (priv->gsettings,
+      EMPATHY_PREFS_FILE_TRANSFER_MAX_HASHING);
+  max_per_contact = g_settings_get_uint (priv->gsettings,
+      EMPATHY_PREFS_FILE_TRANSFER_MAX_PER_CONTACT);
+  max_per_account = g_settings_get_uint (priv->gsettings,
+      EMPATHY_PREFS_FILE_TRANSFER_MAX_PER_ACCOUNT);
+
+  if (max_hashing > 0 && n_hashing >= max_hashing &&
+      empathy_ft_handler_get_use_hash (handler))
+    return FALSE;
+
+  if (max_per_contact > 0 && n_contact >= max_per_contact)
+    return FALSE;
+
+  if (max_per_account > 0 && n_account >= max_per_account)
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Starts the queued transfers the limits allow, first come first served
+ * unless the user moved some of them. A transfer which can't start doesn't
+ * block the ones behind it, going to another contact or not needing to be
+ * hashed. */
+static void
+ft_manager_schedule (EmpathyFTManager *manager)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  gboolean started;
+
+  do
+    {
+      GList *l;
+
+      started = FALSE;
+
+      for (l = priv->queue.head; l != NULL; l = l->next)
+        {
+          EmpathyFTHandler *handler = l->data;
+
+          if (!ft_manager_can_start (manager, handler))
+            continue;
+
+          DEBUG ("Starting queued transfer of %s",
+              empathy_ft_handler_get_filename (handler));
+
+          g_queue_delete_link (&priv->queue, l);
+
+          /* Starting the transfer may finish another one and reenter this
+           * function, so look at the queue again from the start */
+          ft_manager_start_transfer (manager, handler);
+          g_object_unref (handler);
+
+          started = TRUE;
+          break;
+        }
+    }
+  while (started);
+
+  ft_manager_update_queued_messages (manager);
+}
+
+static void
+ft_manager_move_selected (EmpathyFTManager *manager,
+                          gboolean first)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  GtkTreeSelection *selection;
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  EmpathyFTHandler *handler;
+  GList *l;
+
+  selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (priv->treeview));
+
+  if (!gtk_tree_selection_get_selected (selection, &model, &iter))
+    return;
+
+  gtk_tree_model_get (model, &iter, COL_FT_OBJECT, &handler, -1);
+
+  l = g_queue_find (&priv->queue, handler);
+  if (l != NULL)
+    {
+      DEBUG ("Moving %s to the %s of the queue",
+          empathy_ft_handler_get_filename (handler), first ? "head" : "tail");
+
+      g_queue_unlink (&priv->queue, l);
+
+      if (first)
+        g_queue_push_head_link (&priv->queue, l);
+      else
+        g_queue_push_tail_link (&priv->queue, l);
+
+      ft_manager_update_queued_messages (manager);
+    }
+
+  g_object_unref (handler);
+}
+
 static void
 ft_manager_add_handler_to_list (EmpathyFTManager *manager,
                                 EmpathyFTHandler *handler,
@@ -780,8 +1095,17 @@ ft_manager_add_handler_to_list (EmpathyFTManager *manager,
     g_free (message);
   }
 
-  /* hook up the signals and start the transfer */
-  ft_manager_start_transfer (manager, handler);
+  /* incoming transfers have already been accepted by the user, so start
+   * them right away; outgoing ones wait for their turn */
+  if (empathy_ft_handler_is_incoming (handler))
+    {
+      ft_manager_start_transfer (manager, handler);
+    }
+  else
+    {
+      g_queue_push_tail (&priv->queue, g_object_ref (handler));
+      ft_manager_schedule (manager);
+    }
 }
 
 static void
@@ -857,6 +1181,29 @@ ft_manager_stop (EmpathyFTManager *manager)
 
   empathy_ft_handler_cancel_transfer (handler);
 
+  /* nothing is running yet, so the handler won't report the cancellation */
+  if (g_queue_remove (&priv->queue, handler))
+    {
+      GtkTreeRowReference *row_ref;
+      char *first_line, *message;
+
+      row_ref = ft_manager_get_row_from_handler (manager, handler);
+
+      first_line = ft_manager_format_contact_info (handler);
+      message = g_strdup_printf ("%s\n%s", first_line,
+          _("File transfer cancelled"));
+      ft_manager_update_handler_message (manager, row_ref, message);
+
+      g_free (first_line);
+      g_free (message);
+
+      /* drop the queue's reference */
+      g_object_unref (handler);
+
+      ft_manager_update_queued_messages (manager);
+      ft_manager_update_buttons (manager);
+    }
+
   g_object_unref (handler);
 }
 
@@ -929,18 +1276,91 @@ ft_manager_destroy_cb (GtkWidget *widget,
   g_object_unref (manager);
 }
 
+static void
+ft_manager_send_first_activate_cb (GtkMenuItem *item,
+                                   EmpathyFTManager *manager)
+{
+  ft_manager_move_selected (manager, TRUE);
+}
+
+static void
+ft_manager_send_last_activate_cb (GtkMenuItem *item,
+                                  EmpathyFTManager *manager)
+{
+  ft_manager_move_selected (manager, FALSE);
+}
+
+static void
+ft_manager_show_queue_menu (EmpathyFTManager *manager,
+                            EmpathyFTHandler *handler,
+                            GdkEventButton *event)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  GtkWidget *menu, *item;
+  GtkMenuShell *shell;
+
+  menu = empathy_context_menu_new (priv->treeview);
+  shell = GTK_MENU_SHELL (menu);
+
+  item = gtk_menu_item_new_with_mnemonic (_("Send _First"));
+  gtk_widget_set_sensitive (item, priv->queue.head->data != handler);
+  g_signal_connect (item, "activate",
+      G_CALLBACK (ft_manager_send_first_activate_cb), manager);
+  gtk_menu_shell_append (shell, item);
+  gtk_widget_show (item);
+
+  item = gtk_menu_item_new_with_mnemonic (_("Send _Last"));
+  gtk_widget_set_sensitive (item, priv->queue.tail->data != handler);
+  g_signal_connect (item, "activate",
+      G_CALLBACK (ft_manager_send_last_activate_cb), manager);
+  gtk_menu_shell_append (shell, item);
+  gtk_widget_show (item);
+
+  gtk_menu_popup (GTK_MENU (menu), NULL, NULL, NULL, NULL,
+      event->button, event->time);
+}
+
 static gboolean
 ft_view_button_press_event_cb (GtkWidget *widget,
-                               GdkEventKey *event,
+                               GdkEventButton *event,
                                EmpathyFTManager *manager)
 {
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  GtkTreePath *path;
+  GtkTreeIter iter;
+  EmpathyFTHandler *handler;
+  gboolean queued;
 
-  if (event->type != GDK_2BUTTON_PRESS)
+  if (event->type == GDK_2BUTTON_PRESS)
+    {
+      ft_manager_open (manager);
       return FALSE;
+    }
 
-  ft_manager_open (manager);
+  if (event->type != GDK_BUTTON_PRESS || event->button != 3)
+    return FALSE;
 
-  return FALSE;
+  /* queued transfers can be reordered from their context menu */
+  if (!gtk_tree_view_get_path_at_pos (GTK_TREE_VIEW (widget),
+        event->x, event->y, &path, NULL, NULL, NULL))
+    return FALSE;
+
+  gtk_tree_model_get_iter (priv->model, &iter, path);
+  gtk_tree_path_free (path);
+
+  gtk_tree_model_get (priv->model, &iter, COL_FT_OBJECT, &handler, -1);
+
+  queued = (g_queue_find (&priv->queue, handler) != NULL);
+  if (queued)
+    {
+      gtk_tree_selection_select_iter (
+          gtk_tree_view_get_selection (GTK_TREE_VIEW (widget)), &iter);
+      ft_manager_show_queue_menu (manager, handler, event);
+    }
+
+  g_object_unref (handler);
+
+  return queued;
 }
 
 static gboolean
@@ -1077,6 +1497,15 @@ empathy_ft_manager_finalize (GObject *object)
   DEBUG ("FT Manager %p", object);
 
   g_hash_table_unref (priv->ft_handler_to_row_ref);
+  g_queue_foreach (&priv->queue, (GFunc) g_object_unref, NULL);
+  g_queue_clear (&priv->queue);
+  g_hash_table_unref (priv->active);
+  g_object_unref (priv->gsettings);
+
+  if (priv->refresh_id != 0)
+    g_source_remove (priv->refresh_id);
+
+  g_hash_table_unref (priv->progressed);
 
   G_OBJECT_CLASS (empathy_ft_manager_parent_class)->finalize (object);
 }
@@ -1095,6 +1524,25 @@ empathy_ft_manager_init (EmpathyFTManager *manager)
       g_direct_equal, (GDestroyNotify) g_object_unref,
       (GDestroyNotify) gtk_tree_row_reference_free);
 
+  g_queue_init (&priv->queue);
+  priv->active = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      (GDestroyNotify) g_object_unref, (GDestroyNotify) active_transfer_free);
+
+  priv->progressed = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      (GDestroyNotify) g_object_unref, NULL);
+
+  /* start whatever the new limits let through */
+  priv->gsettings = g_settings_new (EMPATHY_PREFS_SCHEMA);
+  g_signal_connect_swapped (priv->gsettings,
+      "changed::" EMPATHY_PREFS_FILE_TRANSFER_MAX_HASHING,
+      G_CALLBACK (ft_manager_schedule), manager);
+  g_signal_connect_swapped (priv->gsettings,
+      "changed::" EMPATHY_PREFS_FILE_TRANSFER_MAX_PER_CONTACT,
+      G_CALLBACK (ft_manager_schedule), manager);
+  g_signal_connect_swapped (priv->gsettings,
+      "changed::" EMPATHY_PREFS_FILE_TRANSFER_MAX_PER_ACCOUNT,
+      G_CALLBACK (ft_manager_schedule), manager);
+
   ft_manager_build_ui (manager);
 }
 
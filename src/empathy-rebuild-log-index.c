@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Indexes all the text logs again, for instance if the index got
+ * corrupted or logs have been copied from another computer. */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <glib/gi18n.h>
+
+#include "empathy-log-index.h"
+#include "empathy-utils.h"
+
+static gchar *directory = NULL;
+static gboolean update_only = FALSE;
+
+static GOptionEntry entries[] =
+{
+  { "directory", 'd', 0, G_OPTION_ARG_FILENAME, &directory,
+    N_("Store the index in DIR instead of the default location"), "DIR" },
+  { "update", 'u', 0, G_OPTION_ARG_NONE, &update_only,
+    N_("Only index the logs written since the last update"), NULL },
+  { NULL }
+};
+
+static GMainLoop *loop = NULL;
+static gint exit_status = EXIT_SUCCESS;
+static gint64 start_time;
+
+static void
+update_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *index = EMPATHY_LOG_INDEX (source);
+  guint n_targets, n_dates, n_words;
+  GError *error = NULL;
+
+  if (!empathy_log_index_update_finish (index, result, &error))
+    {
+      g_printerr ("Failed to index the logs: %s\n", error->message);
+      g_error_free (error);
+      exit_status = EXIT_FAILURE;
+      goto out;
+    }
+
+  empathy_log_index_get_stats (index, &n_targets, &n_dates, &n_words);
+
+  g_print ("Indexed %u words used with %u contacts and rooms over %u "
+      "conversation days in %.1f s\n", n_words, n_targets, n_dates,
+      (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC);
+
+out:
+  g_main_loop_quit (loop);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  EmpathyLogIndex *index;
+  GError *error = NULL;
+
+  empathy_init ();
+
+  context = g_option_context_new (N_("- rebuild the conversation logs index"));
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\nRun '%s --help' to see a full list of available "
+          "command line options.\n", error->message, argv[0]);
+      g_error_free (error);
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free (context);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  index = empathy_log_index_new (directory);
+
+  start_time = g_get_monotonic_time ();
+  empathy_log_index_update_async (index, !update_only, NULL, update_cb,
+      NULL);
+
+  g_main_loop_run (loop);
+
+  g_object_unref (index);
+  g_main_loop_unref (loop);
+  g_free (directory);
+
+  return exit_status;
+}
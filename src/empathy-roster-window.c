@@ -1036,6 +1036,9 @@ empathy_roster_window_finalize (GObject *window)
   g_object_unref (self->priv->chatroom_manager);
 
   g_object_unref (self->priv->gsettings_ui);
+
+  g_object_set (self->priv->individual_manager,
+      "batch-members-changed", FALSE, NULL);
   g_object_unref (self->priv->individual_manager);
 
   g_object_unref (self->priv->menumodel);
@@ -1969,6 +1972,9 @@ static void
 contacts_loaded_cb (EmpathyIndividualManager *manager,
     EmpathyRosterWindow *self)
 {
+  /* The manager is shared: only batch its changes while loading */
+  g_object_set (manager, "batch-members-changed", FALSE, NULL);
+
   set_notebook_page (self);
 }
 
@@ -2391,6 +2397,13 @@ empathy_roster_window_init (EmpathyRosterWindow *self)
 
   self->priv->individual_manager = empathy_individual_manager_dup_singleton ();
 
+  /* Populate the roster with a few large changes rather than one per change
+   * of the aggregator while it's loading. */
+  if (!empathy_individual_manager_get_contacts_loaded (
+        self->priv->individual_manager))
+    g_object_set (self->priv->individual_manager,
+        "batch-members-changed", TRUE, NULL);
+
   model = EMPATHY_ROSTER_MODEL (empathy_roster_model_manager_new (self->priv->individual_manager));
 
   tp_g_signal_connect_object (self->priv->individual_manager,
@@ -40,6 +40,8 @@
 #include "empathy-ft-manager.h"
 #include "empathy-gsettings.h"
 #include "empathy-location-manager.h"
+#include "empathy-log-catalog.h"
+#include "empathy-log-index.h"
 #include "empathy-notifications-approver.h"
 #include "empathy-presence-manager.h"
 #include "empathy-request-util.h"
@@ -90,6 +92,8 @@ struct _EmpathyApp
   EmpathyStatusIcon *icon;
   TpAccountManager *account_manager;
   TplLogManager *log_manager;
+  EmpathyLogCatalog *log_catalog;
+  EmpathyLogIndex *log_index;
   EmpathyChatroomManager *chatroom_manager;
   EmpathyFTFactory  *ft_factory;
   EmpathyPresenceManager *presence_mgr;
@@ -133,6 +137,8 @@ empathy_app_dispose (GObject *object)
   tp_clear_object (&self->icon);
   tp_clear_object (&self->account_manager);
   tp_clear_object (&self->log_manager);
+  tp_clear_object (&self->log_catalog);
+  tp_clear_object (&self->log_index);
   tp_clear_object (&self->chatroom_manager);
 #ifdef HAVE_GEOCLUE
   tp_clear_object (&self->location_manager);
@@ -773,6 +779,11 @@ empathy_app_constructed (GObject *object)
 
   /* Logging */
   self->log_manager = tpl_log_manager_dup_singleton ();
+  /* Lists which contacts have logs once, for the contact menus */
+  self->log_catalog = empathy_log_catalog_dup_singleton ();
+  /* Keeps the search index up to date, even with the log window closed */
+  self->log_index = empathy_log_index_dup_singleton ();
+  empathy_log_index_observe_messages (self->log_index);
 
   self->chatroom_manager = empathy_chatroom_manager_dup_singleton (NULL);
 
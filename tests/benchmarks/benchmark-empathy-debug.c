@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Runs code paths calling DEBUG() a lot, like the roster and message
+ * handling do, and measures what each call costs when nothing listens to
+ * the debug messages and when a debugger does. */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "empathy-utils.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_CONTACT
+#include "empathy-debug.h"
+
+static gint n_iterations = 1000000;
+static gint max_ns = 0;
+
+static GOptionEntry entries[] =
+{
+  { "iterations", 'i', 0, G_OPTION_ARG_INT, &n_iterations,
+    "Number of times each path is run (default: 1000000)", "N" },
+  { "max-ns", 0, 0, G_OPTION_ARG_INT, &max_ns,
+    "Fail if a DEBUG() nobody listens to takes longer than NS nanoseconds",
+    "NS" },
+  { NULL }
+};
+
+static const gchar *ids[] = { "alice@example.com", "bob@example.com",
+    "carol@example.com", "dave@example.com" };
+
+static const gchar *statuses[] = { "available", "away", "busy", "offline" };
+
+static guint
+update_presence (guint i)
+{
+  const gchar *id = ids[i % G_N_ELEMENTS (ids)];
+  const gchar *status = statuses[i % G_N_ELEMENTS (statuses)];
+
+  DEBUG ("Presence changed for %s: %s (%u)", id, status, i % 7);
+  DEBUG ("Contact %s is %s online", id, i % 2 ? "now" : "no longer");
+
+  return i % 7;
+}
+
+static guint
+receive_message (guint i)
+{
+  const gchar *id = ids[i % G_N_ELEMENTS (ids)];
+
+  DEBUG ("Message %u received from %s, %u bytes, pending: %s", i, id,
+      40 + i % 100, i % 3 ? "yes" : "no");
+
+  return i % 3;
+}
+
+static gdouble
+run (const gchar *name)
+{
+  gint64 start;
+  guint i, sum = 0;
+  gdouble ns;
+
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < (guint) n_iterations; i++)
+    {
+      sum += update_presence (i);
+      sum += receive_message (i);
+    }
+
+  /* 3 DEBUG() per iteration */
+  ns = (g_get_monotonic_time () - start) * 1000.0 / (3.0 * n_iterations);
+  g_print ("%-32s %10.1f ns per DEBUG() (%u)\n", name, ns, sum);
+
+  return ns;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  TpDebugSender *sender;
+  GError *error = NULL;
+  gboolean failed = FALSE;
+  gdouble ns;
+
+  context = g_option_context_new ("- benchmark the DEBUG() macro");
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("option parsing failed: %s\n", error->message);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+#ifndef ENABLE_DEBUG
+  g_printerr ("Debugging is disabled, skipping\n");
+  return 77;
+#endif
+
+  /* Ignore EMPATHY_DEBUG: the benchmark is about the messages nobody
+   * looks at */
+  g_unsetenv ("EMPATHY_DEBUG");
+  empathy_init ();
+
+  ns = run ("no debugger");
+
+  if (max_ns > 0 && ns > max_ns)
+    {
+      g_printerr ("DEBUG() took longer than %d ns with no debugger\n",
+          max_ns);
+      failed = TRUE;
+    }
+
+  /* What the debug window does when it starts listening */
+  sender = tp_debug_sender_dup ();
+  g_object_set (sender, "enabled", TRUE, NULL);
+
+  run ("debugger listening");
+
+  g_object_set (sender, "enabled", FALSE, NULL);
+  g_object_unref (sender);
+
+  empathy_debug_free ();
+
+  return failed ? 1 : 0;
+}
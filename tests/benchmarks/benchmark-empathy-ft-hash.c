@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Hashes a big file the way EmpathyFTHandler does before offering it, and
+ * measures the throughput and how many times the main loop is woken up to
+ * report the progress. The file is written just before being hashed, so it
+ * is most likely read from the page cache: this measures the hashing
+ * pipeline, not the disk. */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <glib/gstdio.h>
+
+#include "empathy-ft-hash.h"
+
+#define WRITE_BUFFER_SIZE (1024 * 1024)
+
+static gint size_mb = 1024;
+static gint max_wakeups_per_s = 0;
+
+static GOptionEntry entries[] =
+{
+  { "size", 's', 0, G_OPTION_ARG_INT, &size_mb,
+    "Size of the file to hash, in MiB (default: 1024)", "MB" },
+  { "max-wakeups", 0, 0, G_OPTION_ARG_INT, &max_wakeups_per_s,
+    "Fail if the progress wakes up the main loop more than N times per "
+    "second", "N" },
+  { NULL }
+};
+
+static GMainLoop *loop = NULL;
+static guint n_wakeups = 0;
+static guint64 hashed_bytes = 0;
+static gboolean failed = FALSE;
+
+static gchar *
+create_file (void)
+{
+  GError *error = NULL;
+  guint32 *buffer;
+  GRand *rand;
+  gchar *path;
+  FILE *file;
+  gint fd, i;
+  guint j;
+
+  fd = g_file_open_tmp ("empathy-ft-hash-XXXXXX", &path, &error);
+  g_assert_no_error (error);
+
+  file = fdopen (fd, "w");
+  g_assert (file != NULL);
+
+  rand = g_rand_new_with_seed (42);
+  buffer = g_malloc (WRITE_BUFFER_SIZE);
+
+  for (i = 0; i < size_mb; i++)
+    {
+      for (j = 0; j < WRITE_BUFFER_SIZE / sizeof (guint32); j++)
+        buffer[j] = g_rand_int (rand);
+
+      if (fwrite (buffer, WRITE_BUFFER_SIZE, 1, file) != 1)
+        g_error ("Failed to write %s", path);
+    }
+
+  fclose (file);
+  g_free (buffer);
+  g_rand_free (rand);
+
+  return path;
+}
+
+static void
+progress_cb (guint64 bytes,
+    gpointer user_data)
+{
+  n_wakeups++;
+}
+
+static void
+hash_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GError *error = NULL;
+
+  if (!empathy_ft_hash_finish (result, &hashed_bytes, &error))
+    {
+      g_printerr ("Failed to hash the file: %s\n", error->message);
+      g_error_free (error);
+      failed = TRUE;
+    }
+
+  g_main_loop_quit (loop);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GFileInputStream *stream;
+  GChecksum *checksum;
+  GFile *file;
+  GError *error = NULL;
+  gchar *path;
+  gint64 start;
+  gdouble seconds;
+
+  context = g_option_context_new ("- benchmark the file transfer hashing");
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("option parsing failed: %s\n", error->message);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  g_print ("Writing a %d MiB file\n", size_mb);
+  path = create_file ();
+
+  file = g_file_new_for_path (path);
+  stream = g_file_read (file, NULL, &error);
+  g_assert_no_error (error);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  checksum = g_checksum_new (G_CHECKSUM_MD5);
+
+  start = g_get_monotonic_time ();
+  empathy_ft_hash_async (G_INPUT_STREAM (stream), checksum, G_MAXUINT64,
+      NULL, progress_cb, hash_cb, NULL);
+  g_main_loop_run (loop);
+  seconds = (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC;
+
+  g_print ("%" G_GUINT64_FORMAT " bytes hashed in %.2f s: %.1f MB/s\n",
+      hashed_bytes, seconds, hashed_bytes / seconds / 1000000);
+  g_print ("%u main loop wakeups, %.1f per second\n", n_wakeups,
+      n_wakeups / seconds);
+  g_print ("MD5: %s\n", g_checksum_get_string (checksum));
+
+  if (hashed_bytes != (guint64) size_mb * 1024 * 1024)
+    {
+      g_printerr ("Only %" G_GUINT64_FORMAT " bytes have been hashed\n",
+          hashed_bytes);
+      failed = TRUE;
+    }
+
+  if (max_wakeups_per_s > 0 && n_wakeups / seconds > max_wakeups_per_s)
+    {
+      g_printerr ("More than %d wakeups per second\n", max_wakeups_per_s);
+      failed = TRUE;
+    }
+
+  g_checksum_free (checksum);
+  g_object_unref (stream);
+  g_object_unref (file);
+  g_main_loop_unref (loop);
+
+  g_unlink (path);
+  g_free (path);
+
+  return failed ? 1 : 0;
+}
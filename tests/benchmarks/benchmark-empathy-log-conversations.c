@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Groups a synthetic day of log events into conversations, the way the
+ * log window does when showing them, and measures how long it takes with
+ * EmpathyLogConversations and with a walk of the top-level rows. */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "empathy-log-conversations.h"
+
+#define MAX_GAP (30 * 60)
+#define SECONDS_PER_DAY (24 * 3600)
+
+enum
+{
+  COL_TS,
+  COL_KEY,
+  COL_TEXT,
+  N_COLUMNS
+};
+
+static gint n_messages = 50000;
+static gint n_contacts = 20;
+static gboolean linear = FALSE;
+static gint max_ms = 0;
+
+static GOptionEntry entries[] =
+{
+  { "messages", 'n', 0, G_OPTION_ARG_INT, &n_messages,
+    "Messages in the day (default: 50000)", "N" },
+  { "contacts", 'c', 0, G_OPTION_ARG_INT, &n_contacts,
+    "Contacts talked with (default: 20)", "N" },
+  { "linear", 0, 0, G_OPTION_ARG_NONE, &linear,
+    "Also measure the walk of all the conversations, for comparison", NULL },
+  { "max-ms", 0, 0, G_OPTION_ARG_INT, &max_ms,
+    "Fail if grouping takes longer than MS milliseconds", "MS" },
+  { NULL }
+};
+
+typedef struct
+{
+  gint64 timestamp;
+  const gchar *key;
+} Event;
+
+static GtkTreeStore *
+create_store (void)
+{
+  GtkTreeStore *store;
+
+  store = gtk_tree_store_new (N_COLUMNS, G_TYPE_INT64, G_TYPE_STRING,
+      G_TYPE_STRING);
+
+  /* Same as the log window */
+  gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (store),
+      COL_TS, GTK_SORT_ASCENDING);
+
+  return store;
+}
+
+/* Events are spread over the day in bursts, so each contact ends up with a
+ * few conversations separated by more than MAX_GAP */
+static Event *
+create_events (gchar **keys,
+    GRand *rand)
+{
+  Event *events;
+  gint64 timestamp = 0;
+  gint i, contact = 0;
+
+  events = g_new (Event, n_messages);
+
+  for (i = 0; i < n_messages; i++)
+    {
+      if (g_rand_int_range (rand, 0, 200) == 0)
+        contact = g_rand_int_range (rand, 0, n_contacts);
+
+      timestamp += g_rand_int_range (rand, 0,
+          2 * SECONDS_PER_DAY / n_messages + 1);
+
+      events[i].timestamp = MIN (timestamp, SECONDS_PER_DAY - 1);
+      events[i].key = keys[contact];
+    }
+
+  return events;
+}
+
+static void
+append_event (GtkTreeStore *store,
+    GtkTreeIter *parent,
+    Event *event)
+{
+  gtk_tree_store_insert_with_values (store, NULL, parent, -1,
+      COL_TS, event->timestamp,
+      COL_KEY, event->key,
+      COL_TEXT, "Lorem ipsum dolor sit amet",
+      -1);
+}
+
+static void
+append_conversation (GtkTreeStore *store,
+    GtkTreeIter *iter,
+    Event *event)
+{
+  gtk_tree_store_insert_with_values (store, iter, NULL, -1,
+      COL_TS, event->timestamp,
+      COL_KEY, event->key,
+      COL_TEXT, "Conversation",
+      -1);
+}
+
+static guint
+group_indexed (GtkTreeStore *store,
+    Event *events)
+{
+  EmpathyLogConversations *conversations;
+  guint n_conversations = 0;
+  gint i;
+
+  conversations = empathy_log_conversations_new (MAX_GAP);
+
+  for (i = 0; i < n_messages; i++)
+    {
+      GtkTreeIter parent;
+
+      if (!empathy_log_conversations_extend (conversations, events[i].key,
+            events[i].timestamp, &parent))
+        {
+          append_conversation (store, &parent, &events[i]);
+          empathy_log_conversations_add (conversations, events[i].key,
+              events[i].timestamp, &parent);
+          n_conversations++;
+        }
+
+      append_event (store, &parent, &events[i]);
+    }
+
+  empathy_log_conversations_free (conversations);
+
+  return n_conversations;
+}
+
+/* What the log window used to do */
+static gboolean
+is_parent (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    Event *event)
+{
+  GtkTreeIter child;
+  gint64 timestamp;
+  gchar *key;
+  gboolean found;
+
+  gtk_tree_model_get (model, iter,
+      COL_KEY, &key,
+      -1);
+
+  found = g_str_equal (key, event->key);
+  g_free (key);
+
+  if (!found)
+    return FALSE;
+
+  gtk_tree_model_iter_nth_child (model, &child, iter,
+      gtk_tree_model_iter_n_children (model, iter) - 1);
+
+  gtk_tree_model_get (model, &child,
+      COL_TS, &timestamp,
+      -1);
+
+  return ABS (event->timestamp - timestamp) < MAX_GAP;
+}
+
+static guint
+group_linear (GtkTreeStore *store,
+    Event *events)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (store);
+  guint n_conversations = 0;
+  gint i;
+
+  for (i = 0; i < n_messages; i++)
+    {
+      GtkTreeIter parent;
+      gboolean next;
+
+      next = gtk_tree_model_get_iter_first (model, &parent);
+      while (next && !is_parent (model, &parent, &events[i]))
+        next = gtk_tree_model_iter_next (model, &parent);
+
+      if (!next)
+        {
+          append_conversation (store, &parent, &events[i]);
+          n_conversations++;
+        }
+
+      append_event (store, &parent, &events[i]);
+    }
+
+  return n_conversations;
+}
+
+static gdouble
+report (const gchar *name,
+    gint64 start,
+    guint n_conversations)
+{
+  gdouble ms;
+
+  ms = (g_get_monotonic_time () - start) / 1000.0;
+  g_print ("%-32s %10.2f ms (%u conversations)\n", name, ms,
+      n_conversations);
+
+  return ms;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GtkTreeStore *store;
+  GError *error = NULL;
+  GRand *rand;
+  Event *events;
+  gchar **keys;
+  gint64 start;
+  guint n_conversations;
+  gdouble ms;
+  gint i;
+  gboolean failed = FALSE;
+
+  context = g_option_context_new ("- benchmark grouping log events");
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("option parsing failed: %s\n", error->message);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  n_contacts = MAX (n_contacts, 1);
+
+  keys = g_new0 (gchar *, n_contacts + 1);
+  for (i = 0; i < n_contacts; i++)
+    keys[i] = g_strdup_printf ("TplTextEvent /account contact%d@example.com",
+        i);
+
+  rand = g_rand_new_with_seed (42);
+  events = create_events (keys, rand);
+
+  g_print ("%d messages with %d contacts\n", n_messages, n_contacts);
+
+  store = create_store ();
+  start = g_get_monotonic_time ();
+  n_conversations = group_indexed (store, events);
+  ms = report ("indexed", start, n_conversations);
+  g_object_unref (store);
+
+  if (max_ms > 0 && ms > max_ms)
+    {
+      g_printerr ("grouping took longer than %d ms\n", max_ms);
+      failed = TRUE;
+    }
+
+  if (linear)
+    {
+      store = create_store ();
+      start = g_get_monotonic_time ();
+      n_conversations = group_linear (store, events);
+      report ("linear", start, n_conversations);
+      g_object_unref (store);
+    }
+
+  g_free (events);
+  g_rand_free (rand);
+  g_strfreev (keys);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
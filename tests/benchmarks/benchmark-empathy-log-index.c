@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Indexes a synthetic multi-year corpus of conversations and measures how
+ * long it takes to index, save, load and query it. Needs a session bus to
+ * create the TpAccount of the search hits; exits with 77 (skipped) if
+ * there is none. */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <glib/gstdio.h>
+
+#include "empathy-log-index.h"
+
+#define ACCOUNT_PATH_FORMAT \
+  TP_ACCOUNT_OBJECT_PATH_BASE "gabble/jabber/benchmark%u"
+
+#define WORDS_PER_MESSAGE 8
+
+static gint n_years = 3;
+static gint n_accounts = 2;
+static gint n_contacts = 20;
+static gint messages_per_day = 20;
+static gint vocabulary_size = 5000;
+static gint max_ms = 0;
+
+static GOptionEntry entries[] =
+{
+  { "years", 'y', 0, G_OPTION_ARG_INT, &n_years,
+    "Years of logs (default: 3)", "N" },
+  { "accounts", 'a', 0, G_OPTION_ARG_INT, &n_accounts,
+    "Number of accounts (default: 2)", "N" },
+  { "contacts", 'c', 0, G_OPTION_ARG_INT, &n_contacts,
+    "Contacts per account (default: 20)", "N" },
+  { "messages", 'm', 0, G_OPTION_ARG_INT, &messages_per_day,
+    "Messages per conversation day (default: 20)", "N" },
+  { "vocabulary", 'v', 0, G_OPTION_ARG_INT, &vocabulary_size,
+    "Number of distinct words (default: 5000)", "N" },
+  { "max-ms", 0, 0, G_OPTION_ARG_INT, &max_ms,
+    "Fail if a query takes longer than MS milliseconds", "MS" },
+  { NULL }
+};
+
+static const gchar *syllables[] = { "ka", "lo", "mi", "ne", "ru", "sa", "ti",
+    "vo", "ba", "de", "fi", "go", "hu", "ja", "pe", "zu" };
+
+static gboolean failed = FALSE;
+
+static gchar **
+create_vocabulary (GRand *rand)
+{
+  gchar **vocabulary;
+  gint i;
+
+  vocabulary = g_new0 (gchar *, vocabulary_size + 1);
+
+  for (i = 0; i < vocabulary_size; i++)
+    {
+      GString *word = g_string_new (NULL);
+      guint n = i;
+
+      /* Words of 2 to 5 syllables */
+      do
+        {
+          g_string_append (word, syllables[n % G_N_ELEMENTS (syllables)]);
+          n /= G_N_ELEMENTS (syllables);
+        }
+      while (n > 0 || word->len < 4);
+
+      if (g_rand_boolean (rand))
+        g_string_append (word, syllables[
+            g_rand_int_range (rand, 0, G_N_ELEMENTS (syllables))]);
+
+      vocabulary[i] = g_string_free (word, FALSE);
+    }
+
+  return vocabulary;
+}
+
+/* Word frequencies roughly follow Zipf's law: the first words of the
+ * vocabulary are way more common than the last ones */
+static const gchar *
+pick_word (GRand *rand,
+    gchar **vocabulary)
+{
+  gdouble r = g_rand_double (rand);
+
+  return vocabulary[(gint) (r * r * r * vocabulary_size)];
+}
+
+static guint
+fill_index (EmpathyLogIndex *index,
+    TpAccountManager *am,
+    gchar **vocabulary,
+    GRand *rand)
+{
+  GString *text;
+  gint64 start_of_logs;
+  gint a, c, day, m, w;
+  guint n_messages = 0;
+
+  text = g_string_new (NULL);
+  start_of_logs = g_get_real_time () / G_USEC_PER_SEC -
+    (gint64) n_years * 365 * 24 * 3600;
+
+  for (a = 0; a < n_accounts; a++)
+    {
+      TpAccount *account;
+      gchar *path;
+
+      path = g_strdup_printf (ACCOUNT_PATH_FORMAT, a);
+      account = tp_account_manager_ensure_account (am, path);
+      g_free (path);
+
+      for (c = 0; c < n_contacts; c++)
+        {
+          gchar *id = g_strdup_printf ("contact%u@example.com", c);
+
+          for (day = 0; day < n_years * 365; day++)
+            {
+              /* Talk with each contact one day out of three */
+              if (g_rand_int_range (rand, 0, 3) != 0)
+                continue;
+
+              for (m = 0; m < messages_per_day; m++)
+                {
+                  g_string_truncate (text, 0);
+
+                  for (w = 0; w < WORDS_PER_MESSAGE; w++)
+                    {
+                      g_string_append (text, pick_word (rand, vocabulary));
+                      g_string_append (text, w % 3 == 2 ? ", " : " ");
+                    }
+
+                  empathy_log_index_add_message (index, account, id,
+                      TPL_ENTITY_CONTACT,
+                      start_of_logs + day * 24 * 3600 + m * 60, text->str);
+                  n_messages++;
+                }
+            }
+
+          g_free (id);
+        }
+    }
+
+  g_string_free (text, TRUE);
+
+  return n_messages;
+}
+
+static gdouble
+report (const gchar *name,
+    gint64 start)
+{
+  gdouble ms;
+
+  ms = (g_get_monotonic_time () - start) / 1000.0;
+  g_print ("%-32s %10.2f ms\n", name, ms);
+
+  return ms;
+}
+
+static void
+query (EmpathyLogIndex *index,
+    const gchar *name,
+    const gchar *text)
+{
+  GList *hits;
+  gint64 start;
+  gchar *label;
+  gdouble ms;
+
+  start = g_get_monotonic_time ();
+
+  if (!empathy_log_index_search (index, text, &hits))
+    {
+      g_printerr ("The index can't answer '%s'\n", text);
+      failed = TRUE;
+      return;
+    }
+
+  label = g_strdup_printf ("query %s (%u hits)", name, g_list_length (hits));
+  ms = report (label, start);
+  g_free (label);
+
+  if (max_ms > 0 && ms > max_ms)
+    {
+      g_printerr ("query %s took longer than %d ms\n", name, max_ms);
+      failed = TRUE;
+    }
+
+  tpl_log_manager_search_free (hits);
+}
+
+static void
+remove_directory (const gchar *path)
+{
+  const gchar *names[] = { "index", "journal", "lock" };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (names); i++)
+    {
+      gchar *file = g_build_filename (path, names[i], NULL);
+
+      g_unlink (file);
+      g_free (file);
+    }
+
+  g_rmdir (path);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  EmpathyLogIndex *index;
+  TpDBusDaemon *bus;
+  TpAccountManager *am;
+  GError *error = NULL;
+  gchar **vocabulary, *directory, *two_words;
+  GRand *rand;
+  gint64 start;
+  guint n_messages, n_targets, n_dates, n_words;
+
+  context = g_option_context_new ("- benchmark the log index");
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("option parsing failed: %s\n", error->message);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  bus = tp_dbus_daemon_dup (&error);
+  if (bus == NULL)
+    {
+      g_printerr ("No session bus available, skipping: %s\n",
+          error->message);
+      g_error_free (error);
+      return 77;
+    }
+
+  am = tp_account_manager_dup ();
+
+  directory = g_dir_make_tmp ("empathy-log-index-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  rand = g_rand_new_with_seed (42);
+  vocabulary = create_vocabulary (rand);
+
+  g_print ("%d years, %d accounts, %d contacts, %d messages per day\n",
+      n_years, n_accounts, n_contacts, messages_per_day);
+
+  index = empathy_log_index_new (directory);
+
+  start = g_get_monotonic_time ();
+  n_messages = fill_index (index, am, vocabulary, rand);
+  report ("indexing", start);
+
+  empathy_log_index_mark_complete (index);
+
+  start = g_get_monotonic_time ();
+  empathy_log_index_save (index, &error);
+  g_assert_no_error (error);
+  report ("saving", start);
+
+  g_object_unref (index);
+
+  /* Queries run against a freshly loaded index, as after a restart */
+  index = empathy_log_index_new (directory);
+
+  start = g_get_monotonic_time ();
+  empathy_log_index_get_stats (index, &n_targets, &n_dates, &n_words);
+  report ("loading", start);
+
+  g_print ("%u messages, %u conversation days, %u words\n", n_messages,
+      n_dates, n_words);
+
+  two_words = g_strdup_printf ("%s %s", vocabulary[0],
+      vocabulary[vocabulary_size / 2]);
+
+  query (index, "common word", vocabulary[0]);
+  query (index, "rare word", vocabulary[vocabulary_size - 1]);
+  query (index, "two words", two_words);
+  query (index, "partial word", "kalo");
+  query (index, "no match", "xyzzy");
+
+  g_free (two_words);
+  g_object_unref (index);
+
+  remove_directory (directory);
+  g_free (directory);
+
+  g_strfreev (vocabulary);
+  g_rand_free (rand);
+  g_object_unref (am);
+  g_object_unref (bus);
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Feeds an EmpathyRosterView with synthetic individuals and reports how long
+ * the roster hot paths take. Doesn't need a running folks backend nor any
+ * interaction; exits with 77 (skipped) if no display is available. */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <folks/folks-dummy.h>
+
+#include "empathy-roster-model.h"
+#include "empathy-roster-view.h"
+#include "empathy-ui-utils.h"
+
+#define N_GROUPS 20
+
+static gint n_individuals = 1000;
+static gboolean show_groups = FALSE;
+static gboolean show_offline = FALSE;
+static gint max_ms = 0;
+
+static GOptionEntry entries[] =
+{
+  { "individuals", 'n', 0, G_OPTION_ARG_INT, &n_individuals,
+    "Number of synthetic individuals (default: 1000)", "N" },
+  { "groups", 0, 0, G_OPTION_ARG_NONE, &show_groups, "Show groups", NULL },
+  { "offline", 0, 0, G_OPTION_ARG_NONE, &show_offline,
+    "Show offline contacts", NULL },
+  { "max-ms", 0, 0, G_OPTION_ARG_INT, &max_ms,
+    "Fail if a measurement takes longer than MS milliseconds", "MS" },
+  { NULL }
+};
+
+/* Stand-in EmpathyRosterModel serving a fixed set of individuals */
+
+typedef struct
+{
+  GObject parent;
+
+  /* owned FolksIndividual */
+  GPtrArray *individuals;
+} BenchmarkRosterModel;
+
+typedef struct
+{
+  GObjectClass parent_class;
+} BenchmarkRosterModelClass;
+
+static GType benchmark_roster_model_get_type (void);
+static void roster_model_iface_init (EmpathyRosterModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (BenchmarkRosterModel,
+    benchmark_roster_model,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (EMPATHY_TYPE_ROSTER_MODEL, roster_model_iface_init))
+
+static void
+benchmark_roster_model_finalize (GObject *object)
+{
+  BenchmarkRosterModel *self = (BenchmarkRosterModel *) object;
+
+  g_ptr_array_unref (self->individuals);
+
+  G_OBJECT_CLASS (benchmark_roster_model_parent_class)->finalize (object);
+}
+
+static void
+benchmark_roster_model_class_init (BenchmarkRosterModelClass *klass)
+{
+  GObjectClass *oclass = G_OBJECT_CLASS (klass);
+
+  oclass->finalize = benchmark_roster_model_finalize;
+}
+
+static void
+benchmark_roster_model_init (BenchmarkRosterModel *self)
+{
+  self->individuals = g_ptr_array_new_with_free_func (g_object_unref);
+}
+
+static GList *
+benchmark_roster_model_get_individuals (EmpathyRosterModel *model)
+{
+  BenchmarkRosterModel *self = (BenchmarkRosterModel *) model;
+  GList *result = NULL;
+  guint i;
+
+  for (i = self->individuals->len; i > 0; i--)
+    result = g_list_prepend (result,
+        g_ptr_array_index (self->individuals, i - 1));
+
+  return result;
+}
+
+static GList *
+benchmark_roster_model_dup_groups_for_individual (EmpathyRosterModel *model,
+    FolksIndividual *individual)
+{
+  guint index;
+
+  index = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (individual),
+        "benchmark-index"));
+
+  /* A third of the contacts are ungrouped */
+  if (index % 3 == 0)
+    return NULL;
+
+  return g_list_prepend (NULL,
+      g_strdup_printf ("Group %02u", index % N_GROUPS));
+}
+
+static void
+roster_model_iface_init (EmpathyRosterModelInterface *iface)
+{
+  iface->get_individuals = benchmark_roster_model_get_individuals;
+  iface->dup_groups_for_individual =
+    benchmark_roster_model_dup_groups_for_individual;
+}
+
+static void
+set_presence (FolksIndividual *individual,
+    gboolean online)
+{
+  if (online)
+    g_object_set (individual,
+        "presence-type", FOLKS_PRESENCE_TYPE_AVAILABLE,
+        "presence-status", "available",
+        "presence-message", "Benchmarking",
+        NULL);
+  else
+    g_object_set (individual,
+        "presence-type", FOLKS_PRESENCE_TYPE_OFFLINE,
+        "presence-status", "offline",
+        "presence-message", "",
+        NULL);
+}
+
+static FolksIndividual *
+create_individual (FolksDummyPersonaStore *store,
+    guint index)
+{
+  FolksDummyFullPersona *persona;
+  FolksIndividual *individual;
+  GeeSet *personas;
+  gchar *id;
+
+  /* The individual's alias falls back to the persona's display ID */
+  id = g_strdup_printf ("contact%06u@example.com", index);
+  persona = folks_dummy_full_persona_new (store, id, FALSE, NULL, 0);
+  g_free (id);
+
+  personas = GEE_SET (
+      gee_hash_set_new (FOLKS_TYPE_PERSONA, g_object_ref, g_object_unref,
+      NULL, NULL, NULL, NULL, NULL, NULL));
+  gee_collection_add (GEE_COLLECTION (personas), persona);
+
+  individual = folks_individual_new (personas);
+
+  g_object_set_data (G_OBJECT (individual), "benchmark-index",
+      GUINT_TO_POINTER (index));
+
+  /* Three quarters of the roster is online */
+  set_presence (individual, index % 4 != 0);
+
+  g_object_unref (personas);
+  g_object_unref (persona);
+
+  return individual;
+}
+
+static BenchmarkRosterModel *
+create_model (guint n)
+{
+  BenchmarkRosterModel *model;
+  FolksDummyPersonaStore *store;
+  guint i;
+
+  model = g_object_new (benchmark_roster_model_get_type (), NULL);
+  store = folks_dummy_persona_store_new ("benchmark", "Benchmark", NULL, 0);
+
+  for (i = 0; i < n; i++)
+    g_ptr_array_add (model->individuals, create_individual (store, i));
+
+  g_object_unref (store);
+
+  return model;
+}
+
+static void
+flush_main_loop (void)
+{
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+}
+
+/* Returns the peak resident set size of the process, in KiB */
+static guint64
+get_peak_memory (void)
+{
+  gchar *status, *line;
+  guint64 result = 0;
+
+  if (!g_file_get_contents ("/proc/self/status", &status, NULL, NULL))
+    return 0;
+
+  line = strstr (status, "VmHWM:");
+  if (line != NULL)
+    result = g_ascii_strtoull (line + strlen ("VmHWM:"), NULL, 10);
+
+  g_free (status);
+
+  return result;
+}
+
+static gboolean failed = FALSE;
+
+static void
+report (const gchar *name,
+    gint64 start)
+{
+  gdouble ms;
+
+  ms = (g_get_monotonic_time () - start) / 1000.0;
+
+  g_print ("%-24s %10.2f ms\n", name, ms);
+
+  if (max_ms > 0 && ms > max_ms)
+    {
+      g_printerr ("%s took longer than %d ms\n", name, max_ms);
+      failed = TRUE;
+    }
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GtkWidget *view, *search;
+  BenchmarkRosterModel *model;
+  GOptionContext *context;
+  GError *error = NULL;
+  gint64 start;
+  guint i;
+
+  context = g_option_context_new ("- benchmark the roster view");
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("option parsing failed: %s\n", error->message);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  if (!gtk_init_check (&argc, &argv))
+    {
+      g_printerr ("No display available, skipping\n");
+      return 77;
+    }
+
+  empathy_gtk_init ();
+
+  g_print ("%d individuals, groups %s, offline contacts %s\n", n_individuals,
+      show_groups ? "shown" : "hidden", show_offline ? "shown" : "hidden");
+
+  start = g_get_monotonic_time ();
+  model = create_model (MAX (n_individuals, 0));
+  report ("model creation", start);
+
+  /* Population: the view adds a row for each individual of the model */
+  start = g_get_monotonic_time ();
+  view = empathy_roster_view_new (EMPATHY_ROSTER_MODEL (model));
+  g_object_ref_sink (view);
+  empathy_roster_view_show_offline (EMPATHY_ROSTER_VIEW (view), show_offline);
+  empathy_roster_view_show_groups (EMPATHY_ROSTER_VIEW (view), show_groups);
+  flush_main_loop ();
+  report ("population", start);
+
+  start = g_get_monotonic_time ();
+  gtk_list_box_invalidate_sort (GTK_LIST_BOX (view));
+  report ("sort", start);
+
+  /* Search: one filter pass per keystroke, as search_timeout_cb() does */
+  search = tpaw_live_search_new (view);
+  g_object_ref_sink (search);
+  empathy_roster_view_set_live_search (EMPATHY_ROSTER_VIEW (view),
+      TPAW_LIVE_SEARCH (search));
+  gtk_widget_show (search);
+
+  start = g_get_monotonic_time ();
+  tpaw_live_search_set_text (TPAW_LIVE_SEARCH (search), "c");
+  gtk_list_box_invalidate_filter (GTK_LIST_BOX (view));
+  report ("search first keystroke", start);
+
+  start = g_get_monotonic_time ();
+  tpaw_live_search_set_text (TPAW_LIVE_SEARCH (search), "contact0001");
+  gtk_list_box_invalidate_filter (GTK_LIST_BOX (view));
+  report ("search refined", start);
+
+  start = g_get_monotonic_time ();
+  tpaw_live_search_set_text (TPAW_LIVE_SEARCH (search), "");
+  gtk_widget_hide (search);
+  gtk_list_box_invalidate_filter (GTK_LIST_BOX (view));
+  report ("search cleared", start);
+
+  /* Presence storm: half of the roster changes presence at once, as when an
+   * account reconnects */
+  start = g_get_monotonic_time ();
+  for (i = 0; i < model->individuals->len; i += 2)
+    set_presence (g_ptr_array_index (model->individuals, i), i % 4 == 0);
+  flush_main_loop ();
+  report ("presence storm", start);
+
+  g_print ("%-24s %10" G_GUINT64_FORMAT " KiB\n", "peak memory",
+      get_peak_memory ());
+
+  empathy_roster_view_set_live_search (EMPATHY_ROSTER_VIEW (view), NULL);
+  g_object_unref (search);
+  gtk_widget_destroy (view);
+  g_object_unref (view);
+  g_object_unref (model);
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "empathy-debug-buffer.h"
+#include "test-debug-helper.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+/* What the buffer counts for each of the messages, which all have the
+ * same length: its overhead, the text and the domain */
+#define MESSAGE_SIZE (128 + strlen ("message 0") + strlen ("test"))
+
+typedef struct
+{
+  EmpathyDebugBuffer *buffer;
+  GPtrArray *messages;
+  guint n_inserted;
+  guint n_deleted;
+} Test;
+
+static void
+row_inserted_cb (GtkTreeModel *model,
+    GtkTreePath *path,
+    GtkTreeIter *iter,
+    Test *test)
+{
+  /* Always appended */
+  g_assert_cmpint (gtk_tree_path_get_indices (path)[0], ==,
+      gtk_tree_model_iter_n_children (model, NULL) - 1);
+  test->n_inserted++;
+}
+
+static void
+row_deleted_cb (GtkTreeModel *model,
+    GtkTreePath *path,
+    Test *test)
+{
+  /* Always the oldest */
+  g_assert_cmpint (gtk_tree_path_get_indices (path)[0], ==, 0);
+  test->n_deleted++;
+}
+
+static void
+setup (Test *test,
+    gconstpointer data)
+{
+  gint64 times[10];
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (times); i++)
+    times[i] = 1000 + i;
+
+  test->messages = test_debug_messages_new ("message", times,
+      G_N_ELEMENTS (times));
+  test->buffer = NULL;
+  test->n_inserted = 0;
+  test->n_deleted = 0;
+}
+
+static void
+teardown (Test *test,
+    gconstpointer data)
+{
+  tp_clear_object (&test->buffer);
+  g_ptr_array_unref (test->messages);
+}
+
+static void
+create_buffer (Test *test,
+    guint max_messages,
+    gsize max_bytes)
+{
+  test->buffer = empathy_debug_buffer_new (max_messages, max_bytes);
+
+  g_signal_connect (test->buffer, "row-inserted",
+      G_CALLBACK (row_inserted_cb), test);
+  g_signal_connect (test->buffer, "row-deleted",
+      G_CALLBACK (row_deleted_cb), test);
+}
+
+static void
+append (Test *test,
+    guint first,
+    guint n)
+{
+  guint i;
+
+  for (i = first; i < first + n; i++)
+    empathy_debug_buffer_append (test->buffer,
+        g_ptr_array_index (test->messages, i));
+}
+
+/* Checks the buffer holds the messages from @first to the last appended
+ * one, @last */
+static void
+check_contents (Test *test,
+    guint first,
+    guint last)
+{
+  guint i, length = last - first + 1;
+
+  g_assert_cmpuint (empathy_debug_buffer_get_length (test->buffer), ==,
+      length);
+  g_assert_cmpint (gtk_tree_model_iter_n_children (
+        GTK_TREE_MODEL (test->buffer), NULL), ==, length);
+
+  for (i = 0; i < length; i++)
+    {
+      guint index;
+
+      g_assert (empathy_debug_buffer_get_message (test->buffer, i) ==
+          g_ptr_array_index (test->messages, first + i));
+      g_assert_cmpuint (empathy_debug_buffer_get_serial (test->buffer, i),
+          ==, first + i);
+      g_assert (empathy_debug_buffer_lookup_serial (test->buffer, first + i,
+            &index));
+      g_assert_cmpuint (index, ==, i);
+    }
+
+  if (first > 0)
+    g_assert (!empathy_debug_buffer_lookup_serial (test->buffer, first - 1,
+          NULL));
+}
+
+static void
+test_max_messages (Test *test,
+    gconstpointer data)
+{
+  create_buffer (test, 3, 0);
+
+  append (test, 0, 3);
+  check_contents (test, 0, 2);
+  g_assert_cmpuint (test->n_deleted, ==, 0);
+
+  /* Each new message evicts the oldest one */
+  append (test, 3, 7);
+  check_contents (test, 7, 9);
+  g_assert_cmpuint (test->n_inserted, ==, 10);
+  g_assert_cmpuint (test->n_deleted, ==, 7);
+}
+
+static void
+test_max_bytes (Test *test,
+    gconstpointer data)
+{
+  /* Room for two messages and a half */
+  create_buffer (test, 0, MESSAGE_SIZE * 5 / 2);
+
+  append (test, 0, 2);
+  check_contents (test, 0, 1);
+
+  append (test, 2, 3);
+  check_contents (test, 3, 4);
+  g_assert_cmpuint (test->n_deleted, ==, 3);
+}
+
+/* The last message is kept even if it's bigger than the limit */
+static void
+test_max_bytes_last (Test *test,
+    gconstpointer data)
+{
+  create_buffer (test, 0, 1);
+
+  append (test, 0, 3);
+  check_contents (test, 2, 2);
+  g_assert_cmpuint (test->n_deleted, ==, 2);
+}
+
+static void
+test_set_limits (Test *test,
+    gconstpointer data)
+{
+  create_buffer (test, 0, 0);
+
+  append (test, 0, 6);
+  check_contents (test, 0, 5);
+
+  empathy_debug_buffer_set_limits (test->buffer, 4, 0);
+  check_contents (test, 2, 5);
+
+  empathy_debug_buffer_set_limits (test->buffer, 0, MESSAGE_SIZE * 3);
+  check_contents (test, 3, 5);
+
+  append (test, 6, 1);
+  check_contents (test, 4, 6);
+  g_assert_cmpuint (test->n_deleted, ==, 4);
+
+  empathy_debug_buffer_clear (test->buffer);
+  g_assert_cmpuint (empathy_debug_buffer_get_length (test->buffer), ==, 0);
+  g_assert_cmpuint (test->n_deleted, ==, 7);
+}
+
+/* The ring grows, then wraps around once it's full */
+static void
+test_wrap (Test *test,
+    gconstpointer data)
+{
+  GPtrArray *messages;
+  gint64 times[700];
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (times); i++)
+    times[i] = 1000 + i;
+
+  messages = test_debug_messages_new ("message", times, G_N_ELEMENTS (times));
+  g_ptr_array_unref (test->messages);
+  test->messages = messages;
+
+  create_buffer (test, 300, 0);
+
+  append (test, 0, 700);
+  check_contents (test, 400, 699);
+  g_assert_cmpuint (test->n_deleted, ==, 400);
+
+  for (i = 1; i < 300; i++)
+    g_assert_cmpint (empathy_debug_buffer_get_time (test->buffer, i - 1), <,
+        empathy_debug_buffer_get_time (test->buffer, i));
+}
+
+/* A message sent before the previous one is kept at its time */
+static void
+test_clock (Test *test,
+    gconstpointer data)
+{
+  GPtrArray *messages;
+  gint64 times[] = { 10, 5, 20 };
+
+  messages = test_debug_messages_new ("message", times, G_N_ELEMENTS (times));
+  g_ptr_array_unref (test->messages);
+  test->messages = messages;
+
+  create_buffer (test, 0, 0);
+  append (test, 0, 3);
+
+  g_assert_cmpint (empathy_debug_buffer_get_time (test->buffer, 0), ==,
+      10 * G_USEC_PER_SEC);
+  g_assert_cmpint (empathy_debug_buffer_get_time (test->buffer, 1), ==,
+      10 * G_USEC_PER_SEC);
+  g_assert_cmpint (empathy_debug_buffer_get_time (test->buffer, 2), ==,
+      20 * G_USEC_PER_SEC);
+
+  g_assert_cmpuint (empathy_debug_buffer_count_before (test->buffer,
+        10 * G_USEC_PER_SEC, FALSE), ==, 0);
+  g_assert_cmpuint (empathy_debug_buffer_count_before (test->buffer,
+        10 * G_USEC_PER_SEC, TRUE), ==, 2);
+  g_assert_cmpuint (empathy_debug_buffer_count_before (test->buffer,
+        30 * G_USEC_PER_SEC, FALSE), ==, 3);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  TpDBusDaemon *bus;
+  GError *error = NULL;
+  int result;
+
+  test_init (argc, argv);
+
+  /* Needed to get TpDebugMessages */
+  bus = tp_dbus_daemon_dup (&error);
+  if (bus == NULL)
+    {
+      g_printerr ("No session bus available, skipping: %s\n",
+          error->message);
+      g_error_free (error);
+      test_deinit ();
+      return 77;
+    }
+
+  g_test_add ("/debug-buffer/max-messages", Test, NULL, setup,
+      test_max_messages, teardown);
+  g_test_add ("/debug-buffer/max-bytes", Test, NULL, setup,
+      test_max_bytes, teardown);
+  g_test_add ("/debug-buffer/max-bytes-last", Test, NULL, setup,
+      test_max_bytes_last, teardown);
+  g_test_add ("/debug-buffer/set-limits", Test, NULL, setup,
+      test_set_limits, teardown);
+  g_test_add ("/debug-buffer/wrap", Test, NULL, setup, test_wrap,
+      teardown);
+  g_test_add ("/debug-buffer/clock", Test, NULL, setup, test_clock,
+      teardown);
+
+  result = g_test_run ();
+
+  g_object_unref (bus);
+  test_deinit ();
+
+  return result;
+}
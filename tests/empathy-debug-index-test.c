@@ -0,0 +1,318 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "empathy-debug-index.h"
+#include "test-debug-helper.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+static const gchar *texts[] = {
+    "Connection ready",
+    "TpConnection disconnected",
+    "Channel closed",
+    "Channel opened for connection 3",
+    "Channel opened again",
+    NULL
+};
+
+typedef struct
+{
+  GPtrArray *messages;
+  EmpathyDebugBuffer *buffer;
+  EmpathyDebugIndex *index;
+  GHashTable *matches;
+} Test;
+
+static void
+setup (Test *test,
+    gconstpointer data)
+{
+  gint64 times[G_N_ELEMENTS (texts) - 1];
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (times); i++)
+    times[i] = 1000 + i;
+
+  test->messages = test_debug_messages_new_full (texts, times,
+      G_N_ELEMENTS (times));
+  test->buffer = NULL;
+  test->index = NULL;
+  test->matches = NULL;
+}
+
+static void
+teardown (Test *test,
+    gconstpointer data)
+{
+  tp_clear_pointer (&test->matches, g_hash_table_unref);
+  tp_clear_object (&test->index);
+  tp_clear_object (&test->buffer);
+  g_ptr_array_unref (test->messages);
+}
+
+/* Messages with two words only found in them, "alpha<i>" and "beta<i>" */
+static void
+use_many_words (Test *test,
+    guint n)
+{
+  GPtrArray *many_texts;
+  gint64 *times;
+  guint i;
+
+  many_texts = g_ptr_array_new_with_free_func (g_free);
+  times = g_new (gint64, n);
+
+  for (i = 0; i < n; i++)
+    {
+      g_ptr_array_add (many_texts, g_strdup_printf ("alpha%u beta%u", i, i));
+      times[i] = 1000 + i;
+    }
+
+  g_ptr_array_unref (test->messages);
+  test->messages = test_debug_messages_new_full (
+      (const gchar * const *) many_texts->pdata, times, n);
+
+  g_ptr_array_unref (many_texts);
+  g_free (times);
+}
+
+static void
+append (Test *test,
+    guint first,
+    guint n)
+{
+  guint i;
+
+  for (i = first; i < first + n; i++)
+    empathy_debug_buffer_append (test->buffer,
+        g_ptr_array_index (test->messages, i));
+}
+
+/* A new set of matches for each search, as the debug window does */
+static void
+search (Test *test,
+    const gchar *text)
+{
+  tp_clear_pointer (&test->matches, g_hash_table_unref);
+  test->matches = g_hash_table_new (NULL, NULL);
+
+  empathy_debug_index_search (test->index, text, test->matches);
+}
+
+static void
+check_matches (Test *test,
+    const guint *expected,
+    guint n)
+{
+  guint i;
+
+  g_assert_cmpuint (g_hash_table_size (test->matches), ==, n);
+
+  for (i = 0; i < n; i++)
+    g_assert (g_hash_table_contains (test->matches,
+          g_ptr_array_index (test->messages, expected[i])));
+}
+
+static void
+test_search (Test *test,
+    gconstpointer data)
+{
+  guint connection[] = { 0, 1, 3 };
+  guint all[] = { 0, 1, 2, 3 };
+  guint closed[] = { 2 };
+  guint number[] = { 3 };
+
+  test->buffer = empathy_debug_buffer_new (0, 0);
+  append (test, 0, 4);
+  /* Indexes the messages already there */
+  test->index = empathy_debug_index_new (test->buffer);
+
+  search (test, "connection");
+  check_matches (test, connection, G_N_ELEMENTS (connection));
+
+  /* Inside words, whatever the case */
+  search (test, "NECTION");
+  check_matches (test, connection, G_N_ELEMENTS (connection));
+
+  /* The domain is searched too */
+  search (test, "test");
+  check_matches (test, all, G_N_ELEMENTS (all));
+
+  /* All the words have to be in the message */
+  search (test, "connection 3");
+  check_matches (test, number, G_N_ELEMENTS (number));
+  search (test, "  chan clo ");
+  check_matches (test, closed, G_N_ELEMENTS (closed));
+
+  search (test, "xyzzy");
+  check_matches (test, NULL, 0);
+}
+
+/* Typing more of the search narrows the previous matches down, which keep
+ * being updated as messages are appended */
+static void
+test_refine (Test *test,
+    gconstpointer data)
+{
+  guint channel[] = { 2, 3 };
+  guint opened[] = { 3 };
+  guint opened_again[] = { 3, 4 };
+  guint channel_again[] = { 2, 3, 4 };
+
+  test->buffer = empathy_debug_buffer_new (0, 0);
+  test->index = empathy_debug_index_new (test->buffer);
+  append (test, 0, 4);
+
+  search (test, "chan");
+  check_matches (test, channel, G_N_ELEMENTS (channel));
+
+  search (test, "chann");
+  check_matches (test, channel, G_N_ELEMENTS (channel));
+
+  search (test, "channel op");
+  check_matches (test, opened, G_N_ELEMENTS (opened));
+
+  append (test, 4, 1);
+  check_matches (test, opened_again, G_N_ELEMENTS (opened_again));
+
+  /* Not a refinement any more */
+  search (test, "channel");
+  check_matches (test, channel_again, G_N_ELEMENTS (channel_again));
+}
+
+static void
+test_evict (Test *test,
+    gconstpointer data)
+{
+  guint channel[] = { 2, 3 };
+  guint channel_left[] = { 3, 4 };
+
+  test->buffer = empathy_debug_buffer_new (2, 0);
+  test->index = empathy_debug_index_new (test->buffer);
+  append (test, 0, 4);
+
+  search (test, "channel");
+  check_matches (test, channel, G_N_ELEMENTS (channel));
+
+  append (test, 4, 1);
+  check_matches (test, channel_left, G_N_ELEMENTS (channel_left));
+}
+
+/* More new words than are looked at one by one */
+static void
+test_many_words (Test *test,
+    gconstpointer data)
+{
+  guint alpha[] = { 123 };
+  guint beta[] = { 59, 590, 591, 592, 593, 594, 595, 596, 597, 598, 599 };
+  guint lpha[] = { 12, 120, 121, 122, 123, 124, 125, 126, 127, 128, 129 };
+
+  use_many_words (test, 600);
+
+  test->buffer = empathy_debug_buffer_new (0, 0);
+  test->index = empathy_debug_index_new (test->buffer);
+  append (test, 0, 600);
+
+  search (test, "alpha123");
+  check_matches (test, alpha, G_N_ELEMENTS (alpha));
+  search (test, "beta59");
+  check_matches (test, beta, G_N_ELEMENTS (beta));
+  search (test, "lpha12");
+  check_matches (test, lpha, G_N_ELEMENTS (lpha));
+}
+
+/* The words of evicted messages are eventually forgotten */
+static void
+test_sweep (Test *test,
+    gconstpointer data)
+{
+  guint beta[] = { 590, 591, 592, 593, 594, 595, 596, 597, 598, 599 };
+  guint i;
+
+  use_many_words (test, 600);
+
+  test->buffer = empathy_debug_buffer_new (100, 0);
+  test->index = empathy_debug_index_new (test->buffer);
+
+  /* Enough evictions for the index to sweep its words; the sender doesn't
+   * keep that many messages, so they are appended more than once */
+  for (i = 0; i < 3; i++)
+    append (test, 0, 600);
+
+  search (test, "alpha1");
+  check_matches (test, NULL, 0);
+  search (test, "beta59");
+  check_matches (test, beta, G_N_ELEMENTS (beta));
+}
+
+/* What the index takes counts against the size limit of the buffer */
+static void
+test_charged (Test *test,
+    gconstpointer data)
+{
+  EmpathyDebugBuffer *plain;
+  guint i;
+
+  use_many_words (test, 100);
+
+  plain = empathy_debug_buffer_new (0, 8 * 1024);
+  test->buffer = empathy_debug_buffer_new (0, 8 * 1024);
+  test->index = empathy_debug_index_new (test->buffer);
+
+  for (i = 0; i < 100; i++)
+    empathy_debug_buffer_append (plain, g_ptr_array_index (test->messages, i));
+  append (test, 0, 100);
+
+  g_assert_cmpuint (empathy_debug_buffer_get_length (plain), <, 100);
+  g_assert_cmpuint (empathy_debug_buffer_get_length (test->buffer), <,
+      empathy_debug_buffer_get_length (plain));
+
+  g_object_unref (plain);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  TpDBusDaemon *bus;
+  GError *error = NULL;
+  int result;
+
+  test_init (argc, argv);
+
+  /* Needed to get TpDebugMessages */
+  bus = tp_dbus_daemon_dup (&error);
+  if (bus == NULL)
+    {
+      g_printerr ("No session bus available, skipping: %s\n",
+          error->message);
+      g_error_free (error);
+      test_deinit ();
+      return 77;
+    }
+
+  g_test_add ("/debug-index/search", Test, NULL, setup, test_search,
+      teardown);
+  g_test_add ("/debug-index/refine", Test, NULL, setup, test_refine,
+      teardown);
+  g_test_add ("/debug-index/evict", Test, NULL, setup, test_evict,
+      teardown);
+  g_test_add ("/debug-index/many-words", Test, NULL, setup,
+      test_many_words, teardown);
+  g_test_add ("/debug-index/sweep", Test, NULL, setup, test_sweep,
+      teardown);
+  g_test_add ("/debug-index/charged", Test, NULL, setup, test_charged,
+      teardown);
+
+  result = g_test_run ();
+
+  g_object_unref (bus);
+  test_deinit ();
+
+  return result;
+}
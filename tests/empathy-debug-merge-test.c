@@ -0,0 +1,324 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "empathy-debug-merge.h"
+#include "test-debug-helper.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+/* in seconds; A messages come before B ones sent at the same time */
+static const gint64 times_a[] = { 1, 3, 3, 5 };
+static const gint64 times_b[] = { 2, 3, 4 };
+
+typedef struct
+{
+  GPtrArray *messages_a;
+  GPtrArray *messages_b;
+  EmpathyDebugBuffer *buffer_a;
+  EmpathyDebugBuffer *buffer_b;
+  EmpathyDebugMerge *merge;
+  /* rows of the row-inserted and row-deleted signals, in order */
+  GArray *inserted;
+  GArray *deleted;
+} Test;
+
+static void
+row_inserted_cb (GtkTreeModel *model,
+    GtkTreePath *path,
+    GtkTreeIter *iter,
+    Test *test)
+{
+  gint row = gtk_tree_path_get_indices (path)[0];
+
+  g_array_append_val (test->inserted, row);
+}
+
+static void
+row_deleted_cb (GtkTreeModel *model,
+    GtkTreePath *path,
+    Test *test)
+{
+  gint row = gtk_tree_path_get_indices (path)[0];
+
+  g_array_append_val (test->deleted, row);
+}
+
+static void
+setup (Test *test,
+    gconstpointer data)
+{
+  test->messages_a = test_debug_messages_new ("a", times_a,
+      G_N_ELEMENTS (times_a));
+  test->messages_b = test_debug_messages_new ("b", times_b,
+      G_N_ELEMENTS (times_b));
+
+  test->buffer_a = empathy_debug_buffer_new (0, 0);
+  test->buffer_b = empathy_debug_buffer_new (0, 0);
+  test->merge = NULL;
+
+  test->inserted = g_array_new (FALSE, FALSE, sizeof (gint));
+  test->deleted = g_array_new (FALSE, FALSE, sizeof (gint));
+}
+
+static void
+teardown (Test *test,
+    gconstpointer data)
+{
+  tp_clear_object (&test->merge);
+  g_object_unref (test->buffer_a);
+  g_object_unref (test->buffer_b);
+  g_ptr_array_unref (test->messages_a);
+  g_ptr_array_unref (test->messages_b);
+  g_array_unref (test->inserted);
+  g_array_unref (test->deleted);
+}
+
+static void
+create_merge (Test *test)
+{
+  GPtrArray *buffers = g_ptr_array_new ();
+
+  g_ptr_array_add (buffers, test->buffer_a);
+  g_ptr_array_add (buffers, test->buffer_b);
+  test->merge = empathy_debug_merge_new (buffers);
+  g_ptr_array_unref (buffers);
+
+  g_signal_connect (test->merge, "row-inserted",
+      G_CALLBACK (row_inserted_cb), test);
+  g_signal_connect (test->merge, "row-deleted",
+      G_CALLBACK (row_deleted_cb), test);
+}
+
+static TpDebugMessage *
+message_a (Test *test,
+    guint i)
+{
+  return g_ptr_array_index (test->messages_a, i);
+}
+
+static TpDebugMessage *
+message_b (Test *test,
+    guint i)
+{
+  return g_ptr_array_index (test->messages_b, i);
+}
+
+static void
+append_a (Test *test,
+    guint i)
+{
+  empathy_debug_buffer_append (test->buffer_a, message_a (test, i));
+}
+
+static void
+append_b (Test *test,
+    guint i)
+{
+  empathy_debug_buffer_append (test->buffer_b, message_b (test, i));
+}
+
+static TpDebugMessage *
+get_message (Test *test,
+    GtkTreeIter *iter)
+{
+  TpDebugMessage *message;
+
+  gtk_tree_model_get (GTK_TREE_MODEL (test->merge), iter, 0, &message, -1);
+  g_object_unref (message);
+
+  /* Still owned by its buffer */
+  return message;
+}
+
+static gint
+get_row (Test *test,
+    GtkTreeIter *iter)
+{
+  GtkTreePath *path;
+  gint row;
+
+  path = gtk_tree_model_get_path (GTK_TREE_MODEL (test->merge), iter);
+  row = gtk_tree_path_get_indices (path)[0];
+  gtk_tree_path_free (path);
+
+  return row;
+}
+
+static void
+check_rows (Test *test,
+    GArray *rows,
+    const gint *expected,
+    guint n)
+{
+  guint i;
+
+  g_assert_cmpuint (rows->len, ==, n);
+
+  for (i = 0; i < n; i++)
+    g_assert_cmpint (g_array_index (rows, gint, i), ==, expected[i]);
+}
+
+/* Checks the merge lists @expected, walking it forwards, backwards and
+ * jumping to each row */
+static void
+check_order (Test *test,
+    TpDebugMessage **expected,
+    guint n)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (test->merge);
+  GtkTreeIter iter;
+  gint i;
+
+  g_assert_cmpint (gtk_tree_model_iter_n_children (model, NULL), ==, n);
+
+  g_assert (gtk_tree_model_get_iter_first (model, &iter));
+  for (i = 0; i < (gint) n; i++)
+    {
+      g_assert (get_message (test, &iter) == expected[i]);
+      g_assert_cmpint (get_row (test, &iter), ==, i);
+      g_assert (gtk_tree_model_iter_next (model, &iter) ==
+          (i + 1 < (gint) n));
+    }
+
+  g_assert (gtk_tree_model_iter_nth_child (model, &iter, NULL, n - 1));
+  for (i = n - 1; i >= 0; i--)
+    {
+      g_assert (get_message (test, &iter) == expected[i]);
+      g_assert (gtk_tree_model_iter_previous (model, &iter) == (i > 0));
+    }
+
+  /* Not in order, so the rows aren't found by moving a cursor */
+  for (i = 0; i < (gint) n; i++)
+    {
+      gint row = (i * 3) % n;
+
+      g_assert (gtk_tree_model_iter_nth_child (model, &iter, NULL, row));
+      g_assert (get_message (test, &iter) == expected[row]);
+    }
+
+  g_assert (!gtk_tree_model_iter_nth_child (model, &iter, NULL, n));
+}
+
+/* By time, then by buffer, then by age within a buffer */
+static void
+test_order (Test *test,
+    gconstpointer data)
+{
+  TpDebugMessage *expected[] = { message_a (test, 0), message_b (test, 0),
+      message_a (test, 1), message_a (test, 2), message_b (test, 1),
+      message_b (test, 2), message_a (test, 3) };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (times_a); i++)
+    append_a (test, i);
+  for (i = 0; i < G_N_ELEMENTS (times_b); i++)
+    append_b (test, i);
+
+  create_merge (test);
+  check_order (test, expected, G_N_ELEMENTS (expected));
+}
+
+static void
+test_row_inserted (Test *test,
+    gconstpointer data)
+{
+  TpDebugMessage *expected[] = { message_a (test, 0), message_b (test, 0),
+      message_a (test, 1), message_a (test, 2), message_b (test, 1),
+      message_b (test, 2), message_a (test, 3) };
+  gint rows[] = { 0, 1, 1, 3, 3, 5, 6 };
+
+  create_merge (test);
+
+  append_a (test, 0);
+  append_a (test, 1);
+  /* Between the two messages of A */
+  append_b (test, 0);
+  /* After the message of A sent at the same time */
+  append_b (test, 1);
+  /* Before the message of B sent at the same time */
+  append_a (test, 2);
+  append_b (test, 2);
+  append_a (test, 3);
+
+  check_rows (test, test->inserted, rows, G_N_ELEMENTS (rows));
+  g_assert_cmpuint (test->deleted->len, ==, 0);
+  check_order (test, expected, G_N_ELEMENTS (expected));
+}
+
+static void
+test_row_deleted (Test *test,
+    gconstpointer data)
+{
+  TpDebugMessage *expected[] = { message_a (test, 1), message_a (test, 2),
+      message_b (test, 1) };
+  gint inserted[] = { 0, 1, 2, 2, 2 };
+  gint deleted[] = { 0, 0 };
+  GtkTreeIter iter;
+
+  empathy_debug_buffer_set_limits (test->buffer_a, 2, 0);
+  empathy_debug_buffer_set_limits (test->buffer_b, 1, 0);
+  create_merge (test);
+
+  append_a (test, 0);
+  append_b (test, 0);
+  append_a (test, 1);
+
+  /* Rows persist while their message is in its buffer */
+  g_assert (gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (test->merge),
+        &iter, NULL, 2));
+  g_assert (get_message (test, &iter) == message_a (test, 1));
+
+  /* Evicts the first message of A */
+  append_a (test, 2);
+  g_assert_cmpint (get_row (test, &iter), ==, 1);
+
+  /* Evicts the first message of B, which comes first */
+  append_b (test, 1);
+  g_assert_cmpint (get_row (test, &iter), ==, 0);
+  g_assert (get_message (test, &iter) == message_a (test, 1));
+
+  check_rows (test, test->inserted, inserted, G_N_ELEMENTS (inserted));
+  check_rows (test, test->deleted, deleted, G_N_ELEMENTS (deleted));
+  check_order (test, expected, G_N_ELEMENTS (expected));
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  TpDBusDaemon *bus;
+  GError *error = NULL;
+  int result;
+
+  test_init (argc, argv);
+
+  /* Needed to get TpDebugMessages */
+  bus = tp_dbus_daemon_dup (&error);
+  if (bus == NULL)
+    {
+      g_printerr ("No session bus available, skipping: %s\n",
+          error->message);
+      g_error_free (error);
+      test_deinit ();
+      return 77;
+    }
+
+  g_test_add ("/debug-merge/order", Test, NULL, setup, test_order,
+      teardown);
+  g_test_add ("/debug-merge/row-inserted", Test, NULL, setup,
+      test_row_inserted, teardown);
+  g_test_add ("/debug-merge/row-deleted", Test, NULL, setup,
+      test_row_deleted, teardown);
+
+  result = g_test_run ();
+
+  g_object_unref (bus);
+  test_deinit ();
+
+  return result;
+}
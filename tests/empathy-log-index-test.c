@@ -0,0 +1,277 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "empathy-log-index.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+#define ACCOUNT_PATH TP_ACCOUNT_OBJECT_PATH_BASE "gabble/jabber/test0"
+
+/* 2013-01-01 12:00 UTC */
+#define DAY_1 G_GINT64_CONSTANT (1357041600)
+#define DAY_2 (DAY_1 + 24 * 3600)
+
+typedef struct
+{
+  TpAccountManager *account_manager;
+  TpAccount *account;
+  gchar *directory;
+} Test;
+
+static void
+setup (Test *test,
+    gconstpointer data)
+{
+  GError *error = NULL;
+
+  test->account_manager = tp_account_manager_dup ();
+  test->account = g_object_ref (tp_account_manager_ensure_account (
+        test->account_manager, ACCOUNT_PATH));
+
+  test->directory = g_dir_make_tmp ("empathy-log-index-test-XXXXXX", &error);
+  g_assert_no_error (error);
+}
+
+static void
+teardown (Test *test,
+    gconstpointer data)
+{
+  const gchar *names[] = { "index", "journal", "lock" };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (names); i++)
+    {
+      gchar *path = g_build_filename (test->directory, names[i], NULL);
+
+      g_unlink (path);
+      g_free (path);
+    }
+
+  g_rmdir (test->directory);
+  g_free (test->directory);
+
+  g_object_unref (test->account);
+  g_object_unref (test->account_manager);
+}
+
+static void
+add_message (Test *test,
+    EmpathyLogIndex *index,
+    const gchar *id,
+    gint64 timestamp,
+    const gchar *text)
+{
+  empathy_log_index_add_message (index, test->account, id,
+      TPL_ENTITY_CONTACT, timestamp, text);
+}
+
+/* Returns the number of hits, and the identifier of the first one in
+ * @first_id if not NULL */
+static guint
+search (EmpathyLogIndex *index,
+    const gchar *text,
+    gchar **first_id)
+{
+  GList *hits;
+  guint n;
+
+  g_assert (empathy_log_index_search (index, text, &hits));
+
+  n = g_list_length (hits);
+
+  if (first_id != NULL)
+    {
+      TplLogSearchHit *hit = hits != NULL ? hits->data : NULL;
+
+      *first_id = hit != NULL ?
+        g_strdup (tpl_entity_get_identifier (hit->target)) : NULL;
+    }
+
+  tpl_log_manager_search_free (hits);
+
+  return n;
+}
+
+static void
+test_save_load (Test *test,
+    gconstpointer data)
+{
+  EmpathyLogIndex *index;
+  GError *error = NULL;
+  GList *hits;
+  guint n_targets, n_dates, n_words;
+  gchar *id;
+
+  index = empathy_log_index_new (test->directory);
+
+  add_message (test, index, "alice@example.com", DAY_1, "Hello world");
+  add_message (test, index, "bob@example.com", DAY_1, "Goodbye, cruel world");
+  add_message (test, index, "bob@example.com", DAY_2, "Nothing to see here");
+
+  /* Nothing is answered until all the logs have been indexed */
+  g_assert (!empathy_log_index_search (index, "world", &hits));
+  g_assert (hits == NULL);
+
+  empathy_log_index_mark_complete (index);
+
+  g_assert (empathy_log_index_save (index, &error));
+  g_assert_no_error (error);
+  g_object_unref (index);
+
+  index = empathy_log_index_new (test->directory);
+
+  empathy_log_index_get_stats (index, &n_targets, &n_dates, &n_words);
+  g_assert_cmpuint (n_targets, ==, 2);
+  g_assert_cmpuint (n_dates, ==, 3);
+  g_assert_cmpuint (n_words, ==, 8);
+
+  g_assert_cmpuint (search (index, "world", NULL), ==, 2);
+  g_assert_cmpuint (search (index, "WORLD", NULL), ==, 2);
+  /* Query words can be parts of logged words */
+  g_assert_cmpuint (search (index, "orl", NULL), ==, 2);
+  g_assert_cmpuint (search (index, "xyzzy", NULL), ==, 0);
+
+  g_assert_cmpuint (search (index, "hello", &id), ==, 1);
+  g_assert_cmpstr (id, ==, "alice@example.com");
+  g_free (id);
+
+  /* All the words have to be logged on the same date */
+  g_assert_cmpuint (search (index, "cruel world", &id), ==, 1);
+  g_assert_cmpstr (id, ==, "bob@example.com");
+  g_free (id);
+  g_assert_cmpuint (search (index, "cruel nothing", NULL), ==, 0);
+
+  g_object_unref (index);
+}
+
+static void
+test_journal (Test *test,
+    gconstpointer data)
+{
+  EmpathyLogIndex *index;
+  GError *error = NULL;
+
+  index = empathy_log_index_new (test->directory);
+  add_message (test, index, "alice@example.com", DAY_1, "Hello world");
+  empathy_log_index_mark_complete (index);
+  g_assert (empathy_log_index_save (index, &error));
+  g_assert_no_error (error);
+
+  /* Only written to the journal */
+  add_message (test, index, "alice@example.com", DAY_2, "See you tomorrow");
+  g_object_unref (index);
+
+  index = empathy_log_index_new (test->directory);
+  g_assert_cmpuint (search (index, "tomorrow", NULL), ==, 1);
+  g_assert_cmpuint (search (index, "hello", NULL), ==, 1);
+  g_object_unref (index);
+}
+
+static void
+test_clear (Test *test,
+    gconstpointer data)
+{
+  EmpathyLogIndex *index;
+  GError *error = NULL;
+  guint n_targets;
+
+  index = empathy_log_index_new (test->directory);
+  add_message (test, index, "alice@example.com", DAY_1, "Hello world");
+  add_message (test, index, "bob@example.com", DAY_2, "Hello there");
+  empathy_log_index_mark_complete (index);
+  g_assert (empathy_log_index_save (index, &error));
+  g_assert_no_error (error);
+
+  empathy_log_index_clear (index, test->account);
+  g_assert_cmpuint (search (index, "hello", NULL), ==, 0);
+  g_object_unref (index);
+
+  /* The journal doesn't bring the messages back */
+  index = empathy_log_index_new (test->directory);
+  empathy_log_index_get_stats (index, &n_targets, NULL, NULL);
+  g_assert_cmpuint (n_targets, ==, 0);
+  g_assert_cmpuint (search (index, "hello", NULL), ==, 0);
+  g_object_unref (index);
+}
+
+/* Two processes using the same index don't lose each other's messages */
+static void
+test_concurrent_save (Test *test,
+    gconstpointer data)
+{
+  EmpathyLogIndex *first, *second, *index;
+  GError *error = NULL;
+
+  first = empathy_log_index_new (test->directory);
+  add_message (test, first, "alice@example.com", DAY_1, "apple");
+  empathy_log_index_mark_complete (first);
+  g_assert (empathy_log_index_save (first, &error));
+  g_assert_no_error (error);
+
+  second = empathy_log_index_new (test->directory);
+  g_assert_cmpuint (search (second, "apple", NULL), ==, 1);
+
+  add_message (test, first, "alice@example.com", DAY_2, "banana");
+  g_assert (empathy_log_index_save (first, &error));
+  g_assert_no_error (error);
+
+  add_message (test, second, "bob@example.com", DAY_2, "cherry");
+  g_assert (empathy_log_index_save (second, &error));
+  g_assert_no_error (error);
+
+  /* second reloaded the snapshot saved by first before saving its own */
+  g_assert_cmpuint (search (second, "banana", NULL), ==, 1);
+
+  index = empathy_log_index_new (test->directory);
+  g_assert_cmpuint (search (index, "apple", NULL), ==, 1);
+  g_assert_cmpuint (search (index, "banana", NULL), ==, 1);
+  g_assert_cmpuint (search (index, "cherry", NULL), ==, 1);
+
+  g_object_unref (index);
+  g_object_unref (first);
+  g_object_unref (second);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  TpDBusDaemon *bus;
+  GError *error = NULL;
+  int result;
+
+  test_init (argc, argv);
+
+  /* Needed to create the TpAccount of the search hits */
+  bus = tp_dbus_daemon_dup (&error);
+  if (bus == NULL)
+    {
+      g_printerr ("No session bus available, skipping: %s\n",
+          error->message);
+      g_error_free (error);
+      test_deinit ();
+      return 77;
+    }
+
+  g_test_add ("/log-index/save-load", Test, NULL, setup, test_save_load,
+      teardown);
+  g_test_add ("/log-index/journal", Test, NULL, setup, test_journal,
+      teardown);
+  g_test_add ("/log-index/clear", Test, NULL, setup, test_clear,
+      teardown);
+  g_test_add ("/log-index/concurrent-save", Test, NULL, setup,
+      test_concurrent_save, teardown);
+
+  result = g_test_run ();
+
+  g_object_unref (bus);
+  test_deinit ();
+
+  return result;
+}
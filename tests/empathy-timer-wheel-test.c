@@ -0,0 +1,228 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "empathy-timer-wheel.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+/* in milliseconds */
+#define RESOLUTION 200
+/* Leeway for the main loop to dispatch the wheel's source */
+#define SLACK 100
+
+typedef struct
+{
+  GMainLoop *loop;
+  EmpathyTimerWheel *wheel;
+  gint64 start;
+  /* elapsed milliseconds when each timeout fired, in the order they did */
+  GArray *fired;
+  /* index of each timeout in fired, in the order they were added */
+  GArray *order;
+  guint n_expected;
+  guint repeat;
+} Test;
+
+typedef struct
+{
+  Test *test;
+  guint index;
+} Timeout;
+
+static void
+setup (Test *test,
+    gconstpointer data)
+{
+  test->loop = g_main_loop_new (NULL, FALSE);
+  test->wheel = empathy_timer_wheel_new (RESOLUTION);
+  test->start = g_get_monotonic_time ();
+  test->fired = g_array_new (FALSE, FALSE, sizeof (gint64));
+  test->order = g_array_new (FALSE, FALSE, sizeof (guint));
+  test->n_expected = 0;
+  test->repeat = 0;
+}
+
+static void
+teardown (Test *test,
+    gconstpointer data)
+{
+  empathy_timer_wheel_free (test->wheel);
+  g_main_loop_unref (test->loop);
+  g_array_unref (test->fired);
+  g_array_unref (test->order);
+}
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+  Timeout *timeout = user_data;
+  Test *test = timeout->test;
+  gint64 elapsed;
+
+  elapsed = (g_get_monotonic_time () - test->start) / 1000;
+  g_array_append_val (test->fired, elapsed);
+  g_array_append_val (test->order, timeout->index);
+
+  if (test->fired->len >= test->n_expected)
+    g_main_loop_quit (test->loop);
+
+  if (test->repeat > 0)
+    {
+      test->repeat--;
+      return G_SOURCE_CONTINUE;
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+static guint
+add_timeout (Test *test,
+    guint interval,
+    guint index)
+{
+  Timeout *timeout = g_new (Timeout, 1);
+
+  timeout->test = test;
+  timeout->index = index;
+
+  return empathy_timer_wheel_add_full (test->wheel, interval, timeout_cb,
+      timeout, (GDestroyNotify) g_free);
+}
+
+static gint64
+fired_at (Test *test,
+    guint i)
+{
+  return g_array_index (test->fired, gint64, i);
+}
+
+static guint
+fired_index (Test *test,
+    guint i)
+{
+  return g_array_index (test->order, guint, i);
+}
+
+/* A deadline is rounded to the nearest slot: it's at most half a slot
+ * early or late */
+static void
+test_deadline (Test *test,
+    gconstpointer data)
+{
+  guint intervals[] = { 500, 650, 1030 };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (intervals); i++)
+    add_timeout (test, intervals[i], i);
+
+  test->n_expected = G_N_ELEMENTS (intervals);
+  g_main_loop_run (test->loop);
+
+  g_assert_cmpuint (test->fired->len, ==, G_N_ELEMENTS (intervals));
+  g_assert_cmpuint (empathy_timer_wheel_get_size (test->wheel), ==, 0);
+
+  for (i = 0; i < G_N_ELEMENTS (intervals); i++)
+    {
+      DEBUG ("timeout of %u ms fired after %" G_GINT64_FORMAT " ms",
+          intervals[fired_index (test, i)], fired_at (test, i));
+
+      g_assert_cmpuint (fired_index (test, i), ==, i);
+      g_assert_cmpint (fired_at (test, i), >=,
+          (gint64) intervals[i] - RESOLUTION / 2);
+      g_assert_cmpint (fired_at (test, i), <=,
+          (gint64) intervals[i] + RESOLUTION / 2 + SLACK);
+    }
+}
+
+/* Timeouts expiring in the same slot fire in the same wake up, in the
+ * order they were added */
+static void
+test_same_slot (Test *test,
+    gconstpointer data)
+{
+  add_timeout (test, 400, 0);
+  add_timeout (test, 400, 1);
+  add_timeout (test, 400, 2);
+
+  test->n_expected = 3;
+  g_main_loop_run (test->loop);
+
+  g_assert_cmpuint (test->fired->len, ==, 3);
+  g_assert_cmpuint (fired_index (test, 0), ==, 0);
+  g_assert_cmpuint (fired_index (test, 1), ==, 1);
+  g_assert_cmpuint (fired_index (test, 2), ==, 2);
+
+  /* dispatched back to back */
+  g_assert_cmpint (fired_at (test, 2) - fired_at (test, 0), <, SLACK);
+}
+
+static void
+test_remove (Test *test,
+    gconstpointer data)
+{
+  guint id;
+
+  id = add_timeout (test, 300, 0);
+  add_timeout (test, 600, 1);
+  g_assert_cmpuint (empathy_timer_wheel_get_size (test->wheel), ==, 2);
+
+  g_assert (empathy_timer_wheel_remove (test->wheel, id));
+  g_assert (!empathy_timer_wheel_remove (test->wheel, id));
+  g_assert_cmpuint (empathy_timer_wheel_get_size (test->wheel), ==, 1);
+
+  test->n_expected = 1;
+  g_main_loop_run (test->loop);
+
+  g_assert_cmpuint (test->fired->len, ==, 1);
+  g_assert_cmpuint (fired_index (test, 0), ==, 1);
+}
+
+/* A repeating timeout never fires twice in the same slot, even with an
+ * interval shorter than the resolution */
+static void
+test_repeat (Test *test,
+    gconstpointer data)
+{
+  guint i;
+
+  add_timeout (test, 10, 0);
+  test->repeat = 2;
+
+  test->n_expected = 3;
+  g_main_loop_run (test->loop);
+
+  g_assert_cmpuint (test->fired->len, ==, 3);
+  g_assert_cmpuint (empathy_timer_wheel_get_size (test->wheel), ==, 0);
+
+  for (i = 1; i < test->fired->len; i++)
+    g_assert_cmpint (fired_at (test, i) - fired_at (test, i - 1), >=,
+        RESOLUTION / 2);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add ("/timer-wheel/deadline", Test, NULL, setup, test_deadline,
+      teardown);
+  g_test_add ("/timer-wheel/same-slot", Test, NULL, setup, test_same_slot,
+      teardown);
+  g_test_add ("/timer-wheel/remove", Test, NULL, setup, test_remove,
+      teardown);
+  g_test_add ("/timer-wheel/repeat", Test, NULL, setup, test_repeat,
+      teardown);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
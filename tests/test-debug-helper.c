@@ -0,0 +1,118 @@
+#include "config.h"
+#include "test-debug-helper.h"
+
+#define DOMAIN "test"
+
+typedef struct
+{
+  GMainLoop *loop;
+  GPtrArray *messages;
+} GetMessagesCtx;
+
+static void
+got_messages_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GetMessagesCtx *ctx = user_data;
+  GError *error = NULL;
+
+  ctx->messages = tp_debug_client_get_messages_finish (
+      TP_DEBUG_CLIENT (source), result, &error);
+  g_assert_no_error (error);
+
+  g_main_loop_quit (ctx->loop);
+}
+
+static gboolean
+is_sent (TpDebugMessage *message)
+{
+  return !tp_strdiff (tp_debug_message_get_domain (message), DOMAIN);
+}
+
+/* TpDebugMessage can only be created by TpDebugClient: sends @n messages
+ * with the @texts logged @times[i] seconds after the epoch through the
+ * TpDebugSender of this process, and returns them as received by a client
+ * of the session bus, oldest first. */
+GPtrArray *
+test_debug_messages_new_full (const gchar * const *texts,
+    const gint64 *times,
+    guint n)
+{
+  TpDBusDaemon *bus;
+  TpDebugSender *sender;
+  TpDebugClient *client;
+  GetMessagesCtx ctx = { NULL, NULL };
+  GPtrArray *messages;
+  GError *error = NULL;
+  guint i, first, found;
+
+  bus = tp_dbus_daemon_dup (&error);
+  g_assert_no_error (error);
+
+  sender = tp_debug_sender_dup ();
+
+  for (i = 0; i < n; i++)
+    {
+      GTimeVal timestamp = { times[i], 0 };
+
+      tp_debug_sender_add_message (sender, &timestamp, DOMAIN,
+          G_LOG_LEVEL_DEBUG, texts[i]);
+    }
+
+  client = tp_debug_client_new (bus, tp_dbus_daemon_get_unique_name (bus),
+      &error);
+  g_assert_no_error (error);
+
+  ctx.loop = g_main_loop_new (NULL, FALSE);
+  tp_debug_client_get_messages_async (client, got_messages_cb, &ctx);
+  g_main_loop_run (ctx.loop);
+
+  /* The sender also returns the messages sent before, and those logged
+   * by the process meanwhile */
+  for (first = ctx.messages->len, found = 0; first > 0 && found < n; first--)
+    {
+      if (is_sent (g_ptr_array_index (ctx.messages, first - 1)))
+        found++;
+    }
+
+  messages = g_ptr_array_new_with_free_func (g_object_unref);
+  for (i = first; i < ctx.messages->len; i++)
+    {
+      TpDebugMessage *message = g_ptr_array_index (ctx.messages, i);
+
+      if (is_sent (message))
+        g_ptr_array_add (messages, g_object_ref (message));
+    }
+
+  g_assert_cmpuint (messages->len, ==, n);
+
+  g_ptr_array_unref (ctx.messages);
+  g_main_loop_unref (ctx.loop);
+  g_object_unref (client);
+  g_object_unref (sender);
+  g_object_unref (bus);
+
+  return messages;
+}
+
+/* Same, with the texts "@text <i>" */
+GPtrArray *
+test_debug_messages_new (const gchar *text,
+    const gint64 *times,
+    guint n)
+{
+  GPtrArray *texts, *messages;
+  guint i;
+
+  texts = g_ptr_array_new_with_free_func (g_free);
+  for (i = 0; i < n; i++)
+    g_ptr_array_add (texts, g_strdup_printf ("%s %u", text, i));
+
+  messages = test_debug_messages_new_full (
+      (const gchar * const *) texts->pdata, times, n);
+
+  g_ptr_array_unref (texts);
+
+  return messages;
+}
@@ -0,0 +1,13 @@
+#ifndef __TEST_DEBUG_HELPER_H__
+#define __TEST_DEBUG_HELPER_H__
+
+#include <telepathy-glib/telepathy-glib.h>
+
+GPtrArray * test_debug_messages_new_full (const gchar * const *texts,
+    const gint64 *times,
+    guint n);
+GPtrArray * test_debug_messages_new (const gchar *text,
+    const gint64 *times,
+    guint n);
+
+#endif /* __TEST_DEBUG_HELPER_H__ */